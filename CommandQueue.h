@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <utility>
+
+// Unbounded multi-producer, single-consumer queue of commands.
+//
+// Any thread may Push without taking a lock: a producer swaps itself in as the
+// new head and then links the previous head to it. Only the owning thread may
+// Pop. A producer that has swapped the head but not yet linked it makes the
+// consumer see the queue as empty for a moment; the producer wakes the consumer
+// afterwards, so nothing is lost.
+class CommandQueue
+{
+public:
+    typedef std::function<void()> Command;
+
+    CommandQueue() :
+        m_head(&m_stub),
+        m_tail(&m_stub)
+    {
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~CommandQueue()
+    {
+        Command command;
+        while (Pop(command))
+        {
+        }
+    }
+
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+
+    // Callable from any thread
+    void Push(Command command)
+    {
+        Node* node = new Node();
+        node->command = std::move(command);
+        PushNode(node);
+    }
+
+    // Owning thread only. Returns false if no command is ready.
+    bool Pop(Command& command)
+    {
+        Node* tail = m_tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &m_stub)
+        {
+            if (!next)
+                return false;
+
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next)
+        {
+            m_tail = next;
+            command = std::move(tail->command);
+            delete tail;
+            return true;
+        }
+
+        // tail is the last linked node; it can only be taken once the stub is behind it
+        if (tail != m_head.load(std::memory_order_acquire))
+            return false;
+
+        PushNode(&m_stub);
+
+        next = tail->next.load(std::memory_order_acquire);
+        if (next)
+        {
+            m_tail = next;
+            command = std::move(tail->command);
+            delete tail;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node*> next;
+        Command command;
+    };
+
+    void PushNode(Node* node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* previous = m_head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    std::atomic<Node*> m_head;
+    Node* m_tail;
+    Node m_stub;
+};
@@ -0,0 +1,406 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// The page shared by the processes of a session that run the library in
+// coordinated mode. One of them, the leader, detects Show Desktop and
+// repositions the windows of all of them. The others, the followers, push
+// their registrations to it through a ring and read the desktop state from
+// the page instead of detecting it themselves.
+//
+// The page only holds fixed-size, lock-free atomics, so it works at any
+// address and in 32- and 64-bit processes alike, and a zero-filled page is a
+// valid empty one. Window handles are stored as 64-bit values.
+//
+// - Leadership is a process id and an epoch in one word. A process takes the
+//   lead with a compare-and-swap when nobody holds it or the holder is gone,
+//   and the epoch changes with every leader.
+// - The desktop state is written by the leader only, under a sequence lock:
+//   the sequence is odd while a write is in progress and readers retry until
+//   they see the same even sequence before and after reading the fields.
+// - Commands go through a bounded ring with any number of producers and the
+//   leader as the only consumer. The turn of a slot is even while it is free
+//   and odd while it holds a command, and grows by two every lap, so a turn of
+//   zero means free for the first lap. A producer claims a position, then
+//   fills the slot and completes it with a compare-and-swap on the turn. The
+//   leader skips a claimed slot whose producer died or that stays empty too
+//   long by moving the turn on to the next lap, and the producer that still
+//   completes it finds its turn gone and claims another position.
+// - Followers list a window in the follower table to be told about changes.
+//
+// How the leader is woken, how followers are told and how a process is known
+// to be alive is up to the platform.
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+    "The shared page needs address-free atomics");
+
+const uint32_t COORDINATOR_VERSION = 2;
+const uint32_t COORDINATOR_RING_SIZE = 256;         // Power of two
+const uint32_t COORDINATOR_MAX_FOLLOWERS = 64;
+const uint32_t COORDINATOR_CLAIM_TIMEOUT_MS = 1000;  // Longest a claimed slot may stay empty
+
+enum CoordinatorOp
+{
+    COORDINATOR_REGISTER = 1,       // Register hwnd in layer, or move it there
+    COORDINATOR_UNREGISTER,
+    COORDINATOR_REFRESH             // Restack all windows
+};
+
+struct CoordinatorCommand
+{
+    uint64_t hwnd;
+    int32_t layer;
+    uint32_t op;                    // CoordinatorOp
+    uint32_t processId;             // Of the process that sent the command
+    uint32_t reserved;
+};
+
+struct CoordinatorState
+{
+    bool showDesktop;
+    uint64_t changes;               // Number of state changes published, 0 before the first
+    uint64_t detectionLatencyMs;
+};
+
+struct CoordinatorSlot
+{
+    std::atomic<uint64_t> turn;
+    std::atomic<uint32_t> op;
+    std::atomic<uint64_t> hwnd;
+    std::atomic<int32_t> layer;
+    std::atomic<uint32_t> processId;
+    std::atomic<uint32_t> owner;        // Process that claimed the slot, 0 until it says so
+    std::atomic<uint64_t> stalledSince; // Leader's time + 1 when it found the slot claimed but empty
+};
+
+struct CoordinatorFollower
+{
+    std::atomic<uint32_t> processId;    // 0 = free
+    std::atomic<uint32_t> reserved;
+    std::atomic<uint64_t> window;       // Where the follower is told about changes
+};
+
+struct CoordinatorPage
+{
+    std::atomic<uint32_t> version;      // Set by the first process to use the page
+
+    std::atomic<uint64_t> leader;       // Epoch << 32 | process id, process id 0 = nobody
+    std::atomic<uint64_t> leaderWindow; // Where the leader is woken
+
+    std::atomic<uint32_t> stateSequence;
+    std::atomic<uint32_t> showDesktop;
+    std::atomic<uint64_t> stateChanges;
+    std::atomic<uint64_t> detectionLatencyMs;
+
+    std::atomic<uint64_t> ringHead;     // Next position the leader reads
+    std::atomic<uint64_t> ringTail;     // Next position a producer claims
+    CoordinatorSlot ring[COORDINATOR_RING_SIZE];
+
+    CoordinatorFollower followers[COORDINATOR_MAX_FOLLOWERS];
+};
+
+// Operations on a mapped page. Holds no state of its own besides the page.
+class CoordinatorChannel
+{
+public:
+    typedef bool (*ProcessAliveCallback)(uint32_t processId, void* context);
+
+    CoordinatorChannel() : m_page(nullptr) {}
+
+    // Returns false if the page was set up by an incompatible version
+    bool Attach(CoordinatorPage* page)
+    {
+        uint32_t version = 0;
+        if (!page->version.compare_exchange_strong(version, COORDINATOR_VERSION) && version != COORDINATOR_VERSION)
+            return false;
+
+        m_page = page;
+        return true;
+    }
+
+    void Detach() { m_page = nullptr; }
+    bool IsAttached() const { return m_page != nullptr; }
+
+    // Leadership
+
+    uint32_t GetLeader() const { return static_cast<uint32_t>(m_page->leader.load(std::memory_order_acquire)); }
+    uint32_t GetLeaderEpoch() const { return static_cast<uint32_t>(m_page->leader.load(std::memory_order_acquire) >> 32); }
+
+    // Take the lead if nobody holds it or the holder is no longer alive.
+    // Returns true if processId leads afterwards.
+    bool TryLead(uint32_t processId, ProcessAliveCallback isAlive, void* context)
+    {
+        uint64_t current = m_page->leader.load(std::memory_order_acquire);
+        for (;;)
+        {
+            uint32_t holder = static_cast<uint32_t>(current);
+            if (holder == processId)
+                return true;
+            if (holder != 0 && isAlive(holder, context))
+                return false;
+
+            uint64_t next = (((current >> 32) + 1) << 32) | processId;
+            if (m_page->leader.compare_exchange_weak(current, next, std::memory_order_acq_rel))
+                break;
+        }
+
+        // A leader that died while writing the state left the sequence odd
+        uint32_t sequence = m_page->stateSequence.load(std::memory_order_relaxed);
+        if (sequence & 1)
+        {
+            m_page->stateSequence.store(sequence + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // Give up the lead so another process can take it
+    void Resign(uint32_t processId)
+    {
+        uint64_t current = m_page->leader.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(current) == processId)
+        {
+            uint64_t next = ((current >> 32) + 1) << 32;
+            if (m_page->leader.compare_exchange_weak(current, next, std::memory_order_acq_rel))
+            {
+                m_page->leaderWindow.store(0, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    // Commands pushed by a producer that did not see the window yet are
+    // visible to the next Pop, as long as the producer fences before reading it
+    void SetLeaderWindow(uint64_t window)
+    {
+        m_page->leaderWindow.store(window, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    uint64_t GetLeaderWindow() const { return m_page->leaderWindow.load(std::memory_order_acquire); }
+
+    // Desktop state
+
+    // Leader only
+    void PublishState(bool showDesktop, uint64_t detectionLatencyMs)
+    {
+        uint32_t sequence = m_page->stateSequence.load(std::memory_order_relaxed);
+        m_page->stateSequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        m_page->showDesktop.store(showDesktop ? 1 : 0, std::memory_order_relaxed);
+        m_page->detectionLatencyMs.store(detectionLatencyMs, std::memory_order_relaxed);
+        m_page->stateChanges.store(m_page->stateChanges.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        m_page->stateSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Never blocks on the leader. Retries while a write is in progress, but
+    // not forever: a leader that died while writing leaves the sequence odd.
+    CoordinatorState ReadState() const
+    {
+        const uint32_t attempts = 1000;
+
+        CoordinatorState state;
+        for (uint32_t attempt = 1;; ++attempt)
+        {
+            uint32_t before = m_page->stateSequence.load(std::memory_order_acquire);
+
+            state.showDesktop = m_page->showDesktop.load(std::memory_order_relaxed) != 0;
+            state.changes = m_page->stateChanges.load(std::memory_order_relaxed);
+            state.detectionLatencyMs = m_page->detectionLatencyMs.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint32_t after = m_page->stateSequence.load(std::memory_order_relaxed);
+            if ((before == after && (before & 1) == 0) || attempt == attempts)
+                return state;
+        }
+    }
+
+    // Command ring
+
+    // Any process. Returns false if the ring is full.
+    bool Push(const CoordinatorCommand& command)
+    {
+        for (;;)
+        {
+            uint64_t position = m_page->ringTail.load(std::memory_order_relaxed);
+            CoordinatorSlot* slot;
+            for (;;)
+            {
+                slot = &m_page->ring[position & (COORDINATOR_RING_SIZE - 1)];
+                uint64_t free = FreeTurn(position);
+                int64_t lag = static_cast<int64_t>(slot->turn.load(std::memory_order_acquire) - free);
+                if (lag == 0)
+                {
+                    if (m_page->ringTail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (lag < 0)
+                {
+                    // Still holds the command of the previous lap
+                    return false;
+                }
+                else
+                {
+                    position = m_page->ringTail.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->owner.store(command.processId, std::memory_order_release);
+            slot->op.store(command.op, std::memory_order_relaxed);
+            slot->hwnd.store(command.hwnd, std::memory_order_relaxed);
+            slot->layer.store(command.layer, std::memory_order_relaxed);
+            slot->processId.store(command.processId, std::memory_order_relaxed);
+
+            // The leader may have given up on the slot meanwhile
+            uint64_t free = FreeTurn(position);
+            if (slot->turn.compare_exchange_strong(free, free + 1, std::memory_order_release, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    // Leader only. Returns false if no command is ready. A slot that was
+    // claimed but not filled is skipped once its producer is no longer alive,
+    // or COORDINATOR_CLAIM_TIMEOUT_MS after the leader first found it empty.
+    bool Pop(CoordinatorCommand& command, ProcessAliveCallback isAlive, void* context, uint64_t nowMs)
+    {
+        for (;;)
+        {
+            uint64_t position = m_page->ringHead.load(std::memory_order_relaxed);
+            CoordinatorSlot& slot = m_page->ring[position & (COORDINATOR_RING_SIZE - 1)];
+            uint64_t full = FreeTurn(position) + 1;
+            int64_t lag = static_cast<int64_t>(slot.turn.load(std::memory_order_acquire) - full);
+            if (lag < 0)
+            {
+                if (!SkipStalled(slot, position, isAlive, context, nowMs))
+                    return false;
+                continue;
+            }
+
+            if (lag == 0)
+            {
+                command.op = slot.op.load(std::memory_order_relaxed);
+                command.hwnd = slot.hwnd.load(std::memory_order_relaxed);
+                command.layer = slot.layer.load(std::memory_order_relaxed);
+                command.processId = slot.processId.load(std::memory_order_relaxed);
+                command.reserved = 0;
+                slot.owner.store(0, std::memory_order_relaxed);
+                slot.stalledSince.store(0, std::memory_order_relaxed);
+                slot.turn.store(full + 1, std::memory_order_release);
+            }
+
+            // A slot already past this lap was read by a leader that died before
+            // moving on, or skipped
+            m_page->ringHead.store(position + 1, std::memory_order_relaxed);
+            if (lag == 0)
+                return true;
+        }
+    }
+
+    // Leader only. True if a producer claimed a slot that Pop could not read
+    // yet, so Pop has to be called again later even without a wake-up.
+    bool HasPendingClaims() const
+    {
+        return m_page->ringTail.load(std::memory_order_relaxed) > m_page->ringHead.load(std::memory_order_relaxed);
+    }
+
+    // Followers
+
+    // Returns false if the table is full. A follower that is listed already
+    // keeps its entry, wherever it is, and only changes its window.
+    bool AddFollower(uint32_t processId, uint64_t window)
+    {
+        for (CoordinatorFollower& follower : m_page->followers)
+        {
+            if (follower.processId.load(std::memory_order_acquire) == processId)
+            {
+                follower.window.store(window, std::memory_order_release);
+                return true;
+            }
+        }
+
+        for (CoordinatorFollower& follower : m_page->followers)
+        {
+            uint32_t expected = 0;
+            if (follower.processId.compare_exchange_strong(expected, processId, std::memory_order_acq_rel))
+            {
+                follower.window.store(window, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void RemoveFollower(uint32_t processId)
+    {
+        for (CoordinatorFollower& follower : m_page->followers)
+        {
+            uint32_t expected = processId;
+            if (follower.processId.load(std::memory_order_relaxed) == processId)
+            {
+                follower.window.store(0, std::memory_order_relaxed);
+                follower.processId.compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+            }
+        }
+    }
+
+    // Calls notify(processId, window) for every follower with a window. Followers
+    // that are no longer alive are removed instead.
+    template <typename Notify>
+    void ForEachFollower(ProcessAliveCallback isAlive, void* context, Notify notify)
+    {
+        for (CoordinatorFollower& follower : m_page->followers)
+        {
+            uint32_t processId = follower.processId.load(std::memory_order_acquire);
+            if (processId == 0)
+                continue;
+
+            if (!isAlive(processId, context))
+            {
+                RemoveFollower(processId);
+                continue;
+            }
+
+            uint64_t window = follower.window.load(std::memory_order_acquire);
+            if (window)
+            {
+                notify(processId, window);
+            }
+        }
+    }
+
+private:
+    // The slot at the head is not filled. Returns true if it was skipped, or
+    // filled just now, and Pop has to look at it again.
+    bool SkipStalled(CoordinatorSlot& slot, uint64_t position, ProcessAliveCallback isAlive, void* context, uint64_t nowMs)
+    {
+        // Not claimed yet, nobody to wait for
+        if (m_page->ringTail.load(std::memory_order_relaxed) <= position)
+            return false;
+
+        uint32_t owner = slot.owner.load(std::memory_order_acquire);
+        if (owner == 0 || isAlive(owner, context))
+        {
+            uint64_t since = 0;
+            if (slot.stalledSince.compare_exchange_strong(since, nowMs + 1, std::memory_order_relaxed) ||
+                nowMs + 1 - since < COORDINATOR_CLAIM_TIMEOUT_MS)
+                return false;
+        }
+
+        slot.owner.store(0, std::memory_order_relaxed);
+        slot.stalledSince.store(0, std::memory_order_relaxed);
+        uint64_t free = FreeTurn(position);
+        slot.turn.compare_exchange_strong(free, free + 2, std::memory_order_acq_rel);
+        return true;
+    }
+
+    // Turn of a free slot for the lap of position
+    static uint64_t FreeTurn(uint64_t position)
+    {
+        return (position / COORDINATOR_RING_SIZE) * 2;
+    }
+
+    CoordinatorPage* m_page;
+};
@@ -0,0 +1,1079 @@
+#pragma once
+
+#include "WindowSystem.h"
+#include "ShowDesktopDetector.h"
+#include "DesktopHostStrategy.h"
+#include "ShellTopologyCache.h"
+#include "ZOrderPlanner.h"
+#include "ZOrderLayers.h"
+#include "WindowRegistry.h"
+#include "SnapshotCell.h"
+#include "PerfCounters.h"
+#include "RetryScheduler.h"
+#include "RefreshScheduler.h"
+#include "TriggerRecognizer.h"
+#include "TopmostBoundary.h"
+#include "FramePacer.h"
+#include "TraceRecorder.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#define ZPOS_SYSTEM_WINDOW_CLASS L"ZposDesktopSystem"
+#define ZPOS_SYSTEM_WINDOW_TITLE L"ZposSystem"
+#define ZPOS_HELPER_WINDOW_TITLE L"ZposPositioningHelper"
+
+enum TIMER
+{
+    TIMER_SHOWDESKTOP = 1,
+    TIMER_RESUME = 2,
+    TIMER_SHELLRETRY = 3,
+    TIMER_REFRESH = 4,
+    TIMER_FRAME = 5,
+    TIMER_RESEND = 6,
+    TIMER_STALLED = 7
+};
+
+enum INTERVAL
+{
+    INTERVAL_SHOWDESKTOP = 250,
+    INTERVAL_RESTOREWINDOWS = 100,
+    INTERVAL_RESUME = 1000,
+    INTERVAL_SHELLRETRY = 10,
+    INTERVAL_REFRESH = 30,
+    INTERVAL_RESEND = 50,
+    INTERVAL_STALLED = 250
+};
+
+// Retries after the first attempt while the shell settles after a foreground change
+const uint32_t SHELL_RETRY_LIMIT = 4;
+
+// Requested repositioning passes run once requests settled for INTERVAL_REFRESH,
+// at least this far apart, and no later than this after the first request
+const uint32_t REFRESH_MIN_INTERVAL_MS = 100;
+const uint32_t REFRESH_MAX_DELAY_MS = 500;
+
+// Windows whose class, process and state are remembered at a time
+const size_t METADATA_CACHE_SIZE = 256;
+
+// Show Desktop detection and repositioning of the registered windows.
+//
+// Everything goes through IWindowSystem, so the same logic runs against the
+// real window manager and against the simulator. The owner creates the system
+// and helper windows, feeds shell restarts in and publishes the registry.
+class DesktopController : public IWindowSystem::EventSink
+{
+public:
+    // Called when the state changes. The windows have been repositioned for it,
+    // or are on the next display frame if this one was already restacked.
+    typedef std::function<void(bool showDesktop, uint64_t detectionLatencyMs)> StateChangedHandler;
+
+    // Called when a registered window was found destroyed, shown, hidden,
+    // minimized or restored. The owner applies the change to the registry.
+    typedef std::function<void(const WindowLifecycle& change)> WindowLifecycleHandler;
+
+    DesktopController(IWindowSystem& windowSystem, const SnapshotCell<WindowRegistry>& windows) :
+        m_windowSystem(windowSystem),
+        m_windows(windows),
+        m_hSystemWindow(nullptr),
+        m_hHelperWindow(nullptr),
+        m_foregroundHook(nullptr),
+        m_shellEventHook(nullptr),
+        m_shellParentHook(nullptr),
+        m_shellProcessId(0),
+        m_shellWindow(nullptr),
+        m_metadata(METADATA_CACHE_SIZE),
+        m_hostStrategy(nullptr),
+        m_probeInterval(0),
+        m_shellRetry(INTERVAL_SHELLRETRY, SHELL_RETRY_LIMIT),
+        m_shellRetryWindow(nullptr),
+        m_waitingForDefView(false),
+        m_refresh(INTERVAL_REFRESH, REFRESH_MIN_INTERVAL_MS, REFRESH_MAX_DELAY_MS),
+        m_refreshDeadline(0),
+        m_pacedHost(nullptr),
+        m_pacedShowDesktop(false),
+        m_pacedTransitionUs(0),
+        m_frameTimerArmed(false),
+        m_sessionLocked(false),
+        m_displayOff(false),
+        m_showDesktop(false),
+        m_probeIntervalMs(0),
+        m_wakeups(0),
+        m_recorder(nullptr)
+    {
+        ShowDesktopDetector::Config config = ShowDesktopDetector::DefaultConfig();
+        config.pollIntervalMs = INTERVAL_SHOWDESKTOP;
+        config.restorePollIntervalMs = INTERVAL_RESTOREWINDOWS;
+        m_detector = ShowDesktopDetector(config);
+    }
+
+    void SetStateChangedHandler(StateChangedHandler handler)
+    {
+        m_onStateChanged = std::move(handler);
+    }
+
+    void SetWindowLifecycleHandler(WindowLifecycleHandler handler)
+    {
+        m_onWindowLifecycle = std::move(handler);
+    }
+
+    // Records resolved topologies and state changes; the backend records the rest
+    void SetTraceRecorder(TraceRecorder* recorder)
+    {
+        m_recorder = recorder;
+    }
+
+    void Start(HWND systemWindow, HWND helperWindow)
+    {
+        m_hSystemWindow = systemWindow;
+        m_hHelperWindow = helperWindow;
+        m_windowSystem.SetEventSink(this);
+
+        m_zorderBatch.PlaceAtBottom(m_hSystemWindow);
+        m_zorderBatch.PlaceAtBottom(m_hHelperWindow);
+        m_zorderBatch.Commit(m_windowSystem);
+
+        m_foregroundHook = m_windowSystem.HookEvents(
+            WINDOW_EVENT_FOREGROUND, WINDOW_EVENT_FOREGROUND, 0, true);
+
+        m_detector.Reset();
+        m_detector.SetSuspended(m_sessionLocked || m_displayOff, m_windowSystem.GetTickCount());
+        m_hostStrategy = m_hostStrategies.Select(m_windowSystem);
+        GetDesktopIconsHostWindow();
+        UpdateWindowHooks();
+        ScheduleProbe();
+    }
+
+    void Stop()
+    {
+        if (m_hSystemWindow)
+        {
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_SHOWDESKTOP);
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_SHELLRETRY);
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_REFRESH);
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_FRAME);
+        }
+        m_shellRetry.Cancel();
+        m_refresh.Reset();
+        m_framePacer.Reset();
+        m_frameTimerArmed = false;
+        m_triggers.Reset();
+        m_refreshDeadline = 0;
+
+        if (m_foregroundHook)
+        {
+            m_windowSystem.UnhookEvents(m_foregroundHook);
+            m_foregroundHook = nullptr;
+        }
+
+        UpdateShellEventHook(0);
+        for (const WindowHook& hook : m_windowHooks)
+        {
+            m_windowSystem.UnhookEvents(hook.events);
+            m_windowSystem.UnhookEvents(hook.minimize);
+        }
+        m_windowHooks.clear();
+        m_windowSystem.SetEventSink(nullptr);
+
+        m_topology.Invalidate();
+        m_metadata.Clear();
+        m_topmostBoundary.Invalidate();
+        m_zorderLayers.Invalidate();
+        m_shellWindow = nullptr;
+        m_probeInterval = 0;
+        m_probeIntervalMs = 0;
+        m_showDesktop = false;
+        m_hSystemWindow = nullptr;
+        m_hHelperWindow = nullptr;
+    }
+
+    // Readable from any thread
+    bool IsShowingDesktop() const
+    {
+        return m_showDesktop.load(std::memory_order_acquire);
+    }
+
+    // Explorer restarted, none of the cached shell windows exist anymore
+    void OnShellRestarted()
+    {
+        m_topology.Invalidate();
+        m_metadata.Clear();
+        m_shellWindow = nullptr;
+        CheckDesktopState(GetDesktopIconsHostWindow());
+    }
+
+    // A key or pointer input, which may announce Show Desktop before the shell
+    // acts on it. The helper window is placed for the state expected next and
+    // the desktop is probed quickly for a short while.
+    void OnInput(const InputEvent& event)
+    {
+        TriggerRecognizer::Trigger trigger = m_triggers.OnInput(event);
+        if (trigger == TriggerRecognizer::Trigger::None || !m_hSystemWindow)
+            return;
+
+        if (!m_detector.OnTrigger(m_windowSystem.GetTickCount()))
+            return;
+
+        PerfCounters::Add(PERF_TRIGGERS);
+        if (TriggerRecognizer::PredictsDesktop(trigger, m_showDesktop))
+        {
+            RunPaced(FramePacer::WORK_HELPER, GetDesktopIconsHostWindow(), true);
+        }
+        ScheduleProbe();
+    }
+
+    // Where the show desktop button is, in the coordinates of the pointer inputs.
+    // An empty area when it is not known.
+    void SetTriggerArea(const InputRect& area)
+    {
+        m_triggers.SetButtonArea(area);
+    }
+
+    // Nothing is probed periodically while the session is locked or the display is off
+    void OnSessionLocked(bool locked)
+    {
+        m_sessionLocked = locked;
+        UpdateSuspended();
+    }
+
+    void OnDisplayPower(bool on)
+    {
+        m_displayOff = !on;
+        UpdateSuspended();
+    }
+
+    void OnTimer(uintptr_t id) override
+    {
+        m_wakeups.fetch_add(1, std::memory_order_relaxed);
+        PerfCounters::Add(PERF_WAKEUPS);
+
+        if (id == TIMER_SHOWDESKTOP)
+        {
+            PerfCounters::Add(PERF_TIMER_TICKS);
+            CheckDesktopState(GetDesktopIconsHostWindow());
+        }
+        else if (id == TIMER_SHELLRETRY)
+        {
+            // One-shot, the next retry arms it again
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_SHELLRETRY);
+            if (m_shellRetry.IsActive())
+            {
+                RetryShellForeground();
+            }
+        }
+        else if (id == TIMER_REFRESH)
+        {
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_REFRESH);
+            m_refreshDeadline = 0;
+            RunRefresh();
+        }
+        else if (id == TIMER_FRAME)
+        {
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_FRAME);
+            m_frameTimerArmed = false;
+            RunPaced(FramePacer::WORK_NONE);
+        }
+    }
+
+    void OnWindowEvent(uint32_t event, HWND hwnd, long idObject, long idChild) override
+    {
+        bool self = (idObject == WINDOW_OBJECT_SELF && idChild == WINDOW_OBJECT_SELF);
+        if (self || event == WINDOW_EVENT_REORDER)
+        {
+            m_metadata.OnWindowEvent(event, hwnd);
+            m_topmostBoundary.OnWindowEvent(event, hwnd);
+        }
+
+        switch (event)
+        {
+        case WINDOW_EVENT_FOREGROUND:
+            if (!m_showDesktop)
+            {
+                HandleShellForeground(hwnd);
+            }
+            OnDesktopEvent(ShowDesktopDetector::Event::Foreground);
+            break;
+
+        case WINDOW_EVENT_REORDER:
+            if (IsShellWindow(hwnd))
+            {
+                OnDesktopEvent(ShowDesktopDetector::Event::HostReorder);
+            }
+            break;
+
+        case WINDOW_EVENT_DESTROY:
+            if (self)
+            {
+                m_topology.OnWindowDestroyed(hwnd);
+                UpdateRegisteredWindow(hwnd);
+            }
+            break;
+
+        case WINDOW_EVENT_PARENTCHANGE:
+            if (self)
+            {
+                m_topology.OnWindowReparented(hwnd);
+            }
+            break;
+
+        case WINDOW_EVENT_SHOW:
+        case WINDOW_EVENT_HIDE:
+            // Hooks of registered windows also report the other windows of
+            // their processes, which may include this one; those are dropped
+            if (self && !UpdateRegisteredWindow(hwnd) && IsShellWindow(hwnd))
+            {
+                OnDesktopEvent(event == WINDOW_EVENT_SHOW ?
+                    ShowDesktopDetector::Event::HostShow : ShowDesktopDetector::Event::HostHide);
+            }
+            break;
+
+        case WINDOW_EVENT_MINIMIZESTART:
+        case WINDOW_EVENT_MINIMIZEEND:
+            if (self)
+            {
+                UpdateRegisteredWindow(hwnd);
+            }
+            break;
+        }
+    }
+
+    void PositionWindows()
+    {
+        PerfScope scope(PERF_POSITION_WINDOWS);
+        PerfCounters::Add(PERF_REPOSITION_PASSES);
+
+        // When showing the desktop, our windows go right after the helper window.
+        // When showing windows, our windows go to the bottom of the Z-order.
+        {
+            // Writers may publish a new registry meanwhile; this pass keeps using its snapshot.
+            // The registry holds the windows of every instance, so one pass serves them all.
+            SnapshotCell<WindowRegistry>::ReadGuard registry = m_windows.Read();
+            m_zorderPlanner.Begin(m_showDesktop ? m_hHelperWindow : nullptr, registry->GetPositionedCount());
+
+            // The enumeration will call our callback for each top-level window in its
+            // current Z-order (top-most first), which lets the planner see what is already in place.
+            // The shell keeps its windows below everything, and the library's
+            // own windows may end up there too
+            const ShellTopology& topology = m_topology.GetTopology();
+            EnumWindowsContext context = { registry.Get(), &m_zorderPlanner,
+                { m_topology.IsValid() ? topology.shellWindow : nullptr, m_topology.IsValid() ? topology.host : nullptr,
+                  m_hSystemWindow, m_hHelperWindow } };
+            m_windowSystem.EnumTopLevelWindows(EnumRegisteredWindowsProc, &context);
+
+            // Only the windows that are out of place are moved.
+            m_zorderPlanner.Plan(m_zorderBatch);
+
+            // A block that was only partly found is left to the next full pass
+            if (m_zorderPlanner.GetBlock().size() == registry->GetPositionedCount())
+            {
+                m_zorderLayers.Store(m_showDesktop ? m_hHelperWindow : nullptr, m_zorderPlanner.GetBlock());
+            }
+            else
+            {
+                m_zorderLayers.Invalidate();
+            }
+        }
+
+        // All moves are committed in one batch. Nothing is committed when the stack is already correct.
+        m_zorderBatch.Commit(m_windowSystem);
+        m_refresh.OnPass(true, m_windowSystem.GetTickCount());
+    }
+
+    // Ask for a repositioning pass, full or of the dirty layers only. Requests
+    // are merged and run from a timer once they settle, see RefreshScheduler.
+    void RequestRefresh(bool full)
+    {
+        PerfCounters::Add(PERF_REFRESH_REQUESTS);
+        if (!m_hSystemWindow)
+            return;
+
+        uint64_t now = m_windowSystem.GetTickCount();
+        m_refresh.Request(full, now);
+        ArmRefresh(now);
+    }
+
+    // Current interval of the probe timer, 0 while it is stopped. Readable from any thread.
+    uint32_t GetProbeIntervalMs() const { return m_probeIntervalMs.load(std::memory_order_relaxed); }
+
+    // Timer callbacks received
+    uint64_t GetWakeupCount() const { return m_wakeups.load(std::memory_order_relaxed); }
+
+    bool IsProbingSuspended() const { return m_sessionLocked || m_displayOff; }
+
+    // Restack only the layers whose windows changed since the last pass, without
+    // enumerating the stack. Falls back to a full pass when there is no block to
+    // build on or a layer cannot be placed next to its neighbours.
+    void PositionDirtyLayers()
+    {
+        // Newly registered windows may belong to a process that is not hooked yet
+        UpdateWindowHooks();
+
+        if (!PlaceDirtyLayers())
+        {
+            PositionWindows();
+        }
+        m_refresh.OnPass(false, m_windowSystem.GetTickCount());
+
+        // The first registered window starts the periodic probes, see ScheduleProbe
+        ScheduleProbe();
+    }
+
+    const ShowDesktopDetector& GetDetector() const { return m_detector; }
+    const ShellTopologyCache& GetTopology() const { return m_topology; }
+    const RetryScheduler& GetShellRetry() const { return m_shellRetry; }
+    const WindowMetadataCache& GetMetadata() const { return m_metadata; }
+    const TopmostBoundary& GetTopmostBoundary() const { return m_topmostBoundary; }
+    const FramePacer& GetFramePacer() const { return m_framePacer; }
+    const ZOrderLayers& GetZOrderLayers() const { return m_zorderLayers; }
+
+    // Support another shell layout. Takes effect the next time detection starts.
+    void AddHostStrategy(std::unique_ptr<DesktopHostStrategy> strategy)
+    {
+        m_hostStrategies.Add(std::move(strategy));
+    }
+
+    // The strategy selected when detection started, null before
+    const DesktopHostStrategy* GetHostStrategy() const { return m_hostStrategy; }
+
+private:
+    // The context for the window enumeration.
+    struct EnumWindowsContext
+    {
+        // The snapshot of the registered windows this pass works on
+        const WindowRegistry* registry;
+        // The planner that records the current stack
+        ZOrderPlanner* planner;
+        // Windows that may stay below the block, see ZOrderPlanner::ObserveFloor
+        HWND floor[4];
+    };
+
+    // The callback function for the top-level window enumeration.
+    // This function will be called for each top-level window on the screen.
+    static bool EnumRegisteredWindowsProc(HWND hwnd, void* param)
+    {
+        EnumWindowsContext* context = static_cast<EnumWindowsContext*>(param);
+        if (context && context->registry && context->planner)
+        {
+            // The planner needs every window to know which of ours are already in place.
+            // It stops the enumeration once the rest of the stack no longer matters.
+            // Hidden and minimized windows are left where they are.
+            if (hwnd && std::find(std::begin(context->floor), std::end(context->floor), hwnd) != std::end(context->floor))
+                return context->planner->ObserveFloor(hwnd);
+
+            const WindowInfo* info = context->registry->Find(hwnd);
+            bool positioned = info && IsPositioned(*info);
+            return context->planner->Observe(hwnd, positioned, positioned ? info->layer : 0);
+        }
+        return true; // Continue enumeration.
+    }
+
+    bool PlaceDirtyLayers()
+    {
+        if (!m_zorderLayers.IsValid(m_showDesktop ? m_hHelperWindow : nullptr))
+            return false;
+
+        PerfScope scope(PERF_POSITION_WINDOWS);
+        {
+            // Moving windows runs window procedures of this process, which may
+            // publish a new registry, so the pass works on a copy
+            SnapshotCell<WindowRegistry>::ReadGuard registry = m_windows.Read();
+            m_layerWindows.Read(*registry);
+        }
+
+        std::vector<int32_t> dirty;
+        m_zorderLayers.GetDirtyLayers(m_layerWindows, dirty);
+        if (dirty.empty())
+            return true;
+
+        PerfCounters::Add(PERF_REPOSITION_PASSES);
+
+        // Layers follow the one above them, so go from the top down. The top of a
+        // block at the bottom of the z-order is placed last, from the layer below.
+        std::vector<int32_t> deferred;
+        for (int32_t layer : dirty)
+        {
+            if (!m_layerWindows.GetLayer(layer).empty() && !m_zorderLayers.HasUpperNeighbour(layer))
+            {
+                deferred.push_back(layer);
+                continue;
+            }
+
+            if (!PlaceLayer(layer))
+                return false;
+        }
+
+        for (int32_t layer : deferred)
+        {
+            if (!PlaceLayer(layer))
+                return false;
+        }
+        return true;
+    }
+
+    bool PlaceLayer(int32_t layer)
+    {
+        if (!m_zorderLayers.PlaceLayer(m_windowSystem, m_layerWindows, layer, m_zorderBatch))
+        {
+            m_zorderLayers.Invalidate();
+            return false;
+        }
+
+        // The next layer is found next to this one, so it has to be in place first
+        m_zorderBatch.Commit(m_windowSystem);
+        return true;
+    }
+
+    HWND GetDefaultShellWindow()
+    {
+        HWND shellW = m_windowSystem.GetShellWindow();
+
+        if (shellW && shellW != m_shellWindow && m_metadata.GetClassAtom(m_windowSystem, shellW) != CLASS_ATOM_PROGMAN)
+        {
+            shellW = nullptr;
+        }
+
+        m_shellWindow = shellW;
+        return shellW;
+    }
+
+    HWND GetDesktopIconsHostWindow()
+    {
+        // As long as the shell window is the same and no event invalidated the cache,
+        // the host found last time is still the host.
+        if (const ShellTopology* cached = m_topology.Lookup(m_windowSystem.GetShellWindow()))
+        {
+            return cached->host;
+        }
+
+        ShellTopology topology = { GetDefaultShellWindow(), nullptr, nullptr, 0 };
+        HWND shellW = topology.shellWindow;
+        if (!shellW || !m_hostStrategy) return nullptr;
+
+        topology.shellProcessId = m_metadata.GetProcessId(m_windowSystem, shellW);
+        UpdateShellEventHook(topology.shellProcessId);
+        m_hostStrategy->Resolve(m_windowSystem, m_metadata, topology);
+
+        // Without DefView the shell is still starting up, so look again next time
+        if (topology.defView)
+        {
+            m_topology.Store(topology);
+        }
+
+        if (m_recorder)
+        {
+            TraceTopology record = { TraceHandle(topology.shellWindow), TraceHandle(topology.defView),
+                TraceHandle(topology.host), topology.shellProcessId, 0 };
+            m_recorder->Record(TRACE_TOPOLOGY, record);
+        }
+
+        return topology.host;
+    }
+
+    void PrepareHelperWindow(HWND desktopIconsHostWindow, bool showDesktop)
+    {
+        const ZOrderMove systemToBottom = { m_hSystemWindow, nullptr, ZOrderMove::Bottom };
+        m_windowSystem.MoveWindow(systemToBottom);
+
+        if (showDesktop && desktopIconsHostWindow)
+        {
+            const ZOrderMove helperToTopmost = { m_hHelperWindow, nullptr, ZOrderMove::Topmost };
+            m_windowSystem.MoveWindow(helperToTopmost);
+
+            // The helper is now at the top of the band, the boundary is below it
+            HWND boundary = m_topmostBoundary.Find(m_windowSystem, m_hHelperWindow);
+            if (boundary)
+            {
+                const ZOrderMove helperBelowTopmost = { m_hHelperWindow, boundary, ZOrderMove::After };
+                if (!m_windowSystem.MoveWindow(helperBelowTopmost))
+                {
+                    m_topmostBoundary.Invalidate();
+                }
+            }
+        }
+        else
+        {
+            const ZOrderMove helperToBottom = { m_hHelperWindow, nullptr, ZOrderMove::Bottom };
+            m_windowSystem.MoveWindow(helperToBottom);
+        }
+    }
+
+    bool CheckDesktopState(HWND desktopIconsHostWindow)
+    {
+        PerfScope scope(PERF_CHECK_DESKTOP_STATE);
+        PerfCounters::Add(PERF_DESKTOP_CHECKS);
+        HWND hwnd = nullptr;
+
+        // Probes of a burst follow events closely enough to trust the cached
+        // visibility; the others are there to catch what events missed
+        if (!m_detector.IsInBurst())
+        {
+            m_metadata.ExpireVolatile();
+        }
+
+        if (desktopIconsHostWindow && m_metadata.IsVisible(m_windowSystem, desktopIconsHostWindow))
+        {
+            hwnd = m_windowSystem.FindWindowAfter(nullptr, desktopIconsHostWindow,
+                ZPOS_SYSTEM_WINDOW_CLASS, ZPOS_SYSTEM_WINDOW_TITLE);
+        }
+
+        uint64_t misses = m_detector.GetTriggerMissCount();
+        uint64_t missProbes = m_detector.GetTriggerMissProbeCount();
+        bool stateChanged = m_detector.OnProbe(hwnd != nullptr, m_windowSystem.GetTickCount());
+        if (m_detector.GetTriggerMissCount() != misses)
+        {
+            PerfCounters::Add(PERF_TRIGGER_MISSES);
+            PerfCounters::Add(PERF_TRIGGER_MISS_PROBES, m_detector.GetTriggerMissProbeCount() - missProbes);
+        }
+
+        if (stateChanged)
+        {
+            m_showDesktop = m_detector.IsShowingDesktop();
+            PerfCounters::Add(PERF_STATE_CHANGES);
+
+            // Latency is measured from the event that started the detection burst
+            m_pacedTransitionUs = PerfCounters::NowUs() - m_detector.GetLastDetectionLatencyMs() * 1000;
+            RunPaced(FramePacer::WORK_HELPER | FramePacer::WORK_FULL | FramePacer::WORK_TRANSITION,
+                desktopIconsHostWindow, m_showDesktop);
+
+            if (m_recorder)
+            {
+                TraceState record = { m_detector.GetLastDetectionLatencyMs(), m_showDesktop ? 1u : 0u, 0 };
+                m_recorder->Record(TRACE_STATE, record);
+            }
+
+            if (m_onStateChanged)
+            {
+                m_onStateChanged(m_showDesktop, m_detector.GetLastDetectionLatencyMs());
+            }
+        }
+
+        ScheduleProbe();
+        return stateChanged;
+    }
+
+    void OnDesktopEvent(ShowDesktopDetector::Event event)
+    {
+        if (m_detector.OnEvent(event, m_windowSystem.GetTickCount()))
+        {
+            CheckDesktopState(GetDesktopIconsHostWindow());
+        }
+    }
+
+    // The desktop icons host, DefView or another window of the hooked shell process
+    bool IsShellWindow(HWND hwnd)
+    {
+        if (!hwnd)
+            return false;
+
+        const ShellTopology& topology = m_topology.GetTopology();
+        if (hwnd == topology.host || hwnd == topology.defView)
+            return true;
+
+        return m_shellProcessId != 0 && m_metadata.GetProcessId(m_windowSystem, hwnd) == m_shellProcessId;
+    }
+
+    // The shell may still be settling when its window comes to the foreground.
+    // Failed checks are retried from a one-shot timer, so the thread pumping
+    // messages is never blocked while waiting.
+    void HandleShellForeground(HWND hwnd)
+    {
+        bool waitForDefView = false;
+        if (m_hostStrategy &&
+            m_hostStrategy->IsShellForeground(m_windowSystem, m_metadata, GetDefaultShellWindow(), hwnd, waitForDefView))
+        {
+            StartShellRetry(hwnd, waitForDefView);
+        }
+    }
+
+    void StartShellRetry(HWND hwnd, bool waitForDefView)
+    {
+        // A newer foreground change supersedes the retries still pending
+        m_shellRetryWindow = hwnd;
+        m_waitingForDefView = waitForDefView;
+        m_shellRetry.Start(m_windowSystem.GetTickCount());
+        RetryShellForeground();
+    }
+
+    void RetryShellForeground()
+    {
+        if (m_waitingForDefView)
+        {
+            if (m_windowSystem.FindWindowAfter(m_shellRetryWindow, nullptr, L"SHELLDLL_DefView", L"") == nullptr)
+            {
+                ScheduleShellRetry();
+                return;
+            }
+
+            // DefView is in place, the state checks get retries of their own
+            m_waitingForDefView = false;
+            m_shellRetry.Start(m_windowSystem.GetTickCount());
+        }
+
+        // A probe in between may have seen the change already
+        if (CheckDesktopState(m_shellRetryWindow) || m_showDesktop)
+        {
+            m_shellRetry.Cancel();
+            return;
+        }
+
+        ScheduleShellRetry();
+    }
+
+    void ScheduleShellRetry()
+    {
+        if (m_shellRetry.OnFailure())
+        {
+            // The shell is expected to be ready by then, so waiting longer only delays detection
+            m_windowSystem.SetTimer(m_hSystemWindow, TIMER_SHELLRETRY,
+                m_shellRetry.GetDelayMs(m_windowSystem.GetTickCount()), TIMER_TOLERANCE_NONE);
+        }
+    }
+
+    void UpdateShellEventHook(uint32_t processId)
+    {
+        // Z-order and visibility changes of the desktop icons host are made by the shell,
+        // so the object events are only hooked for the shell process.
+        if (processId == m_shellProcessId)
+            return;
+
+        if (m_shellEventHook)
+        {
+            m_windowSystem.UnhookEvents(m_shellEventHook);
+            m_shellEventHook = nullptr;
+        }
+
+        if (m_shellParentHook)
+        {
+            m_windowSystem.UnhookEvents(m_shellParentHook);
+            m_shellParentHook = nullptr;
+        }
+
+        m_shellProcessId = processId;
+        if (processId)
+        {
+            m_shellEventHook = m_windowSystem.HookEvents(
+                WINDOW_EVENT_DESTROY, WINDOW_EVENT_REORDER, processId, false);
+            m_shellParentHook = m_windowSystem.HookEvents(
+                WINDOW_EVENT_PARENTCHANGE, WINDOW_EVENT_PARENTCHANGE, processId, false);
+        }
+    }
+
+    // Destroy, show, hide and minimize events of registered windows come from
+    // hooks on the processes that own them. The windows of a process hooked for
+    // the first time are checked, they may have changed before the hook was set.
+    void UpdateWindowHooks()
+    {
+        if (!m_hSystemWindow)
+            return;
+
+        m_processIds.clear();
+        {
+            SnapshotCell<WindowRegistry>::ReadGuard registry = m_windows.Read();
+            for (const WindowInfo& info : *registry)
+            {
+                m_processIds.push_back(info.processId);
+            }
+        }
+        std::sort(m_processIds.begin(), m_processIds.end());
+        m_processIds.erase(std::unique(m_processIds.begin(), m_processIds.end()), m_processIds.end());
+
+        for (size_t i = m_windowHooks.size(); i-- > 0;)
+        {
+            if (!std::binary_search(m_processIds.begin(), m_processIds.end(), m_windowHooks[i].processId))
+            {
+                m_windowSystem.UnhookEvents(m_windowHooks[i].events);
+                m_windowSystem.UnhookEvents(m_windowHooks[i].minimize);
+                m_windowHooks.erase(m_windowHooks.begin() + i);
+            }
+        }
+
+        size_t hooked = m_windowHooks.size();
+        for (uint32_t processId : m_processIds)
+        {
+            if (processId == 0 || FindWindowHook(processId, hooked))
+                continue;
+
+            WindowHook hook = { processId,
+                m_windowSystem.HookEvents(WINDOW_EVENT_DESTROY, WINDOW_EVENT_HIDE, processId, false),
+                m_windowSystem.HookEvents(WINDOW_EVENT_MINIMIZESTART, WINDOW_EVENT_MINIMIZEEND, processId, false) };
+            m_windowHooks.push_back(hook);
+        }
+
+        if (m_windowHooks.size() == hooked)
+            return;
+
+        // Changes are reported after the snapshot is released, reporting publishes a new one
+        std::vector<WindowLifecycle> changes;
+        {
+            SnapshotCell<WindowRegistry>::ReadGuard registry = m_windows.Read();
+            for (const WindowInfo& info : *registry)
+            {
+                WindowLifecycle change;
+                if (!FindWindowHook(info.processId, hooked) && CheckWindow(info, change))
+                {
+                    changes.push_back(change);
+                }
+            }
+        }
+
+        for (const WindowLifecycle& change : changes)
+        {
+            ReportLifecycle(change);
+        }
+    }
+
+    // True if one of the hooks from the first count was set for the process
+    bool FindWindowHook(uint32_t processId, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (m_windowHooks[i].processId == processId)
+                return true;
+        }
+        return false;
+    }
+
+    // Bring a registration up to date after an event about the window and restack
+    // what that changed. Returns false if the window is not registered.
+    bool UpdateRegisteredWindow(HWND hwnd)
+    {
+        WindowLifecycle change;
+        {
+            SnapshotCell<WindowRegistry>::ReadGuard registry = m_windows.Read();
+            const WindowInfo* info = registry->Find(hwnd);
+            if (!info)
+                return false;
+
+            // Events may arrive late, so the window is asked for its state
+            if (!CheckWindow(*info, change))
+                return true;
+        }
+
+        ReportLifecycle(change);
+        RunPaced(FramePacer::WORK_DIRTY_LAYERS);
+        return true;
+    }
+
+    // Returns true if the window is no longer in the state it was registered in
+    bool CheckWindow(const WindowInfo& info, WindowLifecycle& change)
+    {
+        change.hwnd = info.hwnd;
+        change.generation = info.generation;
+
+        // A handle that belongs to another process now was reused after the window was destroyed
+        change.destroyed = !m_windowSystem.IsWindow(info.hwnd) ||
+            m_windowSystem.GetWindowProcessId(info.hwnd) != info.processId;
+        change.isVisible = !change.destroyed && m_windowSystem.IsWindowVisible(info.hwnd);
+        change.isMinimized = !change.destroyed && m_windowSystem.IsMinimized(info.hwnd);
+
+        return change.destroyed || change.isVisible != info.isVisible || change.isMinimized != info.isMinimized;
+    }
+
+    void ReportLifecycle(const WindowLifecycle& change)
+    {
+        // A window registered later under the same handle has to be placed again
+        if (change.destroyed)
+        {
+            m_zorderLayers.Forget(change.hwnd);
+        }
+
+        if (m_recorder)
+        {
+            uint32_t flags = (change.destroyed ? TRACE_WINDOW_DESTROYED : 0) |
+                (change.isVisible ? TRACE_WINDOW_VISIBLE : 0) | (change.isMinimized ? TRACE_WINDOW_MINIMIZED : 0);
+            TraceLifecycle record = { TraceHandle(change.hwnd), flags, 0 };
+            m_recorder->Record(TRACE_LIFECYCLE, record);
+        }
+
+        if (m_onWindowLifecycle)
+        {
+            m_onWindowLifecycle(change);
+        }
+    }
+
+    void UpdateSuspended()
+    {
+        if (m_detector.SetSuspended(m_sessionLocked || m_displayOff, m_windowSystem.GetTickCount()) && m_hSystemWindow)
+        {
+            // Anything may have happened meanwhile
+            CheckDesktopState(GetDesktopIconsHostWindow());
+            return;
+        }
+        ScheduleProbe();
+    }
+
+    // Stacking work runs at most once per display frame, see FramePacer. Work
+    // asked for in a frame that was already restacked is merged and runs from a
+    // one-shot timer once the next frame has started; the helper window is then
+    // placed for the latest state asked for.
+    void RunPaced(uint32_t work, HWND desktopIconsHostWindow = nullptr, bool showDesktop = false)
+    {
+        if (work & FramePacer::WORK_HELPER)
+        {
+            m_pacedHost = desktopIconsHostWindow;
+            m_pacedShowDesktop = showDesktop;
+        }
+
+        const FrameTime time = m_windowSystem.GetFrameTime();
+        const uint64_t deferred = m_framePacer.GetDeferredCount();
+        uint32_t run = m_framePacer.Request(work, time.frame);
+        if (m_framePacer.GetDeferredCount() != deferred)
+        {
+            PerfCounters::Add(PERF_DEFERRED_PASSES);
+        }
+
+        if (run == FramePacer::WORK_NONE)
+        {
+            if (m_framePacer.IsPending() && !m_frameTimerArmed && m_hSystemWindow)
+            {
+                // A coalesced timer could fire frames late, the deferred work has to run in the next one
+                m_frameTimerArmed = true;
+                m_windowSystem.SetTimer(m_hSystemWindow, TIMER_FRAME, FramePacer::GetDelayMs(time.nextFrameUs),
+                    TIMER_TOLERANCE_NONE);
+            }
+            return;
+        }
+
+        if (run & FramePacer::WORK_TRANSITION)
+        {
+            PerfScope transition(PERF_TRANSITION_LATENCY, PerfCounters::NowUs() - m_pacedTransitionUs);
+            RunStacking(run);
+        }
+        else
+        {
+            RunStacking(run);
+        }
+    }
+
+    void RunStacking(uint32_t work)
+    {
+        if (work & FramePacer::WORK_HELPER)
+        {
+            PrepareHelperWindow(m_pacedHost, m_pacedShowDesktop);
+        }
+
+        if (work & FramePacer::WORK_FULL)
+        {
+            PositionWindows();
+        }
+
+        // Finds nothing left to restack after a full pass
+        if (work & FramePacer::WORK_DIRTY_LAYERS)
+        {
+            PositionDirtyLayers();
+        }
+    }
+
+    void RunRefresh()
+    {
+        uint64_t now = m_windowSystem.GetTickCount();
+        RefreshScheduler::Pass pass = m_refresh.OnTimer(now);
+        if (pass == RefreshScheduler::PASS_FULL)
+        {
+            PerfCounters::Add(PERF_REFRESHES);
+            RunPaced(FramePacer::WORK_FULL);
+        }
+        else if (pass == RefreshScheduler::PASS_DIRTY_LAYERS)
+        {
+            PerfCounters::Add(PERF_REFRESHES);
+            RunPaced(FramePacer::WORK_DIRTY_LAYERS);
+        }
+        else
+        {
+            // Not due yet, a request moved the deadline
+            ArmRefresh(now);
+        }
+    }
+
+    // The refresh timer is one-shot; re-arming it resets its countdown, so it
+    // is only set again when the deadline moves
+    void ArmRefresh(uint64_t nowMs)
+    {
+        if (!m_refresh.IsPending() || m_refresh.GetDeadline() == m_refreshDeadline)
+            return;
+
+        m_refreshDeadline = m_refresh.GetDeadline();
+        // Requests are merged over a settling delay already, the system may stretch it a little
+        m_windowSystem.SetTimer(m_hSystemWindow, TIMER_REFRESH, (std::max)(m_refresh.GetDelayMs(nowMs), 1u),
+            TIMER_TOLERANCE_DEFAULT);
+    }
+
+    void ScheduleProbe()
+    {
+        if (!m_hSystemWindow)
+            return;
+
+        // Without registered windows only events are worth waking up for
+        m_detector.SetIdle(m_windows.Read()->IsEmpty());
+
+        // Re-arming the timer resets its countdown, so only do it when the interval changes
+        uint32_t interval = m_detector.NextProbeDelayMs();
+        if (interval == m_probeInterval)
+            return;
+
+        if (interval == ShowDesktopDetector::NO_PROBE)
+        {
+            m_windowSystem.KillTimer(m_hSystemWindow, TIMER_SHOWDESKTOP);
+        }
+        else
+        {
+            // Burst, trigger and polling probes are there to detect a transition quickly
+            uint32_t tolerance = m_detector.NextProbeToleranceMs();
+            m_windowSystem.SetTimer(m_hSystemWindow, TIMER_SHOWDESKTOP, interval,
+                tolerance ? tolerance : TIMER_TOLERANCE_NONE);
+        }
+        m_probeInterval = interval;
+        m_probeIntervalMs.store(interval, std::memory_order_relaxed);
+    }
+
+    // Lifecycle events of the registered windows of one process
+    struct WindowHook
+    {
+        uint32_t processId;
+        IWindowSystem::EventHook events;
+        IWindowSystem::EventHook minimize;
+    };
+
+    IWindowSystem& m_windowSystem;
+    const SnapshotCell<WindowRegistry>& m_windows;
+    HWND m_hSystemWindow;
+    HWND m_hHelperWindow;
+    IWindowSystem::EventHook m_foregroundHook;
+    IWindowSystem::EventHook m_shellEventHook;
+    IWindowSystem::EventHook m_shellParentHook;
+    std::vector<WindowHook> m_windowHooks;
+    std::vector<uint32_t> m_processIds;
+    uint32_t m_shellProcessId;
+    HWND m_shellWindow;
+    ShellTopologyCache m_topology;
+    WindowMetadataCache m_metadata;
+    TopmostBoundary m_topmostBoundary;
+    DesktopHostStrategies m_hostStrategies;
+    DesktopHostStrategy* m_hostStrategy;    // Selected when starting
+    uint32_t m_probeInterval;
+    ShowDesktopDetector m_detector;
+    RetryScheduler m_shellRetry;
+    HWND m_shellRetryWindow;
+    bool m_waitingForDefView;
+    TriggerRecognizer m_triggers;
+    RefreshScheduler m_refresh;
+    uint64_t m_refreshDeadline;         // Deadline the refresh timer is armed for, 0 = none
+    FramePacer m_framePacer;
+    HWND m_pacedHost;                   // Where the paced helper placement puts the helper
+    bool m_pacedShowDesktop;
+    uint64_t m_pacedTransitionUs;       // When the paced transition started, PerfCounters::NowUs
+    bool m_frameTimerArmed;
+    bool m_sessionLocked;
+    bool m_displayOff;
+    ZOrderBatch m_zorderBatch;
+    ZOrderPlanner m_zorderPlanner;
+    ZOrderLayers m_zorderLayers;
+    ZOrderLayers::Registered m_layerWindows;
+    std::atomic<bool> m_showDesktop;
+    std::atomic<uint32_t> m_probeIntervalMs;
+    std::atomic<uint64_t> m_wakeups;
+    StateChangedHandler m_onStateChanged;
+    WindowLifecycleHandler m_onWindowLifecycle;
+    TraceRecorder* m_recorder;
+};
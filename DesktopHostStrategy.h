@@ -0,0 +1,138 @@
+#pragma once
+
+#include "ShellTopologyCache.h"
+#include "WindowMetadataCache.h"
+#include "WindowSystem.h"
+#include <memory>
+#include <vector>
+
+// How the shell lays out the desktop: which window hosts SHELLDLL_DefView and
+// which foreground changes mean the shell is settling after Show Desktop.
+//
+// The layout does not change while the shell runs, so one strategy is selected
+// when detection starts and used for every lookup after that. Strategies only
+// talk to the window system, so they run against the simulated shell as well.
+// What rarely changes about a window is asked through the metadata cache.
+class DesktopHostStrategy
+{
+public:
+    virtual ~DesktopHostStrategy() {}
+
+    virtual const char* GetName() const = 0;
+
+    // Whether the running shell lays out the desktop this way
+    virtual bool Matches(IWindowSystem& windowSystem) = 0;
+
+    // Fill in defView and host for topology.shellWindow. Leaves defView null
+    // while the shell is still starting up.
+    virtual void Resolve(IWindowSystem& windowSystem, WindowMetadataCache& metadata, ShellTopology& topology) = 0;
+
+    // Whether hwnd coming to the foreground is the shell settling after a Show
+    // Desktop change. Sets waitForDefView if DefView has yet to move into hwnd.
+    virtual bool IsShellForeground(IWindowSystem& windowSystem, WindowMetadataCache& metadata,
+        HWND shellWindow, HWND hwnd, bool& waitForDefView) = 0;
+};
+
+// Windows 11 24H2 and later: DefView stays in the shell window
+class ShellWindowHostStrategy : public DesktopHostStrategy
+{
+public:
+    const char* GetName() const override { return "shell window"; }
+
+    bool Matches(IWindowSystem& windowSystem) override
+    {
+        return windowSystem.UsesShellWindowAsDesktopIconsHost();
+    }
+
+    void Resolve(IWindowSystem& windowSystem, WindowMetadataCache&, ShellTopology& topology) override
+    {
+        topology.defView = windowSystem.FindWindowAfter(topology.shellWindow, nullptr, L"SHELLDLL_DefView", L"");
+        topology.host = topology.defView ? topology.shellWindow : nullptr;
+    }
+
+    bool IsShellForeground(IWindowSystem&, WindowMetadataCache&, HWND shellWindow, HWND hwnd, bool& waitForDefView) override
+    {
+        waitForDefView = false;
+        return hwnd && hwnd == shellWindow;
+    }
+};
+
+// Earlier versions: Show Desktop moves DefView from the shell window into a
+// WorkerW of the shell process, which then hosts the icons
+class WorkerWHostStrategy : public DesktopHostStrategy
+{
+public:
+    const char* GetName() const override { return "WorkerW"; }
+
+    // The fallback, matches any shell
+    bool Matches(IWindowSystem&) override { return true; }
+
+    void Resolve(IWindowSystem& windowSystem, WindowMetadataCache& metadata, ShellTopology& topology) override
+    {
+        HWND shellW = topology.shellWindow;
+        HWND workerW = nullptr;
+        HWND defView = windowSystem.FindWindowAfter(shellW, nullptr, L"SHELLDLL_DefView", L"");
+        if (defView == nullptr)
+        {
+            while ((workerW = windowSystem.FindWindowAfter(nullptr, workerW, L"WorkerW", L"")) != nullptr)
+            {
+                if (metadata.IsVisible(windowSystem, workerW) &&
+                    metadata.GetProcessId(windowSystem, workerW) == topology.shellProcessId &&
+                    (defView = windowSystem.FindWindowAfter(workerW, nullptr, L"SHELLDLL_DefView", L"")))
+                {
+                    break;
+                }
+            }
+        }
+
+        topology.defView = defView;
+        topology.host = workerW;
+    }
+
+    bool IsShellForeground(IWindowSystem& windowSystem, WindowMetadataCache& metadata,
+        HWND shellWindow, HWND hwnd, bool& waitForDefView) override
+    {
+        waitForDefView = true;
+        return metadata.GetClassAtom(windowSystem, hwnd) == CLASS_ATOM_WORKERW &&
+            metadata.GetProcessId(windowSystem, shellWindow) == metadata.GetProcessId(windowSystem, hwnd);
+    }
+};
+
+// The strategies to choose from. Added ones are tried before the built-in
+// ones, newest first, so a new shell layout can be supported without
+// touching the existing ones.
+class DesktopHostStrategies
+{
+public:
+    DesktopHostStrategies()
+    {
+        m_builtIn.emplace_back(new ShellWindowHostStrategy());
+        m_builtIn.emplace_back(new WorkerWHostStrategy());
+    }
+
+    void Add(std::unique_ptr<DesktopHostStrategy> strategy)
+    {
+        m_added.insert(m_added.begin(), std::move(strategy));
+    }
+
+    // The first strategy that matches the running shell
+    DesktopHostStrategy* Select(IWindowSystem& windowSystem)
+    {
+        for (const std::unique_ptr<DesktopHostStrategy>& strategy : m_added)
+        {
+            if (strategy->Matches(windowSystem))
+                return strategy.get();
+        }
+
+        for (const std::unique_ptr<DesktopHostStrategy>& strategy : m_builtIn)
+        {
+            if (strategy->Matches(windowSystem))
+                return strategy.get();
+        }
+        return m_builtIn.back().get();
+    }
+
+private:
+    std::vector<std::unique_ptr<DesktopHostStrategy>> m_added;
+    std::vector<std::unique_ptr<DesktopHostStrategy>> m_builtIn;
+};
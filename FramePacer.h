@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+
+// Paces stacking passes to the composition frames of the display.
+//
+// Z-order changes made within one frame are shown together, so a second pass
+// in the same frame only lets the user see the stack it replaces. The first
+// pass of a frame runs right away. Work asked for later in that frame is merged
+// and runs once, when the next frame has started.
+//
+// The frames come from the caller, normally IWindowSystem::GetFrameTime, so the
+// pacing follows the simulated clock as well as the display.
+//
+// The caller asks Request whether to run now. If not, it arms a one-shot timer
+// for GetDelayMs and calls Request again with no new work when it fires.
+class FramePacer
+{
+public:
+    enum Work
+    {
+        WORK_NONE = 0x0,
+        WORK_HELPER = 0x1,          // Place the helper window
+        WORK_DIRTY_LAYERS = 0x2,    // Restack the layers whose windows changed
+        WORK_FULL = 0x4,            // Restack everything
+        WORK_TRANSITION = 0x8       // The work finishes a Show Desktop transition
+    };
+
+    FramePacer() :
+        m_pending(WORK_NONE),
+        m_lastFrame(0),
+        m_hasPassed(false),
+        m_passes(0),
+        m_deferred(0)
+    {
+    }
+
+    void Reset()
+    {
+        m_pending = WORK_NONE;
+        m_hasPassed = false;
+    }
+
+    // Add work in the given frame. Returns the work to run now, all that is
+    // pending, or WORK_NONE if this frame already had its pass.
+    uint32_t Request(uint32_t work, uint64_t frame)
+    {
+        if (work != WORK_NONE && m_pending == WORK_NONE && m_hasPassed && frame == m_lastFrame)
+        {
+            ++m_deferred;
+        }
+        m_pending |= work;
+
+        if (m_pending == WORK_NONE || (m_hasPassed && frame == m_lastFrame))
+            return WORK_NONE;
+
+        uint32_t run = m_pending;
+        m_pending = WORK_NONE;
+        m_lastFrame = frame;
+        m_hasPassed = true;
+        ++m_passes;
+        return run;
+    }
+
+    // Timer delay until the next frame starts, rounded up so it has started
+    static uint32_t GetDelayMs(uint32_t nextFrameUs)
+    {
+        uint32_t ms = (nextFrameUs + 999) / 1000;
+        return ms > 0 ? ms : 1;
+    }
+
+    bool IsPending() const { return m_pending != WORK_NONE; }
+
+    uint64_t GetPassCount() const { return m_passes; }
+
+    // Times work had to wait for the next frame
+    uint64_t GetDeferredCount() const { return m_deferred; }
+
+private:
+    uint32_t m_pending;
+    uint64_t m_lastFrame;
+    bool m_hasPassed;
+    uint64_t m_passes;
+    uint64_t m_deferred;
+};
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Delivers desktop state changes to subscribers on dispatcher threads.
+//
+// The detection path only appends a timestamped event to a bounded ring and
+// wakes the dispatchers; it never waits for a subscriber. Every subscriber has
+// its own dispatcher reading the ring through its own cursor, so a slow
+// subscriber delays nobody but itself. One that falls so far behind that the
+// ring wraps past its cursor skips the lost events and has them counted as
+// dropped. A subscriber can ask for rapid flip-flops to be coalesced: events
+// are then held for a window and only the newest pending state is delivered,
+// or nothing at all if it matches what the subscriber saw last.
+class NotificationPipeline
+{
+public:
+    struct Event
+    {
+        int state;
+        uint64_t sequence;              // 1 for the first event published
+        uint64_t timestampMs;           // Steady clock time of publication
+        uint32_t detectionLatencyMs;    // Time from the triggering event to detection
+    };
+
+    typedef std::function<void(const Event& event)> Handler;
+    typedef uint32_t SubscriberId;
+
+    explicit NotificationPipeline(size_t capacity = 64) :
+        m_ring(capacity ? capacity : 1),
+        m_head(0),
+        m_state(0),
+        m_nextId(1),
+        m_running(false)
+    {
+    }
+
+    ~NotificationPipeline()
+    {
+        Stop();
+    }
+
+    NotificationPipeline(const NotificationPipeline&) = delete;
+    NotificationPipeline& operator=(const NotificationPipeline&) = delete;
+
+    // initialState is the state subscribers are assumed to know before the first event
+    bool Start(int initialState)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_running)
+            return false;
+
+        m_head = 0;
+        m_state = initialState;
+        m_running = true;
+        for (const std::shared_ptr<Subscriber>& subscriber : m_subscribers)
+        {
+            subscriber->next = 1;
+            subscriber->lastState = initialState;
+            StartDispatcher(subscriber);
+        }
+        return true;
+    }
+
+    // Subscriptions are kept, events not yet delivered are discarded
+    void Stop()
+    {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_running)
+                return;
+
+            m_running = false;
+            for (const std::shared_ptr<Subscriber>& subscriber : m_subscribers)
+            {
+                threads.push_back(std::move(subscriber->thread));
+            }
+            threads.insert(threads.end(),
+                std::make_move_iterator(m_retired.begin()), std::make_move_iterator(m_retired.end()));
+            m_retired.clear();
+        }
+        m_wake.notify_all();
+
+        for (std::thread& thread : threads)
+        {
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+    }
+
+    // Append an event and return its sequence number. Never blocks on subscribers.
+    uint64_t Publish(int state, uint32_t detectionLatencyMs)
+    {
+        uint64_t sequence;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            sequence = ++m_head;
+
+            Event& event = m_ring[(sequence - 1) % m_ring.size()];
+            event.state = state;
+            event.sequence = sequence;
+            event.timestampMs = Now();
+            event.detectionLatencyMs = detectionLatencyMs;
+            m_state = state;
+        }
+        m_wake.notify_all();
+        return sequence;
+    }
+
+    // Subscribers only receive events published after they subscribed.
+    // A coalescing window of 0 delivers every event.
+    SubscriberId Subscribe(Handler handler, uint32_t coalesceWindowMs)
+    {
+        std::shared_ptr<Subscriber> subscriber(new Subscriber());
+        subscriber->handler = std::move(handler);
+        subscriber->coalesceWindowMs = coalesceWindowMs;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        subscriber->id = m_nextId++;
+        subscriber->next = m_head + 1;
+        subscriber->lastState = m_state;
+        m_subscribers.push_back(subscriber);
+        if (m_running)
+        {
+            StartDispatcher(subscriber);
+        }
+        return subscriber->id;
+    }
+
+    // After this returns the handler is not called anymore, unless it is
+    // the handler itself that unsubscribes.
+    bool Unsubscribe(SubscriberId id)
+    {
+        std::thread thread;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            size_t i = 0;
+            while (i < m_subscribers.size() && m_subscribers[i]->id != id)
+            {
+                ++i;
+            }
+            if (i == m_subscribers.size())
+                return false;
+
+            m_subscribers[i]->stopping = true;
+            thread = std::move(m_subscribers[i]->thread);
+            m_subscribers.erase(m_subscribers.begin() + i);
+
+            // A dispatcher cannot join itself; Stop joins it later
+            if (thread.get_id() == std::this_thread::get_id())
+            {
+                m_retired.push_back(std::move(thread));
+            }
+        }
+        m_wake.notify_all();
+
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        return true;
+    }
+
+    bool SetCoalesceWindow(SubscriberId id, uint32_t coalesceWindowMs)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            Subscriber* subscriber = Find(id);
+            if (!subscriber)
+                return false;
+
+            subscriber->coalesceWindowMs = coalesceWindowMs;
+        }
+        m_wake.notify_all();
+        return true;
+    }
+
+    uint64_t GetPublishedCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_head;
+    }
+
+    uint64_t GetDroppedCount(SubscriberId id) const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        const Subscriber* subscriber = Find(id);
+        return subscriber ? subscriber->dropped : 0;
+    }
+
+    uint64_t GetCoalescedCount(SubscriberId id) const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        const Subscriber* subscriber = Find(id);
+        return subscriber ? subscriber->coalesced : 0;
+    }
+
+private:
+    struct Subscriber
+    {
+        Subscriber() :
+            id(0),
+            coalesceWindowMs(0),
+            next(1),
+            lastState(0),
+            dropped(0),
+            coalesced(0),
+            stopping(false)
+        {
+        }
+
+        SubscriberId id;
+        Handler handler;
+        uint32_t coalesceWindowMs;
+        uint64_t next;                  // Sequence of the next event to deliver
+        int lastState;
+        uint64_t dropped;
+        uint64_t coalesced;
+        bool stopping;
+        std::thread thread;
+    };
+
+    static uint64_t Now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    const Subscriber* Find(SubscriberId id) const
+    {
+        for (const std::shared_ptr<Subscriber>& subscriber : m_subscribers)
+        {
+            if (subscriber->id == id)
+                return subscriber.get();
+        }
+        return nullptr;
+    }
+
+    Subscriber* Find(SubscriberId id)
+    {
+        return const_cast<Subscriber*>(static_cast<const NotificationPipeline*>(this)->Find(id));
+    }
+
+    const Event& At(uint64_t sequence) const
+    {
+        return m_ring[(sequence - 1) % m_ring.size()];
+    }
+
+    void StartDispatcher(const std::shared_ptr<Subscriber>& subscriber)
+    {
+        subscriber->stopping = false;
+        subscriber->thread = std::thread(&NotificationPipeline::Dispatch, this, subscriber);
+    }
+
+    // Move the events due for subscriber into batch. Returns the time at which
+    // held back events become due, or 0 if nothing is held back.
+    uint64_t Collect(Subscriber& subscriber, uint64_t now, std::vector<Event>& batch)
+    {
+        // Events the ring has already overwritten are lost for this subscriber
+        uint64_t oldest = m_head >= m_ring.size() ? m_head - m_ring.size() + 1 : 1;
+        if (subscriber.next < oldest)
+        {
+            subscriber.dropped += oldest - subscriber.next;
+            subscriber.next = oldest;
+        }
+
+        if (subscriber.next > m_head)
+            return 0;
+
+        if (subscriber.coalesceWindowMs)
+        {
+            uint64_t due = At(subscriber.next).timestampMs + subscriber.coalesceWindowMs;
+            if (now < due)
+                return due;
+
+            // Everything pending collapses into the newest state
+            subscriber.coalesced += m_head - subscriber.next;
+            subscriber.next = m_head;
+            if (At(m_head).state == subscriber.lastState)
+            {
+                ++subscriber.coalesced;
+                subscriber.next = m_head + 1;
+                return 0;
+            }
+        }
+
+        for (; subscriber.next <= m_head; ++subscriber.next)
+        {
+            batch.push_back(At(subscriber.next));
+        }
+        subscriber.lastState = batch.back().state;
+        return 0;
+    }
+
+    void Dispatch(std::shared_ptr<Subscriber> subscriber)
+    {
+        std::vector<Event> batch;
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        while (m_running && !subscriber->stopping)
+        {
+            uint64_t now = Now();
+            batch.clear();
+            uint64_t due = Collect(*subscriber, now, batch);
+
+            if (!batch.empty())
+            {
+                lock.unlock();
+                for (const Event& event : batch)
+                {
+                    subscriber->handler(event);
+                }
+                lock.lock();
+            }
+            else if (due)
+            {
+                m_wake.wait_for(lock, std::chrono::milliseconds(due - now));
+            }
+            else
+            {
+                m_wake.wait(lock, [&]()
+                {
+                    return !m_running || subscriber->stopping || subscriber->next <= m_head;
+                });
+            }
+        }
+    }
+
+    std::vector<Event> m_ring;
+    uint64_t m_head;                    // Sequence of the newest event
+    int m_state;
+    std::vector<std::shared_ptr<Subscriber>> m_subscribers;
+    std::vector<std::thread> m_retired;
+    SubscriberId m_nextId;
+    bool m_running;
+    mutable std::mutex m_lock;
+    std::condition_variable m_wake;
+};
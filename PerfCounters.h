@@ -0,0 +1,270 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Set to 0 to compile the instrumentation out entirely
+#ifndef ZPOSDESKTOP_STATS
+#define ZPOSDESKTOP_STATS 1
+#endif
+
+enum PerfCounter
+{
+    PERF_MESSAGES,              // Messages handled by the system window
+    PERF_TIMER_TICKS,           // Probe timer ticks
+    PERF_DESKTOP_CHECKS,        // Desktop state probes
+    PERF_STATE_CHANGES,         // Detected Show Desktop transitions
+    PERF_REPOSITION_PASSES,     // Repositioning passes
+    PERF_ENUMERATIONS,          // Top-level window enumerations
+    PERF_ENUMERATED_WINDOWS,    // Windows visited by those enumerations
+    PERF_ZORDER_CALLS,          // SetWindowPos and DeferWindowPos calls
+    PERF_ZORDER_COMMITS,        // Batched z-order commits
+    PERF_WAKEUPS,               // Timer callbacks of any kind
+    PERF_REFRESH_REQUESTS,      // Repositioning passes asked for by messages and API calls
+    PERF_REFRESHES,             // Passes those requests were merged into
+    PERF_TRIGGERS,              // Inputs recognised as announcing Show Desktop
+    PERF_TRIGGER_MISSES,        // Triggers not followed by a transition
+    PERF_TRIGGER_MISS_PROBES,   // Probes run for those
+    PERF_DEFERRED_PASSES,       // Stacking passes moved to the next display frame
+
+    PERF_COUNTER_COUNT
+};
+
+enum PerfHistogram
+{
+    PERF_CHECK_DESKTOP_STATE,   // Duration of a desktop state probe
+    PERF_POSITION_WINDOWS,      // Duration of a repositioning pass
+    PERF_TRANSITION_LATENCY,    // From the event behind a transition to the windows being in place
+
+    PERF_HISTOGRAM_COUNT
+};
+
+// Bucket 0 holds 0 us, bucket i holds [2^(i-1), 2^i) us, the last bucket everything above
+const size_t PERF_HISTOGRAM_BUCKETS = 20;
+
+struct PerfHistogramData
+{
+    uint64_t count;
+    uint64_t totalUs;
+    uint64_t maxUs;
+    uint64_t buckets[PERF_HISTOGRAM_BUCKETS];
+};
+
+struct PerfSnapshot
+{
+    uint64_t counters[PERF_COUNTER_COUNT];
+    PerfHistogramData histograms[PERF_HISTOGRAM_COUNT];
+};
+
+// Process-wide counters and latency histograms.
+//
+// Every thread that records gets its own block of counters, so recording is a
+// plain load and store on memory no other thread writes: no locked instruction
+// and no shared cache line. Readers sum the blocks. Blocks of finished threads
+// are handed to new threads, so the totals keep growing and memory stays
+// bounded by the number of threads that record at the same time.
+class PerfCounters
+{
+public:
+    static bool IsEnabled() { return ZPOSDESKTOP_STATS != 0; }
+
+#if ZPOSDESKTOP_STATS
+    static void Add(PerfCounter counter, uint64_t value = 1)
+    {
+        Increase(GetBlock().counters[counter], value);
+    }
+
+    static void Record(PerfHistogram histogram, uint64_t us)
+    {
+        ThreadBlock::Histogram& data = GetBlock().histograms[histogram];
+        Increase(data.count, 1);
+        Increase(data.totalUs, us);
+        if (us > data.maxUs.load(std::memory_order_relaxed))
+        {
+            data.maxUs.store(us, std::memory_order_relaxed);
+        }
+        Increase(data.buckets[GetBucket(us)], 1);
+    }
+
+    static void Read(PerfSnapshot& snapshot)
+    {
+        snapshot = PerfSnapshot();
+        for (ThreadBlock* block = GetHead().load(std::memory_order_acquire); block; block = block->next)
+        {
+            for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+            {
+                snapshot.counters[i] += block->counters[i].load(std::memory_order_relaxed);
+            }
+
+            for (size_t i = 0; i < PERF_HISTOGRAM_COUNT; ++i)
+            {
+                const ThreadBlock::Histogram& source = block->histograms[i];
+                PerfHistogramData& target = snapshot.histograms[i];
+                target.count += source.count.load(std::memory_order_relaxed);
+                target.totalUs += source.totalUs.load(std::memory_order_relaxed);
+
+                uint64_t maxUs = source.maxUs.load(std::memory_order_relaxed);
+                if (maxUs > target.maxUs)
+                {
+                    target.maxUs = maxUs;
+                }
+
+                for (size_t bucket = 0; bucket < PERF_HISTOGRAM_BUCKETS; ++bucket)
+                {
+                    target.buckets[bucket] += source.buckets[bucket].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+#else
+    static void Add(PerfCounter, uint64_t = 1) {}
+    static void Record(PerfHistogram, uint64_t) {}
+    static void Read(PerfSnapshot& snapshot) { snapshot = PerfSnapshot(); }
+#endif
+
+    static size_t GetBucket(uint64_t us)
+    {
+        size_t bucket = 0;
+        while (us && bucket < PERF_HISTOGRAM_BUCKETS - 1)
+        {
+            us >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    static uint64_t NowUs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+private:
+#if ZPOSDESKTOP_STATS
+    struct ThreadBlock
+    {
+        struct Histogram
+        {
+            std::atomic<uint64_t> count;
+            std::atomic<uint64_t> totalUs;
+            std::atomic<uint64_t> maxUs;
+            std::atomic<uint64_t> buckets[PERF_HISTOGRAM_BUCKETS];
+        };
+
+        ThreadBlock() : inUse(true), next(nullptr)
+        {
+            for (std::atomic<uint64_t>& counter : counters)
+            {
+                counter.store(0, std::memory_order_relaxed);
+            }
+
+            for (Histogram& histogram : histograms)
+            {
+                histogram.count.store(0, std::memory_order_relaxed);
+                histogram.totalUs.store(0, std::memory_order_relaxed);
+                histogram.maxUs.store(0, std::memory_order_relaxed);
+                for (std::atomic<uint64_t>& bucket : histogram.buckets)
+                {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        std::atomic<uint64_t> counters[PERF_COUNTER_COUNT];
+        Histogram histograms[PERF_HISTOGRAM_COUNT];
+        std::atomic<bool> inUse;
+        ThreadBlock* next;
+    };
+
+    // Releases the block of a thread when the thread exits
+    struct ThreadSlot
+    {
+        ThreadSlot() : block(nullptr) {}
+
+        ~ThreadSlot()
+        {
+            if (block)
+            {
+                block->inUse.store(false, std::memory_order_release);
+            }
+        }
+
+        ThreadBlock* block;
+    };
+
+    // Only the owning thread writes a block, so no read-modify-write is needed
+    static void Increase(std::atomic<uint64_t>& value, uint64_t amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static std::atomic<ThreadBlock*>& GetHead()
+    {
+        // Blocks live until the process exits; readers may walk them at any time
+        static std::atomic<ThreadBlock*> head(nullptr);
+        return head;
+    }
+
+    static ThreadBlock& GetBlock()
+    {
+        static thread_local ThreadSlot slot;
+        if (!slot.block)
+        {
+            slot.block = AcquireBlock();
+        }
+        return *slot.block;
+    }
+
+    static ThreadBlock* AcquireBlock()
+    {
+        std::atomic<ThreadBlock*>& head = GetHead();
+        for (ThreadBlock* block = head.load(std::memory_order_acquire); block; block = block->next)
+        {
+            bool free = false;
+            if (!block->inUse.load(std::memory_order_relaxed) &&
+                block->inUse.compare_exchange_strong(free, true, std::memory_order_acquire))
+            {
+                return block;
+            }
+        }
+
+        ThreadBlock* block = new ThreadBlock();
+        block->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+        return block;
+    }
+#endif
+};
+
+// Records the lifetime of the scope in a histogram, plus time spent before it
+class PerfScope
+{
+public:
+#if ZPOSDESKTOP_STATS
+    explicit PerfScope(PerfHistogram histogram, uint64_t earlierUs = 0) :
+        m_histogram(histogram),
+        m_startUs(PerfCounters::NowUs() - earlierUs)
+    {
+    }
+
+    ~PerfScope()
+    {
+        PerfCounters::Record(m_histogram, PerfCounters::NowUs() - m_startUs);
+    }
+#else
+    explicit PerfScope(PerfHistogram, uint64_t = 0) {}
+#endif
+
+private:
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+#if ZPOSDESKTOP_STATS
+    PerfHistogram m_histogram;
+    uint64_t m_startUs;
+#endif
+};
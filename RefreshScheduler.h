@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+
+// Debounces requests for repositioning passes.
+//
+// Requests only mark the windows dirty. The pass runs on the trailing edge,
+// once no request came in for the settle time, but never later than the
+// maximum delay after the first request it covers, and never sooner than the
+// minimum interval after the previous pass. A burst of requests therefore
+// costs one pass, or one per maximum delay while it lasts.
+//
+// The caller arms a one-shot timer for GetDelayMs after every request and asks
+// OnTimer what to run when it fires.
+class RefreshScheduler
+{
+public:
+    enum Pass
+    {
+        PASS_NONE,
+        PASS_DIRTY_LAYERS,      // Restack the layers whose windows changed
+        PASS_FULL               // Restack everything
+    };
+
+    RefreshScheduler(uint32_t settleMs, uint32_t minIntervalMs, uint32_t maxDelayMs) :
+        m_settleMs(settleMs),
+        m_minIntervalMs(minIntervalMs),
+        m_maxDelayMs(maxDelayMs),
+        m_pending(PASS_NONE),
+        m_firstRequest(0),
+        m_deadline(0),
+        m_lastPass(0),
+        m_hasPassed(false),
+        m_requested(0),
+        m_executed(0)
+    {
+    }
+
+    void Reset()
+    {
+        m_pending = PASS_NONE;
+        m_hasPassed = false;
+    }
+
+    void Request(bool full, uint64_t nowMs)
+    {
+        ++m_requested;
+        if (m_pending == PASS_NONE)
+        {
+            m_firstRequest = nowMs;
+        }
+        if (full || m_pending == PASS_NONE)
+        {
+            m_pending = full ? PASS_FULL : PASS_DIRTY_LAYERS;
+        }
+
+        uint64_t deadline = nowMs + m_settleMs;
+        if (deadline > m_firstRequest + m_maxDelayMs)
+        {
+            deadline = m_firstRequest + m_maxDelayMs;
+        }
+        if (m_hasPassed && deadline < m_lastPass + m_minIntervalMs)
+        {
+            deadline = m_lastPass + m_minIntervalMs;
+        }
+        m_deadline = deadline;
+    }
+
+    // The timer fired. Returns the pass to run now, or PASS_NONE if nothing is
+    // pending or the pass is not due yet, in which case the timer is armed again.
+    Pass OnTimer(uint64_t nowMs)
+    {
+        if (m_pending == PASS_NONE || nowMs < m_deadline)
+            return PASS_NONE;
+
+        Pass pass = m_pending;
+        m_pending = PASS_NONE;
+        m_lastPass = nowMs;
+        m_hasPassed = true;
+        ++m_executed;
+        return pass;
+    }
+
+    // A pass ran, from the timer or outside the scheduler. A full one covers
+    // everything requested before it, a dirty-layers one covers the same. Either
+    // way the next pass keeps the minimum interval from this one.
+    void OnPass(bool full, uint64_t nowMs)
+    {
+        if (full || m_pending == PASS_DIRTY_LAYERS)
+        {
+            m_pending = PASS_NONE;
+        }
+
+        m_lastPass = nowMs;
+        m_hasPassed = true;
+        if (m_pending != PASS_NONE && m_deadline < m_lastPass + m_minIntervalMs)
+        {
+            m_deadline = m_lastPass + m_minIntervalMs;
+        }
+    }
+
+    // Delay until the pending pass is due, 0 if it already is
+    uint32_t GetDelayMs(uint64_t nowMs) const
+    {
+        return m_deadline > nowMs ? static_cast<uint32_t>(m_deadline - nowMs) : 0;
+    }
+
+    bool IsPending() const { return m_pending != PASS_NONE; }
+    uint64_t GetDeadline() const { return m_deadline; }
+
+    uint64_t GetRequestedCount() const { return m_requested; }
+    uint64_t GetExecutedCount() const { return m_executed; }
+
+private:
+    uint32_t m_settleMs;
+    uint32_t m_minIntervalMs;
+    uint32_t m_maxDelayMs;
+    Pass m_pending;
+    uint64_t m_firstRequest;
+    uint64_t m_deadline;
+    uint64_t m_lastPass;
+    bool m_hasPassed;
+    uint64_t m_requested;
+    uint64_t m_executed;
+};
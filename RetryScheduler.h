@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+// Deadline bookkeeping for an operation that is retried a bounded number of
+// times without blocking.
+//
+// The caller makes an attempt, and when it fails asks for the delay until the
+// next one and arms a one-shot timer for it. Deadlines are counted from the
+// first attempt, so a late timer does not push back the attempts after it;
+// an attempt that is already overdue is due at once, but overdue attempts are
+// never made in a burst since each still needs its own timer.
+class RetryScheduler
+{
+public:
+    RetryScheduler(uint32_t intervalMs, uint32_t maxRetries) :
+        m_intervalMs(intervalMs),
+        m_maxRetries(maxRetries),
+        m_retries(0),
+        m_deadline(0),
+        m_active(false),
+        m_scheduled(0),
+        m_exhausted(0)
+    {
+    }
+
+    // Start over with the first attempt made at nowMs
+    void Start(uint64_t nowMs)
+    {
+        m_active = true;
+        m_retries = 0;
+        m_deadline = nowMs;
+    }
+
+    void Cancel()
+    {
+        m_active = false;
+    }
+
+    // Record a failed attempt. Returns true if a retry is due at GetDeadline.
+    bool OnFailure()
+    {
+        if (!m_active)
+            return false;
+
+        if (m_retries >= m_maxRetries)
+        {
+            ++m_exhausted;
+            m_active = false;
+            return false;
+        }
+
+        ++m_retries;
+        ++m_scheduled;
+        m_deadline += m_intervalMs;
+        return true;
+    }
+
+    // Delay until the pending retry is due, 0 if it already is
+    uint32_t GetDelayMs(uint64_t nowMs) const
+    {
+        return m_deadline > nowMs ? static_cast<uint32_t>(m_deadline - nowMs) : 0;
+    }
+
+    bool IsActive() const { return m_active; }
+    bool IsDue(uint64_t nowMs) const { return m_active && nowMs >= m_deadline; }
+    uint64_t GetDeadline() const { return m_deadline; }
+    uint32_t GetRetryCount() const { return m_retries; }
+
+    uint64_t GetScheduledCount() const { return m_scheduled; }
+    uint64_t GetExhaustedCount() const { return m_exhausted; }
+
+private:
+    uint32_t m_intervalMs;
+    uint32_t m_maxRetries;
+    uint32_t m_retries;
+    uint64_t m_deadline;
+    bool m_active;
+    uint64_t m_scheduled;
+    uint64_t m_exhausted;
+};
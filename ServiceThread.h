@@ -0,0 +1,222 @@
+#pragma once
+
+#include "CommandQueue.h"
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+// A thread owned by the library that runs a message pump and executes commands
+// marshalled to it from other threads.
+//
+// The platform side is supplied as a Pump: it sets up its resources on the
+// thread, blocks until there is something to do and can be woken from any
+// thread. Commands travel through a lock-free queue; only a synchronous Invoke
+// waits for its command to complete. Posting checks the thread's state under a
+// short lock, so a command is either run or refused, never left in the queue.
+class ServiceThread
+{
+public:
+    class Pump
+    {
+    public:
+        virtual ~Pump() {}
+
+        // Runs on the service thread before the loop, false aborts the start
+        virtual bool Start() = 0;
+
+        // Wait for and handle pending work, false ends the loop
+        virtual bool RunOnce() = 0;
+
+        // Called from any thread to make RunOnce return
+        virtual void Wake() = 0;
+
+        // Runs on the service thread after the loop
+        virtual void Stop() = 0;
+    };
+
+    ServiceThread() :
+        m_pump(nullptr),
+        m_state(STATE_STOPPED)
+    {
+    }
+
+    ~ServiceThread()
+    {
+        Stop();
+    }
+
+    ServiceThread(const ServiceThread&) = delete;
+    ServiceThread& operator=(const ServiceThread&) = delete;
+
+    // Start the thread and wait until the pump is set up
+    bool Start(Pump* pump)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_stateLock);
+            if (m_state != STATE_STOPPED || m_thread.joinable())
+                return false;
+
+            m_pump = pump;
+            m_state = STATE_STARTING;
+        }
+
+        std::promise<bool> started;
+        std::future<bool> result = started.get_future();
+        m_thread = std::thread(&ServiceThread::Run, this, &started);
+
+        if (!result.get())
+        {
+            m_thread.join();
+            m_pump = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    // Finish queued commands, tear the pump down and join the thread. Also
+    // joins a thread whose pump ended the loop by itself.
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_stateLock);
+            if (m_state == STATE_RUNNING)
+            {
+                m_state = STATE_STOPPING;
+                m_pump->Wake();
+            }
+        }
+
+        if (m_thread.joinable() && !IsServiceThread())
+        {
+            m_thread.join();
+            m_pump = nullptr;
+        }
+    }
+
+    bool IsRunning() const
+    {
+        std::lock_guard<std::mutex> lock(m_stateLock);
+        return m_state == STATE_RUNNING;
+    }
+
+    bool IsServiceThread() const { return std::this_thread::get_id() == m_threadId.load(std::memory_order_acquire); }
+
+    // Queue a command without waiting for it. Returns false, and drops the
+    // command, once the thread is stopping or stopped. A command queued before
+    // that is always run.
+    bool Post(CommandQueue::Command command)
+    {
+        std::lock_guard<std::mutex> lock(m_stateLock);
+        if (m_state != STATE_RUNNING)
+            return false;
+
+        m_commands.Push(std::move(command));
+        m_pump->Wake();
+        return true;
+    }
+
+    // Run a command on the service thread and wait for it to finish. Calls
+    // made on the service thread itself run inline. Returns false without
+    // running the command once the thread is stopping or stopped.
+    bool Invoke(const CommandQueue::Command& command)
+    {
+        if (IsServiceThread())
+        {
+            command();
+            return true;
+        }
+
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+
+        bool posted = Post([&]()
+        {
+            command();
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            done.notify_one();
+        });
+        if (!posted)
+            return false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return finished; });
+        return true;
+    }
+
+private:
+    enum State
+    {
+        STATE_STOPPED,
+        STATE_STARTING,
+        STATE_RUNNING,
+        STATE_STOPPING
+    };
+
+    void Run(std::promise<bool>* started)
+    {
+        m_threadId.store(std::this_thread::get_id(), std::memory_order_release);
+
+        if (!m_pump->Start())
+        {
+            m_pump->Stop();
+            SetState(STATE_STOPPED);
+            m_threadId.store(std::thread::id(), std::memory_order_release);
+            started->set_value(false);
+            return;
+        }
+
+        SetState(STATE_RUNNING);
+        started->set_value(true);
+
+        for (;;)
+        {
+            DrainCommands();
+
+            if (GetState() == STATE_STOPPING)
+                break;
+
+            if (!m_pump->RunOnce())
+                break;
+        }
+
+        // Nothing is queued once stopped is published, so this drain is the last
+        SetState(STATE_STOPPED);
+        DrainCommands();
+        m_pump->Stop();
+        m_threadId.store(std::thread::id(), std::memory_order_release);
+    }
+
+    State GetState() const
+    {
+        std::lock_guard<std::mutex> lock(m_stateLock);
+        return m_state;
+    }
+
+    void SetState(State state)
+    {
+        std::lock_guard<std::mutex> lock(m_stateLock);
+        m_state = state;
+    }
+
+    void DrainCommands()
+    {
+        CommandQueue::Command command;
+        while (m_commands.Pop(command))
+        {
+            command();
+        }
+    }
+
+    CommandQueue m_commands;
+    Pump* m_pump;
+    std::thread m_thread;
+    std::atomic<std::thread::id> m_threadId;
+
+    // Post only queues while running, so Stop can tell when the queue is final
+    mutable std::mutex m_stateLock;
+    State m_state;
+};
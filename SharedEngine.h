@@ -0,0 +1,146 @@
+#pragma once
+
+#include "WindowRegistry.h"
+#include "WindowSystem.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// The engine shared by all manager instances of a process.
+//
+// The first instance creates it with its flags, the last one to release it
+// destroys it. Instances asking for other flags while it runs are refused,
+// since the engine cannot run with two sets of them. An instance that goes
+// away takes its windows and callback with it before its reference is
+// dropped, so the other instances never see them again.
+//
+// Engine needs RemoveOwner(const void* owner).
+template <typename Engine>
+class SharedEngine
+{
+public:
+    SharedEngine() :
+        m_engine(nullptr),
+        m_flags(0),
+        m_references(0)
+    {
+    }
+
+    // Returns the engine for an instance asking for flags. create() is only
+    // called for the first instance and returns a std::unique_ptr<Engine>,
+    // null if the engine could not start. Returns null if it could not, or if
+    // the engine already runs with other flags.
+    template <typename Create>
+    Engine* Acquire(uint32_t flags, Create create)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_engine)
+        {
+            std::unique_ptr<Engine> engine = create();
+            if (!engine)
+                return nullptr;
+
+            m_engine = engine.release();
+            m_flags = flags;
+        }
+        else if (m_flags != flags)
+        {
+            return nullptr;
+        }
+
+        ++m_references;
+        return m_engine;
+    }
+
+    // Removes what owner registered and drops its reference. Returns true if
+    // that was the last one and the engine was destroyed.
+    bool Release(Engine* engine, const void* owner)
+    {
+        if (!engine)
+            return false;
+
+        // Callbacks in progress are waited for, so this runs without the lock
+        engine->RemoveOwner(owner);
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (engine != m_engine || --m_references > 0)
+            return false;
+
+        delete m_engine;
+        m_engine = nullptr;
+        return true;
+    }
+
+    int GetReferenceCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_references;
+    }
+
+private:
+    mutable std::mutex m_lock;
+    Engine* m_engine;
+    uint32_t m_flags;
+    int m_references;
+};
+
+// Which manager instance manages each registered window. A window is managed
+// by one instance at a time; the others can neither take it over, move it to
+// another layer nor unregister it. A handle that moved to another process
+// belongs to a new window whose destruction was missed, and is up for grabs.
+class WindowOwnership
+{
+public:
+    // Inserts hwnd for owner and returns its entry. Null if the window does not
+    // exist or another instance manages it.
+    static const WindowInfo* Insert(IWindowSystem& windowSystem, WindowRegistry& registry, const void* owner,
+        HWND hwnd, int32_t layer)
+    {
+        if (!windowSystem.IsWindow(hwnd))
+            return nullptr;
+
+        WindowInfo info;
+        info.hwnd = hwnd;
+        info.isVisible = windowSystem.IsWindowVisible(hwnd);
+        info.isMinimized = windowSystem.IsMinimized(hwnd);
+        info.owner = owner;
+        info.layer = layer;
+        info.processId = windowSystem.GetWindowProcessId(hwnd);
+        info.generation = 0;
+
+        const WindowInfo* existing = registry.Find(hwnd);
+        if (existing && existing->processId != info.processId)
+        {
+            registry.Erase(hwnd);
+        }
+        else if (existing && existing->owner != owner)
+        {
+            return nullptr;
+        }
+
+        registry.Insert(info);
+        return registry.Find(hwnd);
+    }
+
+    // The entry of hwnd if owner manages it, null otherwise
+    static const WindowInfo* Find(const WindowRegistry& registry, const void* owner, HWND hwnd)
+    {
+        const WindowInfo* info = registry.Find(hwnd);
+        return info && info->owner == owner ? info : nullptr;
+    }
+
+    // All windows owner manages
+    static std::vector<HWND> FindAll(const WindowRegistry& registry, const void* owner)
+    {
+        std::vector<HWND> hwnds;
+        for (const WindowInfo& info : registry)
+        {
+            if (info.owner == owner)
+            {
+                hwnds.push_back(info.hwnd);
+            }
+        }
+        return hwnds;
+    }
+};
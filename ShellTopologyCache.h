@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+
+// Same declaration as <windows.h>, so this header stays usable without it
+struct HWND__;
+typedef HWND__* HWND;
+
+// The shell windows that make up the desktop
+struct ShellTopology
+{
+    HWND shellWindow;           // Progman
+    HWND defView;               // SHELLDLL_DefView
+    HWND host;                  // Window hosting the desktop icons, null if none
+    uint32_t shellProcessId;
+};
+
+// Remembers the shell topology until something actually changes it.
+//
+// Looking the topology up from scratch means walking WorkerW windows and
+// querying class names and owning processes. Instead it is resolved once and
+// kept until the shell window changes, one of the cached windows is destroyed
+// or reparented, or the shell announces a restart. A lookup on a valid cache is
+// a single comparison.
+class ShellTopologyCache
+{
+public:
+    ShellTopologyCache() :
+        m_valid(false),
+        m_hits(0),
+        m_misses(0),
+        m_invalidations(0)
+    {
+        Reset();
+    }
+
+    // Returns the cached topology if it is still valid for the current shell window
+    const ShellTopology* Lookup(HWND currentShellWindow)
+    {
+        if (m_valid && currentShellWindow == m_topology.shellWindow)
+        {
+            ++m_hits;
+            return &m_topology;
+        }
+
+        if (m_valid)
+        {
+            Invalidate();
+        }
+
+        ++m_misses;
+        return nullptr;
+    }
+
+    void Store(const ShellTopology& topology)
+    {
+        m_topology = topology;
+        m_valid = true;
+    }
+
+    void Invalidate()
+    {
+        if (m_valid)
+        {
+            ++m_invalidations;
+        }
+        Reset();
+    }
+
+    void OnWindowDestroyed(HWND hwnd)
+    {
+        if (m_valid && IsCached(hwnd))
+        {
+            Invalidate();
+        }
+    }
+
+    // Moving DefView between Progman and a WorkerW changes the host
+    void OnWindowReparented(HWND hwnd)
+    {
+        if (m_valid && hwnd == m_topology.defView)
+        {
+            Invalidate();
+        }
+    }
+
+    bool IsValid() const { return m_valid; }
+    const ShellTopology& GetTopology() const { return m_topology; }
+
+    uint64_t GetHitCount() const { return m_hits; }
+    uint64_t GetMissCount() const { return m_misses; }
+    uint64_t GetInvalidationCount() const { return m_invalidations; }
+
+private:
+    bool IsCached(HWND hwnd) const
+    {
+        return hwnd && (hwnd == m_topology.shellWindow ||
+            hwnd == m_topology.defView ||
+            hwnd == m_topology.host);
+    }
+
+    void Reset()
+    {
+        m_valid = false;
+        m_topology.shellWindow = nullptr;
+        m_topology.defView = nullptr;
+        m_topology.host = nullptr;
+        m_topology.shellProcessId = 0;
+    }
+
+    ShellTopology m_topology;
+    bool m_valid;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_invalidations;
+};
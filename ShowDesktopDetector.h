@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Platform-neutral decision engine for Show Desktop detection.
+//
+// The host feeds it window-system events and the outcome of every desktop
+// probe; the detector owns the desktop state and decides when the next probe
+// has to run. While events keep arriving the only periodic work is a slow
+// safety poll, which backs off exponentially while nothing happens and starts
+// over at the base interval after every event. The backoff is capped low, so a
+// transition whose events were lost is still seen within about two seconds. If
+// a transition is caught by that poll instead of an event burst, events are
+// considered unreliable and the detector falls back to the classic
+// fixed-interval polling until events prove themselves again.
+//
+// Nothing is probed periodically while the host is suspended (session locked,
+// display off), and only event bursts run while it is idle (nothing to keep
+// visible), so neither state costs any timer wakeups.
+//
+// A trigger is an input that usually makes the shell show the desktop, seen
+// before the shell acts on it. It starts a short run of fast probes so the
+// transition is caught within a frame. A trigger whose run ends without a
+// transition is a miss, and the probes it ran are counted as its cost.
+class ShowDesktopDetector
+{
+public:
+    enum class Event
+    {
+        Foreground,     // The foreground window changed
+        HostReorder,    // Z-order changed around the desktop icons host
+        HostShow,       // A shell window was shown
+        HostHide        // A shell window was hidden
+    };
+
+    enum class Mode
+    {
+        EventDriven,
+        Polling
+    };
+
+    struct Config
+    {
+        uint32_t burstIntervalMs;           // Spacing of the follow-up probes after an event
+        uint32_t burstProbes;               // Follow-up probes per event
+        uint32_t fallbackIntervalMs;        // Safety poll while events are reliable
+        uint32_t maxFallbackIntervalMs;     // Limit of the safety poll backoff
+        uint32_t pollIntervalMs;            // Polling interval while showing windows
+        uint32_t restorePollIntervalMs;     // Polling interval while showing the desktop
+        uint32_t missedTransitionLimit;     // Transitions caught by polling before falling back
+        uint32_t triggerIntervalMs;         // Spacing of the probes after a trigger
+        uint32_t triggerProbes;             // Probes per trigger
+    };
+
+    static Config DefaultConfig()
+    {
+        Config config;
+        config.burstIntervalMs = 16;
+        config.burstProbes = 4;
+        config.fallbackIntervalMs = 1000;
+        config.maxFallbackIntervalMs = 2000;
+        config.pollIntervalMs = 250;
+        config.restorePollIntervalMs = 100;
+        config.missedTransitionLimit = 1;
+        config.triggerIntervalMs = 10;
+        config.triggerProbes = 30;
+        return config;
+    }
+
+    ShowDesktopDetector() :
+        ShowDesktopDetector(DefaultConfig())
+    {
+    }
+
+    explicit ShowDesktopDetector(const Config& config) :
+        m_config(config),
+        m_mode(Mode::EventDriven),
+        m_showDesktop(false),
+        m_burstRemaining(0),
+        m_burstStartMs(0),
+        m_triggerRemaining(0),
+        m_triggerRunProbes(0),
+        m_fallbackIntervalMs(config.fallbackIntervalMs),
+        m_idle(false),
+        m_suspended(false),
+        m_missedTransitions(0),
+        m_lastLatencyMs(0),
+        m_transitions(0),
+        m_events(0),
+        m_probes(0),
+        m_triggers(0),
+        m_triggerHits(0),
+        m_triggerMisses(0),
+        m_triggerMissProbes(0)
+    {
+    }
+
+    // Reset to the initial state, keeping the configuration
+    void Reset()
+    {
+        *this = ShowDesktopDetector(m_config);
+    }
+
+    // Record an event. Returns true if the host should probe immediately.
+    bool OnEvent(Event event, uint64_t nowMs)
+    {
+        (void)event;
+        ++m_events;
+
+        if (m_burstRemaining == 0 && m_triggerRemaining == 0)
+        {
+            m_burstStartMs = nowMs;
+        }
+        m_burstRemaining = m_config.burstProbes;
+        m_fallbackIntervalMs = m_config.fallbackIntervalMs;
+        return true;
+    }
+
+    // Record a trigger. Returns false if it is ignored because the host is
+    // suspended or idle; otherwise the host schedules the next probe.
+    bool OnTrigger(uint64_t nowMs)
+    {
+        if (m_suspended || m_idle)
+            return false;
+
+        ++m_triggers;
+        if (m_triggerRemaining == 0)
+        {
+            m_triggerRunProbes = 0;
+            if (m_burstRemaining == 0)
+            {
+                m_burstStartMs = nowMs;
+            }
+        }
+
+        // A trigger during a run extends it
+        m_triggerRemaining = m_config.triggerProbes;
+        return true;
+    }
+
+    // Record the outcome of a probe. Returns true if the desktop state changed.
+    bool OnProbe(bool showDesktop, uint64_t nowMs)
+    {
+        ++m_probes;
+
+        const bool inBurst = m_burstRemaining > 0 || m_triggerRemaining > 0;
+        if (m_burstRemaining > 0)
+        {
+            --m_burstRemaining;
+        }
+
+        if (m_triggerRemaining > 0)
+        {
+            ++m_triggerRunProbes;
+            if (showDesktop != m_showDesktop)
+            {
+                ++m_triggerHits;
+                m_triggerRemaining = 0;
+            }
+            else if (--m_triggerRemaining == 0)
+            {
+                ++m_triggerMisses;
+                m_triggerMissProbes += m_triggerRunProbes;
+            }
+        }
+
+        if (showDesktop == m_showDesktop)
+        {
+            // A safety poll that found nothing lets the next one wait longer
+            if (!inBurst && m_mode == Mode::EventDriven)
+            {
+                m_fallbackIntervalMs = std::min(m_fallbackIntervalMs * 2, m_config.maxFallbackIntervalMs);
+            }
+            return false;
+        }
+
+        m_showDesktop = showDesktop;
+        ++m_transitions;
+
+        if (inBurst)
+        {
+            // An event led us here, so the hooks are doing their job
+            m_lastLatencyMs = nowMs - m_burstStartMs;
+            m_missedTransitions = 0;
+            m_mode = Mode::EventDriven;
+        }
+        else
+        {
+            // Only the poll noticed this transition
+            m_lastLatencyMs = 0;
+            if (++m_missedTransitions >= m_config.missedTransitionLimit)
+            {
+                m_mode = Mode::Polling;
+            }
+        }
+
+        // Keep probing briefly, the shell often settles in more than one step
+        m_burstRemaining = m_config.burstProbes;
+        m_burstStartMs = nowMs;
+        m_fallbackIntervalMs = m_config.fallbackIntervalMs;
+        return true;
+    }
+
+    // Nothing needs to be kept visible: event bursts still run, periodic probes do not
+    void SetIdle(bool idle)
+    {
+        m_idle = idle;
+    }
+
+    // The session is locked or the display is off: no probes are scheduled at all.
+    // Resuming counts as an event; returns true then, and the host should probe at once.
+    bool SetSuspended(bool suspended, uint64_t nowMs)
+    {
+        if (suspended == m_suspended)
+            return false;
+
+        m_suspended = suspended;
+        m_burstRemaining = suspended ? 0 : m_config.burstProbes;
+        m_triggerRemaining = 0;
+        m_burstStartMs = nowMs;
+        m_fallbackIntervalMs = m_config.fallbackIntervalMs;
+        return !suspended;
+    }
+
+    // Longest a transition whose events were all lost can go unnoticed while
+    // events are trusted: the longest safety poll, run as late as allowed
+    uint32_t GetMaxMissLatencyMs() const
+    {
+        return m_config.maxFallbackIntervalMs + m_config.maxFallbackIntervalMs / 4;
+    }
+
+    // Delay until the next probe is due, NO_PROBE if none has to be scheduled
+    uint32_t NextProbeDelayMs() const
+    {
+        if (m_suspended)
+            return NO_PROBE;
+
+        if (m_triggerRemaining > 0 && m_burstRemaining > 0)
+            return std::min(m_config.triggerIntervalMs, m_config.burstIntervalMs);
+
+        if (m_triggerRemaining > 0)
+            return m_config.triggerIntervalMs;
+
+        if (m_burstRemaining > 0)
+            return m_config.burstIntervalMs;
+
+        if (m_idle)
+            return NO_PROBE;
+
+        if (m_mode == Mode::Polling)
+            return m_showDesktop ? m_config.restorePollIntervalMs : m_config.pollIntervalMs;
+
+        return m_fallbackIntervalMs;
+    }
+
+    // How late the next probe may run so that the system can coalesce its timer
+    // with others. Only the safety poll is relaxed, a quarter of its interval;
+    // 0 means the probe has to run on time.
+    uint32_t NextProbeToleranceMs() const
+    {
+        bool safetyPoll = !m_suspended && !m_idle && m_burstRemaining == 0 && m_triggerRemaining == 0 &&
+            m_mode == Mode::EventDriven;
+        return safetyPoll ? m_fallbackIntervalMs / 4 : 0;
+    }
+
+    static const uint32_t NO_PROBE = 0;
+
+    bool IsShowingDesktop() const { return m_showDesktop; }
+    Mode GetMode() const { return m_mode; }
+    bool IsIdle() const { return m_idle; }
+    bool IsSuspended() const { return m_suspended; }
+    const Config& GetConfig() const { return m_config; }
+
+    // Time from the first event of a burst to the probe that saw the transition
+    uint64_t GetLastDetectionLatencyMs() const { return m_lastLatencyMs; }
+    uint64_t GetTransitionCount() const { return m_transitions; }
+    uint64_t GetEventCount() const { return m_events; }
+    uint64_t GetProbeCount() const { return m_probes; }
+
+    bool IsTriggered() const { return m_triggerRemaining > 0; }
+    // Whether the next probe belongs to an event burst or a trigger run
+    bool IsInBurst() const { return m_burstRemaining > 0 || m_triggerRemaining > 0; }
+    uint64_t GetTriggerCount() const { return m_triggers; }
+    uint64_t GetTriggerHitCount() const { return m_triggerHits; }
+    uint64_t GetTriggerMissCount() const { return m_triggerMisses; }
+    // Probes run for triggers that turned out to be misses
+    uint64_t GetTriggerMissProbeCount() const { return m_triggerMissProbes; }
+
+private:
+    Config m_config;
+    Mode m_mode;
+    bool m_showDesktop;
+    uint32_t m_burstRemaining;
+    uint64_t m_burstStartMs;
+    uint32_t m_triggerRemaining;
+    uint32_t m_triggerRunProbes;
+    uint32_t m_fallbackIntervalMs;
+    bool m_idle;
+    bool m_suspended;
+    uint32_t m_missedTransitions;
+    uint64_t m_lastLatencyMs;
+    uint64_t m_transitions;
+    uint64_t m_events;
+    uint64_t m_probes;
+    uint64_t m_triggers;
+    uint64_t m_triggerHits;
+    uint64_t m_triggerMisses;
+    uint64_t m_triggerMissProbes;
+};
@@ -0,0 +1,659 @@
+#pragma once
+
+#include "WindowSystem.h"
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// In-memory IWindowSystem for running the desktop logic without a desktop.
+//
+// Models a stack of top-level windows (top first) with a topmost band, child
+// windows, the shell windows that host the desktop icons and the way Show
+// Desktop raises them. Time is virtual: it only moves on Advance, which fires
+// the timers that became due in order, so every run is deterministic.
+// Events are delivered synchronously and only for the scripted operations;
+// z-order changes made through the backend do not raise events.
+class SimulatedWindowSystem : public IWindowSystem
+{
+public:
+    explicit SimulatedWindowSystem(uint32_t ownProcessId = 1) :
+        m_sink(nullptr),
+        m_ownProcessId(ownProcessId),
+        m_nextHandle(1),
+        m_nextHook(1),
+        m_now(0),
+        m_shellWindow(nullptr),
+        m_host(nullptr),
+        m_shellWindowHost(false),
+        m_rejectBatches(false),
+        m_reuseHandles(false),
+        m_dropEvents(false),
+        m_framePeriodUs(16667),
+        m_moves(0),
+        m_commits(0),
+        m_enumerations(0),
+        m_enumeratedWindows(0),
+        m_neighbourQueries(0),
+        m_windowQueries(0)
+    {
+    }
+
+    // Builds the shell windows. With shellWindowHost, Progman hosts DefView
+    // itself (Windows 11 24H2+); otherwise DefView lives in a WorkerW.
+    void CreateShell(uint32_t processId, bool shellWindowHost)
+    {
+        m_shellWindowHost = shellWindowHost;
+        m_shellWindow = CreateWindow(L"Progman", L"Program Manager", processId);
+        Find(m_shellWindow)->shellBottom = true;
+        MoveToBottom(m_shellWindow);
+
+        if (shellWindowHost)
+        {
+            m_host = m_shellWindow;
+        }
+        else
+        {
+            m_host = CreateWindow(L"WorkerW", L"", processId);
+            Find(m_host)->shellBottom = true;
+            MoveToBottom(m_host);
+            Raise(m_host, m_shellWindow, false);
+        }
+
+        CreateWindow(L"SHELLDLL_DefView", L"", processId, m_host);
+    }
+
+    // Creates a visible window at the top of the non-topmost band, or as the last child of parent
+    HWND CreateWindow(const wchar_t* className, const wchar_t* title, uint32_t processId, HWND parent = nullptr)
+    {
+        Window window;
+        if (m_reuseHandles && !m_freeHandles.empty())
+        {
+            window.hwnd = m_freeHandles.front();
+            m_freeHandles.pop_front();
+        }
+        else
+        {
+            window.hwnd = reinterpret_cast<HWND>(static_cast<uintptr_t>(m_nextHandle++ * 4));
+        }
+        window.parent = parent;
+        window.className = className;
+        window.title = title;
+        window.processId = processId;
+        window.visible = true;
+        window.minimized = false;
+        window.topmost = false;
+        window.shellBottom = false;
+        m_windows.push_back(window);
+
+        if (parent)
+        {
+            m_children[parent].push_back(window.hwnd);
+        }
+        else
+        {
+            m_stack.insert(m_stack.begin() + TopmostCount(), window.hwnd);
+        }
+        return window.hwnd;
+    }
+
+    void DestroyWindow(HWND hwnd)
+    {
+        Window* window = Find(hwnd);
+        if (!window)
+            return;
+
+        Window copy = *window;
+        std::vector<HWND> children = m_children[hwnd];
+        for (HWND child : children)
+        {
+            DestroyWindow(child);
+        }
+        m_children.erase(hwnd);
+
+        // Destroying the children moved the window in m_windows
+        Detach(copy);
+        m_windows.erase(m_windows.begin() + (Find(hwnd) - &m_windows[0]));
+        if (hwnd == m_host)
+        {
+            m_host = nullptr;
+        }
+        if (hwnd == m_shellWindow)
+        {
+            m_shellWindow = nullptr;
+        }
+        if (m_reuseHandles)
+        {
+            m_freeHandles.push_back(hwnd);
+        }
+        Fire(WINDOW_EVENT_DESTROY, copy.hwnd, copy.processId);
+    }
+
+    // Moves a child window to another parent, as the shell does with DefView
+    void SetParent(HWND hwnd, HWND parent)
+    {
+        Window* window = Find(hwnd);
+        if (!window || !window->parent || !parent)
+            return;
+
+        Detach(*window);
+        window->parent = parent;
+        m_children[parent].push_back(hwnd);
+        if (window->className == L"SHELLDLL_DefView")
+        {
+            m_host = parent;
+        }
+        Fire(WINDOW_EVENT_PARENTCHANGE, hwnd, window->processId);
+    }
+
+    void SetVisible(HWND hwnd, bool visible)
+    {
+        Window* window = Find(hwnd);
+        if (!window || window->visible == visible)
+            return;
+
+        window->visible = visible;
+        Fire(visible ? WINDOW_EVENT_SHOW : WINDOW_EVENT_HIDE, hwnd, window->processId);
+    }
+
+    void SetMinimized(HWND hwnd, bool minimized)
+    {
+        Window* window = Find(hwnd);
+        if (!window || window->parent || window->minimized == minimized)
+            return;
+
+        window->minimized = minimized;
+        Fire(minimized ? WINDOW_EVENT_MINIMIZESTART : WINDOW_EVENT_MINIMIZEEND, hwnd, window->processId);
+    }
+
+    // Puts a window in the topmost band, or back below it
+    void SetTopmost(HWND hwnd, bool topmost)
+    {
+        Window* window = Find(hwnd);
+        if (!window || window->parent)
+            return;
+
+        RemoveFromStack(hwnd);
+        window->topmost = topmost;
+        m_stack.insert(m_stack.begin() + (topmost ? 0 : TopmostCount()), hwnd);
+    }
+
+    // Show Desktop: the icons host is raised above all normal windows
+    void ShowDesktop()
+    {
+        if (!m_host)
+            return;
+
+        RemoveFromStack(m_host);
+        m_stack.insert(m_stack.begin() + TopmostCount(), m_host);
+        const uint32_t processId = Find(m_host)->processId;
+        Fire(WINDOW_EVENT_FOREGROUND, m_host, processId);
+        Fire(WINDOW_EVENT_REORDER, m_host, processId);
+    }
+
+    // Leaving Show Desktop: the host drops back to the bottom and foreground goes to window
+    void RestoreWindows(HWND foreground)
+    {
+        if (!m_host)
+            return;
+
+        MoveToBottom(m_host);
+        if (m_host != m_shellWindow && m_shellWindow)
+        {
+            Raise(m_host, m_shellWindow, false);
+        }
+        Fire(WINDOW_EVENT_REORDER, m_host, Find(m_host)->processId);
+
+        if (const Window* window = Find(foreground))
+        {
+            Fire(WINDOW_EVENT_FOREGROUND, foreground, window->processId);
+        }
+    }
+
+    // Advance the clock, firing the timers that become due on the way
+    void Advance(uint64_t ms)
+    {
+        const uint64_t end = m_now + ms;
+        for (;;)
+        {
+            std::map<std::pair<HWND, uintptr_t>, Timer>::iterator next = m_timers.end();
+            for (std::map<std::pair<HWND, uintptr_t>, Timer>::iterator it = m_timers.begin(); it != m_timers.end(); ++it)
+            {
+                if (it->second.due <= end && (next == m_timers.end() || it->second.due < next->second.due))
+                {
+                    next = it;
+                }
+            }
+
+            if (next == m_timers.end())
+                break;
+
+            m_now = std::max(m_now, next->second.due);
+            next->second.due = m_now + next->second.intervalMs;
+            if (m_sink)
+            {
+                m_sink->OnTimer(next->first.second);
+            }
+        }
+        m_now = end;
+    }
+
+    // The current stack of top-level windows, top first
+    const std::vector<HWND>& GetStack() const { return m_stack; }
+
+    size_t GetStackIndex(HWND hwnd) const
+    {
+        return static_cast<size_t>(std::find(m_stack.begin(), m_stack.end(), hwnd) - m_stack.begin());
+    }
+
+    HWND GetDesktopIconsHost() const { return m_host; }
+
+    // Makes CommitZOrder fail, to exercise the per-window fallback
+    void SetRejectBatches(bool reject) { m_rejectBatches = reject; }
+
+    // Hand out the handles of destroyed windows again, oldest first, as the
+    // real window manager eventually does
+    void SetReuseHandles(bool reuse) { m_reuseHandles = reuse; }
+
+    // Loses every window event, as when hooks miss them, leaving detection
+    // to the safety poll
+    void SetDropEvents(bool drop) { m_dropEvents = drop; }
+
+    // Called before a window of this process is moved, where the real window
+    // manager would run its window procedure
+    void SetMoveHandler(std::function<void(HWND)> handler) { m_onMove = std::move(handler); }
+
+    // Length of a composition frame, 60 Hz unless set
+    void SetFramePeriodUs(uint32_t periodUs) { m_framePeriodUs = periodUs; }
+
+    uint64_t GetMoveCount() const { return m_moves; }
+    uint64_t GetCommitCount() const { return m_commits; }
+    uint64_t GetEnumerationCount() const { return m_enumerations; }
+    uint64_t GetEnumeratedWindowCount() const { return m_enumeratedWindows; }
+    uint64_t GetNeighbourQueryCount() const { return m_neighbourQueries; }
+    // Class, process and state queries, the ones WindowMetadataCache answers
+    uint64_t GetWindowQueryCount() const { return m_windowQueries; }
+
+    void SetEventSink(EventSink* sink) override
+    {
+        m_sink = sink;
+    }
+
+    void EnumTopLevelWindows(EnumWindowsCallback callback, void* context) override
+    {
+        ++m_enumerations;
+        const std::vector<HWND> stack = m_stack;
+        for (HWND hwnd : stack)
+        {
+            ++m_enumeratedWindows;
+            if (!callback(hwnd, context))
+                break;
+        }
+    }
+
+    bool MoveWindow(const ZOrderMove& move) override
+    {
+        ++m_moves;
+        Window* window = Find(move.hwnd);
+        if (!window || window->parent)
+            return false;
+
+        if (m_onMove && window->processId == m_ownProcessId)
+        {
+            m_onMove(move.hwnd);
+            if (!(window = Find(move.hwnd)))
+                return false;
+        }
+
+        switch (move.placement)
+        {
+        case ZOrderMove::Bottom:
+            // Like HWND_BOTTOM, this drops the topmost style
+            window->topmost = false;
+            MoveToBottom(move.hwnd);
+            return true;
+
+        case ZOrderMove::Topmost:
+            window->topmost = true;
+            RemoveFromStack(move.hwnd);
+            m_stack.insert(m_stack.begin(), move.hwnd);
+            return true;
+
+        default:
+            {
+                const Window* after = Find(move.insertAfter);
+                if (!after || after->parent || move.insertAfter == move.hwnd)
+                    return false;
+
+                // The window joins the band of the window it is placed after
+                window->topmost = after->topmost;
+                Raise(move.hwnd, move.insertAfter, true);
+                return true;
+            }
+        }
+    }
+
+    bool CommitZOrder(const ZOrderMove* moves, size_t count) override
+    {
+        ++m_commits;
+        if (m_rejectBatches)
+            return false;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            MoveWindow(moves[i]);
+        }
+        return true;
+    }
+
+    HWND GetWindowAbove(HWND hwnd) override
+    {
+        ++m_neighbourQueries;
+        size_t index = GetStackIndex(hwnd);
+        return index > 0 && index < m_stack.size() ? m_stack[index - 1] : nullptr;
+    }
+
+    HWND GetWindowBelow(HWND hwnd) override
+    {
+        ++m_neighbourQueries;
+        size_t index = GetStackIndex(hwnd);
+        return index + 1 < m_stack.size() ? m_stack[index + 1] : nullptr;
+    }
+
+    HWND GetShellWindow() override
+    {
+        return m_shellWindow;
+    }
+
+    HWND FindWindowAfter(HWND parent, HWND childAfter, const wchar_t* className, const wchar_t* title) override
+    {
+        const std::vector<HWND>& siblings = parent ? m_children[parent] : m_stack;
+        std::vector<HWND>::const_iterator it = siblings.begin();
+        if (childAfter)
+        {
+            it = std::find(siblings.begin(), siblings.end(), childAfter);
+            if (it == siblings.end())
+                return nullptr;
+            ++it;
+        }
+
+        for (; it != siblings.end(); ++it)
+        {
+            const Window* window = Find(*it);
+            if ((!className || window->className == className) &&
+                (!title || window->title == title))
+            {
+                return *it;
+            }
+        }
+        return nullptr;
+    }
+
+    int GetWindowClass(HWND hwnd, wchar_t* className, int count) override
+    {
+        ++m_windowQueries;
+        const Window* window = Find(hwnd);
+        if (!window || count <= 0)
+            return 0;
+
+        // Truncated like GetClassName
+        size_t length = std::min(window->className.size(), static_cast<size_t>(count - 1));
+        std::memcpy(className, window->className.c_str(), length * sizeof(wchar_t));
+        className[length] = L'\0';
+        return static_cast<int>(length);
+    }
+
+    bool IsWindow(HWND hwnd) override
+    {
+        return Find(hwnd) != nullptr;
+    }
+
+    bool IsWindowVisible(HWND hwnd) override
+    {
+        ++m_windowQueries;
+        const Window* window = Find(hwnd);
+        return window && window->visible;
+    }
+
+    bool IsMinimized(HWND hwnd) override
+    {
+        ++m_windowQueries;
+        const Window* window = Find(hwnd);
+        return window && window->minimized;
+    }
+
+    bool IsTopmost(HWND hwnd) override
+    {
+        ++m_windowQueries;
+        const Window* window = Find(hwnd);
+        return window && window->topmost;
+    }
+
+    uint32_t GetWindowProcessId(HWND hwnd) override
+    {
+        ++m_windowQueries;
+        const Window* window = Find(hwnd);
+        return window ? window->processId : 0;
+    }
+
+    bool UsesShellWindowAsDesktopIconsHost() override
+    {
+        return m_shellWindowHost;
+    }
+
+    uint64_t GetTickCount() override
+    {
+        return m_now;
+    }
+
+    // Timers fire on time, the tolerance only allows the real system to delay them
+    bool SetTimer(HWND owner, uintptr_t id, uint32_t ms, uint32_t toleranceMs) override
+    {
+        // Like USER_TIMER_MINIMUM
+        ms = std::max<uint32_t>(ms, 10);
+        Timer timer = { ms, m_now + ms, toleranceMs };
+        m_timers[std::make_pair(owner, id)] = timer;
+        return true;
+    }
+
+    void KillTimer(HWND owner, uintptr_t id) override
+    {
+        m_timers.erase(std::make_pair(owner, id));
+    }
+
+    // Interval and tolerance a timer was set with, false if it is not running
+    bool GetTimer(HWND owner, uintptr_t id, uint32_t& intervalMs, uint32_t& toleranceMs) const
+    {
+        std::map<std::pair<HWND, uintptr_t>, Timer>::const_iterator it = m_timers.find(std::make_pair(owner, id));
+        if (it == m_timers.end())
+            return false;
+
+        intervalMs = it->second.intervalMs;
+        toleranceMs = it->second.toleranceMs;
+        return true;
+    }
+
+    // Frames start at time 0 and every period after it
+    FrameTime GetFrameTime() override
+    {
+        const uint64_t nowUs = m_now * 1000;
+        FrameTime time;
+        time.frame = nowUs / m_framePeriodUs;
+        time.nextFrameUs = static_cast<uint32_t>(m_framePeriodUs - nowUs % m_framePeriodUs);
+        return time;
+    }
+
+    EventHook HookEvents(uint32_t eventMin, uint32_t eventMax, uint32_t processId, bool skipOwnProcess) override
+    {
+        Hook hook = { m_nextHook++, eventMin, eventMax, processId, skipOwnProcess };
+        m_hooks.push_back(hook);
+        return reinterpret_cast<EventHook>(hook.id);
+    }
+
+    void UnhookEvents(EventHook hook) override
+    {
+        for (size_t i = 0; i < m_hooks.size(); ++i)
+        {
+            if (reinterpret_cast<EventHook>(m_hooks[i].id) == hook)
+            {
+                m_hooks.erase(m_hooks.begin() + i);
+                return;
+            }
+        }
+    }
+
+private:
+    struct Window
+    {
+        HWND hwnd;
+        HWND parent;
+        std::wstring className;
+        std::wstring title;
+        uint32_t processId;
+        bool visible;
+        bool minimized;
+        bool topmost;
+        bool shellBottom;       // Kept below everything else while at the bottom
+    };
+
+    struct Timer
+    {
+        uint32_t intervalMs;
+        uint64_t due;
+        uint32_t toleranceMs;
+    };
+
+    struct Hook
+    {
+        uintptr_t id;
+        uint32_t eventMin;
+        uint32_t eventMax;
+        uint32_t processId;
+        bool skipOwnProcess;
+    };
+
+    Window* Find(HWND hwnd)
+    {
+        for (Window& window : m_windows)
+        {
+            if (window.hwnd == hwnd)
+                return &window;
+        }
+        return nullptr;
+    }
+
+    const Window* Find(HWND hwnd) const
+    {
+        return const_cast<SimulatedWindowSystem*>(this)->Find(hwnd);
+    }
+
+    size_t TopmostCount() const
+    {
+        size_t count = 0;
+        while (count < m_stack.size() && Find(m_stack[count])->topmost)
+        {
+            ++count;
+        }
+        return count;
+    }
+
+    void RemoveFromStack(HWND hwnd)
+    {
+        std::vector<HWND>::iterator it = std::find(m_stack.begin(), m_stack.end(), hwnd);
+        if (it != m_stack.end())
+        {
+            m_stack.erase(it);
+        }
+    }
+
+    void Detach(const Window& window)
+    {
+        if (window.parent)
+        {
+            std::vector<HWND>& siblings = m_children[window.parent];
+            siblings.erase(std::find(siblings.begin(), siblings.end(), window.hwnd));
+        }
+        else
+        {
+            RemoveFromStack(window.hwnd);
+        }
+    }
+
+    // The bottom of the stack, above the shell windows resting there
+    void MoveToBottom(HWND hwnd)
+    {
+        RemoveFromStack(hwnd);
+        size_t index = m_stack.size();
+        if (!Find(hwnd)->shellBottom)
+        {
+            while (index > 0 && Find(m_stack[index - 1])->shellBottom)
+            {
+                --index;
+            }
+        }
+        m_stack.insert(m_stack.begin() + index, hwnd);
+    }
+
+    // Place hwnd directly below (below = true) or above insertAfter
+    void Raise(HWND hwnd, HWND insertAfter, bool below)
+    {
+        RemoveFromStack(hwnd);
+        std::vector<HWND>::iterator it = std::find(m_stack.begin(), m_stack.end(), insertAfter);
+        m_stack.insert(below ? it + 1 : it, hwnd);
+    }
+
+    void Fire(uint32_t event, HWND hwnd, uint32_t processId)
+    {
+        if (m_dropEvents)
+            return;
+
+        const std::vector<Hook> hooks = m_hooks;
+        for (const Hook& hook : hooks)
+        {
+            if (event < hook.eventMin || event > hook.eventMax)
+                continue;
+            if (hook.processId && hook.processId != processId)
+                continue;
+            if (hook.skipOwnProcess && processId == m_ownProcessId)
+                continue;
+
+            if (m_sink)
+            {
+                m_sink->OnWindowEvent(event, hwnd, WINDOW_OBJECT_SELF, WINDOW_OBJECT_SELF);
+            }
+        }
+    }
+
+    EventSink* m_sink;
+    uint32_t m_ownProcessId;
+    uintptr_t m_nextHandle;
+    uintptr_t m_nextHook;
+    uint64_t m_now;
+    HWND m_shellWindow;
+    HWND m_host;
+    bool m_shellWindowHost;
+    bool m_rejectBatches;
+    bool m_reuseHandles;
+    bool m_dropEvents;
+    uint32_t m_framePeriodUs;
+    std::function<void(HWND)> m_onMove;
+
+    std::vector<Window> m_windows;
+    std::deque<HWND> m_freeHandles;
+    std::vector<HWND> m_stack;
+    std::map<HWND, std::vector<HWND>> m_children;
+    std::map<std::pair<HWND, uintptr_t>, Timer> m_timers;
+    std::vector<Hook> m_hooks;
+
+    uint64_t m_moves;
+    uint64_t m_commits;
+    uint64_t m_enumerations;
+    uint64_t m_enumeratedWindows;
+    uint64_t m_neighbourQueries;
+    uint64_t m_windowQueries;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// Holds an immutable snapshot that readers use without locks while writers
+// replace it copy-on-write.
+//
+// A reader announces itself on one of two counters, picked by the current
+// epoch, then loads the snapshot pointer. A writer publishes the new snapshot
+// first and then flips the epoch twice, each time waiting for the counter that
+// new readers no longer use to drain. After that no reader can still hold the
+// old snapshot, so it is freed. Readers never wait; writers must be serialized
+// by the caller and wait only for readers already inside a read section.
+template <typename T>
+class SnapshotCell
+{
+public:
+    class ReadGuard
+    {
+    public:
+        ReadGuard(ReadGuard&& other) :
+            m_counter(other.m_counter),
+            m_snapshot(other.m_snapshot)
+        {
+            other.m_counter = nullptr;
+        }
+
+        ~ReadGuard()
+        {
+            if (m_counter)
+            {
+                m_counter->fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        const T& operator*() const { return *m_snapshot; }
+        const T* operator->() const { return m_snapshot; }
+        const T* Get() const { return m_snapshot; }
+
+    private:
+        friend class SnapshotCell;
+
+        ReadGuard(std::atomic<long>* counter, const T* snapshot) :
+            m_counter(counter),
+            m_snapshot(snapshot)
+        {
+        }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        std::atomic<long>* m_counter;
+        const T* m_snapshot;
+    };
+
+    SnapshotCell() :
+        m_current(new T()),
+        m_epoch(0)
+    {
+        m_readers[0].count.store(0, std::memory_order_relaxed);
+        m_readers[1].count.store(0, std::memory_order_relaxed);
+    }
+
+    ~SnapshotCell()
+    {
+        delete m_current.load(std::memory_order_relaxed);
+    }
+
+    SnapshotCell(const SnapshotCell&) = delete;
+    SnapshotCell& operator=(const SnapshotCell&) = delete;
+
+    // Pin the current snapshot for the lifetime of the guard. Lock-free.
+    ReadGuard Read() const
+    {
+        std::atomic<long>* counter = &m_readers[m_epoch.load(std::memory_order_seq_cst) & 1].count;
+        counter->fetch_add(1, std::memory_order_seq_cst);
+        return ReadGuard(counter, m_current.load(std::memory_order_seq_cst));
+    }
+
+    // The current snapshot, for the serialized writer to copy from
+    const T& GetForWriter() const
+    {
+        return *m_current.load(std::memory_order_acquire);
+    }
+
+    // Replace the snapshot. Writers must be serialized by the caller.
+    void Publish(std::unique_ptr<T> snapshot)
+    {
+        T* previous = m_current.exchange(snapshot.release(), std::memory_order_seq_cst);
+
+        for (int flip = 0; flip < 2; ++flip)
+        {
+            unsigned epoch = m_epoch.load(std::memory_order_relaxed);
+            m_epoch.store(epoch + 1, std::memory_order_seq_cst);
+
+            const std::atomic<long>& drained = m_readers[epoch & 1].count;
+            while (drained.load(std::memory_order_acquire) != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        delete previous;
+    }
+
+private:
+    // Keep the two counters on separate cache lines. Padding rather than
+    // alignas, so owners can still be allocated with plain new before C++17.
+    struct ReaderCount
+    {
+        std::atomic<long> count;
+        char padding[64 - sizeof(std::atomic<long>)];
+    };
+
+    std::atomic<T*> m_current;
+    std::atomic<unsigned> m_epoch;
+    mutable ReaderCount m_readers[2];
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// The desktop state as one versioned snapshot: the state, the number of
+// transitions published so far and when the latest one happened.
+//
+// There is a single writer. Readers never block it and never take a lock: the
+// sequence word is odd while a write is in progress, and a reader retries until
+// it sees the same even word before and after reading the fields. The sequence
+// word is also what waiters sleep on, with WaitOnAddress on Windows and a futex
+// on Linux, so waiting costs no CPU and a publish only makes a system call when
+// somebody is waiting.
+class StateSnapshotCell
+{
+public:
+    struct Snapshot
+    {
+        bool showDesktop;
+        uint32_t sequence;          // Transitions published, 0 before the first
+        uint64_t transitionMs;      // Time of the latest transition, 0 before the first
+    };
+
+    // Timeout of a wait without one
+    static const uint32_t FOREVER = 0xFFFFFFFF;
+
+    StateSnapshotCell() :
+        m_word(0),
+        m_showDesktop(false),
+        m_transitionMs(0),
+        m_waiters(0)
+    {
+    }
+
+    StateSnapshotCell(const StateSnapshotCell&) = delete;
+    StateSnapshotCell& operator=(const StateSnapshotCell&) = delete;
+
+    // Writer only. Publishing the current state again is not a transition.
+    void Publish(bool showDesktop, uint64_t nowMs)
+    {
+        if (m_showDesktop.load(std::memory_order_relaxed) == showDesktop)
+            return;
+
+        uint32_t word = m_word.load(std::memory_order_relaxed);
+        m_word.store(word + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        m_showDesktop.store(showDesktop, std::memory_order_relaxed);
+        m_transitionMs.store(nowMs, std::memory_order_relaxed);
+
+        // Orders the new word before the check for waiters, which register
+        // before they read the word
+        m_word.store(word + 2, std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) != 0)
+        {
+            WakeAll();
+        }
+    }
+
+    Snapshot Read() const
+    {
+        Snapshot snapshot;
+        for (;;)
+        {
+            uint32_t before = m_word.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            snapshot.showDesktop = m_showDesktop.load(std::memory_order_relaxed);
+            snapshot.transitionMs = m_transitionMs.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_word.load(std::memory_order_relaxed) == before)
+            {
+                snapshot.sequence = before / 2;
+                return snapshot;
+            }
+        }
+    }
+
+    // Block until the sequence differs from lastSequence or timeoutMs passed
+    // (FOREVER never passes). Returns true and the new snapshot if it changed;
+    // on timeout, false and the unchanged one.
+    bool WaitForChange(uint32_t lastSequence, uint32_t timeoutMs, Snapshot& snapshot) const
+    {
+        const std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        for (;;)
+        {
+            uint32_t word = m_word.load(std::memory_order_seq_cst);
+            if (word / 2 != lastSequence)
+                break;
+
+            if (timeoutMs == FOREVER)
+            {
+                Wait(word, FOREVER);
+                continue;
+            }
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+                break;
+
+            // Rounded up, so the wait does not end just short of the deadline
+            std::chrono::steady_clock::duration remaining = deadline - now + std::chrono::milliseconds(1);
+            Wait(word, static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()));
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+        snapshot = Read();
+        return snapshot.sequence != lastSequence;
+    }
+
+    // Number of threads in WaitForChange
+    uint32_t GetWaiterCount() const { return m_waiters.load(std::memory_order_relaxed); }
+
+private:
+    // Sleep while the word still holds expected, for at most timeoutMs.
+    // May return early; callers check the word again.
+    void Wait(uint32_t expected, uint32_t timeoutMs) const
+    {
+#if defined(_WIN32)
+        // FOREVER is INFINITE
+        WaitOnAddress(const_cast<std::atomic<uint32_t>*>(&m_word), &expected, sizeof(expected), timeoutMs);
+#elif defined(__linux__)
+        struct timespec timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = static_cast<long>(timeoutMs % 1000) * 1000000;
+        syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&m_word), FUTEX_WAIT_PRIVATE, expected,
+            timeoutMs == FOREVER ? nullptr : &timeout, nullptr, 0);
+#else
+        (void)expected;
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs < 10 ? timeoutMs : 10u));
+#endif
+    }
+
+    void WakeAll()
+    {
+#if defined(_WIN32)
+        WakeByAddressAll(&m_word);
+#elif defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+    }
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "The sequence word is waited on directly");
+
+    std::atomic<uint32_t> m_word;           // Sequence * 2, odd while a write is in progress
+    std::atomic<bool> m_showDesktop;
+    std::atomic<uint64_t> m_transitionMs;
+    mutable std::atomic<uint32_t> m_waiters;
+};
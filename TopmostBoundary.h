@@ -0,0 +1,84 @@
+#pragma once
+
+#include "WindowSystem.h"
+#include <cstdint>
+
+// Where the topmost band ends: the lowest topmost window.
+//
+// Topmost windows are always stacked above all the others, so the band ends at
+// a single window, and whether a remembered one still does is checked with a
+// few queries: it is still topmost and the window below it is not. The band is
+// only walked when that check fails, and then from the top, which visits the
+// topmost windows and none of the others.
+//
+// Windows of other processes can change the band without an event reaching the
+// library, so the boundary is always checked before it is used; events only
+// forget it early.
+class TopmostBoundary
+{
+public:
+    TopmostBoundary() :
+        m_boundary(nullptr),
+        m_hits(0),
+        m_walks(0),
+        m_walkSteps(0)
+    {
+    }
+
+    // The lowest topmost window other than exclude, which must be at the top of
+    // the z-order. Null if exclude is the only topmost window.
+    HWND Find(IWindowSystem& windowSystem, HWND exclude)
+    {
+        if (m_boundary && m_boundary != exclude && IsBoundary(windowSystem, m_boundary, exclude))
+        {
+            ++m_hits;
+            return m_boundary;
+        }
+
+        ++m_walks;
+        m_boundary = nullptr;
+        HWND hwnd = exclude;
+        while ((hwnd = windowSystem.GetWindowBelow(hwnd)) != nullptr && windowSystem.IsTopmost(hwnd))
+        {
+            ++m_walkSteps;
+            m_boundary = hwnd;
+        }
+        return m_boundary;
+    }
+
+    void OnWindowEvent(uint32_t event, HWND hwnd)
+    {
+        if (hwnd == m_boundary && event == WINDOW_EVENT_DESTROY)
+        {
+            m_boundary = nullptr;
+        }
+    }
+
+    void Invalidate()
+    {
+        m_boundary = nullptr;
+    }
+
+    uint64_t GetHitCount() const { return m_hits; }
+    uint64_t GetWalkCount() const { return m_walks; }
+    uint64_t GetWalkStepCount() const { return m_walkSteps; }
+
+private:
+    bool IsBoundary(IWindowSystem& windowSystem, HWND hwnd, HWND exclude)
+    {
+        if (!windowSystem.IsTopmost(hwnd))
+            return false;
+
+        HWND below = windowSystem.GetWindowBelow(hwnd);
+        if (below == exclude)
+        {
+            below = windowSystem.GetWindowBelow(below);
+        }
+        return below == nullptr || !windowSystem.IsTopmost(below);
+    }
+
+    HWND m_boundary;
+    uint64_t m_hits;
+    uint64_t m_walks;
+    uint64_t m_walkSteps;
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+
+// Binary trace of everything the desktop logic sees and does.
+//
+// A file header is followed by records. Every record starts with a
+// TraceRecordHeader carrying its type, the size of the payload that follows
+// and the microseconds elapsed since the previous record; a TRACE_CLOCK record
+// carries gaps that do not fit. Payloads are the structs below, written as is
+// in little-endian byte order, and window handles are stored as 64-bit values.
+//
+// Inputs (timers, window events, messages, registrations and user input) drive the logic,
+// the answers of window-system queries are what it observed, and actions are
+// the calls it made. Replaying the inputs and answering the queries from the
+// trace reproduces every decision.
+
+const char TRACE_MAGIC[4] = { 'Z', 'D', 'T', 'R' };
+const uint32_t TRACE_VERSION = 5;
+
+enum TraceRecordType
+{
+    TRACE_CLOCK = 1,        // uint64_t absolute time in us, before a long gap
+    TRACE_LOST,             // uint64_t number of records dropped before this one
+
+    // Inputs
+    TRACE_START,            // TraceStart, the logic (re)starts
+    TRACE_STOP,             // No payload
+    TRACE_TIMER,            // uint64_t timer id
+    TRACE_WINDOW_EVENT,     // TraceWindowEvent
+    TRACE_MESSAGE,          // uint32_t TraceMessage
+    TRACE_REGISTER,         // TraceRegistration per registered window or layer change
+    TRACE_UNREGISTER,       // uint64_t handles of unregistered windows
+    TRACE_INPUT,            // TraceInput, a key or pointer input
+    TRACE_TRIGGER_AREA,     // TraceRect, where the show desktop button is, empty if unknown
+
+    // Observations
+    TRACE_QUERY,            // TraceQueryResult
+    TRACE_CLASS,            // uint64_t handle, then the class name in UTF-16 units
+    TRACE_ENUM,             // uint64_t handles in the order they were enumerated
+    TRACE_TOPOLOGY,         // TraceTopology, each time the shell topology is resolved
+
+    // Actions
+    TRACE_MOVE,             // TraceMove
+    TRACE_COMMIT,           // TraceCommit, then TraceMove per window
+    TRACE_SET_TIMER,        // TraceTimer
+    TRACE_KILL_TIMER,       // TraceTimer
+    TRACE_HOOK,             // TraceHook
+    TRACE_UNHOOK,           // uint64_t hook
+    TRACE_STATE,            // TraceState, the desktop state changed
+    TRACE_LIFECYCLE,        // TraceLifecycle, a registered window was destroyed, shown, hidden or minimized
+
+    TRACE_RECORD_TYPE_COUNT
+};
+
+enum TraceMessage
+{
+    TRACE_MESSAGE_DISPLAY_CHANGE,
+    TRACE_MESSAGE_SETTING_CHANGE,
+    TRACE_MESSAGE_RESUME,
+    TRACE_MESSAGE_REFRESH,
+    TRACE_MESSAGE_SHELL_RESTARTED,
+    TRACE_MESSAGE_LAYERS,           // Restack the layers that changed
+    TRACE_MESSAGE_SESSION_LOCK,
+    TRACE_MESSAGE_SESSION_UNLOCK,
+    TRACE_MESSAGE_DISPLAY_OFF,
+    TRACE_MESSAGE_DISPLAY_ON
+};
+
+enum TraceQuery
+{
+    TRACE_QUERY_SHELL_WINDOW,
+    TRACE_QUERY_FIND_WINDOW,
+    TRACE_QUERY_WINDOW_ABOVE,
+    TRACE_QUERY_WINDOW_BELOW,
+    TRACE_QUERY_IS_WINDOW,
+    TRACE_QUERY_IS_VISIBLE,
+    TRACE_QUERY_IS_TOPMOST,
+    TRACE_QUERY_PROCESS_ID,
+    TRACE_QUERY_SHELL_HOST,
+    TRACE_QUERY_TICK_COUNT,
+    TRACE_QUERY_IS_MINIMIZED,
+    TRACE_QUERY_FRAME,              // FrameTime::frame
+    TRACE_QUERY_NEXT_FRAME_US       // FrameTime::nextFrameUs
+};
+
+struct TraceFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t startUs;
+};
+
+struct TraceRecordHeader
+{
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t size;          // Payload bytes
+    uint32_t deltaUs;       // Since the previous record
+};
+
+struct TraceStart
+{
+    uint64_t systemWindow;
+    uint64_t helperWindow;
+};
+
+struct TraceWindowEvent
+{
+    uint64_t hwnd;
+    uint32_t event;
+    int32_t idObject;
+    int32_t idChild;
+    uint32_t reserved;
+};
+
+struct TraceRegistration
+{
+    uint64_t hwnd;
+    int32_t layer;
+    uint32_t processId;
+    uint32_t flags;         // TraceWindowFlags
+    uint32_t reserved;
+};
+
+enum TraceWindowFlags
+{
+    TRACE_WINDOW_VISIBLE = 1,
+    TRACE_WINDOW_MINIMIZED = 2,
+    TRACE_WINDOW_DESTROYED = 4
+};
+
+struct TraceInput
+{
+    uint32_t type;          // InputEvent::Type
+    uint32_t key;
+    int32_t x;
+    int32_t y;
+};
+
+struct TraceRect
+{
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+};
+
+struct TraceQueryResult
+{
+    uint64_t argument;      // The window asked about, if any
+    uint64_t result;
+    uint32_t query;
+    uint32_t reserved;
+};
+
+struct TraceTopology
+{
+    uint64_t shellWindow;
+    uint64_t defView;
+    uint64_t host;
+    uint32_t shellProcessId;
+    uint32_t reserved;
+};
+
+struct TraceMove
+{
+    uint64_t hwnd;
+    uint64_t insertAfter;
+    uint32_t placement;     // ZOrderMove::Placement
+    uint32_t result;        // Of TRACE_MOVE only
+};
+
+struct TraceCommit
+{
+    uint32_t count;
+    uint32_t result;
+};
+
+struct TraceTimer
+{
+    uint64_t id;
+    uint32_t intervalMs;    // Of TRACE_SET_TIMER only
+    uint32_t toleranceMs;   // Of TRACE_SET_TIMER only
+};
+
+struct TraceHook
+{
+    uint64_t hook;
+    uint32_t eventMin;
+    uint32_t eventMax;
+    uint32_t processId;
+    uint32_t skipOwnProcess;
+};
+
+struct TraceState
+{
+    uint64_t detectionLatencyMs;
+    uint32_t showDesktop;
+    uint32_t reserved;
+};
+
+struct TraceLifecycle
+{
+    uint64_t hwnd;
+    uint32_t flags;         // TraceWindowFlags, the state the window was found in
+    uint32_t reserved;
+};
+
+inline uint64_t TraceHandle(const void* hwnd)
+{
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(hwnd));
+}
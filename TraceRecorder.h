@@ -0,0 +1,511 @@
+#pragma once
+
+#include "TraceFormat.h"
+#include "WindowSystem.h"
+#include "PerfCounters.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes a trace (see TraceFormat.h) to a file.
+//
+// Records are appended to a preallocated buffer, which costs a clock read and
+// a copy under an uncontended lock. A writer thread takes full buffers, and
+// once a second whatever has accumulated, and writes them out, so the file is
+// never touched on the recording thread. When the writer falls behind by more
+// than a buffer, records are dropped and counted instead of waiting.
+class TraceRecorder
+{
+public:
+    explicit TraceRecorder(size_t bufferSize = 256 * 1024) :
+        m_bufferSize(bufferSize),
+        m_file(nullptr),
+        m_lastUs(0),
+        m_closing(false),
+        m_records(0),
+        m_dropped(0),
+        m_unreported(0),
+        m_written(0)
+    {
+    }
+
+    ~TraceRecorder()
+    {
+        Close();
+    }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Takes ownership of file, which is closed by Close
+    bool Open(std::FILE* file)
+    {
+        if (!file || m_file)
+            return false;
+
+        m_lastUs = PerfCounters::NowUs();
+        TraceFileHeader header = { { TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3] }, TRACE_VERSION, m_lastUs };
+        if (std::fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            std::fclose(file);
+            return false;
+        }
+
+        m_active.reserve(m_bufferSize);
+        m_pending.reserve(m_bufferSize);
+        m_file = file;
+        m_closing = false;
+        m_writer = std::thread(&TraceRecorder::Write, this);
+        return true;
+    }
+
+    // Write out everything recorded so far and close the file
+    void Close()
+    {
+        if (!m_file)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_unreported)
+            {
+                // Not on the hot path anymore, the buffer may grow for this one
+                Append(TRACE_LOST, 0, &m_unreported, sizeof(m_unreported), nullptr, 0);
+                m_unreported = 0;
+            }
+            m_closing = true;
+        }
+        m_wake.notify_one();
+        m_writer.join();
+
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+
+    bool IsOpen() const { return m_file != nullptr; }
+
+    void Record(TraceRecordType type, const void* payload, size_t size)
+    {
+        Record(type, payload, size, nullptr, 0);
+    }
+
+    // A payload made of two parts, such as a fixed header and an array
+    void Record(TraceRecordType type, const void* first, size_t firstSize, const void* second, size_t secondSize)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        uint64_t now = PerfCounters::NowUs();
+        uint64_t delta = now > m_lastUs ? now - m_lastUs : 0;
+
+        size_t needed = sizeof(TraceRecordHeader) + firstSize + secondSize;
+        const bool clock = delta > UINT32_MAX;
+        if (clock)
+        {
+            needed += sizeof(TraceRecordHeader) + sizeof(uint64_t);
+        }
+        if (m_unreported)
+        {
+            needed += sizeof(TraceRecordHeader) + sizeof(uint64_t);
+        }
+
+        if (!Reserve(needed))
+        {
+            ++m_dropped;
+            ++m_unreported;
+            return;
+        }
+
+        // Replay needs to know where the trace has holes
+        if (m_unreported)
+        {
+            Append(TRACE_LOST, 0, &m_unreported, sizeof(m_unreported), nullptr, 0);
+            m_unreported = 0;
+        }
+
+        if (clock)
+        {
+            Append(TRACE_CLOCK, 0, &now, sizeof(now), nullptr, 0);
+            delta = 0;
+        }
+
+        Append(type, static_cast<uint32_t>(delta), first, firstSize, second, secondSize);
+        m_lastUs = now;
+        ++m_records;
+    }
+
+    template <typename T>
+    void Record(TraceRecordType type, const T& payload)
+    {
+        Record(type, &payload, sizeof(payload), nullptr, 0);
+    }
+
+    uint64_t GetRecordCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_records;
+    }
+
+    uint64_t GetDroppedCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_dropped;
+    }
+
+    uint64_t GetWrittenBytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_written;
+    }
+
+private:
+    // Make room in the active buffer, handing it to the writer if it is full
+    bool Reserve(size_t needed)
+    {
+        if (needed > m_bufferSize)
+            return false;
+
+        if (m_active.size() + needed <= m_bufferSize)
+            return true;
+
+        if (!m_pending.empty())
+            return false; // The writer still has the other buffer
+
+        m_active.swap(m_pending);
+        m_wake.notify_one();
+        return true;
+    }
+
+    void Append(TraceRecordType type, uint32_t deltaUs, const void* first, size_t firstSize, const void* second, size_t secondSize)
+    {
+        TraceRecordHeader header = { static_cast<uint8_t>(type), { 0, 0, 0 }, static_cast<uint32_t>(firstSize + secondSize), deltaUs };
+        const char* bytes = reinterpret_cast<const char*>(&header);
+        m_active.insert(m_active.end(), bytes, bytes + sizeof(header));
+
+        if (firstSize)
+        {
+            bytes = static_cast<const char*>(first);
+            m_active.insert(m_active.end(), bytes, bytes + firstSize);
+        }
+
+        if (secondSize)
+        {
+            bytes = static_cast<const char*>(second);
+            m_active.insert(m_active.end(), bytes, bytes + secondSize);
+        }
+    }
+
+    void Write()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        for (;;)
+        {
+            if (m_pending.empty())
+            {
+                m_wake.wait_for(lock, std::chrono::seconds(1), [this]() { return !m_pending.empty() || m_closing; });
+            }
+
+            if (m_pending.empty())
+            {
+                if (m_active.empty())
+                {
+                    if (m_closing)
+                        break;
+                    continue;
+                }
+
+                // Flush periodically, so a crash loses at most a second
+                m_active.swap(m_pending);
+            }
+
+            // The recording thread leaves the pending buffer alone until it is empty again
+            lock.unlock();
+            std::fwrite(m_pending.data(), 1, m_pending.size(), m_file);
+            std::fflush(m_file);
+            lock.lock();
+
+            m_written += m_pending.size();
+            m_pending.clear();
+        }
+    }
+
+    const size_t m_bufferSize;
+    std::FILE* m_file;
+    uint64_t m_lastUs;
+    std::vector<char> m_active;
+    std::vector<char> m_pending;
+    bool m_closing;
+    uint64_t m_records;
+    uint64_t m_dropped;
+    uint64_t m_unreported;      // Dropped since the last record written
+    uint64_t m_written;
+    std::thread m_writer;
+    mutable std::mutex m_lock;
+    std::condition_variable m_wake;
+};
+
+// Forwards to another backend and records every call into a trace.
+//
+// Timers and window events are recorded as inputs, the answers of queries as
+// observations and z-order changes, timers and hooks as actions. Without a
+// recorder it only forwards. The recorder is set on the thread the desktop
+// logic runs on.
+class RecordingWindowSystem : public IWindowSystem, private IWindowSystem::EventSink
+{
+public:
+    explicit RecordingWindowSystem(IWindowSystem& inner) :
+        m_inner(inner),
+        m_sink(nullptr),
+        m_recorder(nullptr)
+    {
+    }
+
+    void SetRecorder(TraceRecorder* recorder) { m_recorder = recorder; }
+    TraceRecorder* GetRecorder() const { return m_recorder; }
+
+    void SetEventSink(IWindowSystem::EventSink* sink) override
+    {
+        m_sink = sink;
+        m_inner.SetEventSink(sink ? this : nullptr);
+    }
+
+    void EnumTopLevelWindows(EnumWindowsCallback callback, void* context) override
+    {
+        if (!m_recorder)
+        {
+            m_inner.EnumTopLevelWindows(callback, context);
+            return;
+        }
+
+        EnumContext enumContext = { callback, context, &m_enumerated };
+        m_enumerated.clear();
+        m_inner.EnumTopLevelWindows(EnumRecordingProc, &enumContext);
+        m_recorder->Record(TRACE_ENUM, m_enumerated.data(), m_enumerated.size() * sizeof(uint64_t));
+    }
+
+    bool MoveWindow(const ZOrderMove& move) override
+    {
+        bool result = m_inner.MoveWindow(move);
+        if (m_recorder)
+        {
+            TraceMove record = ToTrace(move);
+            record.result = result ? 1 : 0;
+            m_recorder->Record(TRACE_MOVE, record);
+        }
+        return result;
+    }
+
+    bool CommitZOrder(const ZOrderMove* moves, size_t count) override
+    {
+        bool result = m_inner.CommitZOrder(moves, count);
+        if (m_recorder)
+        {
+            m_moves.clear();
+            for (size_t i = 0; i < count; ++i)
+            {
+                m_moves.push_back(ToTrace(moves[i]));
+            }
+
+            TraceCommit record = { static_cast<uint32_t>(count), result ? 1u : 0u };
+            m_recorder->Record(TRACE_COMMIT, &record, sizeof(record), m_moves.data(), m_moves.size() * sizeof(TraceMove));
+        }
+        return result;
+    }
+
+    HWND GetWindowAbove(HWND hwnd) override
+    {
+        return RecordWindow(TRACE_QUERY_WINDOW_ABOVE, hwnd, m_inner.GetWindowAbove(hwnd));
+    }
+
+    HWND GetWindowBelow(HWND hwnd) override
+    {
+        return RecordWindow(TRACE_QUERY_WINDOW_BELOW, hwnd, m_inner.GetWindowBelow(hwnd));
+    }
+
+    HWND GetShellWindow() override
+    {
+        return RecordWindow(TRACE_QUERY_SHELL_WINDOW, nullptr, m_inner.GetShellWindow());
+    }
+
+    HWND FindWindowAfter(HWND parent, HWND childAfter, const wchar_t* className, const wchar_t* title) override
+    {
+        return RecordWindow(TRACE_QUERY_FIND_WINDOW, parent ? parent : childAfter,
+            m_inner.FindWindowAfter(parent, childAfter, className, title));
+    }
+
+    int GetWindowClass(HWND hwnd, wchar_t* className, int count) override
+    {
+        int length = m_inner.GetWindowClass(hwnd, className, count);
+        if (m_recorder)
+        {
+            // Stored as UTF-16 units whatever the size of wchar_t
+            m_className.clear();
+            for (int i = 0; i < length; ++i)
+            {
+                m_className.push_back(static_cast<uint16_t>(className[i]));
+            }
+
+            uint64_t handle = TraceHandle(hwnd);
+            m_recorder->Record(TRACE_CLASS, &handle, sizeof(handle), m_className.data(), m_className.size() * sizeof(uint16_t));
+        }
+        return length;
+    }
+
+    bool IsWindow(HWND hwnd) override
+    {
+        return RecordValue(TRACE_QUERY_IS_WINDOW, hwnd, m_inner.IsWindow(hwnd)) != 0;
+    }
+
+    bool IsWindowVisible(HWND hwnd) override
+    {
+        return RecordValue(TRACE_QUERY_IS_VISIBLE, hwnd, m_inner.IsWindowVisible(hwnd)) != 0;
+    }
+
+    bool IsMinimized(HWND hwnd) override
+    {
+        return RecordValue(TRACE_QUERY_IS_MINIMIZED, hwnd, m_inner.IsMinimized(hwnd)) != 0;
+    }
+
+    bool IsTopmost(HWND hwnd) override
+    {
+        return RecordValue(TRACE_QUERY_IS_TOPMOST, hwnd, m_inner.IsTopmost(hwnd)) != 0;
+    }
+
+    uint32_t GetWindowProcessId(HWND hwnd) override
+    {
+        return static_cast<uint32_t>(RecordValue(TRACE_QUERY_PROCESS_ID, hwnd, m_inner.GetWindowProcessId(hwnd)));
+    }
+
+    bool UsesShellWindowAsDesktopIconsHost() override
+    {
+        return RecordValue(TRACE_QUERY_SHELL_HOST, nullptr, m_inner.UsesShellWindowAsDesktopIconsHost()) != 0;
+    }
+
+    uint64_t GetTickCount() override
+    {
+        return RecordValue(TRACE_QUERY_TICK_COUNT, nullptr, m_inner.GetTickCount());
+    }
+
+    bool SetTimer(HWND owner, uintptr_t id, uint32_t ms, uint32_t toleranceMs) override
+    {
+        if (m_recorder)
+        {
+            TraceTimer record = { id, ms, toleranceMs };
+            m_recorder->Record(TRACE_SET_TIMER, record);
+        }
+        return m_inner.SetTimer(owner, id, ms, toleranceMs);
+    }
+
+    void KillTimer(HWND owner, uintptr_t id) override
+    {
+        if (m_recorder)
+        {
+            TraceTimer record = { id, 0, 0 };
+            m_recorder->Record(TRACE_KILL_TIMER, record);
+        }
+        m_inner.KillTimer(owner, id);
+    }
+
+    FrameTime GetFrameTime() override
+    {
+        FrameTime time = m_inner.GetFrameTime();
+        RecordValue(TRACE_QUERY_FRAME, nullptr, time.frame);
+        RecordValue(TRACE_QUERY_NEXT_FRAME_US, nullptr, time.nextFrameUs);
+        return time;
+    }
+
+    EventHook HookEvents(uint32_t eventMin, uint32_t eventMax, uint32_t processId, bool skipOwnProcess) override
+    {
+        EventHook hook = m_inner.HookEvents(eventMin, eventMax, processId, skipOwnProcess);
+        if (m_recorder)
+        {
+            TraceHook record = { TraceHandle(hook), eventMin, eventMax, processId, skipOwnProcess ? 1u : 0u };
+            m_recorder->Record(TRACE_HOOK, record);
+        }
+        return hook;
+    }
+
+    void UnhookEvents(EventHook hook) override
+    {
+        if (m_recorder)
+        {
+            uint64_t record = TraceHandle(hook);
+            m_recorder->Record(TRACE_UNHOOK, record);
+        }
+        m_inner.UnhookEvents(hook);
+    }
+
+private:
+    struct EnumContext
+    {
+        EnumWindowsCallback callback;
+        void* context;
+        std::vector<uint64_t>* enumerated;
+    };
+
+    static bool EnumRecordingProc(HWND hwnd, void* param)
+    {
+        EnumContext* context = static_cast<EnumContext*>(param);
+        context->enumerated->push_back(TraceHandle(hwnd));
+        return context->callback(hwnd, context->context);
+    }
+
+    static TraceMove ToTrace(const ZOrderMove& move)
+    {
+        TraceMove record = { TraceHandle(move.hwnd), TraceHandle(move.insertAfter), static_cast<uint32_t>(move.placement), 0 };
+        return record;
+    }
+
+    void OnTimer(uintptr_t id) override
+    {
+        if (m_recorder)
+        {
+            uint64_t record = id;
+            m_recorder->Record(TRACE_TIMER, record);
+        }
+
+        if (m_sink)
+        {
+            m_sink->OnTimer(id);
+        }
+    }
+
+    void OnWindowEvent(uint32_t event, HWND hwnd, long idObject, long idChild) override
+    {
+        if (m_recorder)
+        {
+            TraceWindowEvent record = { TraceHandle(hwnd), event, static_cast<int32_t>(idObject), static_cast<int32_t>(idChild), 0 };
+            m_recorder->Record(TRACE_WINDOW_EVENT, record);
+        }
+
+        if (m_sink)
+        {
+            m_sink->OnWindowEvent(event, hwnd, idObject, idChild);
+        }
+    }
+
+    HWND RecordWindow(TraceQuery query, HWND argument, HWND result)
+    {
+        RecordValue(query, argument, TraceHandle(result));
+        return result;
+    }
+
+    uint64_t RecordValue(TraceQuery query, HWND argument, uint64_t result)
+    {
+        if (m_recorder)
+        {
+            TraceQueryResult record = { TraceHandle(argument), result, static_cast<uint32_t>(query), 0 };
+            m_recorder->Record(TRACE_QUERY, record);
+        }
+        return result;
+    }
+
+    IWindowSystem& m_inner;
+    IWindowSystem::EventSink* m_sink;
+    TraceRecorder* m_recorder;
+    std::vector<uint64_t> m_enumerated;
+    std::vector<TraceMove> m_moves;
+    std::vector<uint16_t> m_className;
+};
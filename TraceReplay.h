@@ -0,0 +1,818 @@
+#pragma once
+
+#include "DesktopController.h"
+#include "TraceFormat.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A trace file loaded into memory, with absolute timestamps.
+//
+// Files that end in the middle of a record, or hold records of an unknown
+// type or of the wrong size for their type, are refused. A trace cut short by
+// a crash can still be read up to the cut by allowing truncation.
+class TraceReader
+{
+public:
+    struct Record
+    {
+        TraceRecordType type;
+        uint64_t timeUs;        // Since the start of the trace
+        const char* payload;
+        uint32_t size;
+
+        template <typename T>
+        bool Read(T& value, size_t offset = 0) const
+        {
+            if (offset + sizeof(T) > size)
+                return false;
+            std::memcpy(&value, payload + offset, sizeof(T));
+            return true;
+        }
+    };
+
+    TraceReader() : m_truncated(false), m_lost(0), m_error("") {}
+
+    bool Load(const char* path, bool allowTruncated = false)
+    {
+        std::FILE* file = std::fopen(path, "rb");
+        if (!file)
+        {
+            m_error = "cannot be opened";
+            return false;
+        }
+
+        m_data.clear();
+        char chunk[64 * 1024];
+        size_t read;
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+        {
+            m_data.insert(m_data.end(), chunk, chunk + read);
+        }
+        std::fclose(file);
+        return Parse(allowTruncated);
+    }
+
+    const std::vector<Record>& GetRecords() const { return m_records; }
+
+    // The file ended in the middle of a record
+    bool IsTruncated() const { return m_truncated; }
+
+    // Records the recorder had to drop, replay diverges around them
+    uint64_t GetLostCount() const { return m_lost; }
+
+    // Why the last Load failed
+    const char* GetError() const { return m_error; }
+
+private:
+    // Payload sizes the recorder writes for each type
+    static bool IsValidRecord(const TraceRecordHeader& header, const char* payload)
+    {
+        if (header.reserved[0] || header.reserved[1] || header.reserved[2])
+            return false;
+
+        const uint32_t size = header.size;
+        switch (header.type)
+        {
+        case TRACE_CLOCK:
+        case TRACE_LOST:
+        case TRACE_TIMER:
+        case TRACE_UNHOOK:
+            return size == sizeof(uint64_t);
+        case TRACE_START: return size == sizeof(TraceStart);
+        case TRACE_STOP: return size == 0;
+        case TRACE_WINDOW_EVENT: return size == sizeof(TraceWindowEvent);
+        case TRACE_MESSAGE: return size == sizeof(uint32_t);
+        case TRACE_REGISTER: return size % sizeof(TraceRegistration) == 0;
+        case TRACE_UNREGISTER:
+        case TRACE_ENUM:
+            return size % sizeof(uint64_t) == 0;
+        case TRACE_INPUT: return size == sizeof(TraceInput);
+        case TRACE_TRIGGER_AREA: return size == sizeof(TraceRect);
+        case TRACE_QUERY: return size == sizeof(TraceQueryResult);
+        case TRACE_CLASS: return size >= sizeof(uint64_t) && (size - sizeof(uint64_t)) % sizeof(uint16_t) == 0;
+        case TRACE_TOPOLOGY: return size == sizeof(TraceTopology);
+        case TRACE_MOVE: return size == sizeof(TraceMove);
+        case TRACE_COMMIT:
+            {
+                TraceCommit commit;
+                if (size < sizeof(commit))
+                    return false;
+                std::memcpy(&commit, payload, sizeof(commit));
+                return size == sizeof(commit) + static_cast<uint64_t>(commit.count) * sizeof(TraceMove);
+            }
+        case TRACE_SET_TIMER:
+        case TRACE_KILL_TIMER:
+            return size == sizeof(TraceTimer);
+        case TRACE_HOOK: return size == sizeof(TraceHook);
+        case TRACE_STATE: return size == sizeof(TraceState);
+        case TRACE_LIFECYCLE: return size == sizeof(TraceLifecycle);
+        default: return false;
+        }
+    }
+
+    bool Parse(bool allowTruncated)
+    {
+        m_records.clear();
+        m_truncated = false;
+        m_lost = 0;
+        m_error = "";
+
+        TraceFileHeader header;
+        if (m_data.size() < sizeof(header))
+        {
+            m_error = "is too short for a trace";
+            return false;
+        }
+
+        std::memcpy(&header, m_data.data(), sizeof(header));
+        if (std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+        {
+            m_error = "is not a trace";
+            return false;
+        }
+        if (header.version != TRACE_VERSION)
+        {
+            m_error = "is a trace of another version";
+            return false;
+        }
+
+        uint64_t timeUs = 0;
+        size_t offset = sizeof(header);
+        while (offset < m_data.size())
+        {
+            TraceRecordHeader recordHeader;
+            if (m_data.size() - offset < sizeof(recordHeader))
+            {
+                m_truncated = true;
+                break;
+            }
+
+            std::memcpy(&recordHeader, &m_data[offset], sizeof(recordHeader));
+            offset += sizeof(recordHeader);
+            if (m_data.size() - offset < recordHeader.size)
+            {
+                m_truncated = true;
+                break;
+            }
+
+            if (!IsValidRecord(recordHeader, &m_data[offset]))
+            {
+                m_records.clear();
+                m_error = "holds a corrupted record";
+                return false;
+            }
+
+            Record record = { static_cast<TraceRecordType>(recordHeader.type), 0, &m_data[offset], recordHeader.size };
+            offset += recordHeader.size;
+
+            if (record.type == TRACE_CLOCK)
+            {
+                uint64_t absoluteUs = 0;
+                if (record.Read(absoluteUs) && absoluteUs > header.startUs)
+                {
+                    timeUs = absoluteUs - header.startUs;
+                }
+                continue;
+            }
+
+            uint64_t lost = 0;
+            if (record.type == TRACE_LOST && record.Read(lost))
+            {
+                m_lost += lost;
+                continue;
+            }
+
+            timeUs += recordHeader.deltaUs;
+            record.timeUs = timeUs;
+            m_records.push_back(record);
+        }
+
+        if (m_truncated && !allowTruncated)
+        {
+            m_records.clear();
+            m_error = "ends in the middle of a record";
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<char> m_data;
+    std::vector<Record> m_records;
+    bool m_truncated;
+    uint64_t m_lost;
+    const char* m_error;
+};
+
+inline bool IsTraceInput(TraceRecordType type)
+{
+    return type >= TRACE_START && type <= TRACE_TRIGGER_AREA;
+}
+
+// Answers the calls of the desktop logic from a trace.
+//
+// The calls are matched in order against the observations and actions
+// recorded after the input being replayed. A call that does not match the
+// next record is a divergence: it is answered with a neutral value and the
+// record is left for the next call, so replay stays in step with the trace.
+class ReplayWindowSystem : public IWindowSystem
+{
+public:
+    explicit ReplayWindowSystem(const std::vector<TraceReader::Record>& records) :
+        m_records(records),
+        m_cursor(0),
+        m_tickCount(0),
+        m_recorded(true),
+        m_divergences(0),
+        m_moves(0),
+        m_commits(0)
+    {
+    }
+
+    // Position of the next record to match
+    size_t GetCursor() const { return m_cursor; }
+    void SetCursor(size_t cursor) { m_cursor = cursor; }
+
+    // Calls made while not recorded, such as stopping before a new start, are not matched
+    void SetRecorded(bool recorded) { m_recorded = recorded; }
+
+    // Registration changes met while matching, applied once the current input is done
+    std::vector<size_t>& GetDeferred() { return m_deferred; }
+
+    uint64_t GetDivergenceCount() const { return m_divergences; }
+    uint64_t GetMoveCount() const { return m_moves; }
+    uint64_t GetCommitCount() const { return m_commits; }
+    const std::vector<std::string>& GetNotes() const { return m_notes; }
+
+    void Diverge(const std::string& note)
+    {
+        ++m_divergences;
+        if (m_notes.size() < 32)
+        {
+            m_notes.push_back(note);
+        }
+    }
+
+    void SetEventSink(EventSink*) override {}
+
+    void EnumTopLevelWindows(EnumWindowsCallback callback, void* context) override
+    {
+        const TraceReader::Record* record = Next(TRACE_ENUM, "enumeration");
+        if (!record)
+            return;
+
+        for (uint32_t offset = 0; offset + sizeof(uint64_t) <= record->size; offset += sizeof(uint64_t))
+        {
+            uint64_t handle = 0;
+            record->Read(handle, offset);
+            if (!callback(ToHandle(handle), context))
+                break;
+        }
+    }
+
+    bool MoveWindow(const ZOrderMove& move) override
+    {
+        ++m_moves;
+        const TraceReader::Record* record = Next(TRACE_MOVE, "z-order move");
+        TraceMove recorded;
+        if (!record || !record->Read(recorded))
+            return true;
+
+        if (!Matches(recorded, move))
+        {
+            Diverge("z-order move differs from the trace");
+        }
+        return recorded.result != 0;
+    }
+
+    bool CommitZOrder(const ZOrderMove* moves, size_t count) override
+    {
+        ++m_commits;
+        m_moves += count;
+        const TraceReader::Record* record = Next(TRACE_COMMIT, "z-order commit");
+        TraceCommit recorded;
+        if (!record || !record->Read(recorded))
+            return true;
+
+        bool same = recorded.count == count;
+        for (size_t i = 0; same && i < count; ++i)
+        {
+            TraceMove recordedMove;
+            same = record->Read(recordedMove, sizeof(recorded) + i * sizeof(recordedMove)) &&
+                Matches(recordedMove, moves[i]);
+        }
+
+        if (!same)
+        {
+            Diverge("z-order commit differs from the trace");
+        }
+        return recorded.result != 0;
+    }
+
+    HWND GetWindowAbove(HWND) override { return ToHandle(Query(TRACE_QUERY_WINDOW_ABOVE, 0)); }
+    HWND GetWindowBelow(HWND) override { return ToHandle(Query(TRACE_QUERY_WINDOW_BELOW, 0)); }
+    HWND GetShellWindow() override { return ToHandle(Query(TRACE_QUERY_SHELL_WINDOW, 0)); }
+
+    HWND FindWindowAfter(HWND, HWND, const wchar_t*, const wchar_t*) override
+    {
+        return ToHandle(Query(TRACE_QUERY_FIND_WINDOW, 0));
+    }
+
+    int GetWindowClass(HWND, wchar_t* className, int count) override
+    {
+        const TraceReader::Record* record = Next(TRACE_CLASS, "class name query");
+        if (!record || count <= 0)
+            return 0;
+
+        int length = 0;
+        uint16_t unit = 0;
+        while (length < count - 1 && record->Read(unit, sizeof(uint64_t) + length * sizeof(uint16_t)))
+        {
+            className[length++] = static_cast<wchar_t>(unit);
+        }
+        className[length] = L'\0';
+        return length;
+    }
+
+    bool IsWindow(HWND) override { return Query(TRACE_QUERY_IS_WINDOW, 0) != 0; }
+    bool IsWindowVisible(HWND) override { return Query(TRACE_QUERY_IS_VISIBLE, 0) != 0; }
+    bool IsMinimized(HWND) override { return Query(TRACE_QUERY_IS_MINIMIZED, 0) != 0; }
+    bool IsTopmost(HWND) override { return Query(TRACE_QUERY_IS_TOPMOST, 0) != 0; }
+    uint32_t GetWindowProcessId(HWND) override { return static_cast<uint32_t>(Query(TRACE_QUERY_PROCESS_ID, 0)); }
+    bool UsesShellWindowAsDesktopIconsHost() override { return Query(TRACE_QUERY_SHELL_HOST, 0) != 0; }
+
+    uint64_t GetTickCount() override
+    {
+        m_tickCount = Query(TRACE_QUERY_TICK_COUNT, m_tickCount);
+        return m_tickCount;
+    }
+
+    bool SetTimer(HWND, uintptr_t id, uint32_t ms, uint32_t toleranceMs) override
+    {
+        const TraceReader::Record* record = Next(TRACE_SET_TIMER, "timer");
+        TraceTimer recorded;
+        if (record && record->Read(recorded) &&
+            (recorded.id != id || recorded.intervalMs != ms || recorded.toleranceMs != toleranceMs))
+        {
+            Diverge("timer " + std::to_string(id) + " set to " + std::to_string(ms) + " ms, trace has " +
+                std::to_string(recorded.intervalMs) + " ms");
+        }
+        return true;
+    }
+
+    void KillTimer(HWND, uintptr_t id) override
+    {
+        const TraceReader::Record* record = Next(TRACE_KILL_TIMER, "timer kill");
+        TraceTimer recorded;
+        if (record && record->Read(recorded) && recorded.id != id)
+        {
+            Diverge("a different timer was killed");
+        }
+    }
+
+    FrameTime GetFrameTime() override
+    {
+        FrameTime time;
+        time.frame = Query(TRACE_QUERY_FRAME, 0);
+        time.nextFrameUs = static_cast<uint32_t>(Query(TRACE_QUERY_NEXT_FRAME_US, 0));
+        return time;
+    }
+
+    EventHook HookEvents(uint32_t eventMin, uint32_t eventMax, uint32_t processId, bool skipOwnProcess) override
+    {
+        const TraceReader::Record* record = Next(TRACE_HOOK, "event hook");
+        TraceHook recorded;
+        if (!record || !record->Read(recorded))
+            return nullptr;
+
+        if (recorded.eventMin != eventMin || recorded.eventMax != eventMax ||
+            recorded.processId != processId || (recorded.skipOwnProcess != 0) != skipOwnProcess)
+        {
+            Diverge("event hook differs from the trace");
+        }
+        return reinterpret_cast<EventHook>(static_cast<uintptr_t>(recorded.hook));
+    }
+
+    void UnhookEvents(EventHook) override
+    {
+        Next(TRACE_UNHOOK, "event unhook");
+    }
+
+private:
+    static HWND ToHandle(uint64_t handle)
+    {
+        return reinterpret_cast<HWND>(static_cast<uintptr_t>(handle));
+    }
+
+    static bool Matches(const TraceMove& recorded, const ZOrderMove& move)
+    {
+        return recorded.hwnd == TraceHandle(move.hwnd) &&
+            recorded.insertAfter == TraceHandle(move.insertAfter) &&
+            recorded.placement == static_cast<uint32_t>(move.placement);
+    }
+
+    uint64_t Query(TraceQuery query, uint64_t fallback)
+    {
+        const TraceReader::Record* record = Next(TRACE_QUERY, "query", query);
+        TraceQueryResult recorded;
+        return record && record->Read(recorded) ? recorded.result : fallback;
+    }
+
+    // The next record if it is of the given type, null otherwise
+    const TraceReader::Record* Next(TraceRecordType type, const char* what, int query = -1)
+    {
+        if (!m_recorded)
+            return nullptr;
+
+        while (m_cursor < m_records.size())
+        {
+            const TraceReader::Record& record = m_records[m_cursor];
+            if (record.type == TRACE_REGISTER || record.type == TRACE_UNREGISTER)
+            {
+                // Made on another thread while this input was handled
+                m_deferred.push_back(m_cursor++);
+                continue;
+            }
+
+            if (record.type == TRACE_TOPOLOGY || record.type == TRACE_STATE || record.type == TRACE_LIFECYCLE)
+            {
+                ++m_cursor;
+                continue;
+            }
+
+            TraceQueryResult recorded;
+            if (record.type == type && (query < 0 || (record.Read(recorded) && static_cast<int>(recorded.query) == query)))
+            {
+                ++m_cursor;
+                return &record;
+            }
+            break;
+        }
+
+        Diverge(std::string("unexpected ") + what);
+        return nullptr;
+    }
+
+    const std::vector<TraceReader::Record>& m_records;
+    size_t m_cursor;
+    uint64_t m_tickCount;
+    bool m_recorded;
+    std::vector<size_t> m_deferred;
+    uint64_t m_divergences;
+    uint64_t m_moves;
+    uint64_t m_commits;
+    std::vector<std::string> m_notes;
+};
+
+// Feeds the inputs of a trace through DesktopController and reports what it
+// decided and how long each input took, in the trace and in the replay.
+class TraceReplayer
+{
+public:
+    struct Decision
+    {
+        uint64_t timeUs;
+        bool showDesktop;
+        uint64_t detectionLatencyMs;
+    };
+
+    struct Timing
+    {
+        uint64_t count;
+        uint64_t recordedUs;        // Until the last record caused by the input
+        uint64_t replayedUs;
+        uint64_t maxReplayedUs;
+    };
+
+    struct Report
+    {
+        uint64_t records;
+        uint64_t inputs;
+        uint64_t divergences;
+        uint64_t skipped;           // Recorded calls the replay did not make
+        uint64_t moves;
+        uint64_t commits;
+        std::vector<Decision> recorded;
+        std::vector<Decision> replayed;
+        Timing timings[TRACE_RECORD_TYPE_COUNT];
+        std::vector<std::string> notes;
+        std::vector<std::string> log;
+    };
+
+    static const char* GetInputName(TraceRecordType type)
+    {
+        switch (type)
+        {
+        case TRACE_START: return "start";
+        case TRACE_STOP: return "stop";
+        case TRACE_TIMER: return "timer";
+        case TRACE_WINDOW_EVENT: return "window event";
+        case TRACE_MESSAGE: return "message";
+        case TRACE_REGISTER: return "register";
+        case TRACE_UNREGISTER: return "unregister";
+        case TRACE_INPUT: return "input";
+        case TRACE_TRIGGER_AREA: return "trigger area";
+        default: return "other";
+        }
+    }
+
+    // verbose logs every input with the moves replayed for it
+    static void Run(const TraceReader& trace, bool verbose, Report& report)
+    {
+        const std::vector<TraceReader::Record>& records = trace.GetRecords();
+        report = Report();
+        report.records = records.size();
+
+        // Decisions are reported at the time of the input that led to them
+        uint64_t inputTimeUs = 0;
+        for (const TraceReader::Record& record : records)
+        {
+            TraceState state;
+            if (IsTraceInput(record.type))
+            {
+                inputTimeUs = record.timeUs;
+            }
+            else if (record.type == TRACE_STATE && record.Read(state))
+            {
+                Decision decision = { inputTimeUs, state.showDesktop != 0, state.detectionLatencyMs };
+                report.recorded.push_back(decision);
+            }
+        }
+
+        ReplayWindowSystem windowSystem(records);
+        SnapshotCell<WindowRegistry> windows;
+        DesktopController controller(windowSystem, windows);
+        controller.SetStateChangedHandler([&](bool showDesktop, uint64_t latencyMs)
+        {
+            Decision decision = { inputTimeUs, showDesktop, latencyMs };
+            report.replayed.push_back(decision);
+        });
+
+        // The replayed logic finds the same windows destroyed, hidden or minimized
+        controller.SetWindowLifecycleHandler([&windows](const WindowLifecycle& change)
+        {
+            std::unique_ptr<WindowRegistry> registry(new WindowRegistry(windows.GetForWriter()));
+            if (registry->Apply(change))
+            {
+                windows.Publish(std::move(registry));
+            }
+        });
+
+        ControllerState controllerState;
+        size_t i = 0;
+        while (i < records.size())
+        {
+            const TraceReader::Record& input = records[i];
+            if (!IsTraceInput(input.type))
+            {
+                // Left over from the previous input
+                if (input.type != TRACE_TOPOLOGY && input.type != TRACE_STATE && input.type != TRACE_LIFECYCLE)
+                {
+                    ++report.skipped;
+                }
+                ++i;
+                continue;
+            }
+
+            ++report.inputs;
+            inputTimeUs = input.timeUs;
+            windowSystem.SetCursor(i + 1);
+            const uint64_t moves = windowSystem.GetMoveCount();
+            const uint64_t startUs = PerfCounters::NowUs();
+
+            Dispatch(input, controller, windowSystem, windows, controllerState);
+
+            const uint64_t replayedUs = PerfCounters::NowUs() - startUs;
+            ApplyDeferred(records, windowSystem.GetDeferred(), windows);
+
+            // Everything recorded up to the next input was caused by this one
+            size_t next = i + 1;
+            while (next < records.size() && !IsTraceInput(records[next].type))
+            {
+                ++next;
+            }
+
+            Timing& timing = report.timings[input.type];
+            ++timing.count;
+            timing.recordedUs += records[next - 1].timeUs - input.timeUs;
+            timing.replayedUs += replayedUs;
+            if (replayedUs > timing.maxReplayedUs)
+            {
+                timing.maxReplayedUs = replayedUs;
+            }
+
+            if (verbose)
+            {
+                report.log.push_back(std::to_string(input.timeUs / 1000) + " ms " + GetInputName(input.type) +
+                    ": " + std::to_string(windowSystem.GetMoveCount() - moves) + " moves, " +
+                    std::to_string(replayedUs) + " us");
+            }
+
+            // Calls the replay did not make are counted as skipped by the loop
+            i = std::max(windowSystem.GetCursor(), i + 1);
+        }
+
+        report.divergences = windowSystem.GetDivergenceCount() + report.skipped;
+        report.moves = windowSystem.GetMoveCount();
+        report.commits = windowSystem.GetCommitCount();
+        report.notes = windowSystem.GetNotes();
+    }
+
+private:
+    struct ControllerState
+    {
+        ControllerState() : started(false), startPending(false) {}
+
+        bool started;
+        bool startPending;          // Until the registrations recorded with the start
+        TraceStart pendingStart;
+    };
+
+    static void Dispatch(const TraceReader::Record& input, DesktopController& controller,
+        ReplayWindowSystem& windowSystem, SnapshotCell<WindowRegistry>& windows, ControllerState& state)
+    {
+        switch (input.type)
+        {
+        case TRACE_START:
+            {
+                TraceStart start;
+                if (!input.Read(start))
+                    break;
+
+                if (state.started)
+                {
+                    windowSystem.SetRecorded(false);
+                    controller.Stop();
+                    windowSystem.SetRecorded(true);
+                    state.started = false;
+                }
+
+                // The registrations at the time follow the start, and the
+                // logic started with them in place
+                windows.Publish(std::unique_ptr<WindowRegistry>(new WindowRegistry()));
+                state.pendingStart = start;
+                state.startPending = true;
+            }
+            break;
+
+        case TRACE_STOP:
+            state.startPending = false;
+            if (state.started)
+            {
+                windowSystem.SetRecorded(false);
+                controller.Stop();
+                windowSystem.SetRecorded(true);
+                state.started = false;
+            }
+            break;
+
+        case TRACE_TIMER:
+            {
+                uint64_t id = 0;
+                if (state.started && input.Read(id))
+                {
+                    controller.OnTimer(static_cast<uintptr_t>(id));
+                }
+            }
+            break;
+
+        case TRACE_WINDOW_EVENT:
+            {
+                TraceWindowEvent event;
+                if (state.started && input.Read(event))
+                {
+                    controller.OnWindowEvent(event.event, reinterpret_cast<HWND>(static_cast<uintptr_t>(event.hwnd)),
+                        event.idObject, event.idChild);
+                }
+            }
+            break;
+
+        case TRACE_MESSAGE:
+            {
+                uint32_t message = 0;
+                if (!state.started || !input.Read(message))
+                    break;
+
+                if (message == TRACE_MESSAGE_REFRESH)
+                {
+                    controller.RequestRefresh(true);
+                }
+                else if (message == TRACE_MESSAGE_LAYERS)
+                {
+                    controller.RequestRefresh(false);
+                }
+                else if (message == TRACE_MESSAGE_SHELL_RESTARTED)
+                {
+                    controller.OnShellRestarted();
+                }
+                else if (message == TRACE_MESSAGE_SESSION_LOCK || message == TRACE_MESSAGE_SESSION_UNLOCK)
+                {
+                    controller.OnSessionLocked(message == TRACE_MESSAGE_SESSION_LOCK);
+                }
+                else if (message == TRACE_MESSAGE_DISPLAY_OFF || message == TRACE_MESSAGE_DISPLAY_ON)
+                {
+                    controller.OnDisplayPower(message == TRACE_MESSAGE_DISPLAY_ON);
+                }
+            }
+            break;
+
+        case TRACE_INPUT:
+            {
+                TraceInput record;
+                if (state.started && input.Read(record))
+                {
+                    InputEvent event = { static_cast<InputEvent::Type>(record.type), record.key, record.x, record.y };
+                    controller.OnInput(event);
+                }
+            }
+            break;
+
+        case TRACE_TRIGGER_AREA:
+            {
+                // Kept across restarts, like the registrations
+                TraceRect record;
+                if (input.Read(record))
+                {
+                    InputRect area = { record.left, record.top, record.right, record.bottom };
+                    controller.SetTriggerArea(area);
+                }
+            }
+            break;
+
+        case TRACE_REGISTER:
+        case TRACE_UNREGISTER:
+            {
+                std::unique_ptr<WindowRegistry> registry(new WindowRegistry(windows.GetForWriter()));
+                ApplyRegistration(input, *registry);
+                windows.Publish(std::move(registry));
+
+                if (state.startPending)
+                {
+                    state.startPending = false;
+                    controller.Start(reinterpret_cast<HWND>(static_cast<uintptr_t>(state.pendingStart.systemWindow)),
+                        reinterpret_cast<HWND>(static_cast<uintptr_t>(state.pendingStart.helperWindow)));
+                    state.started = true;
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    static void ApplyRegistration(const TraceReader::Record& record, WindowRegistry& registry)
+    {
+        if (record.type == TRACE_REGISTER)
+        {
+            for (uint32_t offset = 0; offset + sizeof(TraceRegistration) <= record.size; offset += sizeof(TraceRegistration))
+            {
+                TraceRegistration registration;
+                record.Read(registration, offset);
+
+                WindowInfo info;
+                info.hwnd = reinterpret_cast<HWND>(static_cast<uintptr_t>(registration.hwnd));
+                info.isVisible = (registration.flags & TRACE_WINDOW_VISIBLE) != 0;
+                info.isMinimized = (registration.flags & TRACE_WINDOW_MINIMIZED) != 0;
+                info.owner = nullptr;
+                info.layer = registration.layer;
+                info.processId = registration.processId;
+                info.generation = 0;
+
+                // As the engine does when a handle was reused by another process
+                const WindowInfo* existing = registry.Find(info.hwnd);
+                if (existing && existing->processId != info.processId)
+                {
+                    registry.Erase(info.hwnd);
+                }
+                registry.Insert(info);
+            }
+            return;
+        }
+
+        for (uint32_t offset = 0; offset + sizeof(uint64_t) <= record.size; offset += sizeof(uint64_t))
+        {
+            uint64_t handle = 0;
+            record.Read(handle, offset);
+            registry.Erase(reinterpret_cast<HWND>(static_cast<uintptr_t>(handle)));
+        }
+    }
+
+    static void ApplyDeferred(const std::vector<TraceReader::Record>& records, std::vector<size_t>& deferred,
+        SnapshotCell<WindowRegistry>& windows)
+    {
+        if (deferred.empty())
+            return;
+
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(windows.GetForWriter()));
+        for (size_t index : deferred)
+        {
+            ApplyRegistration(records[index], *registry);
+        }
+
+        deferred.clear();
+        windows.Publish(std::move(registry));
+    }
+};
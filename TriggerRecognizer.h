@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+
+// Keys and buttons, with the values of the matching Win32 virtual-key codes
+enum InputKey
+{
+    INPUT_KEY_SHIFT = 0x10,         // VK_SHIFT
+    INPUT_KEY_D = 0x44,
+    INPUT_KEY_M = 0x4D,
+    INPUT_KEY_LWIN = 0x5B,          // VK_LWIN
+    INPUT_KEY_RWIN = 0x5C,          // VK_RWIN
+    INPUT_KEY_LSHIFT = 0xA0,        // VK_LSHIFT
+    INPUT_KEY_RSHIFT = 0xA1,        // VK_RSHIFT
+    INPUT_KEY_COMMA = 0xBC,         // VK_OEM_COMMA
+
+    INPUT_BUTTON_LEFT = 0x01        // VK_LBUTTON
+};
+
+// One keyboard or pointer input, in screen coordinates
+struct InputEvent
+{
+    enum Type
+    {
+        KEY_DOWN,
+        KEY_UP,
+        POINTER_DOWN,
+        POINTER_UP,
+        POINTER_MOVE
+    };
+
+    Type type;
+    uint32_t key;       // InputKey of key and button events
+    int32_t x;
+    int32_t y;
+};
+
+struct InputRect
+{
+    int32_t left;
+    int32_t top;
+    int32_t right;      // Exclusive
+    int32_t bottom;     // Exclusive
+
+    bool Contains(int32_t x, int32_t y) const
+    {
+        return x >= left && x < right && y >= top && y < bottom;
+    }
+};
+
+// Recognises the inputs the shell turns into Show Desktop, before the shell
+// acts on them, so detection can get ready ahead of the transition:
+// - Win+D, Win+M, Win+Shift+M and Win+, (Aero Peek)
+// - a click on the show desktop button at the end of the taskbar
+// - the pointer coming to rest on that button, which starts Aero Peek
+//
+// Only the order of the inputs matters, there are no timeouts. Key repeats
+// and the release of a trigger key are not triggers. The host says where the
+// button is, and again whenever the taskbar moves.
+class TriggerRecognizer
+{
+public:
+    enum class Trigger
+    {
+        None,
+        ShowDesktopKey,     // Win+D, toggles the desktop
+        MinimizeKey,        // Win+M, shows the desktop
+        RestoreKey,         // Win+Shift+M, shows the windows again
+        PeekKey,            // Win+,
+        ShowDesktopButton,  // Click on the button, toggles the desktop
+        PeekHover           // Pointer entered the button
+    };
+
+    TriggerRecognizer() :
+        m_leftWin(false),
+        m_rightWin(false),
+        m_shift(0),
+        m_triggerKey(0),
+        m_hasArea(false),
+        m_inArea(false),
+        m_triggers(0)
+    {
+        m_area = InputRect();
+    }
+
+    void SetButtonArea(const InputRect& area)
+    {
+        m_area = area;
+        m_hasArea = area.right > area.left && area.bottom > area.top;
+        m_inArea = false;
+    }
+
+    void ClearButtonArea()
+    {
+        m_hasArea = false;
+        m_inArea = false;
+    }
+
+    // Returns the trigger this input completes, Trigger::None if it does not
+    Trigger OnInput(const InputEvent& event)
+    {
+        Trigger trigger = Recognize(event);
+        if (trigger != Trigger::None)
+        {
+            ++m_triggers;
+        }
+        return trigger;
+    }
+
+    // Drop the keys and pointer position seen so far, e.g. when input stopped
+    // reaching us and releases may have been missed
+    void Reset()
+    {
+        m_leftWin = m_rightWin = false;
+        m_shift = 0;
+        m_triggerKey = 0;
+        m_inArea = false;
+    }
+
+    // Whether the trigger is expected to bring the desktop to the front,
+    // given the current state; restoring ones bring the windows back
+    static bool PredictsDesktop(Trigger trigger, bool showingDesktop)
+    {
+        switch (trigger)
+        {
+        case Trigger::ShowDesktopKey:
+        case Trigger::ShowDesktopButton:
+            return !showingDesktop;
+        case Trigger::MinimizeKey:
+        case Trigger::PeekKey:
+        case Trigger::PeekHover:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool IsWinDown() const { return m_leftWin || m_rightWin; }
+    uint64_t GetTriggerCount() const { return m_triggers; }
+
+private:
+    Trigger Recognize(const InputEvent& event)
+    {
+        switch (event.type)
+        {
+        case InputEvent::KEY_DOWN:
+            return OnKeyDown(event.key);
+
+        case InputEvent::KEY_UP:
+            OnKeyUp(event.key);
+            return Trigger::None;
+
+        case InputEvent::POINTER_DOWN:
+            if (event.key == INPUT_BUTTON_LEFT && m_hasArea && m_area.Contains(event.x, event.y))
+            {
+                m_inArea = true;
+                return Trigger::ShowDesktopButton;
+            }
+            return OnPointerMove(event.x, event.y);
+
+        case InputEvent::POINTER_UP:
+        case InputEvent::POINTER_MOVE:
+            return OnPointerMove(event.x, event.y);
+        }
+        return Trigger::None;
+    }
+
+    Trigger OnKeyDown(uint32_t key)
+    {
+        switch (key)
+        {
+        case INPUT_KEY_LWIN:
+            m_leftWin = true;
+            return Trigger::None;
+        case INPUT_KEY_RWIN:
+            m_rightWin = true;
+            return Trigger::None;
+        case INPUT_KEY_SHIFT:
+        case INPUT_KEY_LSHIFT:
+        case INPUT_KEY_RSHIFT:
+            m_shift |= ShiftBit(key);
+            return Trigger::None;
+        }
+
+        // Held keys repeat their key down
+        if (!IsWinDown() || key == m_triggerKey)
+            return Trigger::None;
+
+        m_triggerKey = key;
+        switch (key)
+        {
+        case INPUT_KEY_D:
+            return Trigger::ShowDesktopKey;
+        case INPUT_KEY_M:
+            return m_shift ? Trigger::RestoreKey : Trigger::MinimizeKey;
+        case INPUT_KEY_COMMA:
+            return Trigger::PeekKey;
+        default:
+            return Trigger::None;
+        }
+    }
+
+    void OnKeyUp(uint32_t key)
+    {
+        switch (key)
+        {
+        case INPUT_KEY_LWIN:
+            m_leftWin = false;
+            break;
+        case INPUT_KEY_RWIN:
+            m_rightWin = false;
+            break;
+        case INPUT_KEY_SHIFT:
+        case INPUT_KEY_LSHIFT:
+        case INPUT_KEY_RSHIFT:
+            m_shift &= ~ShiftBit(key);
+            break;
+        }
+
+        if (key == m_triggerKey)
+        {
+            m_triggerKey = 0;
+        }
+    }
+
+    Trigger OnPointerMove(int32_t x, int32_t y)
+    {
+        bool inArea = m_hasArea && m_area.Contains(x, y);
+        bool entered = inArea && !m_inArea;
+        m_inArea = inArea;
+        return entered ? Trigger::PeekHover : Trigger::None;
+    }
+
+    // The generic shift key is reported alongside or instead of the sided ones
+    static uint32_t ShiftBit(uint32_t key)
+    {
+        return key == INPUT_KEY_LSHIFT ? 1u : key == INPUT_KEY_RSHIFT ? 2u : 4u;
+    }
+
+    bool m_leftWin;
+    bool m_rightWin;
+    uint32_t m_shift;
+    uint32_t m_triggerKey;      // Key that completed the last key trigger, until released
+    InputRect m_area;
+    bool m_hasArea;
+    bool m_inArea;
+    uint64_t m_triggers;
+};
@@ -0,0 +1,210 @@
+#include "pch.h"
+#include "Win32WindowSystem.h"
+#include "PerfCounters.h"
+#include <dwmapi.h>
+
+IWindowSystem::EventSink* Win32WindowSystem::s_sink = nullptr;
+
+Win32WindowSystem::Win32WindowSystem() :
+    m_shellWindowHost(-1)
+{
+}
+
+void Win32WindowSystem::SetEventSink(EventSink* sink)
+{
+    s_sink = sink;
+}
+
+void Win32WindowSystem::EnumTopLevelWindows(EnumWindowsCallback callback, void* context)
+{
+    PerfCounters::Add(PERF_ENUMERATIONS);
+    EnumContext enumContext = { callback, context };
+    EnumWindows(EnumWindowsProc, reinterpret_cast<LPARAM>(&enumContext));
+}
+
+BOOL CALLBACK Win32WindowSystem::EnumWindowsProc(HWND hwnd, LPARAM lParam)
+{
+    PerfCounters::Add(PERF_ENUMERATED_WINDOWS);
+    EnumContext* enumContext = reinterpret_cast<EnumContext*>(lParam);
+    return enumContext->callback(hwnd, enumContext->context) ? TRUE : FALSE;
+}
+
+void CALLBACK Win32WindowSystem::TimerProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+{
+    if (s_sink)
+    {
+        s_sink->OnTimer(idEvent);
+    }
+}
+
+void CALLBACK Win32WindowSystem::WinEventProc(HWINEVENTHOOK hWinEventHook, DWORD event, HWND hwnd,
+    LONG idObject, LONG idChild, DWORD dwEventThread, DWORD dwmsEventTime)
+{
+    if (s_sink)
+    {
+        s_sink->OnWindowEvent(event, hwnd, idObject, idChild);
+    }
+}
+
+HWND Win32WindowSystem::GetInsertAfter(const ZOrderMove& move)
+{
+    switch (move.placement)
+    {
+    case ZOrderMove::Bottom:
+        return HWND_BOTTOM;
+
+    case ZOrderMove::Topmost:
+        return HWND_TOPMOST;
+
+    default:
+        return move.insertAfter;
+    }
+}
+
+bool Win32WindowSystem::MoveWindow(const ZOrderMove& move)
+{
+    PerfCounters::Add(PERF_ZORDER_CALLS);
+    return SetWindowPos(move.hwnd, GetInsertAfter(move), 0, 0, 0, 0, ZPOS_FLAGS) != FALSE;
+}
+
+bool Win32WindowSystem::CommitZOrder(const ZOrderMove* moves, size_t count)
+{
+    // The window manager recomputes the z-order and repaints once for the whole batch
+    PerfCounters::Add(PERF_ZORDER_COMMITS);
+    HDWP hdwp = BeginDeferWindowPos(static_cast<int>(count));
+    if (!hdwp)
+        return false;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        // On failure DeferWindowPos releases the batch itself
+        PerfCounters::Add(PERF_ZORDER_CALLS);
+        hdwp = DeferWindowPos(hdwp, moves[i].hwnd, GetInsertAfter(moves[i]), 0, 0, 0, 0, ZPOS_FLAGS);
+        if (!hdwp)
+            return false;
+    }
+
+    return EndDeferWindowPos(hdwp) != FALSE;
+}
+
+HWND Win32WindowSystem::GetWindowAbove(HWND hwnd)
+{
+    return ::GetNextWindow(hwnd, GW_HWNDPREV);
+}
+
+HWND Win32WindowSystem::GetWindowBelow(HWND hwnd)
+{
+    return ::GetNextWindow(hwnd, GW_HWNDNEXT);
+}
+
+HWND Win32WindowSystem::GetShellWindow()
+{
+    return ::GetShellWindow();
+}
+
+HWND Win32WindowSystem::FindWindowAfter(HWND parent, HWND childAfter, const wchar_t* className, const wchar_t* title)
+{
+    return ::FindWindowEx(parent, childAfter, className, title);
+}
+
+int Win32WindowSystem::GetWindowClass(HWND hwnd, wchar_t* className, int count)
+{
+    return ::GetClassName(hwnd, className, count);
+}
+
+bool Win32WindowSystem::IsWindow(HWND hwnd)
+{
+    return ::IsWindow(hwnd) != FALSE;
+}
+
+bool Win32WindowSystem::IsWindowVisible(HWND hwnd)
+{
+    return ::IsWindowVisible(hwnd) != FALSE;
+}
+
+bool Win32WindowSystem::IsMinimized(HWND hwnd)
+{
+    return ::IsIconic(hwnd) != FALSE;
+}
+
+bool Win32WindowSystem::IsTopmost(HWND hwnd)
+{
+    return (::GetWindowLongPtr(hwnd, GWL_EXSTYLE) & WS_EX_TOPMOST) != 0;
+}
+
+uint32_t Win32WindowSystem::GetWindowProcessId(HWND hwnd)
+{
+    DWORD processId = 0;
+    ::GetWindowThreadProcessId(hwnd, &processId);
+    return processId;
+}
+
+bool Win32WindowSystem::UsesShellWindowAsDesktopIconsHost()
+{
+    // Check for Windows 11 24H2+ by looking for GetCurrentMonitorTopologyId function
+    if (m_shellWindowHost < 0)
+    {
+        m_shellWindowHost = GetProcAddress(GetModuleHandle(L"user32"), "GetCurrentMonitorTopologyId") != nullptr ? 1 : 0;
+    }
+    return m_shellWindowHost != 0;
+}
+
+uint64_t Win32WindowSystem::GetTickCount()
+{
+    return ::GetTickCount64();
+}
+
+bool Win32WindowSystem::SetTimer(HWND owner, uintptr_t id, uint32_t ms, uint32_t toleranceMs)
+{
+    static_assert(TIMER_TOLERANCE_DEFAULT == TIMERV_DEFAULT_COALESCING, "Timer tolerances must match Win32");
+    static_assert(TIMER_TOLERANCE_NONE == TIMERV_NO_COALESCING, "Timer tolerances must match Win32");
+    return ::SetCoalescableTimer(owner, id, ms, TimerProc, toleranceMs) != 0;
+}
+
+void Win32WindowSystem::KillTimer(HWND owner, uintptr_t id)
+{
+    ::KillTimer(owner, id);
+}
+
+FrameTime Win32WindowSystem::GetFrameTime()
+{
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+
+    DWM_TIMING_INFO timing = {};
+    timing.cbSize = sizeof(timing);
+    uint64_t period = static_cast<uint64_t>(frequency.QuadPart) / 60;
+    uint64_t phase = 0;
+    if (SUCCEEDED(DwmGetCompositionTimingInfo(nullptr, &timing)) && timing.qpcRefreshPeriod != 0)
+    {
+        period = timing.qpcRefreshPeriod;
+        phase = timing.qpcVBlank % period;
+    }
+
+    // Frames are counted from the vertical blanks, which recur every period
+    const uint64_t ticks = static_cast<uint64_t>(now.QuadPart) - phase;
+    FrameTime time;
+    time.frame = ticks / period;
+    time.nextFrameUs = static_cast<uint32_t>((period - ticks % period) * 1000000 / frequency.QuadPart);
+    return time;
+}
+
+IWindowSystem::EventHook Win32WindowSystem::HookEvents(uint32_t eventMin, uint32_t eventMax, uint32_t processId, bool skipOwnProcess)
+{
+    return SetWinEventHook(
+        eventMin,
+        eventMax,
+        nullptr,
+        WinEventProc,
+        processId, 0,
+        WINEVENT_OUTOFCONTEXT | (skipOwnProcess ? WINEVENT_SKIPOWNPROCESS : 0));
+}
+
+void Win32WindowSystem::UnhookEvents(EventHook hook)
+{
+    if (hook)
+    {
+        UnhookWinEvent(static_cast<HWINEVENTHOOK>(hook));
+    }
+}
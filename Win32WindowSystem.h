@@ -0,0 +1,58 @@
+#pragma once
+
+#include "WindowSystem.h"
+
+#define ZPOS_FLAGS (SWP_NOMOVE | SWP_NOSIZE | SWP_NOOWNERZORDER | SWP_NOACTIVATE | SWP_NOSENDCHANGING)
+
+// IWindowSystem on top of the real window manager
+class Win32WindowSystem : public IWindowSystem
+{
+public:
+    Win32WindowSystem();
+
+    void SetEventSink(EventSink* sink) override;
+
+    void EnumTopLevelWindows(EnumWindowsCallback callback, void* context) override;
+    bool MoveWindow(const ZOrderMove& move) override;
+    bool CommitZOrder(const ZOrderMove* moves, size_t count) override;
+
+    HWND GetWindowAbove(HWND hwnd) override;
+    HWND GetWindowBelow(HWND hwnd) override;
+
+    HWND GetShellWindow() override;
+    HWND FindWindowAfter(HWND parent, HWND childAfter, const wchar_t* className, const wchar_t* title) override;
+    int GetWindowClass(HWND hwnd, wchar_t* className, int count) override;
+    bool IsWindow(HWND hwnd) override;
+    bool IsWindowVisible(HWND hwnd) override;
+    bool IsMinimized(HWND hwnd) override;
+    bool IsTopmost(HWND hwnd) override;
+    uint32_t GetWindowProcessId(HWND hwnd) override;
+
+    bool UsesShellWindowAsDesktopIconsHost() override;
+
+    uint64_t GetTickCount() override;
+    bool SetTimer(HWND owner, uintptr_t id, uint32_t ms, uint32_t toleranceMs) override;
+    void KillTimer(HWND owner, uintptr_t id) override;
+    FrameTime GetFrameTime() override;
+
+    EventHook HookEvents(uint32_t eventMin, uint32_t eventMax, uint32_t processId, bool skipOwnProcess) override;
+    void UnhookEvents(EventHook hook) override;
+
+private:
+    struct EnumContext
+    {
+        EnumWindowsCallback callback;
+        void* context;
+    };
+
+    static BOOL CALLBACK EnumWindowsProc(HWND hwnd, LPARAM lParam);
+    static void CALLBACK TimerProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime);
+    static void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook, DWORD event, HWND hwnd,
+        LONG idObject, LONG idChild, DWORD dwEventThread, DWORD dwmsEventTime);
+    static HWND GetInsertAfter(const ZOrderMove& move);
+
+    int m_shellWindowHost;      // -1 until checked
+
+    // Timer and WinEvent callbacks carry no context, and there is one engine per process
+    static EventSink* s_sink;
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "WindowSystem.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Small id of a window class name, compared instead of the name
+typedef uint16_t ClassAtom;
+
+// Atoms of the shell classes, interned by every cache
+enum ShellClassAtom : ClassAtom
+{
+    CLASS_ATOM_NONE = 0,            // Unknown window, or no class
+    CLASS_ATOM_OTHER,               // Any class beyond the interned ones
+    CLASS_ATOM_PROGMAN,
+    CLASS_ATOM_WORKERW,
+    CLASS_ATOM_DEFVIEW
+};
+
+// Remembers what the window system said about windows, so the hot paths do
+// not ask again.
+//
+// - The class and the owning process never change for the lifetime of a
+//   window. They are kept until the window is destroyed or the cache is
+//   cleared. A handle reused by a window whose destruction went unseen keeps
+//   the facts of the old window until it is evicted, so they are only used
+//   where a wrong answer costs a check and not a wrong decision.
+// - Visibility and the topmost bit do change. They are forgotten on the
+//   window's show and hide events, the topmost bits on any reorder, and all
+//   of them whenever the host calls ExpireVolatile.
+//
+// The cache is bounded; when it is full it starts over.
+class WindowMetadataCache
+{
+public:
+    explicit WindowMetadataCache(size_t capacity) :
+        m_capacity(capacity),
+        m_hits(0),
+        m_misses(0)
+    {
+        // In the order of ShellClassAtom
+        m_classNames.push_back(L"");
+        m_classNames.push_back(L"");
+        m_classNames.push_back(L"Progman");
+        m_classNames.push_back(L"WorkerW");
+        m_classNames.push_back(L"SHELLDLL_DefView");
+    }
+
+    ClassAtom GetClassAtom(IWindowSystem& windowSystem, HWND hwnd)
+    {
+        Entry* entry = Find(hwnd);
+        if (entry && entry->classAtom != CLASS_ATOM_NONE)
+        {
+            ++m_hits;
+            return entry->classAtom;
+        }
+
+        ++m_misses;
+        wchar_t className[MAX_CLASS_NAME];
+        if (windowSystem.GetWindowClass(hwnd, className, MAX_CLASS_NAME) <= 0)
+            return CLASS_ATOM_NONE;
+
+        ClassAtom atom = Intern(className);
+        Insert(hwnd).classAtom = atom;
+        return atom;
+    }
+
+    uint32_t GetProcessId(IWindowSystem& windowSystem, HWND hwnd)
+    {
+        Entry* entry = Find(hwnd);
+        if (entry && entry->processId != 0)
+        {
+            ++m_hits;
+            return entry->processId;
+        }
+
+        ++m_misses;
+        uint32_t processId = windowSystem.GetWindowProcessId(hwnd);
+        if (processId != 0)
+        {
+            Insert(hwnd).processId = processId;
+        }
+        return processId;
+    }
+
+    bool IsVisible(IWindowSystem& windowSystem, HWND hwnd)
+    {
+        return GetFlag(windowSystem, hwnd, VISIBLE_KNOWN, VISIBLE);
+    }
+
+    bool IsTopmost(IWindowSystem& windowSystem, HWND hwnd)
+    {
+        return GetFlag(windowSystem, hwnd, TOPMOST_KNOWN, TOPMOST);
+    }
+
+    void OnWindowEvent(uint32_t event, HWND hwnd)
+    {
+        switch (event)
+        {
+        case WINDOW_EVENT_DESTROY:
+            m_entries.erase(hwnd);
+            break;
+
+        case WINDOW_EVENT_SHOW:
+        case WINDOW_EVENT_HIDE:
+        case WINDOW_EVENT_MINIMIZESTART:
+        case WINDOW_EVENT_MINIMIZEEND:
+            if (Entry* entry = Find(hwnd))
+            {
+                entry->flags &= ~VISIBLE_KNOWN;
+            }
+            break;
+
+        case WINDOW_EVENT_REORDER:
+            ForgetFlags(TOPMOST_KNOWN);
+            break;
+        }
+    }
+
+    // Forget what may have changed without an event reaching us
+    void ExpireVolatile()
+    {
+        ForgetFlags(VISIBLE_KNOWN | TOPMOST_KNOWN);
+    }
+
+    void Clear()
+    {
+        m_entries.clear();
+    }
+
+    size_t GetSize() const { return m_entries.size(); }
+    uint64_t GetHitCount() const { return m_hits; }
+    uint64_t GetMissCount() const { return m_misses; }
+
+private:
+    // Longest class name the window system allows, with the terminator
+    static const int MAX_CLASS_NAME = 257;
+
+    // Beyond this, classes are all CLASS_ATOM_OTHER; only the shell ones are compared
+    static const size_t MAX_CLASSES = 64;
+
+    enum Flags : uint8_t
+    {
+        VISIBLE_KNOWN = 0x1,
+        VISIBLE = 0x2,
+        TOPMOST_KNOWN = 0x4,
+        TOPMOST = 0x8
+    };
+
+    struct Entry
+    {
+        ClassAtom classAtom;
+        uint8_t flags;
+        uint32_t processId;
+    };
+
+    Entry* Find(HWND hwnd)
+    {
+        std::unordered_map<HWND, Entry>::iterator it = m_entries.find(hwnd);
+        return it != m_entries.end() ? &it->second : nullptr;
+    }
+
+    Entry& Insert(HWND hwnd)
+    {
+        if (m_entries.size() >= m_capacity && m_entries.find(hwnd) == m_entries.end())
+        {
+            m_entries.clear();
+        }
+
+        return m_entries[hwnd];
+    }
+
+    bool GetFlag(IWindowSystem& windowSystem, HWND hwnd, uint8_t known, uint8_t value)
+    {
+        Entry* entry = Find(hwnd);
+        if (entry && (entry->flags & known))
+        {
+            ++m_hits;
+            return (entry->flags & value) != 0;
+        }
+
+        ++m_misses;
+        bool result = known == VISIBLE_KNOWN ? windowSystem.IsWindowVisible(hwnd) : windowSystem.IsTopmost(hwnd);
+        Entry& inserted = Insert(hwnd);
+        inserted.flags = static_cast<uint8_t>((inserted.flags & ~value) | known | (result ? value : 0));
+        return result;
+    }
+
+    void ForgetFlags(uint8_t flags)
+    {
+        for (std::unordered_map<HWND, Entry>::value_type& entry : m_entries)
+        {
+            entry.second.flags &= ~flags;
+        }
+    }
+
+    ClassAtom Intern(const wchar_t* className)
+    {
+        for (size_t atom = CLASS_ATOM_PROGMAN; atom < m_classNames.size(); ++atom)
+        {
+            if (m_classNames[atom] == className)
+                return static_cast<ClassAtom>(atom);
+        }
+
+        if (m_classNames.size() >= MAX_CLASSES)
+            return CLASS_ATOM_OTHER;
+
+        m_classNames.push_back(className);
+        return static_cast<ClassAtom>(m_classNames.size() - 1);
+    }
+
+    size_t m_capacity;
+    std::unordered_map<HWND, Entry> m_entries;
+    std::vector<std::wstring> m_classNames;     // Indexed by atom
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Same declaration as <windows.h>, so this header stays usable without it
+struct HWND__;
+typedef HWND__* HWND;
+
+struct WindowInfo
+{
+    HWND hwnd;
+    bool isVisible;
+    bool isMinimized;
+    const void* owner;          // Manager instance that registered the window
+    int32_t layer;              // Z-order layer, higher layers stack above lower ones
+    uint32_t processId;         // Owner of the window, a different one means the handle was reused
+    uint32_t generation;        // Assigned by the registry, new for every registration
+};
+
+// Hidden and minimized windows keep their registration but are not restacked
+inline bool IsPositioned(const WindowInfo& info)
+{
+    return info.isVisible && !info.isMinimized;
+}
+
+// What became of a registered window since it was registered
+struct WindowLifecycle
+{
+    HWND hwnd;
+    uint32_t generation;        // Of the registration the change was observed for
+    bool destroyed;
+    bool isVisible;
+    bool isMinimized;
+};
+
+// Registered windows stored contiguously, with an open-addressing index on top.
+//
+// Lookups hash the handle into a power-of-two table of slots holding positions
+// in the dense array and probe linearly, so a lookup touches one or two cache
+// lines instead of walking tree nodes. Removal swaps the last entry into the
+// hole and uses backward-shift deletion, so the table never collects tombstones.
+//
+// Every new registration gets a generation, so a change observed for a window
+// is not applied to a later registration that reuses the same handle.
+class WindowRegistry
+{
+public:
+    typedef std::vector<WindowInfo>::const_iterator const_iterator;
+
+    WindowRegistry() : m_mask(0), m_shift(64), m_positioned(0), m_lastGeneration(0) {}
+
+    size_t GetSize() const { return m_entries.size(); }
+    size_t GetPositionedCount() const { return m_positioned; }
+    bool IsEmpty() const { return m_entries.empty(); }
+    const_iterator begin() const { return m_entries.begin(); }
+    const_iterator end() const { return m_entries.end(); }
+
+    bool Contains(HWND hwnd) const
+    {
+        return FindSlot(hwnd) != NOT_FOUND;
+    }
+
+    const WindowInfo* Find(HWND hwnd) const
+    {
+        size_t slot = FindSlot(hwnd);
+        return slot != NOT_FOUND ? &m_entries[m_slots[slot]] : nullptr;
+    }
+
+    WindowInfo* Find(HWND hwnd)
+    {
+        size_t slot = FindSlot(hwnd);
+        return slot != NOT_FOUND ? &m_entries[m_slots[slot]] : nullptr;
+    }
+
+    // Insert a window or replace its info, which keeps its generation.
+    // Returns true if the window was new.
+    bool Insert(const WindowInfo& info)
+    {
+        if (WindowInfo* existing = Find(info.hwnd))
+        {
+            uint32_t generation = existing->generation;
+            m_positioned -= IsPositioned(*existing) ? 1 : 0;
+            *existing = info;
+            existing->generation = generation;
+            m_positioned += IsPositioned(info) ? 1 : 0;
+            return false;
+        }
+
+        // Keep the load factor at or below one half
+        if ((m_entries.size() + 1) * 2 > m_slots.size())
+        {
+            Rehash(m_slots.empty() ? 16 : m_slots.size() * 2);
+        }
+
+        m_entries.push_back(info);
+        m_entries.back().generation = ++m_lastGeneration;
+        m_positioned += IsPositioned(info) ? 1 : 0;
+        size_t slot = Hash(info.hwnd);
+        while (m_slots[slot] != EMPTY)
+        {
+            slot = (slot + 1) & m_mask;
+        }
+        m_slots[slot] = static_cast<uint32_t>(m_entries.size() - 1);
+        return true;
+    }
+
+    bool Erase(HWND hwnd)
+    {
+        size_t slot = FindSlot(hwnd);
+        if (slot == NOT_FOUND)
+            return false;
+
+        // Move the last entry into the hole and repoint its slot
+        uint32_t index = m_slots[slot];
+        m_positioned -= IsPositioned(m_entries[index]) ? 1 : 0;
+        uint32_t last = static_cast<uint32_t>(m_entries.size() - 1);
+        if (index != last)
+        {
+            m_entries[index] = m_entries[last];
+            m_slots[FindSlot(m_entries[index].hwnd, last)] = index;
+        }
+        m_entries.pop_back();
+
+        // Backward-shift the following cluster over the freed slot
+        size_t hole = slot;
+        size_t next = (hole + 1) & m_mask;
+        while (m_slots[next] != EMPTY)
+        {
+            size_t home = Hash(m_entries[m_slots[next]].hwnd);
+            if (((next - home) & m_mask) >= ((next - hole) & m_mask))
+            {
+                m_slots[hole] = m_slots[next];
+                hole = next;
+            }
+            next = (next + 1) & m_mask;
+        }
+        m_slots[hole] = EMPTY;
+        return true;
+    }
+
+    // Apply a change of a registered window, unless the window was registered
+    // again since. Destroyed windows are removed. Returns true if anything changed.
+    bool Apply(const WindowLifecycle& change)
+    {
+        WindowInfo* info = Find(change.hwnd);
+        if (!info || info->generation != change.generation)
+            return false;
+
+        if (change.destroyed)
+            return Erase(change.hwnd);
+
+        if (info->isVisible == change.isVisible && info->isMinimized == change.isMinimized)
+            return false;
+
+        m_positioned -= IsPositioned(*info) ? 1 : 0;
+        info->isVisible = change.isVisible;
+        info->isMinimized = change.isMinimized;
+        m_positioned += IsPositioned(*info) ? 1 : 0;
+        return true;
+    }
+
+    void Clear()
+    {
+        m_entries.clear();
+        m_slots.clear();
+        m_mask = 0;
+        m_shift = 64;
+        m_positioned = 0;
+    }
+
+private:
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+    static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+    size_t Hash(HWND hwnd) const
+    {
+        // Fibonacci hashing spreads the low-entropy handle values over the table
+        uint64_t key = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(hwnd));
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> m_shift);
+    }
+
+    size_t FindSlot(HWND hwnd) const
+    {
+        if (m_entries.empty())
+            return NOT_FOUND;
+
+        size_t slot = Hash(hwnd);
+        while (m_slots[slot] != EMPTY)
+        {
+            if (m_entries[m_slots[slot]].hwnd == hwnd)
+                return slot;
+            slot = (slot + 1) & m_mask;
+        }
+        return NOT_FOUND;
+    }
+
+    // Find the slot that points at a specific dense index
+    size_t FindSlot(HWND hwnd, uint32_t index) const
+    {
+        size_t slot = Hash(hwnd);
+        while (m_slots[slot] != index)
+        {
+            slot = (slot + 1) & m_mask;
+        }
+        return slot;
+    }
+
+    void Rehash(size_t capacity)
+    {
+        int bits = 0;
+        while ((static_cast<size_t>(1) << bits) < capacity)
+        {
+            ++bits;
+        }
+
+        m_slots.assign(static_cast<size_t>(1) << bits, static_cast<uint32_t>(EMPTY));
+        m_mask = m_slots.size() - 1;
+        m_shift = 64 - bits;
+
+        for (uint32_t i = 0; i < m_entries.size(); ++i)
+        {
+            size_t slot = Hash(m_entries[i].hwnd);
+            while (m_slots[slot] != EMPTY)
+            {
+                slot = (slot + 1) & m_mask;
+            }
+            m_slots[slot] = i;
+        }
+    }
+
+    std::vector<WindowInfo> m_entries;
+    std::vector<uint32_t> m_slots;
+    size_t m_mask;
+    int m_shift;
+    size_t m_positioned;
+    uint32_t m_lastGeneration;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Same declaration as <windows.h>, so this header stays usable without it
+struct HWND__;
+typedef HWND__* HWND;
+
+// A single z-order change
+struct ZOrderMove
+{
+    enum Placement
+    {
+        After,      // Directly below insertAfter
+        Bottom,     // Bottom of the z-order
+        Topmost     // Top of the topmost band
+    };
+
+    HWND hwnd;
+    HWND insertAfter;
+    Placement placement;
+};
+
+// Window events, with the values of the matching Win32 WinEvent constants
+enum WindowEvent
+{
+    WINDOW_EVENT_FOREGROUND = 0x0003,       // EVENT_SYSTEM_FOREGROUND
+    WINDOW_EVENT_MINIMIZESTART = 0x0016,    // EVENT_SYSTEM_MINIMIZESTART
+    WINDOW_EVENT_MINIMIZEEND = 0x0017,      // EVENT_SYSTEM_MINIMIZEEND
+    WINDOW_EVENT_DESTROY = 0x8001,          // EVENT_OBJECT_DESTROY
+    WINDOW_EVENT_SHOW = 0x8002,             // EVENT_OBJECT_SHOW
+    WINDOW_EVENT_HIDE = 0x8003,             // EVENT_OBJECT_HIDE
+    WINDOW_EVENT_REORDER = 0x8004,          // EVENT_OBJECT_REORDER
+    WINDOW_EVENT_PARENTCHANGE = 0x800F      // EVENT_OBJECT_PARENTCHANGE
+};
+
+// Object and child id of events about the window itself (OBJID_WINDOW, CHILDID_SELF)
+const long WINDOW_OBJECT_SELF = 0;
+
+// Timer tolerances other than a number of milliseconds, with the values of the
+// matching Win32 constants
+const uint32_t TIMER_TOLERANCE_DEFAULT = 0;             // TIMERV_DEFAULT_COALESCING, what the system picks
+const uint32_t TIMER_TOLERANCE_NONE = 0xFFFFFFFE;       // TIMERV_NO_COALESCING, on time
+
+// Where the display is in its composition frames. Z-order changes made within
+// one frame are shown together.
+struct FrameTime
+{
+    uint64_t frame;             // Grows by one every frame
+    uint32_t nextFrameUs;       // Until the next frame starts
+};
+
+// The window-system calls used by the desktop manager
+class IWindowSystem
+{
+public:
+    // Return false from the callback to stop the enumeration
+    typedef bool (*EnumWindowsCallback)(HWND hwnd, void* context);
+
+    typedef void* EventHook;
+
+    // Receives timers and window events, on the thread that set them up
+    class EventSink
+    {
+    public:
+        virtual ~EventSink() {}
+        virtual void OnTimer(uintptr_t id) = 0;
+        virtual void OnWindowEvent(uint32_t event, HWND hwnd, long idObject, long idChild) = 0;
+    };
+
+    virtual ~IWindowSystem() {}
+
+    virtual void SetEventSink(EventSink* sink) = 0;
+
+    // Enumerate top-level windows from the top of the z-order down
+    virtual void EnumTopLevelWindows(EnumWindowsCallback callback, void* context) = 0;
+
+    // Apply one z-order change
+    virtual bool MoveWindow(const ZOrderMove& move) = 0;
+
+    // Apply a sequence of z-order changes as one atomic commit
+    virtual bool CommitZOrder(const ZOrderMove* moves, size_t count) = 0;
+
+    // Neighbours in the z-order, null at either end
+    virtual HWND GetWindowAbove(HWND hwnd) = 0;
+    virtual HWND GetWindowBelow(HWND hwnd) = 0;
+
+    // Window queries
+    virtual HWND GetShellWindow() = 0;
+    virtual HWND FindWindowAfter(HWND parent, HWND childAfter, const wchar_t* className, const wchar_t* title) = 0;
+    virtual int GetWindowClass(HWND hwnd, wchar_t* className, int count) = 0;
+    virtual bool IsWindow(HWND hwnd) = 0;
+    virtual bool IsWindowVisible(HWND hwnd) = 0;
+    virtual bool IsMinimized(HWND hwnd) = 0;
+    virtual bool IsTopmost(HWND hwnd) = 0;
+    virtual uint32_t GetWindowProcessId(HWND hwnd) = 0;
+
+    // True where the shell window itself hosts the desktop icons (Windows 11 24H2+)
+    virtual bool UsesShellWindowAsDesktopIconsHost() = 0;
+
+    // Time and timers. Timers fire on the sink until they are killed, and may
+    // fire up to toleranceMs late so the system can coalesce them with others,
+    // or take one of the TIMER_TOLERANCE values.
+    virtual uint64_t GetTickCount() = 0;
+    virtual bool SetTimer(HWND owner, uintptr_t id, uint32_t ms, uint32_t toleranceMs) = 0;
+    virtual void KillTimer(HWND owner, uintptr_t id) = 0;
+
+    // The composition frame clock of the display
+    virtual FrameTime GetFrameTime() = 0;
+
+    // Deliver events in [eventMin, eventMax] of one process (0 = all) to the sink
+    virtual EventHook HookEvents(uint32_t eventMin, uint32_t eventMax, uint32_t processId, bool skipOwnProcess) = 0;
+    virtual void UnhookEvents(EventHook hook) = 0;
+};
+
+// Collects the z-order changes of a repositioning pass and commits them at once.
+// Moves are applied in the order they were added, so a move may refer to a
+// window placed by an earlier move of the same batch.
+class ZOrderBatch
+{
+public:
+    ZOrderBatch() : m_commits(0), m_fallbacks(0) {}
+
+    void Clear() { m_moves.clear(); }
+    bool IsEmpty() const { return m_moves.empty(); }
+    size_t GetSize() const { return m_moves.size(); }
+    const std::vector<ZOrderMove>& GetMoves() const { return m_moves; }
+
+    void PlaceAfter(HWND hwnd, HWND insertAfter)
+    {
+        ZOrderMove move = { hwnd, insertAfter, ZOrderMove::After };
+        m_moves.push_back(move);
+    }
+
+    void PlaceAtBottom(HWND hwnd)
+    {
+        ZOrderMove move = { hwnd, nullptr, ZOrderMove::Bottom };
+        m_moves.push_back(move);
+    }
+
+    // Commit all moves, falling back to one call per window if the batch is rejected
+    void Commit(IWindowSystem& windowSystem)
+    {
+        if (m_moves.empty())
+            return;
+
+        ++m_commits;
+        if (!windowSystem.CommitZOrder(m_moves.data(), m_moves.size()))
+        {
+            ++m_fallbacks;
+            for (const ZOrderMove& move : m_moves)
+            {
+                windowSystem.MoveWindow(move);
+            }
+        }
+
+        m_moves.clear();
+    }
+
+    size_t GetCommitCount() const { return m_commits; }
+    size_t GetFallbackCount() const { return m_fallbacks; }
+
+private:
+    std::vector<ZOrderMove> m_moves;
+    size_t m_commits;
+    size_t m_fallbacks;
+};
@@ -0,0 +1,321 @@
+#pragma once
+
+#include "WindowSystem.h"
+#include "WindowRegistry.h"
+#include "ZOrderPlanner.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+// The block of registered windows as the last repositioning pass left it,
+// grouped by layer, so that a registration change only restacks the layers it
+// touched.
+//
+// A full pass enumerates the whole stack. A layer pass instead starts at the
+// window the layer has to follow, which is the last window of the nearest
+// higher layer or the anchor, and walks down with GetWindowBelow over the
+// windows of the layer that are still in place. Windows of the layer that are
+// not part of that run are moved right after it. The cost is proportional to
+// the size of the dirty layers, not to the size of the block or the stack.
+//
+// The other layers are trusted to be where they were left. Anything that may
+// have moved them runs a full pass, which stores the block again. Hidden and
+// minimized windows are not part of the block.
+class ZOrderLayers
+{
+public:
+    // Layers from the top of the block down
+    typedef std::map<int32_t, std::vector<HWND>, std::greater<int32_t>> LayerMap;
+
+    // The registered windows a layer pass works on, copied out of the registry
+    // so that no registry snapshot is held while windows are moved
+    class Registered
+    {
+    public:
+        void Read(const WindowRegistry& registry)
+        {
+            m_layers.clear();
+            m_positioned.clear();
+            m_windows.clear();
+            for (const WindowInfo& info : registry)
+            {
+                m_windows.push_back(info.hwnd);
+                if (IsPositioned(info))
+                {
+                    m_layers[info.layer].push_back(info.hwnd);
+                    m_positioned.push_back(std::make_pair(info.hwnd, info.layer));
+                }
+            }
+            std::sort(m_windows.begin(), m_windows.end());
+            std::sort(m_positioned.begin(), m_positioned.end());
+        }
+
+        // Positioned windows by layer, from the top down, in registration order
+        const LayerMap& GetLayers() const { return m_layers; }
+
+        const std::vector<HWND>& GetLayer(int32_t layer) const
+        {
+            static const std::vector<HWND> empty;
+            LayerMap::const_iterator it = m_layers.find(layer);
+            return it != m_layers.end() ? it->second : empty;
+        }
+
+        // Registered, whether positioned or not
+        bool Contains(HWND hwnd) const
+        {
+            return std::binary_search(m_windows.begin(), m_windows.end(), hwnd);
+        }
+
+        bool IsPlaced(HWND hwnd) const
+        {
+            return Find(hwnd) != m_positioned.end();
+        }
+
+        bool IsInLayer(HWND hwnd, int32_t layer) const
+        {
+            std::vector<std::pair<HWND, int32_t>>::const_iterator it = Find(hwnd);
+            return it != m_positioned.end() && it->second == layer;
+        }
+
+    private:
+        std::vector<std::pair<HWND, int32_t>>::const_iterator Find(HWND hwnd) const
+        {
+            std::vector<std::pair<HWND, int32_t>>::const_iterator it = std::lower_bound(
+                m_positioned.begin(), m_positioned.end(), std::make_pair(hwnd, INT32_MIN));
+            return it != m_positioned.end() && it->first == hwnd ? it : m_positioned.end();
+        }
+
+        LayerMap m_layers;
+        std::vector<std::pair<HWND, int32_t>> m_positioned;     // Sorted by handle
+        std::vector<HWND> m_windows;                            // Sorted
+    };
+
+    ZOrderLayers() : m_anchor(nullptr), m_valid(false) {}
+
+    void Invalidate()
+    {
+        m_layers.clear();
+        m_valid = false;
+    }
+
+    // True if the stored block was placed next to anchor (null for the bottom)
+    bool IsValid(HWND anchor) const
+    {
+        return m_valid && m_anchor == anchor;
+    }
+
+    // Remember the block placed by a full pass
+    void Store(HWND anchor, const std::vector<ZOrderPlanner::PlacedWindow>& block)
+    {
+        m_layers.clear();
+        for (const ZOrderPlanner::PlacedWindow& window : block)
+        {
+            m_layers[window.layer].push_back(window.hwnd);
+        }
+        m_anchor = anchor;
+        m_valid = true;
+    }
+
+    // Drop a destroyed window, so a window registered later under the same
+    // handle makes its layer dirty
+    void Forget(HWND hwnd)
+    {
+        for (LayerMap::value_type& layer : m_layers)
+        {
+            std::vector<HWND>::iterator it = std::find(layer.second.begin(), layer.second.end(), hwnd);
+            if (it != layer.second.end())
+            {
+                layer.second.erase(it);
+                return;
+            }
+        }
+    }
+
+    // List the layers that differ from the stored block, from the top down
+    void GetDirtyLayers(const Registered& windows, std::vector<int32_t>& dirty) const
+    {
+        const LayerMap& current = windows.GetLayers();
+        dirty.clear();
+
+        LayerMap::const_iterator stored = m_layers.begin();
+        LayerMap::const_iterator registered = current.begin();
+        while (stored != m_layers.end() || registered != current.end())
+        {
+            if (registered == current.end() || (stored != m_layers.end() && stored->first > registered->first))
+            {
+                dirty.push_back(stored->first);
+                ++stored;
+            }
+            else if (stored == m_layers.end() || registered->first > stored->first)
+            {
+                dirty.push_back(registered->first);
+                ++registered;
+            }
+            else
+            {
+                if (!IsSameSet(stored->second, registered->second))
+                {
+                    dirty.push_back(stored->first);
+                }
+                ++stored;
+                ++registered;
+            }
+        }
+    }
+
+    // Restack one layer between its neighbours. Returns false if the layer
+    // cannot be placed on its own, in which case a full pass is needed.
+    bool PlaceLayer(IWindowSystem& windowSystem, const Registered& registered, int32_t layer, ZOrderBatch& batch)
+    {
+        const std::vector<HWND>& windows = registered.GetLayer(layer);
+        if (windows.empty())
+        {
+            m_layers.erase(layer);
+            return true;
+        }
+
+        // Windows that were only unregistered or hidden leave the rest of the layer in place
+        LayerMap::iterator stored = m_layers.find(layer);
+        if (stored != m_layers.end() && IsSubset(windows, stored->second))
+        {
+            std::vector<HWND>& placed = stored->second;
+            placed.erase(std::remove_if(placed.begin(), placed.end(), [&registered, layer](HWND hwnd)
+            {
+                return !registered.IsInLayer(hwnd, layer);
+            }), placed.end());
+            return true;
+        }
+
+        HWND upper = GetUpperNeighbour(layer);
+        std::vector<HWND> placed;
+        placed.reserve(windows.size());
+
+        if (upper)
+        {
+            // A neighbour that was unregistered since may be gone
+            if (upper != m_anchor && !registered.IsPlaced(upper))
+                return false;
+
+            // Windows of the layer directly below the neighbour are in place
+            HWND hwnd = upper;
+            while (placed.size() < windows.size() && (hwnd = windowSystem.GetWindowBelow(hwnd)) != nullptr &&
+                registered.IsInLayer(hwnd, layer))
+            {
+                placed.push_back(hwnd);
+            }
+
+            HWND insertAfter = placed.empty() ? upper : placed.back();
+            PlaceRest(windows, placed, insertAfter, batch);
+        }
+        else
+        {
+            // Top of a block at the bottom of the z-order: work up from the layer
+            // below, or from the lowest window of the layer if it is the only one
+            HWND lower = GetLowerNeighbour(layer);
+            std::vector<HWND> run;
+            if (!lower && stored != m_layers.end() && !stored->second.empty() &&
+                registered.IsInLayer(stored->second.back(), layer))
+            {
+                lower = stored->second.back();
+                run.push_back(lower);
+            }
+            if (!lower || !registered.IsPlaced(lower))
+                return false;
+
+            HWND hwnd = lower;
+            while (run.size() < windows.size() && (hwnd = windowSystem.GetWindowAbove(hwnd)) != nullptr &&
+                registered.IsInLayer(hwnd, layer))
+            {
+                run.push_back(hwnd);
+            }
+
+            // The rest goes between the run and the window above it, which must not be ours
+            if (!hwnd || registered.Contains(hwnd))
+                return false;
+
+            PlaceRest(windows, run, hwnd, batch, &placed);
+            placed.insert(placed.end(), run.rbegin(), run.rend());
+        }
+
+        m_layers[layer] = std::move(placed);
+        return true;
+    }
+
+    // False for the top layer of a block at the bottom, which is placed from below
+    bool HasUpperNeighbour(int32_t layer) const
+    {
+        return GetUpperNeighbour(layer) != nullptr;
+    }
+
+    const LayerMap& GetLayers() const { return m_layers; }
+
+private:
+    static bool IsSameSet(std::vector<HWND> a, std::vector<HWND> b)
+    {
+        if (a.size() != b.size())
+            return false;
+
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        return a == b;
+    }
+
+    static bool IsSubset(std::vector<HWND> subset, std::vector<HWND> set)
+    {
+        std::sort(subset.begin(), subset.end());
+        std::sort(set.begin(), set.end());
+        return std::includes(set.begin(), set.end(), subset.begin(), subset.end());
+    }
+
+    // Place the windows that are not in run after insertAfter, in registration order.
+    // They are appended to placed, or to run if placed is null.
+    static void PlaceRest(const std::vector<HWND>& windows, std::vector<HWND>& run, HWND insertAfter,
+        ZOrderBatch& batch, std::vector<HWND>* placed = nullptr)
+    {
+        std::vector<HWND> sorted(run);
+        std::sort(sorted.begin(), sorted.end());
+
+        std::vector<HWND>& target = placed ? *placed : run;
+        for (HWND hwnd : windows)
+        {
+            if (!std::binary_search(sorted.begin(), sorted.end(), hwnd))
+            {
+                batch.PlaceAfter(hwnd, insertAfter);
+                insertAfter = hwnd;
+                target.push_back(hwnd);
+            }
+        }
+    }
+
+    // Last window of the nearest higher layer, or the anchor
+    HWND GetUpperNeighbour(int32_t layer) const
+    {
+        HWND upper = m_anchor;
+        for (LayerMap::const_iterator it = m_layers.begin(); it != m_layers.end() && it->first > layer; ++it)
+        {
+            if (!it->second.empty())
+            {
+                upper = it->second.back();
+            }
+        }
+        return upper;
+    }
+
+    // First window of the nearest lower layer
+    HWND GetLowerNeighbour(int32_t layer) const
+    {
+        for (LayerMap::const_iterator it = m_layers.upper_bound(layer); it != m_layers.end(); ++it)
+        {
+            if (!it->second.empty())
+                return it->second.front();
+        }
+        return nullptr;
+    }
+
+    LayerMap m_layers;
+    HWND m_anchor;
+    bool m_valid;
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "WindowSystem.h"
+#include <algorithm>
+#include <vector>
+
+// Computes the smallest set of z-order moves that brings the registered windows
+// into one contiguous block, either directly below an anchor window or at the
+// bottom of the z-order.
+//
+// The planner is fed the current stack from the top down. In the block higher
+// layers come first, and the windows of a layer keep their current relative
+// order. Only the run of registered windows that already sits next to the
+// anchor (or at the bottom) can stay where it is; of that run the longest
+// subsequence already in block order is kept and everything else is moved.
+// A stack that is already in place costs no window-manager calls at all.
+//
+// Once every registered window has been seen the rest of the stack can no longer
+// change the plan, so Observe tells the caller to stop enumerating early.
+//
+// Some windows stay below everything else, such as the shell's. A block at the
+// bottom sits right above them, so they are fed with ObserveFloor and do not
+// count as windows below the block.
+class ZOrderPlanner
+{
+public:
+    struct PlacedWindow
+    {
+        HWND hwnd;
+        int32_t layer;
+    };
+
+    ZOrderPlanner() :
+        m_expected(0),
+        m_anchor(nullptr),
+        m_aboveRun(nullptr),
+        m_runStart(0),
+        m_runEnd(0),
+        m_runOpen(false),
+        m_bottom(true),
+        m_onFloor(false),
+        m_floor(nullptr)
+    {
+    }
+
+    // Start a pass that places the block below anchor, or at the bottom if anchor is null.
+    // expected is the number of registered windows the stack can contain.
+    void Begin(HWND anchor, size_t expected)
+    {
+        m_windows.clear();
+        m_windows.reserve(expected);
+        m_layers.clear();
+        m_layers.reserve(expected);
+        m_block.clear();
+        m_expected = expected;
+        m_anchor = anchor;
+        m_aboveRun = nullptr;
+        m_runStart = 0;
+        m_runEnd = 0;
+        m_runOpen = false;
+        m_bottom = (anchor == nullptr);
+        m_onFloor = false;
+        m_floor = nullptr;
+    }
+
+    // Feed the next window of the current stack, top-most first.
+    // Returns false once the remaining windows cannot change the plan.
+    bool Observe(HWND hwnd, bool registered, int32_t layer = 0)
+    {
+        if (m_bottom)
+        {
+            if (registered)
+            {
+                // Registered windows below the floor start a new run
+                if (m_onFloor)
+                {
+                    m_runStart = m_windows.size();
+                    m_aboveRun = m_floor;
+                    m_onFloor = false;
+                }
+                m_windows.push_back(hwnd);
+                m_layers.push_back(layer);
+                m_runEnd = m_windows.size();
+                return true;
+            }
+
+            // Anything registered above this window is not at the bottom
+            m_onFloor = false;
+            m_runStart = m_windows.size();
+            m_runEnd = m_runStart;
+            m_aboveRun = (m_runStart == m_expected) ? nullptr : hwnd;
+            return m_windows.size() < m_expected;
+        }
+
+        if (hwnd == m_anchor)
+        {
+            m_runStart = m_windows.size();
+            m_runEnd = m_runStart;
+            m_runOpen = true;
+            return m_windows.size() < m_expected;
+        }
+
+        if (registered)
+        {
+            m_windows.push_back(hwnd);
+            m_layers.push_back(layer);
+            if (m_runOpen)
+            {
+                m_runEnd = m_windows.size();
+            }
+        }
+        else
+        {
+            m_runOpen = false;
+        }
+
+        // Past this point the anchor is either behind us or below every registered window
+        return m_windows.size() < m_expected;
+    }
+
+    // Feed a window of the current stack that may stay below the block
+    bool ObserveFloor(HWND hwnd)
+    {
+        if (!m_bottom || m_runEnd == m_runStart)
+            return Observe(hwnd, false);
+
+        m_onFloor = true;
+        m_floor = hwnd;
+        return m_windows.size() < m_expected;
+    }
+
+    // Append the moves that complete the block to batch
+    void Plan(ZOrderBatch& batch)
+    {
+        OrderBlock();
+
+        // In bottom mode an empty run leaves the first moved window to go to the very bottom
+        HWND insertAfter = m_bottom ? m_aboveRun : m_anchor;
+        if (!insertAfter && !m_kept.empty() && !m_kept[m_order[0]])
+        {
+            // Nothing to place the top of the block after, so restack all of it from the bottom
+            m_kept.assign(m_windows.size(), false);
+        }
+
+        for (size_t index : m_order)
+        {
+            if (!m_kept[index])
+            {
+                if (insertAfter)
+                {
+                    batch.PlaceAfter(m_windows[index], insertAfter);
+                }
+                else
+                {
+                    batch.PlaceAtBottom(m_windows[index]);
+                }
+            }
+            insertAfter = m_windows[index];
+
+            PlacedWindow placed = { m_windows[index], m_layers[index] };
+            m_block.push_back(placed);
+        }
+    }
+
+    // Registered windows in their current z-order
+    const std::vector<HWND>& GetWindows() const { return m_windows; }
+
+    // The block as the last plan leaves it, top-most first
+    const std::vector<PlacedWindow>& GetBlock() const { return m_block; }
+
+    // Number of windows that are already in place
+    size_t GetKeptCount() const
+    {
+        return static_cast<size_t>(std::count(m_kept.begin(), m_kept.end(), true));
+    }
+
+private:
+    // Sort the windows into block order and pick the ones that can stay
+    void OrderBlock()
+    {
+        size_t count = m_windows.size();
+        m_order.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_order[i] = i;
+        }
+
+        const std::vector<int32_t>& layers = m_layers;
+        std::stable_sort(m_order.begin(), m_order.end(), [&layers](size_t a, size_t b)
+        {
+            return layers[a] > layers[b];
+        });
+
+        std::vector<size_t> rank(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            rank[m_order[i]] = i;
+        }
+
+        // Longest increasing subsequence of the block positions along the run.
+        // tails[k] is the run index ending the best subsequence of length k + 1.
+        const size_t none = static_cast<size_t>(-1);
+        m_kept.assign(count, false);
+        std::vector<size_t> tails;
+        std::vector<size_t> previous(count, none);
+        for (size_t i = m_runStart; i < m_runEnd; ++i)
+        {
+            size_t length = std::lower_bound(tails.begin(), tails.end(), i,
+                [&rank](size_t tail, size_t current) { return rank[tail] < rank[current]; }) - tails.begin();
+
+            previous[i] = length > 0 ? tails[length - 1] : none;
+            if (length == tails.size())
+            {
+                tails.push_back(i);
+            }
+            else
+            {
+                tails[length] = i;
+            }
+        }
+
+        for (size_t i = tails.empty() ? none : tails.back(); i != none; i = previous[i])
+        {
+            m_kept[i] = true;
+        }
+    }
+
+    std::vector<HWND> m_windows;
+    std::vector<int32_t> m_layers;
+    std::vector<size_t> m_order;
+    std::vector<bool> m_kept;
+    std::vector<PlacedWindow> m_block;
+    size_t m_expected;
+    HWND m_anchor;
+    HWND m_aboveRun;
+    size_t m_runStart;
+    size_t m_runEnd;
+    bool m_runOpen;
+    bool m_bottom;
+    bool m_onFloor;         // Floor windows were seen below the run
+    HWND m_floor;
+};
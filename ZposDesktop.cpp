@@ -1,137 +1,449 @@
 #include "pch.h"
 #include "framework.h"
 #include "ZposDesktop.h"
-#include <map>
+#include "DesktopController.h"
+#include "Win32WindowSystem.h"
+#include "WindowRegistry.h"
+#include "ServiceThread.h"
+#include "SnapshotCell.h"
+#include "StateSnapshot.h"
+#include "NotificationPipeline.h"
+#include "PerfCounters.h"
+#include "TraceRecorder.h"
+#include "CoordinatorProtocol.h"
+#include "SharedEngine.h"
+#include <wtsapi32.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <mutex>
 #include <vector>
 #include <memory>
 
-#define ZPOS_FLAGS (SWP_NOMOVE | SWP_NOSIZE | SWP_NOOWNERZORDER | SWP_NOACTIVATE | SWP_NOSENDCHANGING)
+#define WM_ZPOS_WAKE (WM_APP + 1)
+#define WM_ZPOS_REFRESH (WM_APP + 2)
+#define WM_ZPOS_INVOKE (WM_APP + 3)
+#define WM_ZPOS_INPUT (WM_APP + 4)
 
-enum TIMER
+// Width of the show desktop button where the taskbar does not expose it as a window
+#define SHOW_DESKTOP_BUTTON_SIZE 12
+
+// Shared by the processes of a session in coordinated mode
+#define ZPOS_COORDINATOR_PAGE L"Local\\ZposDesktopCoordinator"
+#define ZPOS_COORDINATOR_MESSAGE L"ZposDesktopCoordinator"
+
+static TraceRegistration GetTraceRegistration(const WindowInfo& info)
 {
-    TIMER_SHOWDESKTOP = 1,
-    TIMER_RESUME = 2
-};
+    uint32_t flags = (info.isVisible ? TRACE_WINDOW_VISIBLE : 0) | (info.isMinimized ? TRACE_WINDOW_MINIMIZED : 0);
+    TraceRegistration registration = { TraceHandle(info.hwnd), info.layer, info.processId, flags, 0 };
+    return registration;
+}
 
-enum INTERVAL
+// Window handles are stored as 64-bit values in the coordinator page
+static uint64_t ToSharedHandle(HWND hwnd)
 {
-    INTERVAL_SHOWDESKTOP = 250,
-    INTERVAL_RESTOREWINDOWS = 100,
-    INTERVAL_RESUME = 1000
-};
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(hwnd));
+}
 
-struct WindowInfo
+static HWND FromSharedHandle(uint64_t handle)
 {
-    HWND hwnd;
-    bool isVisible;
-};
+    return reinterpret_cast<HWND>(static_cast<uintptr_t>(handle));
+}
 
-class CZposDesktop::Impl
+class DesktopEngine
 {
 public:
-    Impl() :
+    DesktopEngine() :
         m_hInstance(nullptr),
+        m_flags(ZD_FLAG_NONE),
         m_hSystemWindow(nullptr),
         m_hHelperWindow(nullptr),
-        m_hWinEventHook(nullptr),
-        m_showDesktop(false),
-        m_callback(nullptr)
+        m_taskbarCreatedMessage(0),
+        m_sessionNotification(false),
+        m_displayNotification(nullptr),
+        m_windowSystem(new Win32WindowSystem()),
+        m_recordingSystem(*m_windowSystem),
+        m_controller(m_recordingSystem, m_windows),
+        m_ownerThreadId(0),
+        m_refreshRequests(0),
+        m_windowClass(0),
+        m_keyboardHook(nullptr),
+        m_mouseHook(nullptr),
+        m_pointerInTriggerArea(false),
+        m_coordinatorMapping(nullptr),
+        m_coordinatorPage(nullptr),
+        m_coordinatorMessage(0),
+        m_following(false),
+        m_leaderEpoch(0),
+        m_leaderProcess(nullptr),
+        m_leaderWait(nullptr),
+        m_stateChanges(0),
+        m_followerHook(nullptr),
+        m_resendPending(false),
+        m_trace(nullptr)
     {
+        m_triggerArea = InputRect();
+
+        // Callbacks run on the dispatcher, a slow one does not hold up detection
+        m_controller.SetStateChangedHandler([this](bool showDesktop, uint64_t latencyMs)
+        {
+            OnStateChanged(showDesktop, latencyMs);
+        });
+
+        // Destroyed windows are unregistered, hidden and minimized ones are skipped
+        m_controller.SetWindowLifecycleHandler([this](const WindowLifecycle& change)
+        {
+            ApplyWindowLifecycle(change);
+        });
     }
 
-    ~Impl()
+    ~DesktopEngine()
     {
-        Finalize();
+        Shutdown();
     }
 
-    bool Initialize(HINSTANCE hInstance);
-    void Finalize();
-    bool RegisterWindow(HWND hwnd);
-    bool UnregisterWindow(HWND hwnd);
+    // The engine is shared by all manager instances of the process, see SharedEngine
+    static DesktopEngine* Acquire(HINSTANCE hInstance, DWORD flags);
+    static void Release(DesktopEngine* engine, const void* owner);
+
+    // Windows and callbacks are tagged with the instance that owns them
+    // Registration changes are published at once. reposition = false leaves the
+    // repositioning pass to the caller, so several changes can share one pass.
+    size_t RegisterWindows(const void* owner, const HWND* hwnds, size_t count, int32_t layer, bool reposition);
+    size_t UnregisterWindows(const void* owner, const HWND* hwnds, size_t count);
+    bool SetWindowLayer(const void* owner, HWND hwnd, int32_t layer, bool reposition);
+    void RemoveOwner(const void* owner);
     DesktopState GetDesktopState() const;
-    void SetDesktopStateCallback(DesktopStateCallback callback);
+    // The state is process-wide and outlives the engine, so waiters never see it go away
+    static ZposDesktopStateSnapshot GetStateSnapshot();
+    static bool WaitForStateChange(UINT32 lastSequence, DWORD timeoutMs, ZposDesktopStateSnapshot* snapshot);
+    void SetDesktopStateCallback(const void* owner, DesktopStateCallback callback);
+    void SetCallbackCoalescing(const void* owner, DWORD windowMs);
+    void GetNotificationCounts(const void* owner, uint64_t& dropped, uint64_t& coalesced);
     void RefreshWindowPositions();
-    bool IsWindowRegistered(HWND hwnd) const;
+    // Only restacks the layers whose windows changed
+    void RefreshDirtyLayers();
+    bool IsWindowRegistered(const void* owner, HWND hwnd) const;
+    void GetProbeState(DWORD& intervalMs, bool& suspended) const;
+
+    // Record everything the engine sees and does into a trace file. Starting
+    // restarts detection so the trace holds everything needed to replay it.
+    bool StartTrace(const wchar_t* path);
+    bool StopTrace();
 
 private:
+    bool Initialize(HINSTANCE hInstance, DWORD flags);
+    void Shutdown();
+
+    bool Initialize(HINSTANCE hInstance);
+    void Finalize();
+
     static LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
-    static void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook, DWORD event, HWND hwnd,
-        LONG idObject, LONG idChild, DWORD dwEventThread, DWORD dwmsEventTime);
 
-    // The context for the window enumeration.
-    struct EnumWindowsContext
+    // Runs command on the thread that owns our windows and waits for it
+    void RunOnOwnerThread(const std::function<void()>& command);
+    void Refresh(bool dirtyLayersOnly);
+    void ApplyRefreshRequests();
+    // Passes are requested from the controller, which merges them
+    void Reposition();
+    void RepositionDirtyLayers();
+    void ApplyWindowLifecycle(const WindowLifecycle& change);
+    void AttachTrace(TraceRecorder* recorder);
+    void DetachTrace();
+    void RecordMessage(TraceMessage message);
+    void OnStateChanged(bool showDesktop, uint64_t latencyMs);
+    static void PublishState(bool showDesktop);
+    static ZposDesktopStateSnapshot ToStateSnapshot(const StateSnapshotCell::Snapshot& snapshot);
+
+    // Detection and, with ZD_FLAG_INPUT_TRIGGERS, the input hooks that let it
+    // get ready for Show Desktop before the shell acts
+    void StartController();
+    void StartInputTriggers();
+    void StopInputTriggers();
+    void UpdateTriggerArea();
+    void OnInput(WPARAM wParam, LPARAM lParam);
+    static void PostInput(InputEvent::Type type, uint32_t key, POINT pt);
+    static LRESULT CALLBACK KeyboardProc(int code, WPARAM wParam, LPARAM lParam);
+    static LRESULT CALLBACK MouseProc(int code, WPARAM wParam, LPARAM lParam);
+
+    // Coordinated mode, see CoordinatorProtocol.h. The leader runs the controller
+    // for the windows of all processes; a follower keeps its registry, sends it
+    // to the leader and takes over when the leader goes away.
+    enum CoordinatorMessage
+    {
+        COORDINATOR_WAKE = 1,       // To the leader: commands are waiting
+        COORDINATOR_STATE,          // To followers: the desktop state changed
+        COORDINATOR_LEADER,         // To followers: the leader changed or went away
+        COORDINATOR_RESEND          // To itself: commands are waiting for room in the ring
+    };
+
+    // Owner tag of the windows of a follower
+    struct RemoteOwner
     {
-        // We need a pointer to the Impl instance to call IsWindowRegistered
-        const CZposDesktop::Impl* instance;
-        // A pointer to the vector we want to populate
-        std::vector<HWND>* windowList;
+        DWORD processId;
     };
 
-    // The callback function for EnumWindows.
-    // This function will be called for each top-level window on the screen.
-    static BOOL CALLBACK EnumRegisteredWindowsProc(HWND hwnd, LPARAM lParam)
+    bool OpenCoordinator();
+    void CloseCoordinator();
+    void Lead();
+    void Follow();
+    void OnCoordinatorMessage(WPARAM code);
+    void OnLeaderChanged();
+    void ProcessCommands();
+    static CoordinatorCommand MakeCommand(CoordinatorOp op, HWND hwnd, int32_t layer);
+    bool SendToLeader(const std::vector<CoordinatorCommand>& commands);
+    bool PushUnsent();
+    void RecordRegistrations(std::vector<TraceRegistration>& registrations);
+    void RecordUnregistrations(std::vector<uint64_t>& handles);
+    void ResendToLeader();
+    void DropUnsent();
+    void WakeLeader();
+    void NotifyFollowers(CoordinatorMessage message);
+    void WatchLeader();
+    void UnwatchLeader();
+    const void* GetRemoteOwner(DWORD processId);
+    const WindowInfo* InsertWindow(WindowRegistry& registry, const void* owner, HWND hwnd, int32_t layer);
+    static bool IsProcessAlive(uint32_t processId, void* context);
+    static void CALLBACK OnLeaderExited(PVOID context, BOOLEAN timedOut);
+    void OnFollowerWindowDestroyed(HWND hwnd);
+    void UnhookFollowerEvents();
+    static void CALLBACK FollowerEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd,
+        LONG idObject, LONG idChild, DWORD eventThread, DWORD eventTime);
+
+    // Message pump of the service thread
+    class ServicePump : public ServiceThread::Pump
     {
-        // The context is passed as lParam.
-        EnumWindowsContext* context = reinterpret_cast<EnumWindowsContext*>(lParam);
-        if (context && context->instance && context->windowList)
+    public:
+        ServicePump(DesktopEngine* engine, HINSTANCE hInstance) :
+            m_engine(engine),
+            m_hInstance(hInstance),
+            m_threadId(0)
         {
-            // Check if the window is one we are managing.
-            if (context->instance->IsWindowRegistered(hwnd))
-            {
-                // If so, add it to our list.
-                context->windowList->push_back(hwnd);
-            }
         }
-        return TRUE; // Continue enumeration.
-    }
 
-    HWND GetDefaultShellWindow();
-    HWND GetDesktopIconsHostWindow();
-    bool ShouldUseShellWindowAsDesktopIconsHost();
-    bool BelongToSameProcess(HWND hwndA, HWND hwndB);
-    void PrepareHelperWindow(HWND desktopIconsHostWindow);
-    bool CheckDesktopState(HWND desktopIconsHostWindow);
-    void PositionWindowsOnDesktop();
+        bool Start() override;
+        bool RunOnce() override;
+        void Wake() override;
+        void Stop() override;
+
+    private:
+        DesktopEngine* m_engine;
+        HINSTANCE m_hInstance;
+        DWORD m_threadId;
+    };
 
     HINSTANCE m_hInstance;
+    DWORD m_flags;
     HWND m_hSystemWindow;
     HWND m_hHelperWindow;
-    HWINEVENTHOOK m_hWinEventHook;
-    bool m_showDesktop;
-    DesktopStateCallback m_callback;
-    std::map<HWND, WindowInfo> m_windows;
+    UINT m_taskbarCreatedMessage;
+
+    // Lock and display state notifications, which stop the periodic probes
+    bool m_sessionNotification;
+    HPOWERNOTIFY m_displayNotification;
 
-    static Impl* s_instance;
+    // Readable from any thread without locks. The registry is replaced
+    // copy-on-write; writers are serialized by m_writeLock.
+    SnapshotCell<WindowRegistry> m_windows;
+    std::mutex m_writeLock;
+
+    // Detection and repositioning, through the window-system backend
+    std::unique_ptr<IWindowSystem> m_windowSystem;
+    RecordingWindowSystem m_recordingSystem;
+    DesktopController m_controller;
+    DWORD m_ownerThreadId;
+
+    // Refreshes asked for on other threads, not yet seen by the owner thread
+    enum RefreshRequest
+    {
+        REFRESH_DIRTY_LAYERS = 1,
+        REFRESH_FULL = 2
+    };
+
+    std::atomic<uint32_t> m_refreshRequests;
+
+    ATOM m_windowClass;
+
+    // Used on the service thread, which the hooks are called on
+    HHOOK m_keyboardHook;
+    HHOOK m_mouseHook;
+    InputRect m_triggerArea;
+    bool m_pointerInTriggerArea;
+
+    // Coordinated mode. m_following is read from any thread; the rest is used
+    // on the owner thread, and m_remoteOwners under m_writeLock.
+    HANDLE m_coordinatorMapping;
+    CoordinatorPage* m_coordinatorPage;
+    CoordinatorChannel m_coordinator;
+    UINT m_coordinatorMessage;
+    std::atomic<bool> m_following;
+    uint32_t m_leaderEpoch;
+    HANDLE m_leaderProcess;
+    HANDLE m_leaderWait;
+    uint64_t m_stateChanges;
+    std::vector<std::unique_ptr<RemoteOwner>> m_remoteOwners;
+    HWINEVENTHOOK m_followerHook;
+
+    // Commands for the leader are pushed under m_sendLock, which is taken before
+    // m_writeLock is released so they keep the order of the changes. Those that
+    // found the ring full wait in m_unsent and go before any later ones.
+    std::mutex m_sendLock;
+    std::vector<CoordinatorCommand> m_unsent;
+    bool m_resendPending;
+
+    std::unique_ptr<ServicePump> m_servicePump;
+    ServiceThread m_serviceThread;
+
+    // State changes are delivered to the callbacks by the notification pipeline,
+    // off the detection path
+    struct Listener
+    {
+        const void* owner;
+        DesktopStateCallback callback;
+        DWORD coalesceWindowMs;
+        NotificationPipeline::SubscriberId subscriber;
+    };
+
+    Listener& GetListener(const void* owner);
+
+    NotificationPipeline m_notifications;
+    std::vector<Listener> m_listeners;
+    std::mutex m_listenerLock;
+
+    // The recorder in use, changed on the owner thread under m_writeLock
+    TraceRecorder* m_trace;
+    std::unique_ptr<TraceRecorder> m_traceRecorder;
+    std::mutex m_traceLock;
+
+    // Used by the window procedure
+    static DesktopEngine* s_engine;
+
+    // Written on the owner thread of the engine in use, read from any thread
+    static StateSnapshotCell s_state;
+
+    // Shared engine and the number of instances using it
+    static SharedEngine<DesktopEngine> s_shared;
 };
 
-CZposDesktop::Impl* CZposDesktop::Impl::s_instance = nullptr;
+DesktopEngine* DesktopEngine::s_engine = nullptr;
+SharedEngine<DesktopEngine> DesktopEngine::s_shared;
+StateSnapshotCell DesktopEngine::s_state;
+
+DesktopEngine* DesktopEngine::Acquire(HINSTANCE hInstance, DWORD flags)
+{
+    return s_shared.Acquire(flags, [hInstance, flags]()
+    {
+        std::unique_ptr<DesktopEngine> engine(new DesktopEngine());
+        if (!engine->Initialize(hInstance, flags))
+        {
+            engine.reset();
+        }
+        return engine;
+    });
+}
+
+void DesktopEngine::Release(DesktopEngine* engine, const void* owner)
+{
+    s_shared.Release(engine, owner);
+}
+
+bool DesktopEngine::ServicePump::Start()
+{
+    m_threadId = GetCurrentThreadId();
+    return m_engine->Initialize(m_hInstance);
+}
+
+bool DesktopEngine::ServicePump::RunOnce()
+{
+    MSG msg;
+    if (GetMessage(&msg, nullptr, 0, 0) <= 0)
+        return false;
+
+    // Wake-ups only make the service thread look at its command queue
+    if (msg.hwnd == nullptr && msg.message == WM_ZPOS_WAKE)
+        return true;
+
+    TranslateMessage(&msg);
+    DispatchMessage(&msg);
+    return true;
+}
+
+void DesktopEngine::ServicePump::Wake()
+{
+    PostThreadMessage(m_threadId, WM_ZPOS_WAKE, 0, 0);
+}
+
+void DesktopEngine::ServicePump::Stop()
+{
+    m_engine->Finalize();
+}
+
+bool DesktopEngine::Initialize(HINSTANCE hInstance, DWORD flags)
+{
+    if (m_hInstance != nullptr || m_serviceThread.IsRunning())
+        return false; // Already initialized
+
+    // Low-level hooks stall all input of the session while the thread they are
+    // called on is busy, so they only run on the service thread
+    if ((flags & ZD_FLAG_INPUT_TRIGGERS) && !(flags & ZD_FLAG_SERVICE_THREAD))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return false;
+    }
+
+    m_flags = flags;
+    if (flags & ZD_FLAG_SERVICE_THREAD)
+    {
+        // Windows, hooks and timers all belong to the thread that creates them
+        m_servicePump.reset(new ServicePump(this, hInstance));
+        return m_serviceThread.Start(m_servicePump.get());
+    }
+
+    return Initialize(hInstance);
+}
+
+void DesktopEngine::Shutdown()
+{
+    if (m_flags & ZD_FLAG_SERVICE_THREAD)
+    {
+        // Finalize runs on the service thread before it exits, also when the
+        // thread already ended by itself
+        m_serviceThread.Stop();
+    }
+    else
+    {
+        Finalize();
+    }
+}
 
-bool CZposDesktop::Impl::Initialize(HINSTANCE hInstance)
+bool DesktopEngine::Initialize(HINSTANCE hInstance)
 {
     if (m_hInstance != nullptr)
         return false; // Already initialized
 
     m_hInstance = hInstance;
-    s_instance = this;
+    m_ownerThreadId = GetCurrentThreadId();
+    s_engine = this;
 
     WNDCLASS wc = { 0 };
     wc.lpfnWndProc = WndProc;
     wc.hInstance = hInstance;
-    wc.lpszClassName = L"ZposDesktopSystem";
-    ATOM className = RegisterClass(&wc);
+    wc.lpszClassName = ZPOS_SYSTEM_WINDOW_CLASS;
+    m_windowClass = RegisterClass(&wc);
 
     m_hSystemWindow = CreateWindowEx(
         WS_EX_TOOLWINDOW,
-        MAKEINTATOM(className),
-        L"ZposSystem",
+        MAKEINTATOM(m_windowClass),
+        ZPOS_SYSTEM_WINDOW_TITLE,
         WS_POPUP | WS_DISABLED,
         CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
         nullptr, nullptr, hInstance, nullptr);
 
     m_hHelperWindow = CreateWindowEx(
         WS_EX_TOOLWINDOW,
-        MAKEINTATOM(className),
-        L"ZposPositioningHelper",
+        MAKEINTATOM(m_windowClass),
+        ZPOS_HELPER_WINDOW_TITLE,
         WS_POPUP | WS_DISABLED,
         CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
         nullptr, nullptr, hInstance, nullptr);
@@ -139,34 +451,63 @@ bool CZposDesktop::Impl::Initialize(HINSTANCE hInstance)
     if (!m_hSystemWindow || !m_hHelperWindow)
         return false;
 
-    SetWindowPos(m_hSystemWindow, HWND_BOTTOM, 0, 0, 0, 0, ZPOS_FLAGS);
-    SetWindowPos(m_hHelperWindow, HWND_BOTTOM, 0, 0, 0, 0, ZPOS_FLAGS);
+    // Sent to all top-level windows when Explorer (re)creates the taskbar
+    m_taskbarCreatedMessage = RegisterWindowMessage(L"TaskbarCreated");
 
-    m_hWinEventHook = SetWinEventHook(
-        EVENT_SYSTEM_FOREGROUND,
-        EVENT_SYSTEM_FOREGROUND,
-        nullptr,
-        WinEventProc,
-        0, 0,
-        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    // The display notification is also sent right away with the current state
+    m_sessionNotification = WTSRegisterSessionNotification(m_hSystemWindow, NOTIFY_FOR_THIS_SESSION) != FALSE;
+    m_displayNotification = RegisterPowerSettingNotification(m_hSystemWindow,
+        &GUID_CONSOLE_DISPLAY_STATE, DEVICE_NOTIFY_WINDOW_HANDLE);
 
-    SetTimer(m_hSystemWindow, TIMER_SHOWDESKTOP, INTERVAL_SHOWDESKTOP, nullptr);
+    m_notifications.Start(static_cast<int>(DesktopState::ShowingWindows));
+
+    // In coordinated mode only the leader detects and repositions
+    if ((m_flags & ZD_FLAG_COORDINATED) && OpenCoordinator())
+    {
+        if (m_coordinator.TryLead(GetCurrentProcessId(), IsProcessAlive, nullptr))
+        {
+            Lead();
+        }
+        else
+        {
+            Follow();
+        }
+    }
+    else
+    {
+        StartController();
+    }
 
     return true;
 }
 
-void CZposDesktop::Impl::Finalize()
+void DesktopEngine::Finalize()
 {
     if (m_hSystemWindow)
     {
-        KillTimer(m_hSystemWindow, TIMER_SHOWDESKTOP);
         KillTimer(m_hSystemWindow, TIMER_RESUME);
+        KillTimer(m_hSystemWindow, TIMER_STALLED);
+    }
+
+    DetachTrace();
+    StopInputTriggers();
+    m_controller.Stop();
+
+    // Nobody detects anymore, the state reads as it does before initializing
+    PublishState(false);
+    CloseCoordinator();
+    m_notifications.Stop();
+
+    if (m_displayNotification)
+    {
+        UnregisterPowerSettingNotification(m_displayNotification);
+        m_displayNotification = nullptr;
     }
 
-    if (m_hWinEventHook)
+    if (m_sessionNotification)
     {
-        UnhookWinEvent(m_hWinEventHook);
-        m_hWinEventHook = nullptr;
+        WTSUnRegisterSessionNotification(m_hSystemWindow);
+        m_sessionNotification = false;
     }
 
     if (m_hHelperWindow)
@@ -181,357 +522,1553 @@ void CZposDesktop::Impl::Finalize()
         m_hSystemWindow = nullptr;
     }
 
-    m_windows.clear();
-    s_instance = nullptr;
-    m_hInstance = nullptr;
-}
-
-bool CZposDesktop::Impl::RegisterWindow(HWND hwnd)
-{
-    if (!IsWindow(hwnd))
-        return false;
-
-    WindowInfo info;
-    info.hwnd = hwnd;
-    info.isVisible = IsWindowVisible(hwnd);
-
-    m_windows[hwnd] = info;
-    RefreshWindowPositions();
-    return true;
-}
+    if (m_windowClass)
+    {
+        // Lets a later engine register the class again
+        UnregisterClass(MAKEINTATOM(m_windowClass), m_hInstance);
+        m_windowClass = 0;
+    }
 
-bool CZposDesktop::Impl::UnregisterWindow(HWND hwnd)
-{
-    auto it = m_windows.find(hwnd);
-    if (it != m_windows.end())
     {
-        m_windows.erase(it);
-        return true;
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        m_windows.Publish(std::unique_ptr<WindowRegistry>(new WindowRegistry()));
     }
-    return false;
+    m_ownerThreadId = 0;
+    s_engine = nullptr;
+    m_hInstance = nullptr;
 }
 
-DesktopState CZposDesktop::Impl::GetDesktopState() const
+size_t DesktopEngine::RegisterWindows(const void* owner, const HWND* hwnds, size_t count, int32_t layer, bool reposition)
 {
-    return m_showDesktop ? DesktopState::ShowingDesktop : DesktopState::ShowingWindows;
-}
+    size_t registered = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_writeLock);
+        std::vector<TraceRegistration> traced;
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(m_windows.GetForWriter()));
 
-void CZposDesktop::Impl::SetDesktopStateCallback(DesktopStateCallback callback)
-{
-    m_callback = callback;
-}
+        std::vector<CoordinatorCommand> commands;
 
-void CZposDesktop::Impl::RefreshWindowPositions()
-{
-    PositionWindowsOnDesktop();
-}
+        for (size_t i = 0; i < count; ++i)
+        {
+            const WindowInfo* info = InsertWindow(*registry, owner, hwnds[i], layer);
+            if (!info)
+                continue;
 
-bool CZposDesktop::Impl::IsWindowRegistered(HWND hwnd) const
-{
-    return m_windows.find(hwnd) != m_windows.end();
-}
+            ++registered;
 
-HWND CZposDesktop::Impl::GetDefaultShellWindow()
-{
-    static HWND s_shellW = nullptr;
-    HWND shellW = GetShellWindow();
+            if (m_trace)
+            {
+                traced.push_back(GetTraceRegistration(*info));
+            }
+            if (m_following)
+            {
+                commands.push_back(MakeCommand(COORDINATOR_REGISTER, info->hwnd, layer));
+            }
+        }
 
-    if (shellW)
-    {
-        if (shellW == s_shellW)
+        if (registered == 0)
+            return 0;
+
+        if (m_trace)
         {
-            return shellW;
+            m_trace->Record(TRACE_REGISTER, traced.data(), traced.size() * sizeof(TraceRegistration));
         }
-        else
+
+        m_windows.Publish(std::move(registry));
+
+        if (!commands.empty())
         {
-            const int classLen = 8;
-            WCHAR className[classLen];
-            if (!(GetClassName(shellW, className, classLen) > 0 &&
-                wcscmp(className, L"Progman") == 0))
-            {
-                shellW = nullptr;
-            }
+            std::lock_guard<std::mutex> sending(m_sendLock);
+            lock.unlock();
+            SendToLeader(commands);
         }
     }
 
-    s_shellW = shellW;
-    return shellW;
+    if (reposition)
+    {
+        RefreshDirtyLayers();
+    }
+    return registered;
 }
 
-bool CZposDesktop::Impl::ShouldUseShellWindowAsDesktopIconsHost()
+bool DesktopEngine::SetWindowLayer(const void* owner, HWND hwnd, int32_t layer, bool reposition)
 {
-    // Check for Windows 11 24H2+ by looking for GetCurrentMonitorTopologyId function
-    static bool checked = false;
-    static bool result = false;
-
-    if (!checked)
     {
-        result = GetProcAddress(GetModuleHandle(L"user32"), "GetCurrentMonitorTopologyId") != nullptr;
-        checked = true;
+        std::unique_lock<std::mutex> lock(m_writeLock);
+        const WindowInfo* existing = WindowOwnership::Find(m_windows.GetForWriter(), owner, hwnd);
+        if (!existing)
+            return false;
+
+        if (existing->layer == layer)
+            return true;
+
+        WindowInfo info = *existing;
+        info.layer = layer;
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(m_windows.GetForWriter()));
+        registry->Insert(info);
+
+        if (m_trace)
+        {
+            m_trace->Record(TRACE_REGISTER, GetTraceRegistration(info));
+        }
+
+        m_windows.Publish(std::move(registry));
+
+        if (m_following)
+        {
+            std::lock_guard<std::mutex> sending(m_sendLock);
+            lock.unlock();
+            SendToLeader(std::vector<CoordinatorCommand>(1, MakeCommand(COORDINATOR_REGISTER, hwnd, layer)));
+        }
     }
 
-    return result;
+    if (reposition)
+    {
+        RefreshDirtyLayers();
+    }
+    return true;
 }
 
-HWND CZposDesktop::Impl::GetDesktopIconsHostWindow()
+size_t DesktopEngine::UnregisterWindows(const void* owner, const HWND* hwnds, size_t count)
 {
-    static HWND s_defView = nullptr;
-    HWND shellW = GetDefaultShellWindow();
-    if (!shellW) return nullptr;
+    std::unique_lock<std::mutex> lock(m_writeLock);
+    std::unique_ptr<WindowRegistry> registry;
+    std::vector<uint64_t> traced;
+    std::vector<CoordinatorCommand> commands;
+    size_t unregistered = 0;
 
-    if (ShouldUseShellWindowAsDesktopIconsHost())
+    for (size_t i = 0; i < count; ++i)
     {
-        if (FindWindowEx(shellW, nullptr, L"SHELLDLL_DefView", L""))
+        if (!WindowOwnership::Find(registry ? *registry : m_windows.GetForWriter(), owner, hwnds[i]))
+            continue;
+
+        // Copy the registry only once something actually changes
+        if (!registry)
+        {
+            registry.reset(new WindowRegistry(m_windows.GetForWriter()));
+        }
+        registry->Erase(hwnds[i]);
+        ++unregistered;
+
+        if (m_trace)
+        {
+            traced.push_back(TraceHandle(hwnds[i]));
+        }
+        if (m_following)
         {
-            return shellW;
+            commands.push_back(MakeCommand(COORDINATOR_UNREGISTER, hwnds[i], 0));
         }
-        return nullptr;
     }
 
-    if (s_defView && IsWindow(s_defView))
+    if (registry)
     {
-        HWND parent = GetAncestor(s_defView, GA_PARENT);
-        if (parent)
+        if (m_trace)
+        {
+            m_trace->Record(TRACE_UNREGISTER, traced.data(), traced.size() * sizeof(uint64_t));
+        }
+        m_windows.Publish(std::move(registry));
+
+        if (!commands.empty())
         {
-            if (parent == shellW)
-            {
-                return nullptr;
-            }
-            else
             {
-                const int classLen = 8;
-                WCHAR className[classLen];
-                if (GetClassName(parent, className, classLen) > 0 &&
-                    wcscmp(className, L"WorkerW") == 0)
-                {
-                    return parent;
-                }
+                std::lock_guard<std::mutex> sending(m_sendLock);
+                lock.unlock();
+                SendToLeader(commands);
             }
+            WakeLeader();
         }
     }
+    return unregistered;
+}
 
-    HWND workerW = nullptr;
-    HWND defView = FindWindowEx(shellW, nullptr, L"SHELLDLL_DefView", L"");
-    if (defView == nullptr)
+void DesktopEngine::RemoveOwner(const void* owner)
+{
+    NotificationPipeline::SubscriberId subscriber = 0;
     {
-        while (workerW = FindWindowEx(nullptr, workerW, L"WorkerW", L""))
+        std::lock_guard<std::mutex> lock(m_listenerLock);
+        for (size_t i = 0; i < m_listeners.size(); ++i)
         {
-            if (IsWindowVisible(workerW) &&
-                BelongToSameProcess(shellW, workerW) &&
-                (defView = FindWindowEx(workerW, nullptr, L"SHELLDLL_DefView", L"")))
+            if (m_listeners[i].owner == owner)
             {
+                subscriber = m_listeners[i].subscriber;
+                m_listeners.erase(m_listeners.begin() + i);
                 break;
             }
         }
     }
 
-    s_defView = defView;
-    return workerW;
-}
-
-bool CZposDesktop::Impl::BelongToSameProcess(HWND hwndA, HWND hwndB)
-{
-    DWORD procAId = 0, procBId = 0;
-    GetWindowThreadProcessId(hwndA, &procAId);
-    GetWindowThreadProcessId(hwndB, &procBId);
-    return (procAId == procBId);
-}
+    // Waits for a callback in progress, so it must not hold the listener lock
+    if (subscriber)
+    {
+        m_notifications.Unsubscribe(subscriber);
+    }
 
-void CZposDesktop::Impl::PrepareHelperWindow(HWND desktopIconsHostWindow)
-{
-    SetWindowPos(m_hSystemWindow, HWND_BOTTOM, 0, 0, 0, 0, ZPOS_FLAGS);
+    // Erasing from a copy keeps the generations of the other windows
+    std::unique_lock<std::mutex> lock(m_writeLock);
+    std::vector<HWND> removed = WindowOwnership::FindAll(m_windows.GetForWriter(), owner);
 
-    if (m_showDesktop && desktopIconsHostWindow)
+    if (!removed.empty())
     {
-        SetWindowPos(m_hHelperWindow, HWND_TOPMOST, 0, 0, 0, 0, ZPOS_FLAGS);
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(m_windows.GetForWriter()));
+        std::vector<uint64_t> traced;
+        std::vector<CoordinatorCommand> commands;
+        for (HWND hwnd : removed)
+        {
+            registry->Erase(hwnd);
+            if (m_trace)
+            {
+                traced.push_back(TraceHandle(hwnd));
+            }
+            if (m_following)
+            {
+                commands.push_back(MakeCommand(COORDINATOR_UNREGISTER, hwnd, 0));
+            }
+        }
+
+        if (m_trace)
+        {
+            m_trace->Record(TRACE_UNREGISTER, traced.data(), traced.size() * sizeof(uint64_t));
+        }
+        m_windows.Publish(std::move(registry));
 
-        HWND hwnd = desktopIconsHostWindow;
-        while (hwnd = ::GetNextWindow(hwnd, GW_HWNDPREV))
+        if (!commands.empty())
         {
-            if (GetWindowLongPtr(hwnd, GWL_EXSTYLE) & WS_EX_TOPMOST)
             {
-                if (0 != SetWindowPos(m_hHelperWindow, hwnd, 0, 0, 0, 0, ZPOS_FLAGS))
-                {
-                    return;
-                }
+                std::lock_guard<std::mutex> sending(m_sendLock);
+                lock.unlock();
+                SendToLeader(commands);
             }
+            WakeLeader();
         }
     }
-    else
+}
+
+DesktopState DesktopEngine::GetDesktopState() const
+{
+    bool showDesktop = m_following ? m_coordinator.ReadState().showDesktop : m_controller.IsShowingDesktop();
+    return showDesktop ? DesktopState::ShowingDesktop : DesktopState::ShowingWindows;
+}
+
+ZposDesktopStateSnapshot DesktopEngine::GetStateSnapshot()
+{
+    return ToStateSnapshot(s_state.Read());
+}
+
+bool DesktopEngine::WaitForStateChange(UINT32 lastSequence, DWORD timeoutMs, ZposDesktopStateSnapshot* snapshot)
+{
+    StateSnapshotCell::Snapshot current;
+    bool changed = s_state.WaitForChange(lastSequence, timeoutMs == INFINITE ? StateSnapshotCell::FOREVER : timeoutMs, current);
+    if (snapshot)
     {
-        SetWindowPos(m_hHelperWindow, HWND_BOTTOM, 0, 0, 0, 0, ZPOS_FLAGS);
+        *snapshot = ToStateSnapshot(current);
     }
+    return changed;
 }
 
-bool CZposDesktop::Impl::CheckDesktopState(HWND desktopIconsHostWindow)
+ZposDesktopStateSnapshot DesktopEngine::ToStateSnapshot(const StateSnapshotCell::Snapshot& snapshot)
 {
-    HWND hwnd = nullptr;
+    ZposDesktopStateSnapshot result;
+    result.state = static_cast<int>(snapshot.showDesktop ? DesktopState::ShowingDesktop : DesktopState::ShowingWindows);
+    result.sequence = snapshot.sequence;
+    result.transitionTimeMs = snapshot.transitionMs;
+    return result;
+}
 
-    if (desktopIconsHostWindow && IsWindowVisible(desktopIconsHostWindow))
+DesktopEngine::Listener& DesktopEngine::GetListener(const void* owner)
+{
+    for (Listener& listener : m_listeners)
     {
-        hwnd = FindWindowEx(nullptr, desktopIconsHostWindow, L"ZposDesktopSystem", L"ZposSystem");
+        if (listener.owner == owner)
+            return listener;
     }
 
-    bool stateChanged = (hwnd && !m_showDesktop) || (!hwnd && m_showDesktop);
+    Listener listener = { owner, nullptr, 0, 0 };
+    m_listeners.push_back(listener);
+    return m_listeners.back();
+}
 
-    if (stateChanged)
+void DesktopEngine::SetDesktopStateCallback(const void* owner, DesktopStateCallback callback)
+{
+    NotificationPipeline::SubscriberId previous = 0;
     {
-        m_showDesktop = !m_showDesktop;
+        std::lock_guard<std::mutex> lock(m_listenerLock);
+        Listener& listener = GetListener(owner);
+        previous = listener.subscriber;
+        listener.callback = callback;
+        listener.subscriber = 0;
 
-        PrepareHelperWindow(desktopIconsHostWindow);
-        PositionWindowsOnDesktop();
-
-        if (m_callback)
+        if (callback)
         {
-            m_callback(GetDesktopState());
+            listener.subscriber = m_notifications.Subscribe(
+                [callback](const NotificationPipeline::Event& event)
+                {
+                    callback(static_cast<DesktopState>(event.state));
+                },
+                listener.coalesceWindowMs);
         }
+    }
 
-        if (m_showDesktop)
-        {
-            SetTimer(m_hSystemWindow, TIMER_SHOWDESKTOP, INTERVAL_RESTOREWINDOWS, nullptr);
-        }
-        else
-        {
-            SetTimer(m_hSystemWindow, TIMER_SHOWDESKTOP, INTERVAL_SHOWDESKTOP, nullptr);
-        }
+    if (previous)
+    {
+        m_notifications.Unsubscribe(previous);
+    }
+}
+
+void DesktopEngine::SetCallbackCoalescing(const void* owner, DWORD windowMs)
+{
+    std::lock_guard<std::mutex> lock(m_listenerLock);
+    Listener& listener = GetListener(owner);
+    listener.coalesceWindowMs = windowMs;
+    if (listener.subscriber)
+    {
+        m_notifications.SetCoalesceWindow(listener.subscriber, windowMs);
     }
+}
 
-    return stateChanged;
+void DesktopEngine::GetNotificationCounts(const void* owner, uint64_t& dropped, uint64_t& coalesced)
+{
+    std::lock_guard<std::mutex> lock(m_listenerLock);
+    const Listener& listener = GetListener(owner);
+    dropped = m_notifications.GetDroppedCount(listener.subscriber);
+    coalesced = m_notifications.GetCoalescedCount(listener.subscriber);
 }
 
-void CZposDesktop::Impl::PositionWindowsOnDesktop()
+void DesktopEngine::RefreshWindowPositions()
 {
-    std::vector<HWND> windowsInZOrder;
-    EnumWindowsContext context = { this, &windowsInZOrder };
+    Refresh(false);
+}
 
-    // EnumWindows will call our callback for each top-level window.
-    // Our callback will filter for our registered windows and populate the vector.
-    // The windows will be added to the vector in their current Z-order (top-most first).
-    EnumWindows(CZposDesktop::Impl::EnumRegisteredWindowsProc, reinterpret_cast<LPARAM>(&context));
+void DesktopEngine::RefreshDirtyLayers()
+{
+    Refresh(true);
+}
 
-    if (m_showDesktop)
+void DesktopEngine::Refresh(bool dirtyLayersOnly)
+{
+    // The leader restacks the windows of all processes
+    if (m_following)
     {
-        // When showing the desktop, we position our windows after the helper window.
-        // To preserve the Z-order, we must iterate from the bottom-most to the top-most window in our list.
-        // This is because each SetWindowPos call places the window right after the helper,
-        // effectively pushing any previously placed windows down.
-        for (auto it = windowsInZOrder.rbegin(); it != windowsInZOrder.rend(); ++it)
+        if (!dirtyLayersOnly)
         {
-            SetWindowPos(*it, m_hHelperWindow, 0, 0, 0, 0, ZPOS_FLAGS);
+            std::lock_guard<std::mutex> sending(m_sendLock);
+            SendToLeader(std::vector<CoordinatorCommand>(1, MakeCommand(COORDINATOR_REFRESH, nullptr, 0)));
         }
+        WakeLeader();
+        return;
     }
-    else
+
+    // Repositioning passes only run on the thread that owns our windows
+    if (GetCurrentThreadId() == m_ownerThreadId)
     {
-        // When showing windows, we move our registered windows to the bottom of the Z-order.
-        // Iterating from top to bottom preserves their relative order at the bottom.
-        for (HWND hwnd : windowsInZOrder)
-        {
-            SetWindowPos(hwnd, HWND_BOTTOM, 0, 0, 0, 0, ZPOS_FLAGS);
-        }
+        dirtyLayersOnly ? RepositionDirtyLayers() : Reposition();
+        return;
     }
-}
 
-LRESULT CALLBACK CZposDesktop::Impl::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
-{
-    if (!s_instance)
-        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    // Requests from other threads only set a flag; the first one since the
+    // owner thread last looked tells it to
+    if (m_refreshRequests.fetch_or(dirtyLayersOnly ? REFRESH_DIRTY_LAYERS : REFRESH_FULL) != 0)
+        return;
 
-    if (hWnd != s_instance->m_hSystemWindow)
+    if (m_flags & ZD_FLAG_SERVICE_THREAD)
     {
-        if (uMsg == WM_WINDOWPOSCHANGING)
-        {
-            ((LPWINDOWPOS)lParam)->flags |= SWP_NOZORDER;
-            return 0;
-        }
-        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+        // Refused while the thread stops, when there is nothing left to refresh
+        m_serviceThread.Post([this]() { ApplyRefreshRequests(); });
     }
-
-    switch (uMsg)
+    else if (m_hSystemWindow)
     {
-    case WM_WINDOWPOSCHANGING:
-        ((LPWINDOWPOS)lParam)->flags |= SWP_NOZORDER;
-        break;
+        PostMessage(m_hSystemWindow, WM_ZPOS_REFRESH, 0, 0);
+    }
+}
 
-    case WM_TIMER:
-        if (wParam == TIMER_SHOWDESKTOP)
-        {
-            s_instance->CheckDesktopState(s_instance->GetDesktopIconsHostWindow());
-        }
-        else if (wParam == TIMER_RESUME)
+bool DesktopEngine::IsWindowRegistered(const void* owner, HWND hwnd) const
+{
+    SnapshotCell<WindowRegistry>::ReadGuard registry = m_windows.Read();
+    return WindowOwnership::Find(*registry, owner, hwnd) != nullptr;
+}
+
+void DesktopEngine::GetProbeState(DWORD& intervalMs, bool& suspended) const
+{
+    intervalMs = m_controller.GetProbeIntervalMs();
+    suspended = m_controller.IsProbingSuspended();
+}
+
+bool DesktopEngine::StartTrace(const wchar_t* path)
+{
+    std::lock_guard<std::mutex> lock(m_traceLock);
+    if (m_traceRecorder || !path || !m_hSystemWindow)
+        return false;
+
+    std::FILE* file = nullptr;
+    if (_wfopen_s(&file, path, L"wb") != 0)
+        return false;
+
+    std::unique_ptr<TraceRecorder> recorder(new TraceRecorder());
+    if (!recorder->Open(file))
+        return false;
+
+    m_traceRecorder = std::move(recorder);
+    TraceRecorder* attached = m_traceRecorder.get();
+    RunOnOwnerThread([this, attached]() { AttachTrace(attached); });
+    return true;
+}
+
+bool DesktopEngine::StopTrace()
+{
+    std::lock_guard<std::mutex> lock(m_traceLock);
+    if (!m_traceRecorder)
+        return false;
+
+    RunOnOwnerThread([this]() { DetachTrace(); });
+
+    // Writes out what is still buffered
+    m_traceRecorder.reset();
+    return true;
+}
+
+void DesktopEngine::RunOnOwnerThread(const std::function<void()>& command)
+{
+    if (GetCurrentThreadId() == m_ownerThreadId)
+    {
+        command();
+    }
+    else if (m_flags & ZD_FLAG_SERVICE_THREAD)
+    {
+        m_serviceThread.Invoke(command);
+    }
+    else if (m_hSystemWindow)
+    {
+        SendMessage(m_hSystemWindow, WM_ZPOS_INVOKE, 0, reinterpret_cast<LPARAM>(&command));
+    }
+}
+
+void DesktopEngine::Reposition()
+{
+    RecordMessage(TRACE_MESSAGE_REFRESH);
+    m_controller.RequestRefresh(true);
+}
+
+void DesktopEngine::RepositionDirtyLayers()
+{
+    RecordMessage(TRACE_MESSAGE_LAYERS);
+    m_controller.RequestRefresh(false);
+}
+
+void DesktopEngine::ApplyRefreshRequests()
+{
+    uint32_t requests = m_refreshRequests.exchange(0);
+    if (requests & REFRESH_FULL)
+    {
+        Reposition();
+    }
+    else if (requests & REFRESH_DIRTY_LAYERS)
+    {
+        RepositionDirtyLayers();
+    }
+}
+
+void DesktopEngine::ApplyWindowLifecycle(const WindowLifecycle& change)
+{
+    std::lock_guard<std::mutex> lock(m_writeLock);
+
+    // The window may have been unregistered, or registered again, since the change was seen
+    const WindowInfo* info = m_windows.GetForWriter().Find(change.hwnd);
+    if (!info || info->generation != change.generation)
+        return;
+
+    std::unique_ptr<WindowRegistry> registry(new WindowRegistry(m_windows.GetForWriter()));
+    if (registry->Apply(change))
+    {
+        m_windows.Publish(std::move(registry));
+    }
+}
+
+void DesktopEngine::AttachTrace(TraceRecorder* recorder)
+{
+    // Replay starts from a fresh detector and an empty shell topology cache.
+    // A follower only records its registrations and messages.
+    bool detecting = !m_following;
+    if (detecting)
+    {
+        m_controller.Stop();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        m_trace = recorder;
+
+        TraceStart start = { TraceHandle(m_hSystemWindow), TraceHandle(m_hHelperWindow) };
+        recorder->Record(TRACE_START, start);
+
+        TraceRect area = { m_triggerArea.left, m_triggerArea.top, m_triggerArea.right, m_triggerArea.bottom };
+        recorder->Record(TRACE_TRIGGER_AREA, area);
+
+        // Replay starts the logic on these, so they come last
+        std::vector<TraceRegistration> registrations;
+        for (const WindowInfo& info : m_windows.GetForWriter())
+        {
+            registrations.push_back(GetTraceRegistration(info));
+        }
+        recorder->Record(TRACE_REGISTER, registrations.data(), registrations.size() * sizeof(TraceRegistration));
+    }
+
+    m_recordingSystem.SetRecorder(recorder);
+    m_controller.SetTraceRecorder(recorder);
+    if (detecting)
+    {
+        m_controller.Start(m_hSystemWindow, m_hHelperWindow);
+    }
+}
+
+void DesktopEngine::DetachTrace()
+{
+    if (!m_trace)
+        return;
+
+    m_trace->Record(TRACE_STOP, nullptr, 0);
+    m_recordingSystem.SetRecorder(nullptr);
+    m_controller.SetTraceRecorder(nullptr);
+
+    std::lock_guard<std::mutex> lock(m_writeLock);
+    m_trace = nullptr;
+}
+
+void DesktopEngine::RecordMessage(TraceMessage message)
+{
+    if (m_trace)
+    {
+        uint32_t record = message;
+        m_trace->Record(TRACE_MESSAGE, record);
+    }
+}
+
+void DesktopEngine::PublishState(bool showDesktop)
+{
+    s_state.Publish(showDesktop, GetTickCount64());
+}
+
+void DesktopEngine::OnStateChanged(bool showDesktop, uint64_t latencyMs)
+{
+    PublishState(showDesktop);
+    m_notifications.Publish(static_cast<int>(showDesktop ? DesktopState::ShowingDesktop : DesktopState::ShowingWindows),
+        static_cast<uint32_t>(latencyMs));
+
+    if (m_coordinatorPage && !m_following)
+    {
+        m_coordinator.PublishState(showDesktop, latencyMs);
+        NotifyFollowers(COORDINATOR_STATE);
+    }
+}
+
+void DesktopEngine::StartController()
+{
+    m_controller.Start(m_hSystemWindow, m_hHelperWindow);
+    if (m_flags & ZD_FLAG_INPUT_TRIGGERS)
+    {
+        StartInputTriggers();
+    }
+}
+
+void DesktopEngine::StartInputTriggers()
+{
+    if (m_keyboardHook || m_mouseHook)
+        return;
+
+    // Unlike raw input, low-level hooks leave the input registrations of the
+    // application alone. They are called on the service thread, which pumps
+    // messages and does nothing that blocks for long.
+    m_keyboardHook = SetWindowsHookEx(WH_KEYBOARD_LL, KeyboardProc, m_hInstance, 0);
+    m_mouseHook = SetWindowsHookEx(WH_MOUSE_LL, MouseProc, m_hInstance, 0);
+    UpdateTriggerArea();
+}
+
+void DesktopEngine::StopInputTriggers()
+{
+    if (m_keyboardHook)
+    {
+        UnhookWindowsHookEx(m_keyboardHook);
+        m_keyboardHook = nullptr;
+    }
+
+    if (m_mouseHook)
+    {
+        UnhookWindowsHookEx(m_mouseHook);
+        m_mouseHook = nullptr;
+    }
+}
+
+void DesktopEngine::UpdateTriggerArea()
+{
+    if (!m_mouseHook)
+        return;
+
+    InputRect area = InputRect();
+    RECT rect;
+    HWND tray = FindWindow(L"Shell_TrayWnd", nullptr);
+    HWND notify = tray ? FindWindowEx(tray, nullptr, L"TrayNotifyWnd", nullptr) : nullptr;
+    HWND button = notify ? FindWindowEx(notify, nullptr, L"TrayShowDesktopButtonWClass", nullptr) : nullptr;
+
+    if (button && IsWindowVisible(button) && GetWindowRect(button, &rect) && rect.right > rect.left)
+    {
+        area.left = rect.left;
+        area.top = rect.top;
+        area.right = rect.right;
+        area.bottom = rect.bottom;
+    }
+    else if (tray && GetWindowRect(tray, &rect))
+    {
+        // Windows 11 draws the button itself, at the far end of the taskbar
+        area.left = rect.left;
+        area.top = rect.top;
+        area.right = rect.right;
+        area.bottom = rect.bottom;
+        if (rect.right - rect.left >= rect.bottom - rect.top)
+        {
+            area.left = (std::max)(area.left, area.right - SHOW_DESKTOP_BUTTON_SIZE);
+        }
+        else
+        {
+            area.top = (std::max)(area.top, area.bottom - SHOW_DESKTOP_BUTTON_SIZE);
+        }
+    }
+
+    m_triggerArea = area;
+    m_pointerInTriggerArea = false;
+
+    if (m_trace)
+    {
+        TraceRect record = { area.left, area.top, area.right, area.bottom };
+        m_trace->Record(TRACE_TRIGGER_AREA, record);
+    }
+    m_controller.SetTriggerArea(area);
+}
+
+void DesktopEngine::OnInput(WPARAM wParam, LPARAM lParam)
+{
+    InputEvent event = { static_cast<InputEvent::Type>(LOWORD(wParam)), HIWORD(wParam),
+        static_cast<int16_t>(LOWORD(lParam)), static_cast<int16_t>(HIWORD(lParam)) };
+
+    if (m_trace)
+    {
+        TraceInput record = { static_cast<uint32_t>(event.type), event.key, event.x, event.y };
+        m_trace->Record(TRACE_INPUT, record);
+    }
+    m_controller.OnInput(event);
+}
+
+void DesktopEngine::PostInput(InputEvent::Type type, uint32_t key, POINT pt)
+{
+    // Handled once the input went on, so a probe never holds it up
+    PostMessage(s_engine->m_hSystemWindow, WM_ZPOS_INPUT, MAKEWPARAM(type, key), MAKELPARAM(pt.x, pt.y));
+}
+
+LRESULT CALLBACK DesktopEngine::KeyboardProc(int code, WPARAM wParam, LPARAM lParam)
+{
+    if (code == HC_ACTION && s_engine)
+    {
+        // Only the keys of the shortcuts leave the hook
+        const KBDLLHOOKSTRUCT* key = reinterpret_cast<const KBDLLHOOKSTRUCT*>(lParam);
+        switch (key->vkCode)
+        {
+        case INPUT_KEY_SHIFT:
+        case INPUT_KEY_LSHIFT:
+        case INPUT_KEY_RSHIFT:
+        case INPUT_KEY_LWIN:
+        case INPUT_KEY_RWIN:
+        case INPUT_KEY_D:
+        case INPUT_KEY_M:
+        case INPUT_KEY_COMMA:
+            {
+                POINT pt = { 0, 0 };
+                PostInput((key->flags & LLKHF_UP) ? InputEvent::KEY_UP : InputEvent::KEY_DOWN, key->vkCode, pt);
+            }
+            break;
+        }
+    }
+    return CallNextHookEx(nullptr, code, wParam, lParam);
+}
+
+LRESULT CALLBACK DesktopEngine::MouseProc(int code, WPARAM wParam, LPARAM lParam)
+{
+    if (code == HC_ACTION && s_engine)
+    {
+        const MSLLHOOKSTRUCT* mouse = reinterpret_cast<const MSLLHOOKSTRUCT*>(lParam);
+        if (wParam == WM_LBUTTONDOWN || wParam == WM_LBUTTONUP)
+        {
+            // Only clicks on the button matter; leaving it is seen through moves
+            if (s_engine->m_triggerArea.Contains(mouse->pt.x, mouse->pt.y))
+            {
+                PostInput(wParam == WM_LBUTTONDOWN ? InputEvent::POINTER_DOWN : InputEvent::POINTER_UP,
+                    INPUT_BUTTON_LEFT, mouse->pt);
+            }
+        }
+        else if (wParam == WM_MOUSEMOVE)
+        {
+            // Moves only matter where they cross the edge of the button
+            bool inArea = s_engine->m_triggerArea.Contains(mouse->pt.x, mouse->pt.y);
+            if (inArea != s_engine->m_pointerInTriggerArea)
+            {
+                s_engine->m_pointerInTriggerArea = inArea;
+                PostInput(InputEvent::POINTER_MOVE, 0, mouse->pt);
+            }
+        }
+    }
+    return CallNextHookEx(nullptr, code, wParam, lParam);
+}
+
+const WindowInfo* DesktopEngine::InsertWindow(WindowRegistry& registry, const void* owner, HWND hwnd, int32_t layer)
+{
+    return WindowOwnership::Insert(*m_windowSystem, registry, owner, hwnd, layer);
+}
+
+bool DesktopEngine::OpenCoordinator()
+{
+    // Zero-filled when created, which is a valid empty page
+    m_coordinatorMapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        0, sizeof(CoordinatorPage), ZPOS_COORDINATOR_PAGE);
+    if (!m_coordinatorMapping)
+        return false;
+
+    m_coordinatorPage = static_cast<CoordinatorPage*>(
+        MapViewOfFile(m_coordinatorMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(CoordinatorPage)));
+    if (!m_coordinatorPage || !m_coordinator.Attach(m_coordinatorPage))
+    {
+        CloseCoordinator();
+        return false;
+    }
+
+    // Other processes of the session may run at another integrity level
+    m_coordinatorMessage = RegisterWindowMessage(ZPOS_COORDINATOR_MESSAGE);
+    ChangeWindowMessageFilterEx(m_hSystemWindow, m_coordinatorMessage, MSGFLT_ALLOW, nullptr);
+    return true;
+}
+
+void DesktopEngine::CloseCoordinator()
+{
+    DWORD self = GetCurrentProcessId();
+    if (m_coordinator.IsAttached())
+    {
+        if (m_following)
+        {
+            UnwatchLeader();
+            UnhookFollowerEvents();
+
+            // Our windows may outlive the engine
+            {
+                std::unique_lock<std::mutex> lock(m_writeLock);
+                std::vector<CoordinatorCommand> commands;
+                for (const WindowInfo& info : m_windows.GetForWriter())
+                {
+                    commands.push_back(MakeCommand(COORDINATOR_UNREGISTER, info.hwnd, 0));
+                }
+
+                std::lock_guard<std::mutex> sending(m_sendLock);
+                lock.unlock();
+                SendToLeader(commands);
+            }
+            WakeLeader();
+            m_coordinator.RemoveFollower(self);
+            m_following = false;
+        }
+        else if (m_coordinator.GetLeader() == self)
+        {
+            m_coordinator.Resign(self);
+            NotifyFollowers(COORDINATOR_LEADER);
+        }
+        m_coordinator.Detach();
+    }
+
+    if (m_coordinatorPage)
+    {
+        UnmapViewOfFile(m_coordinatorPage);
+        m_coordinatorPage = nullptr;
+    }
+
+    if (m_coordinatorMapping)
+    {
+        CloseHandle(m_coordinatorMapping);
+        m_coordinatorMapping = nullptr;
+    }
+
+    // Nobody reads the ring for this process anymore
+    DropUnsent();
+
+    std::lock_guard<std::mutex> lock(m_writeLock);
+    m_remoteOwners.clear();
+}
+
+void DesktopEngine::Lead()
+{
+    m_following = false;
+    UnwatchLeader();
+    UnhookFollowerEvents();
+
+    DWORD self = GetCurrentProcessId();
+    m_coordinator.RemoveFollower(self);
+
+    // The leader skips its own commands
+    DropUnsent();
+
+    // Windows destroyed while following whose event was missed
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        std::unique_ptr<WindowRegistry> registry;
+        for (const WindowInfo& info : m_windows.GetForWriter())
+        {
+            if (m_windowSystem->IsWindow(info.hwnd) && m_windowSystem->GetWindowProcessId(info.hwnd) == info.processId)
+                continue;
+
+            if (!registry)
+            {
+                registry.reset(new WindowRegistry(m_windows.GetForWriter()));
+            }
+            registry->Erase(info.hwnd);
+        }
+
+        if (registry)
+        {
+            m_windows.Publish(std::move(registry));
+        }
+    }
+
+    StartController();
+
+    // The page may still hold the state seen by the previous leader
+    bool showDesktop = m_controller.IsShowingDesktop();
+    if (m_coordinator.ReadState().showDesktop != showDesktop)
+    {
+        OnStateChanged(showDesktop, 0);
+    }
+
+    // Commands sent while nobody was leading are waiting in the ring
+    m_coordinator.SetLeaderWindow(ToSharedHandle(m_hSystemWindow));
+    ProcessCommands();
+
+    // Followers send their windows again
+    NotifyFollowers(COORDINATOR_LEADER);
+    Reposition();
+}
+
+void DesktopEngine::Follow()
+{
+    DWORD self = GetCurrentProcessId();
+    if (!m_coordinator.AddFollower(self, ToSharedHandle(m_hSystemWindow)))
+    {
+        // Too many processes, this one runs on its own
+        CloseCoordinator();
+        StartController();
+        return;
+    }
+
+    CoordinatorState state = m_coordinator.ReadState();
+    m_stateChanges = state.changes;
+    PublishState(state.showDesktop);
+    m_following = true;
+    WatchLeader();
+
+    // The leader unregisters destroyed windows on its side, this process on its own
+    if (!m_followerHook)
+    {
+        m_followerHook = SetWinEventHook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_DESTROY, nullptr,
+            FollowerEventProc, GetCurrentProcessId(), 0, WINEVENT_OUTOFCONTEXT);
+    }
+
+    // The leader may have resigned before we were listed to be told
+    PostMessage(m_hSystemWindow, m_coordinatorMessage, COORDINATOR_LEADER, 0);
+}
+
+void DesktopEngine::OnCoordinatorMessage(WPARAM code)
+{
+    switch (code)
+    {
+    case COORDINATOR_WAKE:
+        if (!m_following)
+        {
+            ProcessCommands();
+        }
+        break;
+
+    case COORDINATOR_STATE:
+        if (m_following)
+        {
+            CoordinatorState state = m_coordinator.ReadState();
+            if (state.changes != m_stateChanges)
+            {
+                m_stateChanges = state.changes;
+                PublishState(state.showDesktop);
+                m_notifications.Publish(static_cast<int>(state.showDesktop ? DesktopState::ShowingDesktop : DesktopState::ShowingWindows),
+                    static_cast<uint32_t>(state.detectionLatencyMs));
+            }
+        }
+        break;
+
+    case COORDINATOR_LEADER:
+        OnLeaderChanged();
+        break;
+
+    case COORDINATOR_RESEND:
+        ResendToLeader();
+        break;
+    }
+}
+
+void DesktopEngine::OnLeaderChanged()
+{
+    if (!m_following)
+        return;
+
+    if (m_coordinator.TryLead(GetCurrentProcessId(), IsProcessAlive, nullptr))
+    {
+        Lead();
+        return;
+    }
+
+    if (m_coordinator.GetLeaderEpoch() == m_leaderEpoch)
+        return;
+
+    UnwatchLeader();
+    WatchLeader();
+
+    // The new leader knows nothing about our windows, and only needs the current ones
+    {
+        std::unique_lock<std::mutex> lock(m_writeLock);
+        std::vector<CoordinatorCommand> commands;
+        for (const WindowInfo& info : m_windows.GetForWriter())
+        {
+            commands.push_back(MakeCommand(COORDINATOR_REGISTER, info.hwnd, info.layer));
+        }
+
+        std::lock_guard<std::mutex> sending(m_sendLock);
+        lock.unlock();
+        m_unsent.clear();
+        SendToLeader(commands);
+    }
+    WakeLeader();
+}
+
+void DesktopEngine::ProcessCommands()
+{
+    bool refresh = false;
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        std::unique_ptr<WindowRegistry> registry;
+        std::vector<TraceRegistration> registered;
+        std::vector<uint64_t> unregistered;
+        DWORD self = GetCurrentProcessId();
+
+        CoordinatorCommand command;
+        while (m_coordinator.Pop(command, IsProcessAlive, nullptr, GetTickCount64()))
+        {
+            // Sent by this process while it was following, its windows are registered already
+            if (command.processId == self)
+                continue;
+
+            if (command.op == COORDINATOR_REFRESH)
+            {
+                refresh = true;
+                continue;
+            }
+
+            HWND hwnd = FromSharedHandle(command.hwnd);
+            const void* owner = GetRemoteOwner(command.processId);
+            if (!registry)
+            {
+                registry.reset(new WindowRegistry(m_windows.GetForWriter()));
+            }
+
+            if (command.op == COORDINATOR_UNREGISTER)
+            {
+                if (WindowOwnership::Find(*registry, owner, hwnd))
+                {
+                    RecordRegistrations(registered);
+                    registry->Erase(hwnd);
+                    unregistered.push_back(command.hwnd);
+                    changed = true;
+                }
+            }
+            else if (command.op == COORDINATOR_REGISTER)
+            {
+                // A follower only gets to manage its own windows
+                if (m_windowSystem->GetWindowProcessId(hwnd) != command.processId)
+                    continue;
+
+                const WindowInfo* info = InsertWindow(*registry, owner, hwnd, command.layer);
+                if (info)
+                {
+                    RecordUnregistrations(unregistered);
+                    registered.push_back(GetTraceRegistration(*info));
+                    changed = true;
+                }
+            }
+        }
+
+        // A follower is still filling a slot, or died before it did, and the
+        // commands behind it wait until the slot is read or skipped
+        if (m_coordinator.HasPendingClaims())
+        {
+            SetTimer(m_hSystemWindow, TIMER_STALLED, INTERVAL_STALLED, nullptr);
+        }
+
+        if (changed)
+        {
+            // At most one of them holds anything, the last run of the batch
+            RecordUnregistrations(unregistered);
+            RecordRegistrations(registered);
+            m_windows.Publish(std::move(registry));
+        }
+    }
+
+    if (refresh)
+    {
+        Reposition();
+    }
+    else if (changed)
+    {
+        RepositionDirtyLayers();
+    }
+}
+
+CoordinatorCommand DesktopEngine::MakeCommand(CoordinatorOp op, HWND hwnd, int32_t layer)
+{
+    CoordinatorCommand command = { ToSharedHandle(hwnd), layer, static_cast<uint32_t>(op), static_cast<uint32_t>(GetCurrentProcessId()), 0 };
+    return command;
+}
+
+bool DesktopEngine::SendToLeader(const std::vector<CoordinatorCommand>& commands)
+{
+    // Called with m_sendLock held. Never waits for the leader: commands that
+    // find the ring full are kept, and the owner thread sends them once the
+    // leader, woken now, has made room.
+    m_unsent.insert(m_unsent.end(), commands.begin(), commands.end());
+    if (PushUnsent())
+        return true;
+
+    WakeLeader();
+    if (!m_resendPending)
+    {
+        m_resendPending = true;
+        PostMessage(m_hSystemWindow, m_coordinatorMessage, COORDINATOR_RESEND, 0);
+    }
+    return false;
+}
+
+bool DesktopEngine::PushUnsent()
+{
+    size_t pushed = 0;
+    while (pushed < m_unsent.size() && m_coordinator.Push(m_unsent[pushed]))
+    {
+        ++pushed;
+    }
+    m_unsent.erase(m_unsent.begin(), m_unsent.begin() + pushed);
+    return m_unsent.empty();
+}
+
+void DesktopEngine::ResendToLeader()
+{
+    KillTimer(m_hSystemWindow, TIMER_RESEND);
+    {
+        std::lock_guard<std::mutex> sending(m_sendLock);
+        if (!m_resendPending)
+            return;
+
+        if (!m_following || PushUnsent())
+        {
+            m_resendPending = false;
+        }
+        else
+        {
+            SetTimer(m_hSystemWindow, TIMER_RESEND, INTERVAL_RESEND, nullptr);
+        }
+    }
+    WakeLeader();
+}
+
+void DesktopEngine::DropUnsent()
+{
+    if (m_hSystemWindow)
+    {
+        KillTimer(m_hSystemWindow, TIMER_RESEND);
+    }
+
+    std::lock_guard<std::mutex> sending(m_sendLock);
+    m_unsent.clear();
+    m_resendPending = false;
+}
+
+void DesktopEngine::RecordRegistrations(std::vector<TraceRegistration>& registrations)
+{
+    if (m_trace && !registrations.empty())
+    {
+        m_trace->Record(TRACE_REGISTER, registrations.data(), registrations.size() * sizeof(TraceRegistration));
+    }
+    registrations.clear();
+}
+
+void DesktopEngine::RecordUnregistrations(std::vector<uint64_t>& handles)
+{
+    if (m_trace && !handles.empty())
+    {
+        m_trace->Record(TRACE_UNREGISTER, handles.data(), handles.size() * sizeof(uint64_t));
+    }
+    handles.clear();
+}
+
+void DesktopEngine::WakeLeader()
+{
+    // Pairs with the leader setting its window before emptying the ring
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    HWND leader = FromSharedHandle(m_coordinator.GetLeaderWindow());
+    if (leader && !PostMessage(leader, m_coordinatorMessage, COORDINATOR_WAKE, 0))
+    {
+        // The leader went away without resigning
+        PostMessage(m_hSystemWindow, m_coordinatorMessage, COORDINATOR_LEADER, 0);
+    }
+}
+
+void DesktopEngine::NotifyFollowers(CoordinatorMessage message)
+{
+    m_coordinator.ForEachFollower(IsProcessAlive, nullptr, [this, message](uint32_t, uint64_t window)
+    {
+        PostMessage(FromSharedHandle(window), m_coordinatorMessage, message, 0);
+    });
+}
+
+void DesktopEngine::WatchLeader()
+{
+    m_leaderEpoch = m_coordinator.GetLeaderEpoch();
+
+    // Without a handle, a leader that went away is noticed the next time it is woken
+    m_leaderProcess = OpenProcess(SYNCHRONIZE, FALSE, m_coordinator.GetLeader());
+    if (m_leaderProcess &&
+        !RegisterWaitForSingleObject(&m_leaderWait, m_leaderProcess, OnLeaderExited, this, INFINITE, WT_EXECUTEONLYONCE))
+    {
+        m_leaderWait = nullptr;
+    }
+}
+
+void DesktopEngine::UnwatchLeader()
+{
+    if (m_leaderWait)
+    {
+        // Waits for a callback in progress
+        UnregisterWaitEx(m_leaderWait, INVALID_HANDLE_VALUE);
+        m_leaderWait = nullptr;
+    }
+
+    if (m_leaderProcess)
+    {
+        CloseHandle(m_leaderProcess);
+        m_leaderProcess = nullptr;
+    }
+}
+
+void CALLBACK DesktopEngine::OnLeaderExited(PVOID context, BOOLEAN)
+{
+    // Runs on a thread pool thread
+    DesktopEngine* engine = static_cast<DesktopEngine*>(context);
+    PostMessage(engine->m_hSystemWindow, engine->m_coordinatorMessage, COORDINATOR_LEADER, 0);
+}
+
+void DesktopEngine::UnhookFollowerEvents()
+{
+    if (m_followerHook)
+    {
+        UnhookWinEvent(m_followerHook);
+        m_followerHook = nullptr;
+    }
+}
+
+void CALLBACK DesktopEngine::FollowerEventProc(HWINEVENTHOOK, DWORD event, HWND hwnd,
+    LONG idObject, LONG idChild, DWORD, DWORD)
+{
+    if (event == EVENT_OBJECT_DESTROY && idObject == OBJID_WINDOW && idChild == CHILDID_SELF && s_engine)
+    {
+        s_engine->OnFollowerWindowDestroyed(hwnd);
+    }
+}
+
+void DesktopEngine::OnFollowerWindowDestroyed(HWND hwnd)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_writeLock);
+        if (!m_following || !m_windows.GetForWriter().Find(hwnd))
+            return;
+
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(m_windows.GetForWriter()));
+        registry->Erase(hwnd);
+        if (m_trace)
+        {
+            uint64_t traced = TraceHandle(hwnd);
+            m_trace->Record(TRACE_UNREGISTER, traced);
+        }
+        m_windows.Publish(std::move(registry));
+
+        std::lock_guard<std::mutex> sending(m_sendLock);
+        lock.unlock();
+        SendToLeader(std::vector<CoordinatorCommand>(1, MakeCommand(COORDINATOR_UNREGISTER, hwnd, 0)));
+    }
+    WakeLeader();
+}
+
+const void* DesktopEngine::GetRemoteOwner(DWORD processId)
+{
+    for (const std::unique_ptr<RemoteOwner>& owner : m_remoteOwners)
+    {
+        if (owner->processId == processId)
+            return owner.get();
+    }
+
+    m_remoteOwners.emplace_back(new RemoteOwner{ processId });
+    return m_remoteOwners.back().get();
+}
+
+bool DesktopEngine::IsProcessAlive(uint32_t processId, void*)
+{
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, processId);
+    if (!process)
+        return GetLastError() == ERROR_ACCESS_DENIED; // Exists, but cannot be waited on
+
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+}
+
+LRESULT CALLBACK DesktopEngine::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    if (!s_engine)
+        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+
+    if (hWnd != s_engine->m_hSystemWindow)
+    {
+        if (uMsg == WM_WINDOWPOSCHANGING)
+        {
+            ((LPWINDOWPOS)lParam)->flags |= SWP_NOZORDER;
+            return 0;
+        }
+        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    }
+
+    PerfCounters::Add(PERF_MESSAGES);
+
+    if (uMsg == s_engine->m_taskbarCreatedMessage && uMsg != 0)
+    {
+        if (!s_engine->m_following)
+        {
+            s_engine->RecordMessage(TRACE_MESSAGE_SHELL_RESTARTED);
+            s_engine->m_controller.OnShellRestarted();
+            s_engine->UpdateTriggerArea();
+        }
+        return 0;
+    }
+
+    if (uMsg == s_engine->m_coordinatorMessage && uMsg != 0)
+    {
+        s_engine->OnCoordinatorMessage(wParam);
+        return 0;
+    }
+
+    switch (uMsg)
+    {
+    case WM_WINDOWPOSCHANGING:
+        ((LPWINDOWPOS)lParam)->flags |= SWP_NOZORDER;
+        break;
+
+    case WM_TIMER:
+        // The probe timer is delivered to the controller by the backend
+        if (wParam == TIMER_RESUME)
+        {
+            PerfCounters::Add(PERF_WAKEUPS);
+            KillTimer(hWnd, TIMER_RESUME);
+            s_engine->RecordMessage(TRACE_MESSAGE_RESUME);
+            s_engine->RefreshWindowPositions();
+        }
+        else if (wParam == TIMER_RESEND)
+        {
+            s_engine->ResendToLeader();
+        }
+        else if (wParam == TIMER_STALLED)
+        {
+            KillTimer(hWnd, TIMER_STALLED);
+            s_engine->OnCoordinatorMessage(COORDINATOR_WAKE);
+        }
+        break;
+
+    case WM_DISPLAYCHANGE:
+    case WM_SETTINGCHANGE:
+        s_engine->RecordMessage(uMsg == WM_DISPLAYCHANGE ?
+            TRACE_MESSAGE_DISPLAY_CHANGE : TRACE_MESSAGE_SETTING_CHANGE);
+        s_engine->RefreshWindowPositions();
+        s_engine->UpdateTriggerArea();
+        break;
+
+    case WM_ZPOS_REFRESH:
+        s_engine->ApplyRefreshRequests();
+        break;
+
+    case WM_ZPOS_INPUT:
+        s_engine->OnInput(wParam, lParam);
+        break;
+
+    case WM_ZPOS_INVOKE:
+        (*reinterpret_cast<const std::function<void()>*>(lParam))();
+        break;
+
+    case WM_WTSSESSION_CHANGE:
+        if (wParam == WTS_SESSION_LOCK || wParam == WTS_SESSION_UNLOCK)
+        {
+            bool locked = (wParam == WTS_SESSION_LOCK);
+            s_engine->RecordMessage(locked ? TRACE_MESSAGE_SESSION_LOCK : TRACE_MESSAGE_SESSION_UNLOCK);
+            s_engine->m_controller.OnSessionLocked(locked);
+        }
+        break;
+
+    case WM_POWERBROADCAST:
+        if (wParam == PBT_APMRESUMESUSPEND)
+        {
+            SetTimer(hWnd, TIMER_RESUME, INTERVAL_RESUME, nullptr);
+        }
+        else if (wParam == PBT_POWERSETTINGCHANGE)
+        {
+            const POWERBROADCAST_SETTING* setting = reinterpret_cast<const POWERBROADCAST_SETTING*>(lParam);
+            if (setting && IsEqualGUID(setting->PowerSetting, GUID_CONSOLE_DISPLAY_STATE) &&
+                setting->DataLength >= sizeof(DWORD))
+            {
+                // 0 = off, 1 = on, 2 = dimmed
+                bool on = *reinterpret_cast<const DWORD*>(setting->Data) != 0;
+                s_engine->RecordMessage(on ? TRACE_MESSAGE_DISPLAY_ON : TRACE_MESSAGE_DISPLAY_OFF);
+                s_engine->m_controller.OnDisplayPower(on);
+            }
+        }
+        return TRUE;
+
+    default:
+        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    }
+
+    return 0;
+}
+
+static void CopyHistogram(const PerfHistogramData& source, ZposDesktopHistogram& target)
+{
+    static_assert(ZD_STATS_HISTOGRAM_BUCKETS == PERF_HISTOGRAM_BUCKETS, "Histogram layouts differ");
+
+    target.count = source.count;
+    target.totalUs = source.totalUs;
+    target.maxUs = source.maxUs;
+    for (size_t i = 0; i < PERF_HISTOGRAM_BUCKETS; ++i)
+    {
+        target.buckets[i] = source.buckets[i];
+    }
+}
+
+// The process-wide counters, with the fields of an instance left zero
+static ZposDesktopStats GetProcessStats()
+{
+    ZposDesktopStats stats = {};
+    stats.cbSize = sizeof(stats);
+    stats.enabled = PerfCounters::IsEnabled() ? TRUE : FALSE;
+
+    PerfSnapshot snapshot;
+    PerfCounters::Read(snapshot);
+    stats.messages = snapshot.counters[PERF_MESSAGES];
+    stats.timerTicks = snapshot.counters[PERF_TIMER_TICKS];
+    stats.desktopChecks = snapshot.counters[PERF_DESKTOP_CHECKS];
+    stats.stateChanges = snapshot.counters[PERF_STATE_CHANGES];
+    stats.repositionPasses = snapshot.counters[PERF_REPOSITION_PASSES];
+    stats.enumerations = snapshot.counters[PERF_ENUMERATIONS];
+    stats.enumeratedWindows = snapshot.counters[PERF_ENUMERATED_WINDOWS];
+    stats.zorderCalls = snapshot.counters[PERF_ZORDER_CALLS];
+    stats.zorderCommits = snapshot.counters[PERF_ZORDER_COMMITS];
+    stats.wakeups = snapshot.counters[PERF_WAKEUPS];
+    stats.refreshRequests = snapshot.counters[PERF_REFRESH_REQUESTS];
+    stats.refreshes = snapshot.counters[PERF_REFRESHES];
+    stats.triggers = snapshot.counters[PERF_TRIGGERS];
+    stats.triggerMisses = snapshot.counters[PERF_TRIGGER_MISSES];
+    stats.triggerMissProbes = snapshot.counters[PERF_TRIGGER_MISS_PROBES];
+    stats.deferredPasses = snapshot.counters[PERF_DEFERRED_PASSES];
+    CopyHistogram(snapshot.histograms[PERF_CHECK_DESKTOP_STATE], stats.checkDesktopState);
+    CopyHistogram(snapshot.histograms[PERF_POSITION_WINDOWS], stats.positionWindows);
+    CopyHistogram(snapshot.histograms[PERF_TRANSITION_LATENCY], stats.transitionLatency);
+    return stats;
+}
+
+// A manager instance. All instances share one engine and only keep track of
+// which windows and callback are theirs.
+class CZposDesktop::Impl
+{
+public:
+    Impl() :
+        m_engine(nullptr),
+        m_updateDepth(0),
+        m_pendingRefresh(false)
+    {
+    }
+
+    ~Impl()
+    {
+        Finalize();
+    }
+
+    bool Initialize(HINSTANCE hInstance, DWORD flags)
+    {
+        if (m_engine)
+            return false; // Already initialized
+
+        m_engine = DesktopEngine::Acquire(hInstance, flags);
+        return m_engine != nullptr;
+    }
+
+    void Finalize()
+    {
+        if (m_engine)
+        {
+            DesktopEngine::Release(m_engine, this);
+            m_engine = nullptr;
+        }
+    }
+
+    bool RegisterWindow(HWND hwnd, int32_t layer)
+    {
+        return RegisterWindows(&hwnd, 1, layer) == 1;
+    }
+
+    bool UnregisterWindow(HWND hwnd)
+    {
+        return UnregisterWindows(&hwnd, 1) == 1;
+    }
+
+    size_t RegisterWindows(const HWND* hwnds, size_t count, int32_t layer)
+    {
+        if (!m_engine || !hwnds)
+            return 0;
+
+        // Inside an update scope the pass runs once, when the scope ends
+        bool deferred = m_updateDepth.load(std::memory_order_acquire) > 0;
+        size_t registered = m_engine->RegisterWindows(this, hwnds, count, layer, !deferred);
+        if (deferred && registered)
+        {
+            m_pendingRefresh.store(true, std::memory_order_release);
+        }
+        return registered;
+    }
+
+    bool SetWindowLayer(HWND hwnd, int32_t layer)
+    {
+        if (!m_engine)
+            return false;
+
+        bool deferred = m_updateDepth.load(std::memory_order_acquire) > 0;
+        bool changed = m_engine->SetWindowLayer(this, hwnd, layer, !deferred);
+        if (deferred && changed)
         {
-            KillTimer(hWnd, TIMER_RESUME);
-            s_instance->RefreshWindowPositions();
+            m_pendingRefresh.store(true, std::memory_order_release);
         }
-        break;
+        return changed;
+    }
 
-    case WM_DISPLAYCHANGE:
-    case WM_SETTINGCHANGE:
-        s_instance->RefreshWindowPositions();
-        break;
+    size_t UnregisterWindows(const HWND* hwnds, size_t count)
+    {
+        if (!m_engine || !hwnds)
+            return 0;
 
-    case WM_POWERBROADCAST:
-        if (wParam == PBT_APMRESUMESUSPEND)
+        return m_engine->UnregisterWindows(this, hwnds, count);
+    }
+
+    void BeginUpdate()
+    {
+        m_updateDepth.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    void EndUpdate()
+    {
+        int depth = m_updateDepth.load(std::memory_order_acquire);
+        while (depth > 0 && !m_updateDepth.compare_exchange_weak(depth, depth - 1, std::memory_order_acq_rel))
         {
-            SetTimer(hWnd, TIMER_RESUME, INTERVAL_RESUME, nullptr);
         }
-        return TRUE;
 
-    default:
-        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+        if (depth == 1 && m_pendingRefresh.exchange(false, std::memory_order_acq_rel) && m_engine)
+        {
+            m_engine->RefreshDirtyLayers();
+        }
     }
 
-    return 0;
-}
+    DesktopState GetDesktopState() const
+    {
+        return m_engine ? m_engine->GetDesktopState() : DesktopState::ShowingWindows;
+    }
 
-void CALLBACK CZposDesktop::Impl::WinEventProc(HWINEVENTHOOK hWinEventHook, DWORD event, HWND hwnd,
-    LONG idObject, LONG idChild, DWORD dwEventThread, DWORD dwmsEventTime)
-{
-    if (!s_instance || event != EVENT_SYSTEM_FOREGROUND)
-        return;
+    ZposDesktopStateSnapshot GetStateSnapshot() const
+    {
+        return DesktopEngine::GetStateSnapshot();
+    }
+
+    bool WaitForStateChange(UINT32 lastSequence, DWORD timeoutMs, ZposDesktopStateSnapshot* snapshot) const
+    {
+        return DesktopEngine::WaitForStateChange(lastSequence, timeoutMs, snapshot);
+    }
 
-    if (!s_instance->m_showDesktop)
+    void SetDesktopStateCallback(DesktopStateCallback callback)
     {
-        if (s_instance->ShouldUseShellWindowAsDesktopIconsHost())
+        if (m_engine)
         {
-            if (hwnd == s_instance->GetDefaultShellWindow())
-            {
-                const int max = 5;
-                int loop = 0;
-                while (loop < max && !s_instance->CheckDesktopState(hwnd))
-                {
-                    Sleep(2);
-                    ++loop;
-                }
-            }
-            return;
+            m_engine->SetDesktopStateCallback(this, callback);
         }
+    }
 
-        const int classLen = 8;
-        WCHAR className[classLen];
-        if (GetClassName(hwnd, className, classLen) > 0 &&
-            wcscmp(className, L"WorkerW") == 0 &&
-            s_instance->BelongToSameProcess(s_instance->GetDefaultShellWindow(), hwnd))
+    void SetCallbackCoalescing(DWORD windowMs)
+    {
+        if (m_engine)
         {
-            const int max = 5;
-            int loop = 0;
-            while (loop < max && FindWindowEx(hwnd, nullptr, L"SHELLDLL_DefView", L"") == nullptr)
-            {
-                Sleep(2);
-                ++loop;
-            }
+            m_engine->SetCallbackCoalescing(this, windowMs);
+        }
+    }
 
-            if (loop < max)
-            {
-                loop = 0;
-                while (loop < max && !s_instance->CheckDesktopState(hwnd))
-                {
-                    Sleep(2);
-                    ++loop;
-                }
-            }
+    void RefreshWindowPositions()
+    {
+        if (m_engine)
+        {
+            m_engine->RefreshWindowPositions();
         }
     }
-}
+
+    bool IsWindowRegistered(HWND hwnd) const
+    {
+        return m_engine && m_engine->IsWindowRegistered(this, hwnd);
+    }
+
+    bool StartTrace(const wchar_t* path)
+    {
+        return m_engine && m_engine->StartTrace(path);
+    }
+
+    bool StopTrace()
+    {
+        return m_engine && m_engine->StopTrace();
+    }
+
+    ZposDesktopStats GetStats() const
+    {
+        ZposDesktopStats stats = GetProcessStats();
+        if (m_engine)
+        {
+            uint64_t dropped = 0, coalesced = 0;
+            m_engine->GetNotificationCounts(this, dropped, coalesced);
+            stats.notificationsDropped = dropped;
+            stats.notificationsCoalesced = coalesced;
+
+            bool suspended = false;
+            m_engine->GetProbeState(stats.probeIntervalMs, suspended);
+            stats.probingSuspended = suspended ? TRUE : FALSE;
+        }
+        return stats;
+    }
+
+private:
+    DesktopEngine* m_engine;
+    std::atomic<int> m_updateDepth;
+    std::atomic<bool> m_pendingRefresh;
+};
 
 // CZposDesktop class implementation
 CZposDesktop::CZposDesktop(void) : m_pImpl(new Impl())
@@ -545,7 +2082,12 @@ CZposDesktop::~CZposDesktop(void)
 
 bool CZposDesktop::Initialize(HINSTANCE hInstance)
 {
-    return m_pImpl->Initialize(hInstance);
+    return m_pImpl->Initialize(hInstance, ZD_FLAG_NONE);
+}
+
+bool CZposDesktop::Initialize(HINSTANCE hInstance, DWORD flags)
+{
+    return m_pImpl->Initialize(hInstance, flags);
 }
 
 void CZposDesktop::Finalize()
@@ -555,7 +2097,17 @@ void CZposDesktop::Finalize()
 
 bool CZposDesktop::RegisterWindow(HWND hwnd)
 {
-    return m_pImpl->RegisterWindow(hwnd);
+    return m_pImpl->RegisterWindow(hwnd, ZD_LAYER_DEFAULT);
+}
+
+bool CZposDesktop::RegisterWindow(HWND hwnd, int layer)
+{
+    return m_pImpl->RegisterWindow(hwnd, layer);
+}
+
+bool CZposDesktop::SetWindowLayer(HWND hwnd, int layer)
+{
+    return m_pImpl->SetWindowLayer(hwnd, layer);
 }
 
 bool CZposDesktop::UnregisterWindow(HWND hwnd)
@@ -563,16 +2115,56 @@ bool CZposDesktop::UnregisterWindow(HWND hwnd)
     return m_pImpl->UnregisterWindow(hwnd);
 }
 
+int CZposDesktop::RegisterWindows(const HWND* hwnds, int count)
+{
+    return count > 0 ? static_cast<int>(m_pImpl->RegisterWindows(hwnds, count, ZD_LAYER_DEFAULT)) : 0;
+}
+
+int CZposDesktop::RegisterWindows(const HWND* hwnds, int count, int layer)
+{
+    return count > 0 ? static_cast<int>(m_pImpl->RegisterWindows(hwnds, count, layer)) : 0;
+}
+
+int CZposDesktop::UnregisterWindows(const HWND* hwnds, int count)
+{
+    return count > 0 ? static_cast<int>(m_pImpl->UnregisterWindows(hwnds, count)) : 0;
+}
+
+void CZposDesktop::BeginUpdate()
+{
+    m_pImpl->BeginUpdate();
+}
+
+void CZposDesktop::EndUpdate()
+{
+    m_pImpl->EndUpdate();
+}
+
 DesktopState CZposDesktop::GetDesktopState() const
 {
     return m_pImpl->GetDesktopState();
 }
 
+ZposDesktopStateSnapshot CZposDesktop::GetStateSnapshot() const
+{
+    return m_pImpl->GetStateSnapshot();
+}
+
+bool CZposDesktop::WaitForStateChange(UINT32 lastSequence, DWORD timeoutMs, ZposDesktopStateSnapshot* snapshot) const
+{
+    return m_pImpl->WaitForStateChange(lastSequence, timeoutMs, snapshot);
+}
+
 void CZposDesktop::SetDesktopStateCallback(DesktopStateCallback callback)
 {
     m_pImpl->SetDesktopStateCallback(callback);
 }
 
+void CZposDesktop::SetCallbackCoalescing(DWORD windowMs)
+{
+    m_pImpl->SetCallbackCoalescing(windowMs);
+}
+
 void CZposDesktop::RefreshWindowPositions()
 {
     m_pImpl->RefreshWindowPositions();
@@ -583,9 +2175,33 @@ bool CZposDesktop::IsWindowRegistered(HWND hwnd) const
     return m_pImpl->IsWindowRegistered(hwnd);
 }
 
+ZposDesktopStats CZposDesktop::GetStats() const
+{
+    return m_pImpl->GetStats();
+}
+
+bool CZposDesktop::StartTrace(const wchar_t* path)
+{
+    return m_pImpl->StartTrace(path);
+}
+
+bool CZposDesktop::StopTrace()
+{
+    return m_pImpl->StopTrace();
+}
+
 // Global instance for C exports
 static std::unique_ptr<CZposDesktop> g_instance;
 
+// Callers built against an older header pass a smaller cbSize and get the fields they know
+static bool CopyStats(const ZposDesktopStats& source, ZposDesktopStats* target)
+{
+    DWORD size = target->cbSize;
+    std::memcpy(target, &source, std::min<size_t>(size, sizeof(ZposDesktopStats)));
+    target->cbSize = size;
+    return source.enabled != FALSE;
+}
+
 // C-style exports
 extern "C"
 {
@@ -598,6 +2214,15 @@ extern "C"
         return g_instance->Initialize(hInstance);
     }
 
+    ZPOSDESKTOP_API bool __stdcall ZD_InitializeEx(HINSTANCE hInstance, DWORD flags)
+    {
+        if (!g_instance)
+        {
+            g_instance = std::make_unique<CZposDesktop>();
+        }
+        return g_instance->Initialize(hInstance, flags);
+    }
+
     ZPOSDESKTOP_API void __stdcall ZD_Finalize()
     {
         if (g_instance)
@@ -616,6 +2241,24 @@ extern "C"
         return false;
     }
 
+    ZPOSDESKTOP_API bool __stdcall ZD_RegisterWindowInLayer(HWND hwnd, int layer)
+    {
+        if (g_instance)
+        {
+            return g_instance->RegisterWindow(hwnd, layer);
+        }
+        return false;
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_SetWindowLayer(HWND hwnd, int layer)
+    {
+        if (g_instance)
+        {
+            return g_instance->SetWindowLayer(hwnd, layer);
+        }
+        return false;
+    }
+
     ZPOSDESKTOP_API bool __stdcall ZD_UnregisterWindow(HWND hwnd)
     {
         if (g_instance)
@@ -625,6 +2268,40 @@ extern "C"
         return false;
     }
 
+    ZPOSDESKTOP_API int __stdcall ZD_RegisterWindows(const HWND* hwnds, int count)
+    {
+        if (g_instance)
+        {
+            return g_instance->RegisterWindows(hwnds, count);
+        }
+        return 0;
+    }
+
+    ZPOSDESKTOP_API int __stdcall ZD_UnregisterWindows(const HWND* hwnds, int count)
+    {
+        if (g_instance)
+        {
+            return g_instance->UnregisterWindows(hwnds, count);
+        }
+        return 0;
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_BeginUpdate()
+    {
+        if (g_instance)
+        {
+            g_instance->BeginUpdate();
+        }
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_EndUpdate()
+    {
+        if (g_instance)
+        {
+            g_instance->EndUpdate();
+        }
+    }
+
     ZPOSDESKTOP_API int __stdcall ZD_GetDesktopState()
     {
         if (g_instance)
@@ -634,6 +2311,20 @@ extern "C"
         return 0;
     }
 
+    // Neither needs an instance, so a wait survives ZD_Finalize
+    ZPOSDESKTOP_API void __stdcall ZD_GetStateSnapshot(ZposDesktopStateSnapshot* snapshot)
+    {
+        if (snapshot)
+        {
+            *snapshot = DesktopEngine::GetStateSnapshot();
+        }
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_WaitForStateChange(UINT32 lastSequence, DWORD timeoutMs, ZposDesktopStateSnapshot* snapshot)
+    {
+        return DesktopEngine::WaitForStateChange(lastSequence, timeoutMs, snapshot);
+    }
+
     ZPOSDESKTOP_API void __stdcall ZD_SetDesktopStateCallback(DesktopStateCallback callback)
     {
         if (g_instance)
@@ -642,6 +2333,14 @@ extern "C"
         }
     }
 
+    ZPOSDESKTOP_API void __stdcall ZD_SetCallbackCoalescing(DWORD windowMs)
+    {
+        if (g_instance)
+        {
+            g_instance->SetCallbackCoalescing(windowMs);
+        }
+    }
+
     ZPOSDESKTOP_API void __stdcall ZD_RefreshWindowPositions()
     {
         if (g_instance)
@@ -658,5 +2357,157 @@ extern "C"
         }
         return false;
     }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_GetStats(ZposDesktopStats* stats)
+    {
+        if (!stats || stats->cbSize < ZD_STATS_MIN_SIZE)
+            return false;
+
+        // Without an instance the process-wide counters are still readable
+        return CopyStats(g_instance ? g_instance->GetStats() : GetProcessStats(), stats);
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_StartTrace(const wchar_t* path)
+    {
+        return g_instance ? g_instance->StartTrace(path) : false;
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_StopTrace()
+    {
+        return g_instance ? g_instance->StopTrace() : false;
+    }
+
+    ZPOSDESKTOP_API ZD_HANDLE __stdcall ZD_Create(HINSTANCE hInstance, DWORD flags)
+    {
+        std::unique_ptr<CZposDesktop> instance(new CZposDesktop());
+        if (!instance->Initialize(hInstance, flags))
+            return nullptr;
+
+        return reinterpret_cast<ZD_HANDLE>(instance.release());
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_Destroy(ZD_HANDLE handle)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        if (instance)
+        {
+            instance->Finalize();
+            delete instance;
+        }
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceRegisterWindow(ZD_HANDLE handle, HWND hwnd)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->RegisterWindow(hwnd) : false;
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceRegisterWindowInLayer(ZD_HANDLE handle, HWND hwnd, int layer)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->RegisterWindow(hwnd, layer) : false;
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceSetWindowLayer(ZD_HANDLE handle, HWND hwnd, int layer)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->SetWindowLayer(hwnd, layer) : false;
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceUnregisterWindow(ZD_HANDLE handle, HWND hwnd)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->UnregisterWindow(hwnd) : false;
+    }
+
+    ZPOSDESKTOP_API int __stdcall ZD_InstanceRegisterWindows(ZD_HANDLE handle, const HWND* hwnds, int count)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->RegisterWindows(hwnds, count) : 0;
+    }
+
+    ZPOSDESKTOP_API int __stdcall ZD_InstanceUnregisterWindows(ZD_HANDLE handle, const HWND* hwnds, int count)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->UnregisterWindows(hwnds, count) : 0;
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceBeginUpdate(ZD_HANDLE handle)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        if (instance)
+        {
+            instance->BeginUpdate();
+        }
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceEndUpdate(ZD_HANDLE handle)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        if (instance)
+        {
+            instance->EndUpdate();
+        }
+    }
+
+    ZPOSDESKTOP_API int __stdcall ZD_InstanceGetDesktopState(ZD_HANDLE handle)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? static_cast<int>(instance->GetDesktopState()) : 0;
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceSetDesktopStateCallback(ZD_HANDLE handle, DesktopStateCallback callback)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        if (instance)
+        {
+            instance->SetDesktopStateCallback(callback);
+        }
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceSetCallbackCoalescing(ZD_HANDLE handle, DWORD windowMs)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        if (instance)
+        {
+            instance->SetCallbackCoalescing(windowMs);
+        }
+    }
+
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceRefreshWindowPositions(ZD_HANDLE handle)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        if (instance)
+        {
+            instance->RefreshWindowPositions();
+        }
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceIsWindowRegistered(ZD_HANDLE handle, HWND hwnd)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->IsWindowRegistered(hwnd) : false;
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceGetStats(ZD_HANDLE handle, ZposDesktopStats* stats)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        if (!instance || !stats || stats->cbSize < ZD_STATS_MIN_SIZE)
+            return false;
+
+        return CopyStats(instance->GetStats(), stats);
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceStartTrace(ZD_HANDLE handle, const wchar_t* path)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->StartTrace(path) : false;
+    }
+
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceStopTrace(ZD_HANDLE handle)
+    {
+        CZposDesktop* instance = reinterpret_cast<CZposDesktop*>(handle);
+        return instance ? instance->StopTrace() : false;
+    }
 }
 
@@ -12,6 +12,100 @@ namespace ZposDesktop
         ShowingDesktop = 1
     }
 
+    /// <summary>
+    /// Initialization flags
+    /// </summary>
+    [Flags]
+    public enum InitializeFlags : uint
+    {
+        None = 0x0,
+
+        /// <summary>
+        /// Run detection and repositioning on a dedicated thread owned by the library.
+        /// </summary>
+        ServiceThread = 0x1,
+
+        /// <summary>
+        /// Share detection with the other processes of the session that use this flag.
+        /// One of them detects Show Desktop and repositions the windows of all of them.
+        /// </summary>
+        Coordinated = 0x2,
+
+        /// <summary>
+        /// Watch keyboard and mouse input for the Show Desktop shortcuts and the
+        /// taskbar button, so windows are repositioned as soon as the shell acts.
+        /// Requires <see cref="ServiceThread"/>; without it, initialization fails.
+        /// </summary>
+        InputTriggers = 0x4
+    }
+
+    /// <summary>
+    /// Latency histogram. Bucket 0 counts 0 us, bucket i counts [2^(i-1), 2^i) us
+    /// and the last bucket everything longer.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct Histogram
+    {
+        public ulong Count;
+        public ulong TotalUs;
+        public ulong MaxUs;
+
+        [MarshalAs(UnmanagedType.ByValArray, SizeConst = 20)]
+        public ulong[] Buckets;
+    }
+
+    /// <summary>
+    /// Desktop state with its version. The sequence grows by one with every
+    /// transition, so a reader can tell whether it missed any.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct StateSnapshot
+    {
+        public DesktopState State;
+        public uint Sequence;
+        /// <summary>GetTickCount64 time of the latest transition, 0 before the first</summary>
+        public ulong TransitionTimeMs;
+    }
+
+    /// <summary>
+    /// Library statistics since the process started
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct Stats
+    {
+        public uint Size;
+        public bool Enabled;
+
+        public ulong Messages;
+        public ulong TimerTicks;
+        public ulong DesktopChecks;
+        public ulong StateChanges;
+        public ulong RepositionPasses;
+        public ulong Enumerations;
+        public ulong EnumeratedWindows;
+        public ulong ZOrderCalls;
+        public ulong ZOrderCommits;
+        public ulong NotificationsDropped;
+        public ulong NotificationsCoalesced;
+
+        public Histogram CheckDesktopState;
+        public Histogram PositionWindows;
+        public Histogram TransitionLatency;
+
+        public ulong Wakeups;
+        public uint ProbeIntervalMs;
+        public bool ProbingSuspended;
+
+        public ulong RefreshRequests;
+        public ulong Refreshes;
+
+        public ulong Triggers;
+        public ulong TriggerMisses;
+        public ulong TriggerMissProbes;
+
+        public ulong DeferredPasses;
+    }
+
     /// <summary>
     /// Delegate for desktop state change callbacks
     /// </summary>
@@ -32,27 +126,66 @@ namespace ZposDesktop
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern bool ZD_Initialize(IntPtr hInstance);
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InitializeEx(IntPtr hInstance, uint flags);
+
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern void ZD_Finalize();
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern bool ZD_RegisterWindow(IntPtr hwnd);
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_RegisterWindowInLayer(IntPtr hwnd, int layer);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_SetWindowLayer(IntPtr hwnd, int layer);
+
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern bool ZD_UnregisterWindow(IntPtr hwnd);
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern int ZD_RegisterWindows(IntPtr[] hwnds, int count);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern int ZD_UnregisterWindows(IntPtr[] hwnds, int count);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_BeginUpdate();
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_EndUpdate();
+
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern int ZD_GetDesktopState();
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_GetStateSnapshot(out StateSnapshot snapshot);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_WaitForStateChange(uint lastSequence, uint timeoutMs, out StateSnapshot snapshot);
+
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern void ZD_SetDesktopStateCallback(DesktopStateCallback callback);
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_SetCallbackCoalescing(uint windowMs);
+
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern void ZD_RefreshWindowPositions();
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
         private static extern bool ZD_IsWindowRegistered(IntPtr hwnd);
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_GetStats(ref Stats stats);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true, CharSet = CharSet.Unicode)]
+        private static extern bool ZD_StartTrace(string path);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_StopTrace();
+
         #endregion
 
         #region Public API
@@ -76,6 +209,16 @@ namespace ZposDesktop
             return ZD_Initialize(hInstance);
         }
 
+        /// <summary>
+        /// Initialize the desktop manager with options
+        /// </summary>
+        /// <param name="flags">Initialization flags</param>
+        /// <returns>True if initialization succeeded</returns>
+        public static bool Initialize(InitializeFlags flags)
+        {
+            return ZD_InitializeEx(IntPtr.Zero, (uint)flags);
+        }
+
         /// <summary>
         /// Cleanup resources and shutdown the desktop manager
         /// </summary>
@@ -85,7 +228,8 @@ namespace ZposDesktop
         }
 
         /// <summary>
-        /// Register a window to stay visible when "Show Desktop" is used
+        /// Register a window to stay visible when "Show Desktop" is used.
+        /// Destroyed windows are unregistered automatically.
         /// </summary>
         /// <param name="windowHandle">Handle to the window</param>
         /// <returns>True if registration succeeded</returns>
@@ -97,6 +241,35 @@ namespace ZposDesktop
             return ZD_RegisterWindow(windowHandle);
         }
 
+        /// <summary>
+        /// Register a window in a z-order layer. Windows in higher layers are kept above
+        /// those in lower layers; RegisterWindow uses layer 0.
+        /// </summary>
+        /// <param name="windowHandle">Handle to the window</param>
+        /// <param name="layer">Layer of the window</param>
+        /// <returns>True if registration succeeded</returns>
+        public static bool RegisterWindow(IntPtr windowHandle, int layer)
+        {
+            if (windowHandle == IntPtr.Zero)
+                throw new ArgumentException("Window handle cannot be zero", nameof(windowHandle));
+
+            return ZD_RegisterWindowInLayer(windowHandle, layer);
+        }
+
+        /// <summary>
+        /// Move a registered window to another z-order layer
+        /// </summary>
+        /// <param name="windowHandle">Handle to the window</param>
+        /// <param name="layer">New layer of the window</param>
+        /// <returns>True if the window is registered</returns>
+        public static bool SetWindowLayer(IntPtr windowHandle, int layer)
+        {
+            if (windowHandle == IntPtr.Zero)
+                throw new ArgumentException("Window handle cannot be zero", nameof(windowHandle));
+
+            return ZD_SetWindowLayer(windowHandle, layer);
+        }
+
         /// <summary>
         /// Unregister a previously registered window
         /// </summary>
@@ -110,6 +283,48 @@ namespace ZposDesktop
             return ZD_UnregisterWindow(windowHandle);
         }
 
+        /// <summary>
+        /// Register several windows with a single repositioning pass
+        /// </summary>
+        /// <param name="windowHandles">Handles to the windows</param>
+        /// <returns>Number of windows that were registered</returns>
+        public static int RegisterWindows(IntPtr[] windowHandles)
+        {
+            if (windowHandles == null)
+                throw new ArgumentNullException(nameof(windowHandles));
+
+            return ZD_RegisterWindows(windowHandles, windowHandles.Length);
+        }
+
+        /// <summary>
+        /// Unregister several previously registered windows
+        /// </summary>
+        /// <param name="windowHandles">Handles to the windows</param>
+        /// <returns>Number of windows that were unregistered</returns>
+        public static int UnregisterWindows(IntPtr[] windowHandles)
+        {
+            if (windowHandles == null)
+                throw new ArgumentNullException(nameof(windowHandles));
+
+            return ZD_UnregisterWindows(windowHandles, windowHandles.Length);
+        }
+
+        /// <summary>
+        /// Defer repositioning until the matching EndUpdate. Calls can be nested.
+        /// </summary>
+        public static void BeginUpdate()
+        {
+            ZD_BeginUpdate();
+        }
+
+        /// <summary>
+        /// End an update scope. The outermost scope repositions the windows registered in it.
+        /// </summary>
+        public static void EndUpdate()
+        {
+            ZD_EndUpdate();
+        }
+
         /// <summary>
         /// Get the current desktop state
         /// </summary>
@@ -120,7 +335,31 @@ namespace ZposDesktop
         }
 
         /// <summary>
-        /// Set a callback to be notified of desktop state changes
+        /// Get the desktop state with its sequence and the time of the latest transition
+        /// </summary>
+        public static StateSnapshot GetStateSnapshot()
+        {
+            StateSnapshot snapshot;
+            ZD_GetStateSnapshot(out snapshot);
+            return snapshot;
+        }
+
+        /// <summary>
+        /// Block until the desktop state changes, without using CPU while waiting.
+        /// Works from any thread, also before initializing and after shutting down.
+        /// </summary>
+        /// <param name="lastSequence">Sequence of the last snapshot seen</param>
+        /// <param name="timeoutMs">Timeout in milliseconds, uint.MaxValue waits forever</param>
+        /// <param name="snapshot">The state, changed or not</param>
+        /// <returns>True if the sequence differs from lastSequence</returns>
+        public static bool WaitForStateChange(uint lastSequence, uint timeoutMs, out StateSnapshot snapshot)
+        {
+            return ZD_WaitForStateChange(lastSequence, timeoutMs, out snapshot);
+        }
+
+        /// <summary>
+        /// Set a callback to be notified of desktop state changes.
+        /// The callback is invoked on a library thread.
         /// </summary>
         /// <param name="callback">Callback function to be called on state changes</param>
         public static void SetDesktopStateCallback(DesktopStateCallback callback)
@@ -128,6 +367,16 @@ namespace ZposDesktop
             ZD_SetDesktopStateCallback(callback);
         }
 
+        /// <summary>
+        /// Hold state changes back and only report the net change, so rapid
+        /// flip-flops do not reach the callback
+        /// </summary>
+        /// <param name="windowMs">Coalescing window in milliseconds, 0 reports every change</param>
+        public static void SetCallbackCoalescing(uint windowMs)
+        {
+            ZD_SetCallbackCoalescing(windowMs);
+        }
+
         /// <summary>
         /// Force refresh of all managed window positions
         /// </summary>
@@ -149,6 +398,39 @@ namespace ZposDesktop
             return ZD_IsWindowRegistered(windowHandle);
         }
 
+        /// <summary>
+        /// Get the library statistics
+        /// </summary>
+        /// <returns>The statistics; Enabled is false if the library was built without them</returns>
+        public static Stats GetStats()
+        {
+            var stats = new Stats { Size = (uint)Marshal.SizeOf(typeof(Stats)) };
+            ZD_GetStats(ref stats);
+            return stats;
+        }
+
+        /// <summary>
+        /// Start recording a trace of desktop events and z-order changes for replay
+        /// </summary>
+        /// <param name="path">File to write the trace to</param>
+        /// <returns>True if recording started</returns>
+        public static bool StartTrace(string path)
+        {
+            if (string.IsNullOrEmpty(path))
+                return false;
+
+            return ZD_StartTrace(path);
+        }
+
+        /// <summary>
+        /// Stop recording and close the trace file
+        /// </summary>
+        /// <returns>True if a trace was being recorded</returns>
+        public static bool StopTrace()
+        {
+            return ZD_StopTrace();
+        }
+
         #endregion
 
         #region Helper Methods for Common UI Frameworks
@@ -205,6 +487,17 @@ namespace ZposDesktop
                 throw new InvalidOperationException("Failed to initialize ZposDesktop");
         }
 
+        /// <summary>
+        /// Initialize the desktop manager with options
+        /// </summary>
+        /// <param name="flags">Initialization flags</param>
+        public ZposDesktopManager(InitializeFlags flags)
+        {
+            _initialized = ZposDesktop.Initialize(flags);
+            if (!_initialized)
+                throw new InvalidOperationException("Failed to initialize ZposDesktop");
+        }
+
         /// <summary>
         /// Register a window to stay visible during "Show Desktop"
         /// </summary>
@@ -216,6 +509,27 @@ namespace ZposDesktop
             return ZposDesktop.RegisterWindow(windowHandle);
         }
 
+        /// <summary>
+        /// Register a window in a z-order layer
+        /// </summary>
+        /// <param name="windowHandle">Window handle</param>
+        /// <param name="layer">Layer of the window, higher layers stay above lower ones</param>
+        /// <returns>True if successful</returns>
+        public bool RegisterWindow(IntPtr windowHandle, int layer)
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.RegisterWindow(windowHandle, layer);
+        }
+
+        /// <summary>
+        /// Move a registered window to another z-order layer
+        /// </summary>
+        public bool SetWindowLayer(IntPtr windowHandle, int layer)
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.SetWindowLayer(windowHandle, layer);
+        }
+
 #if WPF
         /// <summary>
         /// Register a WPF Window
@@ -253,6 +567,46 @@ namespace ZposDesktop
             return ZposDesktop.UnregisterWindow(windowHandle);
         }
 
+        /// <summary>
+        /// Register several windows with a single repositioning pass
+        /// </summary>
+        /// <param name="windowHandles">Window handles</param>
+        /// <returns>Number of windows that were registered</returns>
+        public int RegisterWindows(IntPtr[] windowHandles)
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.RegisterWindows(windowHandles);
+        }
+
+        /// <summary>
+        /// Unregister several windows
+        /// </summary>
+        /// <param name="windowHandles">Window handles</param>
+        /// <returns>Number of windows that were unregistered</returns>
+        public int UnregisterWindows(IntPtr[] windowHandles)
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.UnregisterWindows(windowHandles);
+        }
+
+        /// <summary>
+        /// Defer repositioning until the matching EndUpdate
+        /// </summary>
+        public void BeginUpdate()
+        {
+            ThrowIfDisposed();
+            ZposDesktop.BeginUpdate();
+        }
+
+        /// <summary>
+        /// End an update scope
+        /// </summary>
+        public void EndUpdate()
+        {
+            ThrowIfDisposed();
+            ZposDesktop.EndUpdate();
+        }
+
         /// <summary>
         /// Get current desktop state
         /// </summary>
@@ -262,6 +616,28 @@ namespace ZposDesktop
             return ZposDesktop.GetDesktopState();
         }
 
+        /// <summary>
+        /// Get the desktop state with its sequence and the time of the latest transition
+        /// </summary>
+        public StateSnapshot GetStateSnapshot()
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.GetStateSnapshot();
+        }
+
+        /// <summary>
+        /// Block until the desktop state changes, without using CPU while waiting
+        /// </summary>
+        /// <param name="lastSequence">Sequence of the last snapshot seen</param>
+        /// <param name="timeoutMs">Timeout in milliseconds, uint.MaxValue waits forever</param>
+        /// <param name="snapshot">The state, changed or not</param>
+        /// <returns>True if the sequence differs from lastSequence</returns>
+        public bool WaitForStateChange(uint lastSequence, uint timeoutMs, out StateSnapshot snapshot)
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.WaitForStateChange(lastSequence, timeoutMs, out snapshot);
+        }
+
         /// <summary>
         /// Set desktop state change callback
         /// </summary>
@@ -272,6 +648,16 @@ namespace ZposDesktop
             ZposDesktop.SetDesktopStateCallback(callback);
         }
 
+        /// <summary>
+        /// Set the callback coalescing window
+        /// </summary>
+        /// <param name="windowMs">Coalescing window in milliseconds, 0 reports every change</param>
+        public void SetCallbackCoalescing(uint windowMs)
+        {
+            ThrowIfDisposed();
+            ZposDesktop.SetCallbackCoalescing(windowMs);
+        }
+
         /// <summary>
         /// Refresh window positions
         /// </summary>
@@ -292,6 +678,33 @@ namespace ZposDesktop
             return ZposDesktop.IsWindowRegistered(windowHandle);
         }
 
+        /// <summary>
+        /// Get the library statistics
+        /// </summary>
+        public Stats GetStats()
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.GetStats();
+        }
+
+        /// <summary>
+        /// Start recording a trace of desktop events and z-order changes for replay
+        /// </summary>
+        public bool StartTrace(string path)
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.StartTrace(path);
+        }
+
+        /// <summary>
+        /// Stop recording and close the trace file
+        /// </summary>
+        public bool StopTrace()
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.StopTrace();
+        }
+
         private void ThrowIfDisposed()
         {
             if (_disposed)
@@ -310,4 +723,318 @@ namespace ZposDesktop
             }
         }
     }
+
+    /// <summary>
+    /// An independent desktop manager instance.
+    /// Every instance manages its own windows and callback, while all instances
+    /// of a process share one detection engine.
+    /// </summary>
+    public sealed class ZposDesktopInstance : IDisposable
+    {
+        private const string DllName = "ZposDesktop.dll";
+
+        private IntPtr _handle;
+        private DesktopStateCallback _callback;
+
+        #region Native Methods
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern IntPtr ZD_Create(IntPtr hInstance, uint flags);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_Destroy(IntPtr handle);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InstanceRegisterWindow(IntPtr handle, IntPtr hwnd);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InstanceRegisterWindowInLayer(IntPtr handle, IntPtr hwnd, int layer);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InstanceSetWindowLayer(IntPtr handle, IntPtr hwnd, int layer);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InstanceUnregisterWindow(IntPtr handle, IntPtr hwnd);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern int ZD_InstanceRegisterWindows(IntPtr handle, IntPtr[] hwnds, int count);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern int ZD_InstanceUnregisterWindows(IntPtr handle, IntPtr[] hwnds, int count);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_InstanceBeginUpdate(IntPtr handle);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_InstanceEndUpdate(IntPtr handle);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern int ZD_InstanceGetDesktopState(IntPtr handle);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_InstanceSetDesktopStateCallback(IntPtr handle, DesktopStateCallback callback);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_InstanceSetCallbackCoalescing(IntPtr handle, uint windowMs);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern void ZD_InstanceRefreshWindowPositions(IntPtr handle);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InstanceIsWindowRegistered(IntPtr handle, IntPtr hwnd);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InstanceGetStats(IntPtr handle, ref Stats stats);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true, CharSet = CharSet.Unicode)]
+        private static extern bool ZD_InstanceStartTrace(IntPtr handle, string path);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall, SetLastError = true)]
+        private static extern bool ZD_InstanceStopTrace(IntPtr handle);
+
+        #endregion
+
+        /// <summary>
+        /// Create a new manager instance
+        /// </summary>
+        /// <param name="flags">Initialization flags. All instances of a process share one engine, so they must match those of the instances already running.</param>
+        /// <exception cref="InvalidOperationException">The instance could not be created, or other instances run with different flags</exception>
+        public ZposDesktopInstance(InitializeFlags flags = InitializeFlags.None)
+        {
+            _handle = ZD_Create(IntPtr.Zero, (uint)flags);
+            if (_handle == IntPtr.Zero)
+                throw new InvalidOperationException("Failed to create ZposDesktop instance");
+        }
+
+        /// <summary>
+        /// Register a window to stay visible during "Show Desktop"
+        /// </summary>
+        /// <param name="windowHandle">Window handle</param>
+        /// <returns>True if successful, false if the window belongs to another instance</returns>
+        public bool RegisterWindow(IntPtr windowHandle)
+        {
+            ThrowIfDisposed();
+            if (windowHandle == IntPtr.Zero)
+                throw new ArgumentException("Window handle cannot be zero", nameof(windowHandle));
+
+            return ZD_InstanceRegisterWindow(_handle, windowHandle);
+        }
+
+        /// <summary>
+        /// Register a window in a z-order layer
+        /// </summary>
+        /// <param name="windowHandle">Window handle</param>
+        /// <param name="layer">Layer of the window, higher layers stay above lower ones</param>
+        /// <returns>True if successful, false if the window belongs to another instance</returns>
+        public bool RegisterWindow(IntPtr windowHandle, int layer)
+        {
+            ThrowIfDisposed();
+            if (windowHandle == IntPtr.Zero)
+                throw new ArgumentException("Window handle cannot be zero", nameof(windowHandle));
+
+            return ZD_InstanceRegisterWindowInLayer(_handle, windowHandle, layer);
+        }
+
+        /// <summary>
+        /// Move a window of this instance to another z-order layer
+        /// </summary>
+        public bool SetWindowLayer(IntPtr windowHandle, int layer)
+        {
+            ThrowIfDisposed();
+            if (windowHandle == IntPtr.Zero)
+                throw new ArgumentException("Window handle cannot be zero", nameof(windowHandle));
+
+            return ZD_InstanceSetWindowLayer(_handle, windowHandle, layer);
+        }
+
+        /// <summary>
+        /// Unregister a window of this instance
+        /// </summary>
+        /// <param name="windowHandle">Window handle</param>
+        /// <returns>True if successful</returns>
+        public bool UnregisterWindow(IntPtr windowHandle)
+        {
+            ThrowIfDisposed();
+            if (windowHandle == IntPtr.Zero)
+                throw new ArgumentException("Window handle cannot be zero", nameof(windowHandle));
+
+            return ZD_InstanceUnregisterWindow(_handle, windowHandle);
+        }
+
+        /// <summary>
+        /// Register several windows with a single repositioning pass
+        /// </summary>
+        /// <param name="windowHandles">Window handles</param>
+        /// <returns>Number of windows that were registered</returns>
+        public int RegisterWindows(IntPtr[] windowHandles)
+        {
+            ThrowIfDisposed();
+            if (windowHandles == null)
+                throw new ArgumentNullException(nameof(windowHandles));
+
+            return ZD_InstanceRegisterWindows(_handle, windowHandles, windowHandles.Length);
+        }
+
+        /// <summary>
+        /// Unregister several windows of this instance
+        /// </summary>
+        /// <param name="windowHandles">Window handles</param>
+        /// <returns>Number of windows that were unregistered</returns>
+        public int UnregisterWindows(IntPtr[] windowHandles)
+        {
+            ThrowIfDisposed();
+            if (windowHandles == null)
+                throw new ArgumentNullException(nameof(windowHandles));
+
+            return ZD_InstanceUnregisterWindows(_handle, windowHandles, windowHandles.Length);
+        }
+
+        /// <summary>
+        /// Defer repositioning until the matching EndUpdate
+        /// </summary>
+        public void BeginUpdate()
+        {
+            ThrowIfDisposed();
+            ZD_InstanceBeginUpdate(_handle);
+        }
+
+        /// <summary>
+        /// End an update scope
+        /// </summary>
+        public void EndUpdate()
+        {
+            ThrowIfDisposed();
+            ZD_InstanceEndUpdate(_handle);
+        }
+
+        /// <summary>
+        /// Get current desktop state
+        /// </summary>
+        public DesktopState GetDesktopState()
+        {
+            ThrowIfDisposed();
+            return (DesktopState)ZD_InstanceGetDesktopState(_handle);
+        }
+
+        /// <summary>
+        /// Get the desktop state with its sequence and the time of the latest transition.
+        /// The state is shared by all instances.
+        /// </summary>
+        public StateSnapshot GetStateSnapshot()
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.GetStateSnapshot();
+        }
+
+        /// <summary>
+        /// Block until the desktop state changes, without using CPU while waiting
+        /// </summary>
+        /// <param name="lastSequence">Sequence of the last snapshot seen</param>
+        /// <param name="timeoutMs">Timeout in milliseconds, uint.MaxValue waits forever</param>
+        /// <param name="snapshot">The state, changed or not</param>
+        /// <returns>True if the sequence differs from lastSequence</returns>
+        public bool WaitForStateChange(uint lastSequence, uint timeoutMs, out StateSnapshot snapshot)
+        {
+            ThrowIfDisposed();
+            return ZposDesktop.WaitForStateChange(lastSequence, timeoutMs, out snapshot);
+        }
+
+        /// <summary>
+        /// Set the desktop state change callback of this instance
+        /// </summary>
+        /// <param name="callback">Callback function</param>
+        public void SetDesktopStateCallback(DesktopStateCallback callback)
+        {
+            ThrowIfDisposed();
+
+            // Keep the delegate alive while native code holds it
+            _callback = callback;
+            ZD_InstanceSetDesktopStateCallback(_handle, callback);
+        }
+
+        /// <summary>
+        /// Set the callback coalescing window of this instance
+        /// </summary>
+        /// <param name="windowMs">Coalescing window in milliseconds, 0 reports every change</param>
+        public void SetCallbackCoalescing(uint windowMs)
+        {
+            ThrowIfDisposed();
+            ZD_InstanceSetCallbackCoalescing(_handle, windowMs);
+        }
+
+        /// <summary>
+        /// Refresh window positions
+        /// </summary>
+        public void RefreshWindowPositions()
+        {
+            ThrowIfDisposed();
+            ZD_InstanceRefreshWindowPositions(_handle);
+        }
+
+        /// <summary>
+        /// Check if a window is registered with this instance
+        /// </summary>
+        /// <param name="windowHandle">Window handle</param>
+        /// <returns>True if registered</returns>
+        public bool IsWindowRegistered(IntPtr windowHandle)
+        {
+            ThrowIfDisposed();
+            if (windowHandle == IntPtr.Zero)
+                return false;
+
+            return ZD_InstanceIsWindowRegistered(_handle, windowHandle);
+        }
+
+        /// <summary>
+        /// Get the library statistics, with the notification counts of this instance
+        /// </summary>
+        public Stats GetStats()
+        {
+            ThrowIfDisposed();
+            var stats = new Stats { Size = (uint)Marshal.SizeOf(typeof(Stats)) };
+            ZD_InstanceGetStats(_handle, ref stats);
+            return stats;
+        }
+
+        /// <summary>
+        /// Start recording a trace of desktop events and z-order changes for replay.
+        /// The trace covers all instances of the process.
+        /// </summary>
+        public bool StartTrace(string path)
+        {
+            ThrowIfDisposed();
+            if (string.IsNullOrEmpty(path))
+                return false;
+
+            return ZD_InstanceStartTrace(_handle, path);
+        }
+
+        /// <summary>
+        /// Stop recording and close the trace file
+        /// </summary>
+        public bool StopTrace()
+        {
+            ThrowIfDisposed();
+            return ZD_InstanceStopTrace(_handle);
+        }
+
+        private void ThrowIfDisposed()
+        {
+            if (_handle == IntPtr.Zero)
+                throw new ObjectDisposedException(nameof(ZposDesktopInstance));
+        }
+
+        /// <summary>
+        /// Unregister the windows of this instance and release it
+        /// </summary>
+        public void Dispose()
+        {
+            if (_handle != IntPtr.Zero)
+            {
+                ZD_Destroy(_handle);
+                _handle = IntPtr.Zero;
+                _callback = null;
+            }
+        }
+    }
 }
\ No newline at end of file
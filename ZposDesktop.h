@@ -16,6 +16,95 @@ enum class DesktopState
 // Callback for desktop state changes
 typedef void(__stdcall* DesktopStateCallback)(DesktopState state);
 
+// Initialization flags
+enum ZposDesktopFlags
+{
+    ZD_FLAG_NONE = 0x0,
+
+    // Run detection and repositioning on a dedicated thread owned by the library.
+    // API calls are marshalled to it.
+    ZD_FLAG_SERVICE_THREAD = 0x1,
+
+    // Share detection with the other processes of the session that use this flag.
+    // One of them detects Show Desktop and repositions the windows of all of them.
+    ZD_FLAG_COORDINATED = 0x2,
+
+    // Watch keyboard and mouse input for the Show Desktop shortcuts and the
+    // taskbar button, so windows are repositioned as soon as the shell acts.
+    // Requires ZD_FLAG_SERVICE_THREAD; without it, initialization fails with
+    // ERROR_INVALID_PARAMETER.
+    ZD_FLAG_INPUT_TRIGGERS = 0x4
+};
+
+// Layer of windows registered without one. Windows in higher layers are kept
+// above those in lower layers; any int can be used as a layer.
+#define ZD_LAYER_DEFAULT 0
+
+#define ZD_STATS_HISTOGRAM_BUCKETS 20
+
+// Latency histogram. Bucket 0 counts 0 us, bucket i counts [2^(i-1), 2^i) us
+// and the last bucket everything longer.
+struct ZposDesktopHistogram
+{
+    UINT64 count;
+    UINT64 totalUs;
+    UINT64 maxUs;
+    UINT64 buckets[ZD_STATS_HISTOGRAM_BUCKETS];
+};
+
+// Library statistics since the process started. The notification counts are
+// those of the instance's callback. Set cbSize before calling ZD_GetStats;
+// fields beyond cbSize are left alone.
+struct ZposDesktopStats
+{
+    DWORD cbSize;
+    BOOL enabled;                   // FALSE if the library was built without statistics
+
+    UINT64 messages;                // Messages handled by the system window
+    UINT64 timerTicks;              // Probe timer ticks
+    UINT64 desktopChecks;           // Desktop state probes
+    UINT64 stateChanges;            // Show Desktop transitions
+    UINT64 repositionPasses;        // Repositioning passes
+    UINT64 enumerations;            // EnumWindows calls
+    UINT64 enumeratedWindows;       // Windows visited by those calls
+    UINT64 zorderCalls;             // SetWindowPos and DeferWindowPos calls
+    UINT64 zorderCommits;           // Batched z-order commits
+    UINT64 notificationsDropped;    // State changes the callback fell too far behind for
+    UINT64 notificationsCoalesced;  // State changes merged by callback coalescing
+
+    ZposDesktopHistogram checkDesktopState;     // Duration of a probe
+    ZposDesktopHistogram positionWindows;       // Duration of a repositioning pass
+    ZposDesktopHistogram transitionLatency;     // From the triggering event to windows in place
+
+    UINT64 wakeups;                 // Timer callbacks of any kind
+    DWORD probeIntervalMs;          // Current desktop probe interval, 0 while no probe is scheduled
+    BOOL probingSuspended;          // Probing stopped because the session is locked or the display is off
+
+    UINT64 refreshRequests;         // Repositioning passes asked for by messages and API calls
+    UINT64 refreshes;               // Passes those requests were merged into
+
+    UINT64 triggers;                // Inputs recognised as announcing Show Desktop
+    UINT64 triggerMisses;           // Triggers not followed by a transition
+    UINT64 triggerMissProbes;       // Probes run for those
+
+    UINT64 deferredPasses;          // Stacking passes moved to the next display frame
+};
+
+// Desktop state with its version. The sequence grows by one with every
+// transition, so a reader can tell whether it missed any.
+struct ZposDesktopStateSnapshot
+{
+    int state;                      // DesktopState
+    UINT32 sequence;                // Transitions since the process started, 0 before the first
+    UINT64 transitionTimeMs;        // GetTickCount64 time of the latest transition, 0 before the first
+};
+
+// Size of the statistics before wakeups were added, the smallest cbSize accepted
+#define ZD_STATS_MIN_SIZE offsetof(ZposDesktopStats, wakeups)
+
+// Opaque handle to a manager instance created with ZD_Create
+typedef struct ZD_INSTANCE__* ZD_HANDLE;
+
 class ZPOSDESKTOP_API CZposDesktop
 {
 public:
@@ -25,27 +114,70 @@ public:
     // Initialize the desktop manager
     bool Initialize(HINSTANCE hInstance);
 
+    // Initialize the desktop manager with ZposDesktopFlags. All instances of a
+    // process share one engine, so this fails while other instances run it with
+    // different flags.
+    bool Initialize(HINSTANCE hInstance, DWORD flags);
+
     // Cleanup resources
     void Finalize();
 
-    // Register a window to stay visible on desktop
+    // Register a window to stay visible on desktop. Destroyed windows are
+    // unregistered automatically, hidden and minimized ones are not moved.
     bool RegisterWindow(HWND hwnd);
 
+    // Register a window in a z-order layer. Registering or moving a window only
+    // restacks the layers involved.
+    bool RegisterWindow(HWND hwnd, int layer);
+
+    // Move a registered window to another layer
+    bool SetWindowLayer(HWND hwnd, int layer);
+
     // Unregister a window
     bool UnregisterWindow(HWND hwnd);
 
+    // Register or unregister several windows with a single repositioning pass.
+    // Return the number of windows that were (un)registered.
+    int RegisterWindows(const HWND* hwnds, int count);
+    int RegisterWindows(const HWND* hwnds, int count, int layer);
+    int UnregisterWindows(const HWND* hwnds, int count);
+
+    // Registrations between BeginUpdate and EndUpdate share one repositioning
+    // pass when the outermost EndUpdate is called. Scopes can be nested.
+    void BeginUpdate();
+    void EndUpdate();
+
     // Get current desktop state
     DesktopState GetDesktopState() const;
 
-    // Set callback for desktop state changes
+    // Get the desktop state with its sequence and the time of the latest transition
+    ZposDesktopStateSnapshot GetStateSnapshot() const;
+
+    // Block until the sequence differs from lastSequence or timeoutMs passed
+    // (INFINITE waits forever). Returns true if it changed; snapshot receives
+    // the state either way. Waiting threads use no CPU.
+    bool WaitForStateChange(UINT32 lastSequence, DWORD timeoutMs, ZposDesktopStateSnapshot* snapshot) const;
+
+    // Set callback for desktop state changes. It is invoked on a library thread.
     void SetDesktopStateCallback(DesktopStateCallback callback);
 
+    // Hold state changes back for windowMs and only report the net change (0 = report all)
+    void SetCallbackCoalescing(DWORD windowMs);
+
     // Force refresh of all managed windows
     void RefreshWindowPositions();
 
     // Check if a window is registered
     bool IsWindowRegistered(HWND hwnd) const;
 
+    // Get the library statistics
+    ZposDesktopStats GetStats() const;
+
+    // Record a binary trace of all desktop events and z-order changes to a file,
+    // for replay with the TraceReplay tool. The trace covers every instance.
+    bool StartTrace(const wchar_t* path);
+    bool StopTrace();
+
 private:
     class Impl;
     Impl* m_pImpl;
@@ -55,11 +187,46 @@ private:
 extern "C"
 {
     ZPOSDESKTOP_API bool __stdcall ZD_Initialize(HINSTANCE hInstance);
+    ZPOSDESKTOP_API bool __stdcall ZD_InitializeEx(HINSTANCE hInstance, DWORD flags);
     ZPOSDESKTOP_API void __stdcall ZD_Finalize();
     ZPOSDESKTOP_API bool __stdcall ZD_RegisterWindow(HWND hwnd);
+    ZPOSDESKTOP_API bool __stdcall ZD_RegisterWindowInLayer(HWND hwnd, int layer);
+    ZPOSDESKTOP_API bool __stdcall ZD_SetWindowLayer(HWND hwnd, int layer);
     ZPOSDESKTOP_API bool __stdcall ZD_UnregisterWindow(HWND hwnd);
+    ZPOSDESKTOP_API int __stdcall ZD_RegisterWindows(const HWND* hwnds, int count);
+    ZPOSDESKTOP_API int __stdcall ZD_UnregisterWindows(const HWND* hwnds, int count);
+    ZPOSDESKTOP_API void __stdcall ZD_BeginUpdate();
+    ZPOSDESKTOP_API void __stdcall ZD_EndUpdate();
     ZPOSDESKTOP_API int __stdcall ZD_GetDesktopState();
+    ZPOSDESKTOP_API void __stdcall ZD_GetStateSnapshot(ZposDesktopStateSnapshot* snapshot);
+    ZPOSDESKTOP_API bool __stdcall ZD_WaitForStateChange(UINT32 lastSequence, DWORD timeoutMs, ZposDesktopStateSnapshot* snapshot);
     ZPOSDESKTOP_API void __stdcall ZD_SetDesktopStateCallback(DesktopStateCallback callback);
+    ZPOSDESKTOP_API void __stdcall ZD_SetCallbackCoalescing(DWORD windowMs);
     ZPOSDESKTOP_API void __stdcall ZD_RefreshWindowPositions();
     ZPOSDESKTOP_API bool __stdcall ZD_IsWindowRegistered(HWND hwnd);
+    ZPOSDESKTOP_API bool __stdcall ZD_GetStats(ZposDesktopStats* stats);
+    ZPOSDESKTOP_API bool __stdcall ZD_StartTrace(const wchar_t* path);
+    ZPOSDESKTOP_API bool __stdcall ZD_StopTrace();
+
+    // Independent manager instances. Every instance manages its own windows and
+    // callback; all instances of a process share one detection engine, and
+    // ZD_Create fails if the flags differ from those it runs with.
+    ZPOSDESKTOP_API ZD_HANDLE __stdcall ZD_Create(HINSTANCE hInstance, DWORD flags);
+    ZPOSDESKTOP_API void __stdcall ZD_Destroy(ZD_HANDLE handle);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceRegisterWindow(ZD_HANDLE handle, HWND hwnd);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceRegisterWindowInLayer(ZD_HANDLE handle, HWND hwnd, int layer);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceSetWindowLayer(ZD_HANDLE handle, HWND hwnd, int layer);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceUnregisterWindow(ZD_HANDLE handle, HWND hwnd);
+    ZPOSDESKTOP_API int __stdcall ZD_InstanceRegisterWindows(ZD_HANDLE handle, const HWND* hwnds, int count);
+    ZPOSDESKTOP_API int __stdcall ZD_InstanceUnregisterWindows(ZD_HANDLE handle, const HWND* hwnds, int count);
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceBeginUpdate(ZD_HANDLE handle);
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceEndUpdate(ZD_HANDLE handle);
+    ZPOSDESKTOP_API int __stdcall ZD_InstanceGetDesktopState(ZD_HANDLE handle);
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceSetDesktopStateCallback(ZD_HANDLE handle, DesktopStateCallback callback);
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceSetCallbackCoalescing(ZD_HANDLE handle, DWORD windowMs);
+    ZPOSDESKTOP_API void __stdcall ZD_InstanceRefreshWindowPositions(ZD_HANDLE handle);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceIsWindowRegistered(ZD_HANDLE handle, HWND hwnd);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceGetStats(ZD_HANDLE handle, ZposDesktopStats* stats);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceStartTrace(ZD_HANDLE handle, const wchar_t* path);
+    ZPOSDESKTOP_API bool __stdcall ZD_InstanceStopTrace(ZD_HANDLE handle);
 }
\ No newline at end of file
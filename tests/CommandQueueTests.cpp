@@ -0,0 +1,67 @@
+#include "Test.h"
+#include "CommandQueue.h"
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(KeepsEachProducersOrder)
+{
+    const int producers = 4;
+    const int perProducer = 20000;
+    CommandQueue queue;
+    std::vector<int> next(producers, 0);
+    std::atomic<int> outOfOrder(0);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]()
+        {
+            for (int i = 0; i < perProducer; ++i)
+            {
+                queue.Push([&, p, i]()
+                {
+                    outOfOrder += next[p] == i ? 0 : 1;
+                    next[p] = i + 1;
+                });
+            }
+        });
+    }
+
+    // The consumer runs concurrently and may see the queue empty for a moment
+    int popped = 0;
+    CommandQueue::Command command;
+    while (popped < producers * perProducer)
+    {
+        if (queue.Pop(command))
+        {
+            command();
+            ++popped;
+        }
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    CHECK(!queue.Pop(command));
+    CHECK(outOfOrder == 0);
+    for (int p = 0; p < producers; ++p)
+    {
+        CHECK(next[p] == perProducer);
+    }
+}
+
+TEST(FreesCommandsNeverRun)
+{
+    std::shared_ptr<int> token = std::make_shared<int>(0);
+    {
+        CommandQueue queue;
+        for (int i = 0; i < 10; ++i)
+        {
+            queue.Push([token]() {});
+        }
+        CHECK(token.use_count() == 11);
+    }
+    CHECK(token.use_count() == 1);
+}
@@ -0,0 +1,367 @@
+#include "Test.h"
+#include "CoordinatorProtocol.h"
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+// The processes a test pretends are running
+static bool IsAlive(uint32_t processId, void* context)
+{
+    return static_cast<std::set<uint32_t>*>(context)->count(processId) > 0;
+}
+
+static bool AllAlive(uint32_t, void*)
+{
+    return true;
+}
+
+static CoordinatorCommand Command(uint64_t hwnd, int32_t layer, uint32_t processId)
+{
+    CoordinatorCommand command = { hwnd, layer, COORDINATOR_REGISTER, processId, 0 };
+    return command;
+}
+
+// A zero-filled page, as a new mapping is
+static std::unique_ptr<CoordinatorPage> NewPage()
+{
+    return std::unique_ptr<CoordinatorPage>(new CoordinatorPage());
+}
+
+TEST(AttachChecksTheVersion)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    CHECK(channel.Attach(page.get()));
+    CHECK(page->version == COORDINATOR_VERSION);
+
+    CoordinatorChannel other;
+    CHECK(other.Attach(page.get()));
+    page->version = COORDINATOR_VERSION + 1;
+    CoordinatorChannel newer;
+    CHECK(!newer.Attach(page.get()));
+    CHECK(!newer.IsAttached());
+}
+
+TEST(RingWrapsAroundInOrder)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    REQUIRE(channel.Attach(page.get()));
+
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+    CoordinatorCommand command;
+    for (int lap = 0; lap < 10; ++lap)
+    {
+        // Fill the ring completely, then drain most of it
+        while (channel.Push(Command(pushed, 0, 7)))
+        {
+            ++pushed;
+        }
+        CHECK(pushed - popped == COORDINATOR_RING_SIZE);
+
+        for (uint32_t i = 0; i < COORDINATOR_RING_SIZE - 3; ++i)
+        {
+            REQUIRE(channel.Pop(command, AllAlive, nullptr, 0));
+            CHECK(command.hwnd == popped);
+            CHECK(command.processId == 7);
+            ++popped;
+        }
+    }
+
+    while (channel.Pop(command, AllAlive, nullptr, 0))
+    {
+        CHECK(command.hwnd == popped);
+        ++popped;
+    }
+    CHECK(popped == pushed);
+    CHECK(!channel.Pop(command, AllAlive, nullptr, 0));
+}
+
+TEST(LeaderThatDiedWhilePoppingIsCaughtUp)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    REQUIRE(channel.Attach(page.get()));
+    REQUIRE(channel.Push(Command(1, 0, 7)));
+    REQUIRE(channel.Push(Command(2, 0, 7)));
+
+    // The slot was freed, but the head never moved past it
+    const uint64_t head = page->ringHead;
+    CoordinatorCommand command;
+    REQUIRE(channel.Pop(command, AllAlive, nullptr, 0));
+    page->ringHead = head;
+
+    REQUIRE(channel.Pop(command, AllAlive, nullptr, 0));
+    CHECK(command.hwnd == 2);
+    CHECK(!channel.Pop(command, AllAlive, nullptr, 0));
+}
+
+// Runs producers against a leader. An impatient one gives up on every slot
+// it finds claimed but empty, as if each producer took too long to fill it.
+static bool ProduceConcurrently(bool impatient)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel leader;
+    leader.Attach(page.get());
+
+    const int producers = 4;
+    const uint64_t commands = 20000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&page, p, commands]()
+        {
+            CoordinatorChannel channel;
+            channel.Attach(page.get());
+            for (uint64_t i = 0; i < commands;)
+            {
+                if (channel.Push(Command(i, p, 100 + p)))
+                {
+                    ++i;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Commands of one producer arrive in the order they were pushed
+    std::vector<uint64_t> next(producers, 0);
+    uint64_t received = 0;
+    bool ordered = true;
+    uint64_t now = 0;
+    while (received < producers * commands)
+    {
+        CoordinatorCommand command;
+        now += impatient ? COORDINATOR_CLAIM_TIMEOUT_MS : 0;
+        if (!leader.Pop(command, AllAlive, nullptr, now))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        ordered = ordered && command.processId == static_cast<uint32_t>(100 + command.layer) &&
+            command.hwnd == next[command.layer];
+        next[command.layer] = command.hwnd + 1;
+        ++received;
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    CoordinatorCommand command;
+    return ordered && !leader.Pop(command, AllAlive, nullptr, now) && !leader.HasPendingClaims();
+}
+
+TEST(ConcurrentProducersLoseNothing)
+{
+    CHECK(ProduceConcurrently(false));
+}
+
+TEST(SkippedProducersPushAgain)
+{
+    CHECK(ProduceConcurrently(true));
+}
+
+TEST(DeadProducersDoNotBlockTheRing)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    REQUIRE(channel.Attach(page.get()));
+    std::set<uint32_t> alive = { 7 };
+
+    // Process 8 died after claiming the second slot and saying so
+    REQUIRE(channel.Push(Command(1, 0, 7)));
+    page->ring[page->ringTail++].owner = 8;
+    REQUIRE(channel.Push(Command(3, 0, 7)));
+
+    CoordinatorCommand command;
+    REQUIRE(channel.Pop(command, IsAlive, &alive, 0));
+    CHECK(command.hwnd == 1);
+    REQUIRE(channel.Pop(command, IsAlive, &alive, 0));
+    CHECK(command.hwnd == 3);
+    CHECK(!channel.Pop(command, IsAlive, &alive, 0));
+
+    // Another one died before it could say so, its slot is given up on in time
+    page->ringTail++;
+    REQUIRE(channel.Push(Command(4, 0, 7)));
+    CHECK(!channel.Pop(command, IsAlive, &alive, 5000));
+    CHECK(channel.HasPendingClaims());
+    CHECK(!channel.Pop(command, IsAlive, &alive, 5000 + COORDINATOR_CLAIM_TIMEOUT_MS - 1));
+    REQUIRE(channel.Pop(command, IsAlive, &alive, 5000 + COORDINATOR_CLAIM_TIMEOUT_MS));
+    CHECK(command.hwnd == 4);
+    CHECK(!channel.HasPendingClaims());
+
+    // The skipped slots are free again on the next lap
+    uint32_t pushed = 0;
+    while (channel.Push(Command(pushed, 0, 7)))
+    {
+        ++pushed;
+    }
+    CHECK(pushed == COORDINATOR_RING_SIZE);
+    for (uint32_t i = 0; i < pushed; ++i)
+    {
+        REQUIRE(channel.Pop(command, IsAlive, &alive, 0));
+        CHECK(command.hwnd == i);
+    }
+}
+
+
+
+TEST(LeadershipPassesOnWhenTheLeaderIsGone)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    REQUIRE(channel.Attach(page.get()));
+    std::set<uint32_t> alive = { 1, 2 };
+
+    CHECK(channel.TryLead(1, IsAlive, &alive));
+    CHECK(channel.TryLead(1, IsAlive, &alive));
+    CHECK(!channel.TryLead(2, IsAlive, &alive));
+    CHECK(channel.GetLeader() == 1);
+    const uint32_t epoch = channel.GetLeaderEpoch();
+
+    // The leader died in the middle of publishing the state
+    channel.PublishState(true, 5);
+    page->stateSequence.fetch_add(1);
+    alive.erase(1);
+    CHECK(channel.TryLead(2, IsAlive, &alive));
+    CHECK(channel.GetLeader() == 2);
+    CHECK(channel.GetLeaderEpoch() == epoch + 1);
+    CHECK((page->stateSequence & 1) == 0);
+
+    // Resigning leaves the lead free for anybody
+    channel.SetLeaderWindow(0x1234);
+    channel.Resign(1);
+    CHECK(channel.GetLeader() == 2);
+    channel.Resign(2);
+    CHECK(channel.GetLeader() == 0);
+    CHECK(channel.GetLeaderWindow() == 0);
+    CHECK(channel.GetLeaderEpoch() == epoch + 2);
+    alive.insert(3);
+    CHECK(channel.TryLead(3, IsAlive, &alive));
+}
+
+TEST(StateReadsNeverBlock)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    REQUIRE(channel.Attach(page.get()));
+    CHECK(channel.ReadState().changes == 0);
+
+    channel.PublishState(true, 12);
+    CoordinatorState state = channel.ReadState();
+    CHECK(state.showDesktop);
+    CHECK(state.changes == 1);
+    CHECK(state.detectionLatencyMs == 12);
+
+    // A write that never finishes still lets readers through
+    page->stateSequence.fetch_add(1);
+    page->showDesktop = 0;
+    CHECK(!channel.ReadState().showDesktop);
+}
+
+TEST(StateIsNeverTorn)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel leader;
+    REQUIRE(leader.Attach(page.get()));
+
+    const uint64_t changes = 20000;
+    std::atomic<bool> torn(false);
+    std::thread reader([&]()
+    {
+        CoordinatorChannel channel;
+        channel.Attach(page.get());
+        for (;;)
+        {
+            CoordinatorState state = channel.ReadState();
+            if (state.changes && (state.showDesktop != (state.changes % 2 == 1) ||
+                state.detectionLatencyMs != state.changes * 3))
+            {
+                torn = true;
+            }
+            if (state.changes == changes)
+                break;
+            std::this_thread::yield();
+        }
+    });
+
+    for (uint64_t n = 1; n <= changes; ++n)
+    {
+        leader.PublishState(n % 2 == 1, n * 3);
+        if (n % 16 == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+    reader.join();
+    CHECK(!torn);
+}
+
+TEST(FollowersThatDiedAreDropped)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    REQUIRE(channel.Attach(page.get()));
+    std::set<uint32_t> alive;
+
+    for (uint32_t i = 1; i <= COORDINATOR_MAX_FOLLOWERS; ++i)
+    {
+        CHECK(channel.AddFollower(i, i * 10));
+        alive.insert(i);
+    }
+    CHECK(!channel.AddFollower(1000, 1));
+
+    // Adding again moves the follower to another window
+    CHECK(channel.AddFollower(5, 99));
+    alive.erase(7);
+    channel.RemoveFollower(8);
+
+    uint32_t notified = 0;
+    uint64_t window = 0;
+    channel.ForEachFollower(IsAlive, &alive, [&](uint32_t processId, uint64_t followerWindow)
+    {
+        ++notified;
+        if (processId == 5)
+        {
+            window = followerWindow;
+        }
+    });
+    CHECK(notified == COORDINATOR_MAX_FOLLOWERS - 2);
+    CHECK(window == 99);
+    CHECK(channel.AddFollower(1000, 1));
+    CHECK(channel.AddFollower(1001, 1));
+    CHECK(!channel.AddFollower(1002, 1));
+}
+
+TEST(FollowersAddedAgainKeepOneEntry)
+{
+    std::unique_ptr<CoordinatorPage> page = NewPage();
+    CoordinatorChannel channel;
+    REQUIRE(channel.Attach(page.get()));
+    std::set<uint32_t> alive = { 1, 2, 3 };
+    CHECK(channel.AddFollower(1, 10));
+    CHECK(channel.AddFollower(2, 20));
+    CHECK(channel.AddFollower(3, 30));
+
+    // A free entry ahead of the follower's own is not taken
+    channel.RemoveFollower(1);
+    CHECK(channel.AddFollower(3, 31));
+
+    std::vector<uint64_t> windows;
+    channel.ForEachFollower(IsAlive, &alive, [&](uint32_t processId, uint64_t window)
+    {
+        if (processId == 3)
+        {
+            windows.push_back(window);
+        }
+    });
+    REQUIRE(windows.size() == 1);
+    CHECK(windows[0] == 31);
+}
@@ -0,0 +1,377 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+TEST(DetectsShowDesktopFromEvents)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+    CHECK(desktop.IsInPlace());
+
+    const uint32_t burstIntervalMs = desktop.controller.GetDetector().GetConfig().burstIntervalMs;
+    desktop.windowSystem.ShowDesktop();
+    uint64_t latency = desktop.WaitForState(true);
+    CHECK(latency <= burstIntervalMs);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+
+    desktop.windowSystem.Advance(1000);
+    desktop.windowSystem.RestoreWindows(desktop.apps[0]);
+    latency = desktop.WaitForState(false);
+    CHECK(latency <= burstIntervalMs);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+    CHECK(desktop.controller.GetDetector().GetMode() == ShowDesktopDetector::Mode::EventDriven);
+}
+
+TEST(KeepsRegisteredWindowsAboveTheDesktop)
+{
+    SimulatedDesktop desktop;
+    HWND widget = desktop.Register();
+    desktop.Start();
+
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+
+    // Visible over the desktop icons, below every topmost window
+    HWND host = desktop.windowSystem.GetDesktopIconsHost();
+    CHECK(desktop.windowSystem.GetStackIndex(widget) < desktop.windowSystem.GetStackIndex(host));
+    CHECK(desktop.windowSystem.GetStackIndex(desktop.helperWindow) < desktop.windowSystem.GetStackIndex(widget));
+}
+
+TEST(PassesOverAStackInPlaceMoveNothing)
+{
+    for (int layout = 0; layout < 2; ++layout)
+    {
+        SimulatedDesktop desktop(layout == 1);
+        desktop.Register(desktop.CreateWidgets(3), 0);
+        desktop.Register(desktop.CreateWidgets(2), 1);
+        desktop.Start();
+        desktop.windowSystem.Advance(1000);
+        REQUIRE(desktop.IsInPlace());
+
+        // The shell's windows below the block do not make it look out of place
+        uint64_t moves = desktop.windowSystem.GetMoveCount();
+        desktop.controller.PositionWindows();
+        desktop.controller.PositionWindows();
+        CHECK(desktop.windowSystem.GetMoveCount() == moves);
+        CHECK(desktop.IsInPlace());
+
+        desktop.windowSystem.ShowDesktop();
+        REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+        desktop.NextFrame();
+        moves = desktop.windowSystem.GetMoveCount();
+        desktop.controller.PositionWindows();
+        CHECK(desktop.windowSystem.GetMoveCount() == moves);
+        CHECK(desktop.IsInPlace());
+
+        // Nor after coming back to the bottom
+        desktop.windowSystem.RestoreWindows(desktop.apps[0]);
+        REQUIRE(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+        desktop.NextFrame();
+        moves = desktop.windowSystem.GetMoveCount();
+        desktop.controller.PositionWindows();
+        CHECK(desktop.windowSystem.GetMoveCount() == moves);
+        CHECK(desktop.IsInPlace());
+    }
+}
+
+TEST(SafetyPollCatchesLostEvents)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+    desktop.windowSystem.SetDropEvents(true);
+
+    const ShowDesktopDetector::Config& config = desktop.controller.GetDetector().GetConfig();
+    desktop.windowSystem.ShowDesktop();
+    uint64_t latency = desktop.WaitForState(true);
+    CHECK(latency != SimulatedDesktop::NOT_DETECTED);
+    CHECK(latency <= desktop.controller.GetDetector().GetMaxMissLatencyMs());
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+
+    // A transition only the poll saw gives up on events
+    CHECK(desktop.controller.GetDetector().GetMode() == ShowDesktopDetector::Mode::Polling);
+    desktop.windowSystem.Advance(1000);
+    desktop.windowSystem.RestoreWindows(desktop.apps[0]);
+    latency = desktop.WaitForState(false);
+    CHECK(latency <= config.restorePollIntervalMs);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+
+    desktop.windowSystem.Advance(1000);
+    desktop.windowSystem.ShowDesktop();
+    latency = desktop.WaitForState(true);
+    CHECK(latency <= config.pollIntervalMs);
+}
+
+TEST(DetectsWithShellWindowAsHost)
+{
+    SimulatedDesktop desktop(true);
+    desktop.Register();
+    desktop.Start();
+
+    desktop.windowSystem.ShowDesktop();
+    CHECK(desktop.WaitForState(true) <= desktop.controller.GetDetector().GetConfig().burstIntervalMs);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+
+    desktop.windowSystem.RestoreWindows(desktop.apps[1]);
+    CHECK(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(BulkRegistrationTakesOnePass)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    std::vector<HWND> widgets = desktop.CreateWidgets(50);
+    desktop.Start();
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    desktop.NextFrame();
+
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+    const uint64_t commits = desktop.windowSystem.GetCommitCount();
+    const uint64_t enumerations = desktop.windowSystem.GetEnumerationCount();
+
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    desktop.Register(widgets, 0);
+    desktop.controller.PositionDirtyLayers();
+
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    CHECK(after.counters[PERF_REPOSITION_PASSES] - before.counters[PERF_REPOSITION_PASSES] == 1);
+    CHECK(desktop.windowSystem.GetCommitCount() - commits == 1);
+    CHECK(desktop.windowSystem.GetMoveCount() - moves == 50);
+
+    // The new windows are placed next to the block already there, without walking the stack
+    CHECK(desktop.windowSystem.GetEnumerationCount() == enumerations);
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(DeferredRegistrationsMergeIntoOnePass)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    const uint64_t commits = desktop.windowSystem.GetCommitCount();
+
+    // Registrations inside an update scope publish without restacking; the
+    // end of the scope runs one pass for all of them
+    for (int layer = 0; layer < 3; ++layer)
+    {
+        for (int i = 0; i < 5; ++i)
+        {
+            desktop.Register(layer);
+        }
+    }
+    CHECK(desktop.windowSystem.GetCommitCount() == commits);
+    CHECK(!desktop.IsInPlace());
+
+    desktop.controller.PositionDirtyLayers();
+    CHECK(desktop.IsInPlace());
+
+    // One commit per layer that changed, none once nothing did
+    CHECK(desktop.windowSystem.GetCommitCount() - commits <= 3);
+    const uint64_t settled = desktop.windowSystem.GetCommitCount();
+    desktop.controller.PositionDirtyLayers();
+    CHECK(desktop.windowSystem.GetCommitCount() == settled);
+}
+
+TEST(NoWakeupsWithoutRegisteredWindows)
+{
+    SimulatedDesktop desktop;
+    desktop.Start();
+    const uint64_t wakeups = desktop.controller.GetWakeupCount();
+    desktop.windowSystem.Advance(60000);
+    CHECK(desktop.controller.GetWakeupCount() == wakeups);
+    CHECK(desktop.controller.GetProbeIntervalMs() == 0);
+
+    // The first registered window starts the safety poll, coalescable with other timers
+    HWND widget = desktop.Register();
+    desktop.controller.PositionDirtyLayers();
+    const ShowDesktopDetector::Config& config = desktop.controller.GetDetector().GetConfig();
+    CHECK(desktop.controller.GetProbeIntervalMs() == config.fallbackIntervalMs);
+    uint32_t interval = 0;
+    uint32_t tolerance = 0;
+    REQUIRE(desktop.windowSystem.GetTimer(desktop.systemWindow, TIMER_SHOWDESKTOP, interval, tolerance));
+    CHECK(tolerance == config.fallbackIntervalMs / 4);
+
+    // Burst probes run on time
+    desktop.windowSystem.ShowDesktop();
+    desktop.windowSystem.Advance(1);
+    REQUIRE(desktop.windowSystem.GetTimer(desktop.systemWindow, TIMER_SHOWDESKTOP, interval, tolerance));
+    CHECK(interval == config.burstIntervalMs);
+    CHECK(tolerance == TIMER_TOLERANCE_NONE);
+
+    // Events are still seen once every window is gone
+    desktop.Unregister(widget);
+    desktop.windowSystem.Advance(1000);
+    CHECK(desktop.controller.GetProbeIntervalMs() == 0);
+    desktop.windowSystem.RestoreWindows(desktop.apps[0]);
+    CHECK(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+}
+
+TEST(NoWakeupsWhileLockedOrDisplayOff)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+
+    desktop.controller.OnSessionLocked(true);
+    CHECK(desktop.controller.IsProbingSuspended());
+    uint64_t wakeups = desktop.controller.GetWakeupCount();
+    desktop.windowSystem.Advance(60000);
+    CHECK(desktop.controller.GetWakeupCount() == wakeups);
+    CHECK(desktop.controller.GetProbeIntervalMs() == 0);
+
+    // A change missed meanwhile is caught when the session is unlocked
+    desktop.windowSystem.SetDropEvents(true);
+    desktop.windowSystem.ShowDesktop();
+    desktop.windowSystem.SetDropEvents(false);
+    desktop.controller.OnSessionLocked(false);
+    CHECK(desktop.controller.IsShowingDesktop());
+
+    // Either reason keeps probes suspended
+    desktop.controller.OnDisplayPower(false);
+    desktop.controller.OnSessionLocked(true);
+    desktop.controller.OnSessionLocked(false);
+    CHECK(desktop.controller.IsProbingSuspended());
+    wakeups = desktop.controller.GetWakeupCount();
+    desktop.windowSystem.Advance(60000);
+    CHECK(desktop.controller.GetWakeupCount() == wakeups);
+
+    desktop.controller.OnDisplayPower(true);
+    CHECK(!desktop.controller.IsProbingSuspended());
+    CHECK(desktop.controller.GetProbeIntervalMs() == desktop.controller.GetDetector().GetConfig().burstIntervalMs);
+}
+
+// Applies reported changes to the registry, as the library does
+static void ApplyLifecycle(SimulatedDesktop& desktop, std::vector<WindowLifecycle>& changes)
+{
+    desktop.controller.SetWindowLifecycleHandler([&desktop, &changes](const WindowLifecycle& change)
+    {
+        changes.push_back(change);
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(desktop.windows.GetForWriter()));
+        if (registry->Apply(change))
+        {
+            desktop.windows.Publish(std::move(registry));
+        }
+    });
+}
+
+TEST(RegisteredWindowChangesAreReported)
+{
+    SimulatedDesktop desktop;
+    std::vector<WindowLifecycle> changes;
+    ApplyLifecycle(desktop, changes);
+    HWND widget = desktop.Register();
+    HWND other = desktop.Register();
+    desktop.Start();
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+
+    desktop.windowSystem.SetVisible(widget, false);
+    REQUIRE(changes.size() == 1);
+    CHECK(changes[0].hwnd == widget);
+    CHECK(!changes[0].isVisible);
+    CHECK(!changes[0].destroyed);
+    CHECK(desktop.windows.Read()->GetPositionedCount() == 1);
+
+    // Shown again, it is placed back into the block
+    desktop.windowSystem.SetVisible(widget, true);
+    desktop.NextFrame();
+    CHECK(changes.size() == 2);
+    CHECK(desktop.IsInPlace());
+
+    desktop.windowSystem.SetMinimized(other, true);
+    REQUIRE(changes.size() == 3);
+    CHECK(changes[2].isMinimized);
+    desktop.windowSystem.SetMinimized(other, false);
+    CHECK(changes.size() == 4);
+
+    desktop.windowSystem.DestroyWindow(widget);
+    REQUIRE(changes.size() == 5);
+    CHECK(changes[4].destroyed);
+    CHECK(desktop.windows.Read()->Find(widget) == nullptr);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(WindowsOfOtherProcessesAreFollowed)
+{
+    SimulatedDesktop desktop;
+    std::vector<WindowLifecycle> changes;
+    ApplyLifecycle(desktop, changes);
+    desktop.Start();
+
+    HWND widget = desktop.windowSystem.CreateWindow(L"Widget", L"", 7);
+    desktop.Register(widget, 0);
+    desktop.controller.PositionDirtyLayers();
+    desktop.windowSystem.SetVisible(widget, false);
+    REQUIRE(changes.size() == 1);
+    CHECK(!changes[0].isVisible);
+    CHECK(!desktop.windows.Read()->Find(widget)->isVisible);
+
+    // Other windows of that process are not ours to report
+    HWND unregistered = desktop.windowSystem.CreateWindow(L"Widget", L"", 7);
+    desktop.windowSystem.SetVisible(unregistered, false);
+    CHECK(changes.size() == 1);
+    CHECK(desktop.windows.Read()->Find(unregistered) == nullptr);
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(ReusedHandleCountsAsDestroyed)
+{
+    SimulatedDesktop desktop;
+    std::vector<WindowLifecycle> changes;
+    ApplyLifecycle(desktop, changes);
+    desktop.windowSystem.SetReuseHandles(true);
+    HWND widget = desktop.Register();
+    desktop.Start();
+
+    // The destruction was missed, and another process got the handle
+    desktop.windowSystem.SetDropEvents(true);
+    desktop.windowSystem.DestroyWindow(widget);
+    desktop.windowSystem.SetDropEvents(false);
+    HWND reused = desktop.windowSystem.CreateWindow(L"Application", L"Window", 200);
+    REQUIRE(reused == widget);
+    desktop.windowSystem.SetVisible(reused, false);
+
+    // An event about the handle finds it belongs to another process now
+    desktop.controller.OnWindowEvent(WINDOW_EVENT_HIDE, reused, WINDOW_OBJECT_SELF, WINDOW_OBJECT_SELF);
+    REQUIRE(changes.size() == 1);
+    CHECK(changes[0].destroyed);
+    CHECK(desktop.windows.Read()->Find(widget) == nullptr);
+}
+
+TEST(OwnPopupsAreNotDesktopEvents)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    desktop.windowSystem.Advance(2000);
+
+    HWND popup = desktop.windowSystem.CreateWindow(L"Popup", L"", SimulatedDesktop::OWN_PROCESS_ID);
+    const uint64_t events = desktop.controller.GetDetector().GetEventCount();
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    for (int i = 0; i < 10; ++i)
+    {
+        desktop.windowSystem.SetVisible(popup, i % 2 == 1);
+        desktop.windowSystem.SetMinimized(popup, i % 2 == 0);
+    }
+    CHECK(desktop.controller.GetDetector().GetEventCount() == events);
+    CHECK(!desktop.controller.GetDetector().IsInBurst());
+
+    // Nothing was restacked and the desktop is still not shown
+    desktop.windowSystem.Advance(2000);
+    CHECK(desktop.windowSystem.GetMoveCount() == moves);
+    CHECK(!desktop.controller.IsShowingDesktop());
+    CHECK(desktop.IsInPlace());
+}
@@ -0,0 +1,151 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+#include <cstring>
+
+// A layout the built-in strategies do not know, here the 24H2 one under another name
+class RenamedStrategy : public DesktopHostStrategy
+{
+public:
+    RenamedStrategy(const char* name, bool matches) : resolves(0), m_name(name), m_matches(matches) {}
+
+    const char* GetName() const override { return m_name; }
+    bool Matches(IWindowSystem&) override { return m_matches; }
+
+    void Resolve(IWindowSystem& windowSystem, WindowMetadataCache& metadata, ShellTopology& topology) override
+    {
+        ++resolves;
+        ShellWindowHostStrategy().Resolve(windowSystem, metadata, topology);
+    }
+
+    bool IsShellForeground(IWindowSystem&, WindowMetadataCache&, HWND shellWindow, HWND hwnd, bool& waitForDefView) override
+    {
+        waitForDefView = false;
+        return hwnd == shellWindow;
+    }
+
+    int resolves;
+
+private:
+    const char* m_name;
+    bool m_matches;
+};
+
+static ShellTopology Resolve(DesktopHostStrategy& strategy, SimulatedWindowSystem& windowSystem)
+{
+    WindowMetadataCache metadata(16);
+    ShellTopology topology = { windowSystem.GetShellWindow(), nullptr, nullptr, SimulatedDesktop::SHELL_PROCESS_ID };
+    strategy.Resolve(windowSystem, metadata, topology);
+    return topology;
+}
+
+TEST(BuiltInStrategiesFollowTheShellLayout)
+{
+    SimulatedWindowSystem legacy;
+    legacy.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, false);
+    DesktopHostStrategies strategies;
+    DesktopHostStrategy* strategy = strategies.Select(legacy);
+    CHECK(std::strcmp(strategy->GetName(), "WorkerW") == 0);
+    ShellTopology topology = Resolve(*strategy, legacy);
+    CHECK(topology.host == legacy.GetDesktopIconsHost());
+    CHECK(topology.host != legacy.GetShellWindow());
+    CHECK(topology.defView == legacy.FindWindowAfter(topology.host, nullptr, L"SHELLDLL_DefView", L""));
+
+    SimulatedWindowSystem current;
+    current.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, true);
+    strategy = strategies.Select(current);
+    CHECK(std::strcmp(strategy->GetName(), "shell window") == 0);
+    topology = Resolve(*strategy, current);
+    CHECK(topology.host == current.GetShellWindow());
+    CHECK(topology.defView != nullptr);
+}
+
+TEST(NoHostWhileTheShellStartsUp)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, false);
+    HWND host = windowSystem.GetDesktopIconsHost();
+    windowSystem.DestroyWindow(windowSystem.FindWindowAfter(host, nullptr, L"SHELLDLL_DefView", L""));
+
+    WorkerWHostStrategy workerW;
+    ShellTopology topology = Resolve(workerW, windowSystem);
+    CHECK(topology.defView == nullptr);
+    CHECK(topology.host == nullptr);
+
+    // A hidden WorkerW, or one of another process, does not host the icons
+    windowSystem.CreateWindow(L"SHELLDLL_DefView", L"", SimulatedDesktop::SHELL_PROCESS_ID, host);
+    windowSystem.SetVisible(host, false);
+    CHECK(Resolve(workerW, windowSystem).host == nullptr);
+    HWND other = windowSystem.CreateWindow(L"WorkerW", L"", 100);
+    windowSystem.CreateWindow(L"SHELLDLL_DefView", L"", 100, other);
+    CHECK(Resolve(workerW, windowSystem).host == nullptr);
+    windowSystem.SetVisible(host, true);
+    CHECK(Resolve(workerW, windowSystem).host == host);
+}
+
+TEST(ShellForegroundOfEachLayout)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, false);
+    WindowMetadataCache metadata(16);
+    HWND shellWindow = windowSystem.GetShellWindow();
+    HWND workerW = windowSystem.CreateWindow(L"WorkerW", L"", SimulatedDesktop::SHELL_PROCESS_ID);
+    HWND foreign = windowSystem.CreateWindow(L"WorkerW", L"", 100);
+    HWND app = windowSystem.CreateWindow(L"Application", L"", SimulatedDesktop::SHELL_PROCESS_ID);
+
+    bool waitForDefView = false;
+    WorkerWHostStrategy legacy;
+    CHECK(legacy.IsShellForeground(windowSystem, metadata, shellWindow, workerW, waitForDefView));
+    CHECK(waitForDefView);
+    CHECK(!legacy.IsShellForeground(windowSystem, metadata, shellWindow, foreign, waitForDefView));
+    CHECK(!legacy.IsShellForeground(windowSystem, metadata, shellWindow, app, waitForDefView));
+
+    ShellWindowHostStrategy current;
+    CHECK(current.IsShellForeground(windowSystem, metadata, shellWindow, shellWindow, waitForDefView));
+    CHECK(!waitForDefView);
+    CHECK(!current.IsShellForeground(windowSystem, metadata, shellWindow, workerW, waitForDefView));
+    CHECK(!current.IsShellForeground(windowSystem, metadata, shellWindow, nullptr, waitForDefView));
+}
+
+TEST(AddedStrategiesComeFirst)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, true);
+    DesktopHostStrategies strategies;
+    strategies.Add(std::unique_ptr<DesktopHostStrategy>(new RenamedStrategy("older", true)));
+    CHECK(std::strcmp(strategies.Select(windowSystem)->GetName(), "older") == 0);
+
+    strategies.Add(std::unique_ptr<DesktopHostStrategy>(new RenamedStrategy("newer", true)));
+    CHECK(std::strcmp(strategies.Select(windowSystem)->GetName(), "newer") == 0);
+
+    // One that does not match is passed over
+    strategies.Add(std::unique_ptr<DesktopHostStrategy>(new RenamedStrategy("other shell", false)));
+    CHECK(std::strcmp(strategies.Select(windowSystem)->GetName(), "newer") == 0);
+}
+
+TEST(ControllerUsesTheAddedStrategy)
+{
+    SimulatedDesktop desktop(true);
+    RenamedStrategy* strategy = new RenamedStrategy("custom", true);
+    desktop.controller.AddHostStrategy(std::unique_ptr<DesktopHostStrategy>(strategy));
+    CHECK(desktop.controller.GetHostStrategy() == nullptr);
+    desktop.Register();
+    desktop.Start();
+    CHECK(desktop.controller.GetHostStrategy() == strategy);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        desktop.windowSystem.ShowDesktop();
+        CHECK(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(500);
+        desktop.windowSystem.RestoreWindows(desktop.apps[i]);
+        CHECK(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(500);
+    }
+
+    // The topology is resolved once and then cached
+    CHECK(strategy->resolves == 1);
+    desktop.controller.OnShellRestarted();
+    desktop.windowSystem.ShowDesktop();
+    CHECK(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    CHECK(strategy->resolves == 2);
+}
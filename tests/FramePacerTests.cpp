@@ -0,0 +1,159 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+#include <algorithm>
+#include <map>
+#include <set>
+
+TEST(FirstPassOfAFrameRunsAtOnce)
+{
+    FramePacer pacer;
+    CHECK(pacer.Request(FramePacer::WORK_HELPER, 10) == FramePacer::WORK_HELPER);
+    CHECK(!pacer.IsPending());
+
+    // Later work in the same frame is merged, and counted as deferred once
+    CHECK(pacer.Request(FramePacer::WORK_FULL, 10) == FramePacer::WORK_NONE);
+    CHECK(pacer.Request(FramePacer::WORK_DIRTY_LAYERS, 10) == FramePacer::WORK_NONE);
+    CHECK(pacer.IsPending());
+    CHECK(pacer.GetDeferredCount() == 1);
+
+    // A timer firing early finds the frame unchanged
+    CHECK(pacer.Request(FramePacer::WORK_NONE, 10) == FramePacer::WORK_NONE);
+    CHECK(pacer.Request(FramePacer::WORK_NONE, 11) == (FramePacer::WORK_FULL | FramePacer::WORK_DIRTY_LAYERS));
+    CHECK(!pacer.IsPending());
+    CHECK(pacer.GetPassCount() == 2);
+}
+
+TEST(NothingToRunIsNoPass)
+{
+    FramePacer pacer;
+    CHECK(pacer.Request(FramePacer::WORK_NONE, 5) == FramePacer::WORK_NONE);
+    CHECK(pacer.GetPassCount() == 0);
+    CHECK(pacer.Request(FramePacer::WORK_FULL, 5) == FramePacer::WORK_FULL);
+
+    // Work of a later frame runs right away, however many frames passed
+    CHECK(pacer.Request(FramePacer::WORK_DIRTY_LAYERS, 9) == FramePacer::WORK_DIRTY_LAYERS);
+    CHECK(pacer.GetDeferredCount() == 0);
+
+    // Reset forgets the pass of this frame and the pending work
+    pacer.Request(FramePacer::WORK_FULL, 9);
+    pacer.Reset();
+    CHECK(!pacer.IsPending());
+    CHECK(pacer.Request(FramePacer::WORK_HELPER, 9) == FramePacer::WORK_HELPER);
+}
+
+TEST(DelayReachesIntoTheNextFrame)
+{
+    CHECK(FramePacer::GetDelayMs(0) == 1);
+    CHECK(FramePacer::GetDelayMs(1) == 1);
+    CHECK(FramePacer::GetDelayMs(1000) == 1);
+    CHECK(FramePacer::GetDelayMs(1001) == 2);
+    CHECK(FramePacer::GetDelayMs(16667) == 17);
+}
+
+// Records which passes moved windows of this process in each frame
+struct PassRecorder
+{
+    explicit PassRecorder(SimulatedDesktop& desktop) : m_desktop(desktop)
+    {
+        desktop.windowSystem.SetMoveHandler([this](HWND)
+        {
+            passes[m_desktop.windowSystem.GetFrameTime().frame].insert(m_desktop.controller.GetFramePacer().GetPassCount());
+        });
+    }
+
+    ~PassRecorder()
+    {
+        m_desktop.windowSystem.SetMoveHandler(nullptr);
+    }
+
+    size_t GetMaxPassesPerFrame() const
+    {
+        size_t result = 0;
+        for (const auto& frame : passes)
+        {
+            result = std::max(result, frame.second.size());
+        }
+        return result;
+    }
+
+    std::map<uint64_t, std::set<uint64_t>> passes;
+
+private:
+    SimulatedDesktop& m_desktop;
+};
+
+TEST(FlipsWithinAFrameRestackOncePerFrame)
+{
+    SimulatedDesktop desktop;
+    desktop.Register(desktop.CreateWidgets(5), 0);
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+
+    PassRecorder recorder(desktop);
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+    for (size_t i = 0; i < 10; ++i)
+    {
+        // Three flips in one millisecond, then a refresh in the frame after
+        desktop.windowSystem.ShowDesktop();
+        desktop.windowSystem.RestoreWindows(desktop.apps[i % desktop.apps.size()]);
+        desktop.windowSystem.ShowDesktop();
+        REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+
+        // By the next frame the merged pass has placed the block for the last flip
+        desktop.NextFrame();
+        CHECK(desktop.controller.IsShowingDesktop());
+        CHECK(desktop.IsInPlace());
+        desktop.controller.RequestRefresh(true);
+        desktop.windowSystem.Advance(500);
+        CHECK(desktop.IsInPlace());
+
+        desktop.windowSystem.RestoreWindows(desktop.apps[i % desktop.apps.size()]);
+        REQUIRE(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(500);
+        CHECK(desktop.IsInPlace());
+    }
+
+    CHECK(!recorder.passes.empty());
+    CHECK(recorder.GetMaxPassesPerFrame() == 1);
+    CHECK(desktop.controller.GetFramePacer().GetDeferredCount() > 0);
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    CHECK(after.counters[PERF_DEFERRED_PASSES] - before.counters[PERF_DEFERRED_PASSES] ==
+        desktop.controller.GetFramePacer().GetDeferredCount());
+}
+
+TEST(DeferredWorkRunsInTheNextFrame)
+{
+    SimulatedDesktop desktop;
+    desktop.Register(desktop.CreateWidgets(3), 0);
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+
+    // The trigger places the helper, the transition in the same frame has to wait
+    desktop.controller.OnInput(InputEvent{ InputEvent::KEY_DOWN, INPUT_KEY_LWIN, 0, 0 });
+    desktop.controller.OnInput(InputEvent{ InputEvent::KEY_DOWN, INPUT_KEY_D, 0, 0 });
+    const uint64_t passes = desktop.controller.GetFramePacer().GetPassCount();
+    const uint64_t frame = desktop.windowSystem.GetFrameTime().frame;
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.controller.IsShowingDesktop());
+    REQUIRE(desktop.windowSystem.GetFrameTime().frame == frame);
+    CHECK(desktop.controller.GetFramePacer().IsPending());
+    CHECK(desktop.controller.GetFramePacer().GetPassCount() == passes);
+
+    // Until then no window of the block moves
+    CHECK(desktop.windowSystem.GetMoveCount() == moves);
+    CHECK(!desktop.IsInPlace());
+
+    uint32_t intervalMs = 0;
+    uint32_t toleranceMs = 0;
+    REQUIRE(desktop.windowSystem.GetTimer(desktop.systemWindow, TIMER_FRAME, intervalMs, toleranceMs));
+    CHECK(intervalMs <= SimulatedDesktop::FRAME_MS);
+    CHECK(toleranceMs == TIMER_TOLERANCE_NONE);
+
+    desktop.NextFrame();
+    CHECK(!desktop.controller.GetFramePacer().IsPending());
+    CHECK(desktop.controller.GetFramePacer().GetPassCount() == passes + 1);
+    CHECK(desktop.IsInPlace());
+}
@@ -0,0 +1,227 @@
+#include "Test.h"
+#include "NotificationPipeline.h"
+#include <atomic>
+
+typedef NotificationPipeline::Event Event;
+
+// Records what a subscriber received, from its dispatcher thread
+class Received
+{
+public:
+    void Add(const Event& event)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_events.push_back(event);
+        m_changed.notify_all();
+    }
+
+    // Waits until count events arrived, or a second passed
+    bool WaitFor(size_t count)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        return m_changed.wait_for(lock, std::chrono::seconds(1), [&]() { return m_events.size() >= count; });
+    }
+
+    std::vector<Event> Get()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_events;
+    }
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::vector<Event> m_events;
+};
+
+// Holds a dispatcher inside its handler until opened
+class Gate
+{
+public:
+    Gate() : m_open(false), m_waiting(false) {}
+
+    void Pass()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_waiting = true;
+        m_changed.notify_all();
+        m_changed.wait(lock, [this]() { return m_open; });
+    }
+
+    bool WaitUntilHeld()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        return m_changed.wait_for(lock, std::chrono::seconds(1), [this]() { return m_waiting; });
+    }
+
+    void Open()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_open = true;
+        m_changed.notify_all();
+    }
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    bool m_open;
+    bool m_waiting;
+};
+
+TEST(DeliversEveryEventInOrder)
+{
+    NotificationPipeline pipeline;
+    Received first;
+    Received second;
+    pipeline.Subscribe([&](const Event& event) { first.Add(event); }, 0);
+    pipeline.Subscribe([&](const Event& event) { second.Add(event); }, 0);
+    REQUIRE(pipeline.Start(0));
+
+    for (int i = 1; i <= 10; ++i)
+    {
+        CHECK(pipeline.Publish(i % 2, static_cast<uint32_t>(i)) == static_cast<uint64_t>(i));
+    }
+    REQUIRE(first.WaitFor(10));
+    REQUIRE(second.WaitFor(10));
+
+    std::vector<Event> events = first.Get();
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        CHECK(events[i].sequence == i + 1);
+        CHECK(events[i].state == static_cast<int>((i + 1) % 2));
+        CHECK(events[i].detectionLatencyMs == i + 1);
+    }
+    CHECK(pipeline.GetPublishedCount() == 10);
+}
+
+TEST(SlowSubscriberDropsOnlyItsOwnEvents)
+{
+    NotificationPipeline pipeline(4);
+    Gate gate;
+    Received slow;
+    Received fast;
+    NotificationPipeline::SubscriberId slowId = pipeline.Subscribe([&](const Event& event)
+    {
+        slow.Add(event);
+        if (event.sequence == 1)
+        {
+            gate.Pass();
+        }
+    }, 0);
+    NotificationPipeline::SubscriberId fastId = pipeline.Subscribe([&](const Event& event) { fast.Add(event); }, 0);
+    REQUIRE(pipeline.Start(0));
+
+    pipeline.Publish(1, 0);
+    REQUIRE(gate.WaitUntilHeld());
+
+    // Publishing never waits for the stuck subscriber
+    for (int i = 2; i <= 20; ++i)
+    {
+        pipeline.Publish(i % 2, 0);
+    }
+    gate.Open();
+
+    // The ring held the last four events when the slow subscriber came back
+    REQUIRE(slow.WaitFor(5));
+    std::vector<Event> events = slow.Get();
+    CHECK(events.size() == 5);
+    CHECK(events[1].sequence == 17);
+    CHECK(events.back().sequence == 20);
+    CHECK(pipeline.GetDroppedCount(slowId) == 15);
+
+    // The other subscriber kept up, or counted what it missed
+    for (int i = 0; i < 1000 && fast.Get().size() + pipeline.GetDroppedCount(fastId) < 20; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(fast.Get().size() + pipeline.GetDroppedCount(fastId) == 20);
+    CHECK(fast.Get().back().sequence == 20);
+}
+
+TEST(CoalescesFlipFlops)
+{
+    NotificationPipeline pipeline;
+    Received received;
+    NotificationPipeline::SubscriberId id = pipeline.Subscribe([&](const Event& event) { received.Add(event); }, 50);
+    REQUIRE(pipeline.Start(0));
+
+    // Only the newest of a burst is delivered
+    pipeline.Publish(1, 0);
+    pipeline.Publish(0, 0);
+    pipeline.Publish(1, 0);
+    REQUIRE(received.WaitFor(1));
+    CHECK(received.Get()[0].state == 1);
+    CHECK(received.Get()[0].sequence == 3);
+    CHECK(pipeline.GetCoalescedCount(id) == 2);
+
+    // A burst that ends where the subscriber already is delivers nothing
+    pipeline.Publish(0, 0);
+    pipeline.Publish(1, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    CHECK(received.Get().size() == 1);
+    CHECK(pipeline.GetCoalescedCount(id) == 4);
+
+    // Without a window every event is delivered again
+    CHECK(pipeline.SetCoalesceWindow(id, 0));
+    pipeline.Publish(0, 0);
+    pipeline.Publish(1, 0);
+    CHECK(received.WaitFor(3));
+}
+
+TEST(NoEventsAfterUnsubscribe)
+{
+    NotificationPipeline pipeline;
+    std::atomic<int> calls(0);
+    NotificationPipeline::SubscriberId id = pipeline.Subscribe([&](const Event&) { ++calls; }, 0);
+    REQUIRE(pipeline.Start(0));
+    pipeline.Publish(1, 0);
+
+    CHECK(pipeline.Unsubscribe(id));
+    int seen = calls;
+    pipeline.Publish(0, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(calls == seen);
+    CHECK(!pipeline.Unsubscribe(id));
+}
+
+TEST(HandlerCanUnsubscribeItself)
+{
+    NotificationPipeline pipeline;
+    Received received;
+    NotificationPipeline::SubscriberId id = 0;
+    std::mutex idLock;
+    {
+        std::lock_guard<std::mutex> lock(idLock);
+        id = pipeline.Subscribe([&](const Event& event)
+        {
+            received.Add(event);
+            std::lock_guard<std::mutex> lock(idLock);
+            pipeline.Unsubscribe(id);
+        }, 0);
+    }
+    REQUIRE(pipeline.Start(0));
+
+    pipeline.Publish(1, 0);
+    REQUIRE(received.WaitFor(1));
+    pipeline.Publish(0, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(received.Get().size() == 1);
+
+    // Stop joins the dispatcher that ended itself
+    pipeline.Stop();
+}
+
+TEST(LateSubscribersOnlySeeNewEvents)
+{
+    NotificationPipeline pipeline;
+    REQUIRE(pipeline.Start(0));
+    pipeline.Publish(1, 0);
+
+    Received received;
+    pipeline.Subscribe([&](const Event& event) { received.Add(event); }, 0);
+    pipeline.Publish(0, 0);
+    REQUIRE(received.WaitFor(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(received.Get().size() == 1);
+    CHECK(received.Get()[0].sequence == 2);
+}
@@ -0,0 +1,128 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+#include <thread>
+
+static uint64_t Difference(const PerfSnapshot& before, const PerfSnapshot& after, PerfCounter counter)
+{
+    return after.counters[counter] - before.counters[counter];
+}
+
+TEST(BucketsArePowersOfTwo)
+{
+    CHECK(PerfCounters::GetBucket(0) == 0);
+    CHECK(PerfCounters::GetBucket(1) == 1);
+    CHECK(PerfCounters::GetBucket(2) == 2);
+    CHECK(PerfCounters::GetBucket(3) == 2);
+    CHECK(PerfCounters::GetBucket(4) == 3);
+    CHECK(PerfCounters::GetBucket(1023) == 10);
+    CHECK(PerfCounters::GetBucket(1024) == 11);
+    CHECK(PerfCounters::GetBucket(UINT64_MAX) == PERF_HISTOGRAM_BUCKETS - 1);
+}
+
+TEST(HistogramKeepsCountTotalAndMax)
+{
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+    PerfCounters::Record(PERF_TRANSITION_LATENCY, 3);
+    PerfCounters::Record(PERF_TRANSITION_LATENCY, 100);
+    PerfCounters::Record(PERF_TRANSITION_LATENCY, 1000000000);
+
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    const PerfHistogramData& data = after.histograms[PERF_TRANSITION_LATENCY];
+    const PerfHistogramData& old = before.histograms[PERF_TRANSITION_LATENCY];
+    CHECK(data.count - old.count == 3);
+    CHECK(data.totalUs - old.totalUs == 1000000103);
+    CHECK(data.maxUs == 1000000000);
+    CHECK(data.buckets[2] - old.buckets[2] == 1);
+    CHECK(data.buckets[7] - old.buckets[7] == 1);
+    CHECK(data.buckets[PERF_HISTOGRAM_BUCKETS - 1] - old.buckets[PERF_HISTOGRAM_BUCKETS - 1] == 1);
+}
+
+TEST(CountsOfAllThreadsAddUp)
+{
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+
+    // Threads come and go, handing their blocks on; nothing they counted is lost
+    for (int round = 0; round < 5; ++round)
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i)
+        {
+            threads.emplace_back([]()
+            {
+                for (int k = 0; k < 10000; ++k)
+                {
+                    PerfCounters::Add(PERF_MESSAGES);
+                }
+                PerfCounters::Add(PERF_ZORDER_CALLS, 7);
+            });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    CHECK(Difference(before, after, PERF_MESSAGES) == 200000);
+    CHECK(Difference(before, after, PERF_ZORDER_CALLS) == 140);
+}
+
+TEST(ReadingWhileThreadsCountIsSafe)
+{
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+
+    std::atomic<bool> done(false);
+    std::thread counter([&]()
+    {
+        for (int k = 0; k < 100000; ++k)
+        {
+            PerfCounters::Add(PERF_TIMER_TICKS);
+        }
+        done = true;
+    });
+
+    // Totals only grow while a thread is counting
+    uint64_t last = 0;
+    bool monotonic = true;
+    while (!done)
+    {
+        PerfSnapshot snapshot;
+        PerfCounters::Read(snapshot);
+        uint64_t ticks = Difference(before, snapshot, PERF_TIMER_TICKS);
+        monotonic = monotonic && ticks >= last;
+        last = ticks;
+        std::this_thread::yield();
+    }
+    counter.join();
+
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    CHECK(monotonic);
+    CHECK(Difference(before, after, PERF_TIMER_TICKS) == 100000);
+}
+
+TEST(TransitionsAreCounted)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    desktop.NextFrame();
+
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    CHECK(Difference(before, after, PERF_STATE_CHANGES) == 1);
+    CHECK(Difference(before, after, PERF_DESKTOP_CHECKS) >= 1);
+    CHECK(Difference(before, after, PERF_REPOSITION_PASSES) >= 1);
+    CHECK(after.histograms[PERF_TRANSITION_LATENCY].count - before.histograms[PERF_TRANSITION_LATENCY].count == 1);
+    CHECK(after.histograms[PERF_CHECK_DESKTOP_STATE].count > before.histograms[PERF_CHECK_DESKTOP_STATE].count);
+}
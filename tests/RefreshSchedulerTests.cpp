@@ -0,0 +1,166 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+typedef RefreshScheduler::Pass Pass;
+
+TEST(PassRunsOnceRequestsSettle)
+{
+    RefreshScheduler refresh(30, 100, 500);
+    CHECK(refresh.OnTimer(0) == RefreshScheduler::PASS_NONE);
+
+    refresh.Request(false, 1000);
+    CHECK(refresh.GetDelayMs(1000) == 30);
+    refresh.Request(false, 1020);
+    CHECK(refresh.GetDeadline() == 1050);
+
+    // The timer armed for the first request fires too early
+    CHECK(refresh.OnTimer(1030) == RefreshScheduler::PASS_NONE);
+    CHECK(refresh.IsPending());
+    CHECK(refresh.OnTimer(1050) == RefreshScheduler::PASS_DIRTY_LAYERS);
+    CHECK(!refresh.IsPending());
+    CHECK(refresh.OnTimer(1100) == RefreshScheduler::PASS_NONE);
+    CHECK(refresh.GetRequestedCount() == 2);
+    CHECK(refresh.GetExecutedCount() == 1);
+}
+
+TEST(FullRequestsWinOverDirtyLayers)
+{
+    RefreshScheduler refresh(30, 100, 500);
+    refresh.Request(false, 0);
+    refresh.Request(true, 5);
+    refresh.Request(false, 10);
+    CHECK(refresh.OnTimer(40) == RefreshScheduler::PASS_FULL);
+
+    // A pass run meanwhile covers what it restacks
+    refresh.Request(false, 1000);
+    refresh.OnPass(false, 1000);
+    CHECK(!refresh.IsPending());
+    refresh.Request(true, 2000);
+    refresh.OnPass(false, 2000);
+    CHECK(refresh.IsPending());
+    refresh.OnPass(true, 2000);
+    CHECK(!refresh.IsPending());
+}
+
+TEST(EndlessBurstsRunAtTheMaximumDelay)
+{
+    RefreshScheduler refresh(30, 100, 500);
+    uint64_t passes = 0;
+    for (uint64_t now = 0; now < 5000; now += 10)
+    {
+        refresh.Request(false, now);
+        if (refresh.OnTimer(now) != RefreshScheduler::PASS_NONE)
+        {
+            ++passes;
+        }
+    }
+    // The next period starts with the first request after a pass
+    CHECK(passes == 9);
+}
+
+TEST(PassesKeepTheMinimumInterval)
+{
+    RefreshScheduler refresh(30, 100, 500);
+    refresh.Request(true, 0);
+    REQUIRE(refresh.OnTimer(30) == RefreshScheduler::PASS_FULL);
+
+    refresh.Request(true, 40);
+    CHECK(refresh.GetDeadline() == 130);
+    CHECK(refresh.OnTimer(70) == RefreshScheduler::PASS_NONE);
+    CHECK(refresh.OnTimer(130) == RefreshScheduler::PASS_FULL);
+
+    // Reset forgets the previous pass
+    refresh.Reset();
+    refresh.Request(true, 140);
+    CHECK(refresh.GetDeadline() == 170);
+}
+
+TEST(UnscheduledPassesKeepTheMinimumInterval)
+{
+    RefreshScheduler refresh(30, 100, 500);
+
+    // A pass run at once, then a request right after it
+    refresh.OnPass(true, 1000);
+    refresh.Request(true, 1010);
+    CHECK(refresh.GetDeadline() == 1100);
+    CHECK(refresh.OnTimer(1040) == RefreshScheduler::PASS_NONE);
+    CHECK(refresh.OnTimer(1100) == RefreshScheduler::PASS_FULL);
+
+    // A pass that does not cover what is pending pushes it back as well
+    refresh.Request(true, 1300);
+    refresh.OnPass(false, 1320);
+    CHECK(refresh.IsPending());
+    CHECK(refresh.GetDeadline() == 1420);
+}
+
+static uint64_t Refreshes(const PerfSnapshot& before)
+{
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    return after.counters[PERF_REFRESHES] - before.counters[PERF_REFRESHES];
+}
+
+TEST(RequestBurstsAreMerged)
+{
+    SimulatedDesktop desktop;
+    desktop.Register(desktop.CreateWidgets(10), 0);
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+    const uint64_t enumerations = desktop.windowSystem.GetEnumerationCount();
+    for (int i = 0; i < 100; ++i)
+    {
+        desktop.controller.RequestRefresh(i % 7 == 0);
+        desktop.windowSystem.Advance(2);
+    }
+    CHECK(Refreshes(before) == 0);
+    desktop.windowSystem.Advance(INTERVAL_REFRESH);
+    CHECK(Refreshes(before) == 1);
+    CHECK(desktop.windowSystem.GetEnumerationCount() - enumerations == 1);
+
+    // A burst that does not settle still gets a pass every maximum delay
+    PerfCounters::Read(before);
+    for (int i = 0; i < 200; ++i)
+    {
+        desktop.controller.RequestRefresh(false);
+        desktop.windowSystem.Advance(10);
+    }
+    const uint64_t passes = Refreshes(before);
+    CHECK(passes >= 2000 / REFRESH_MAX_DELAY_MS - 1);
+    CHECK(passes <= 2000 / REFRESH_MAX_DELAY_MS);
+
+    // Nothing is left over once it is done
+    desktop.windowSystem.Advance(1000);
+    const uint64_t settled = Refreshes(before);
+    CHECK(settled <= passes + 1);
+    desktop.windowSystem.Advance(1000);
+    CHECK(Refreshes(before) == settled);
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(RefreshRightAfterAnUnscheduledPassWaits)
+{
+    SimulatedDesktop desktop;
+    std::vector<HWND> widgets = desktop.CreateWidgets(5);
+    desktop.Register(widgets, 0);
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+
+    // A pass run inline, as the owner thread does, then a refresh asked for
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+    desktop.controller.PositionWindows();
+    desktop.windowSystem.Advance(10);
+    desktop.controller.RequestRefresh(true);
+    desktop.windowSystem.Advance(REFRESH_MIN_INTERVAL_MS - 20);
+    CHECK(Refreshes(before) == 0);
+
+    // Something moved meanwhile is put back once the interval is over
+    const ZOrderMove raise = { widgets[0], desktop.apps[0], ZOrderMove::After };
+    desktop.windowSystem.MoveWindow(raise);
+    desktop.windowSystem.Advance(20);
+    CHECK(Refreshes(before) == 1);
+    CHECK(desktop.IsInPlace());
+}
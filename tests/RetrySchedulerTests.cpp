@@ -0,0 +1,105 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+TEST(RetriesAreBoundedAndCounted)
+{
+    RetryScheduler retry(10, 3);
+    CHECK(!retry.OnFailure());
+    CHECK(!retry.IsActive());
+
+    retry.Start(1000);
+    CHECK(retry.OnFailure());
+    CHECK(retry.GetDelayMs(1000) == 10);
+    CHECK(retry.OnFailure());
+    CHECK(retry.OnFailure());
+    CHECK(retry.GetRetryCount() == 3);
+
+    // The attempt after the last retry ends it
+    CHECK(!retry.OnFailure());
+    CHECK(!retry.IsActive());
+    CHECK(!retry.IsDue(5000));
+    CHECK(retry.GetScheduledCount() == 3);
+    CHECK(retry.GetExhaustedCount() == 1);
+}
+
+TEST(DeadlinesCountFromTheFirstAttempt)
+{
+    RetryScheduler retry(10, 4);
+    retry.Start(1000);
+    REQUIRE(retry.OnFailure());
+    CHECK(retry.GetDeadline() == 1010);
+    CHECK(!retry.IsDue(1009));
+    CHECK(retry.IsDue(1010));
+
+    // A late timer does not push back the next deadline
+    REQUIRE(retry.OnFailure());
+    CHECK(retry.GetDeadline() == 1020);
+    CHECK(retry.GetDelayMs(1014) == 6);
+
+    // An overdue retry is due at once
+    REQUIRE(retry.OnFailure());
+    CHECK(retry.GetDelayMs(1045) == 0);
+    CHECK(retry.IsDue(1045));
+}
+
+TEST(StartingAgainResetsTheRetries)
+{
+    RetryScheduler retry(10, 2);
+    retry.Start(0);
+    retry.OnFailure();
+    retry.OnFailure();
+    retry.Start(500);
+    CHECK(retry.GetRetryCount() == 0);
+    CHECK(retry.OnFailure());
+    CHECK(retry.GetDeadline() == 510);
+
+    retry.Cancel();
+    CHECK(!retry.IsActive());
+    CHECK(!retry.OnFailure());
+    CHECK(retry.GetExhaustedCount() == 0);
+}
+
+TEST(ShellForegroundWaitsForDefView)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+
+    // The shell brings up a WorkerW before moving DefView into it
+    HWND oldHost = desktop.windowSystem.GetDesktopIconsHost();
+    HWND defView = desktop.windowSystem.FindWindowAfter(oldHost, nullptr, L"SHELLDLL_DefView", L"");
+    HWND workerW = desktop.windowSystem.CreateWindow(L"WorkerW", L"", SimulatedDesktop::SHELL_PROCESS_ID);
+    desktop.controller.OnWindowEvent(WINDOW_EVENT_FOREGROUND, workerW, 0, 0);
+    CHECK(desktop.controller.GetShellRetry().IsActive());
+    CHECK(!desktop.controller.IsShowingDesktop());
+
+    // Checked again from the retry timer, without waiting in between
+    desktop.windowSystem.Advance(INTERVAL_SHELLRETRY);
+    CHECK(desktop.controller.GetShellRetry().GetScheduledCount() == 2);
+    desktop.windowSystem.SetParent(defView, workerW);
+    desktop.windowSystem.Advance(INTERVAL_SHELLRETRY);
+    CHECK(desktop.controller.IsShowingDesktop());
+    CHECK(!desktop.controller.GetShellRetry().IsActive());
+    CHECK(desktop.controller.GetShellRetry().GetExhaustedCount() == 0);
+}
+
+TEST(ShellRetriesGiveUp)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+
+    HWND workerW = desktop.windowSystem.CreateWindow(L"WorkerW", L"", SimulatedDesktop::SHELL_PROCESS_ID);
+    desktop.controller.OnWindowEvent(WINDOW_EVENT_FOREGROUND, workerW, 0, 0);
+    desktop.windowSystem.Advance(1000);
+    CHECK(!desktop.controller.GetShellRetry().IsActive());
+    CHECK(desktop.controller.GetShellRetry().GetScheduledCount() == SHELL_RETRY_LIMIT);
+    CHECK(desktop.controller.GetShellRetry().GetExhaustedCount() == 1);
+    CHECK(!desktop.controller.IsShowingDesktop());
+
+    // Windows of other processes are not the shell settling
+    HWND other = desktop.windowSystem.CreateWindow(L"WorkerW", L"", 100);
+    desktop.controller.OnWindowEvent(WINDOW_EVENT_FOREGROUND, other, 0, 0);
+    CHECK(!desktop.controller.GetShellRetry().IsActive());
+    CHECK(desktop.controller.GetShellRetry().GetScheduledCount() == SHELL_RETRY_LIMIT);
+}
@@ -0,0 +1,183 @@
+#include "Test.h"
+#include "ServiceThread.h"
+#include <chrono>
+#include <vector>
+
+// Blocks until woken, like a message pump waiting for messages
+class TestPump : public ServiceThread::Pump
+{
+public:
+    TestPump() :
+        startResult(true),
+        runLimit(-1),
+        runs(0),
+        started(0),
+        stopped(0),
+        m_woken(false)
+    {
+    }
+
+    bool Start() override
+    {
+        ++started;
+        threadId = std::this_thread::get_id();
+        return startResult;
+    }
+
+    bool RunOnce() override
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_wake.wait(lock, [this]() { return m_woken; });
+        m_woken = false;
+        return runLimit < 0 || ++runs < runLimit;
+    }
+
+    void Wake() override
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_woken = true;
+        m_wake.notify_one();
+    }
+
+    void Stop() override
+    {
+        ++stopped;
+    }
+
+    bool startResult;
+    int runLimit;           // RunOnce calls until the pump ends the loop, -1 for never
+    int runs;
+    std::atomic<int> started;
+    std::atomic<int> stopped;
+    std::thread::id threadId;
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    bool m_woken;
+};
+
+TEST(RunsCommandsOnTheServiceThreadInOrder)
+{
+    TestPump pump;
+    ServiceThread thread;
+    REQUIRE(thread.Start(&pump));
+    CHECK(thread.IsRunning());
+    CHECK(!thread.IsServiceThread());
+
+    std::vector<int> order;
+    bool onServiceThread = true;
+    for (int i = 0; i < 100; ++i)
+    {
+        CHECK(thread.Post([&, i]()
+        {
+            order.push_back(i);
+            onServiceThread = onServiceThread && std::this_thread::get_id() == pump.threadId;
+        }));
+    }
+
+    // Invoke waits, so everything posted before it has run
+    bool ranInline = false;
+    CHECK(thread.Invoke([&]()
+    {
+        // Calls made on the service thread run inline
+        thread.Invoke([&]() { ranInline = thread.IsServiceThread(); });
+    }));
+    CHECK(ranInline);
+    CHECK(onServiceThread);
+    REQUIRE(order.size() == 100);
+    for (int i = 0; i < 100; ++i)
+    {
+        CHECK(order[i] == i);
+    }
+
+    thread.Stop();
+    CHECK(!thread.IsRunning());
+    CHECK(pump.stopped == 1);
+}
+
+TEST(FailedStartLeavesThreadStopped)
+{
+    TestPump pump;
+    pump.startResult = false;
+    ServiceThread thread;
+    CHECK(!thread.Start(&pump));
+    CHECK(!thread.IsRunning());
+    CHECK(pump.stopped == 1);
+    CHECK(!thread.Post([]() {}));
+
+    // It can be started again
+    pump.startResult = true;
+    CHECK(thread.Start(&pump));
+    CHECK(thread.IsRunning());
+    CHECK(pump.started == 2);
+    thread.Stop();
+}
+
+TEST(PostsAfterStopAreRefused)
+{
+    TestPump pump;
+    ServiceThread thread;
+    REQUIRE(thread.Start(&pump));
+    CHECK(!thread.Start(&pump));
+    thread.Stop();
+
+    bool ran = false;
+    CHECK(!thread.Post([&]() { ran = true; }));
+    CHECK(!thread.Invoke([&]() { ran = true; }));
+    CHECK(!ran);
+}
+
+TEST(PumpEndingTheLoopStopsTheThread)
+{
+    TestPump pump;
+    pump.runLimit = 1;
+    ServiceThread thread;
+    REQUIRE(thread.Start(&pump));
+    thread.Post([]() {});
+
+    for (int i = 0; i < 1000 && thread.IsRunning(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(!thread.IsRunning());
+    CHECK(!thread.Invoke([]() {}));
+
+    thread.Stop();
+    CHECK(pump.stopped == 1);
+}
+
+TEST(CommandsRaceWithStop)
+{
+    // Every command is either run or refused, whenever Stop comes in
+    for (int round = 0; round < 50; ++round)
+    {
+        TestPump pump;
+        ServiceThread thread;
+        REQUIRE(thread.Start(&pump));
+
+        std::atomic<int> ran(0);
+        std::atomic<int> accepted(0);
+        std::vector<std::thread> callers;
+        for (int i = 0; i < 4; ++i)
+        {
+            callers.emplace_back([&, i]()
+            {
+                for (int k = 0; k < 100; ++k)
+                {
+                    bool queued = (k + i) % 2 == 0 ?
+                        thread.Post([&]() { ++ran; }) : thread.Invoke([&]() { ++ran; });
+                    accepted += queued ? 1 : 0;
+                }
+            });
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(round * 20));
+        thread.Stop();
+        for (std::thread& caller : callers)
+        {
+            caller.join();
+        }
+        CHECK(ran == accepted);
+    }
+}
@@ -0,0 +1,221 @@
+#include "Test.h"
+#include "SharedEngine.h"
+#include "SimulatedWindowSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// Stands in for the engine, remembering what instances left behind
+struct FakeEngine
+{
+    explicit FakeEngine(int* destroyed) : m_destroyed(destroyed) {}
+    ~FakeEngine() { ++*m_destroyed; }
+
+    void RemoveOwner(const void* owner)
+    {
+        removed.push_back(owner);
+    }
+
+    std::vector<const void*> removed;
+
+private:
+    int* m_destroyed;
+};
+
+typedef SharedEngine<FakeEngine> SharedFakeEngine;
+
+static const uint32_t FLAGS = 0x1;
+
+TEST(FirstInstanceCreatesLastOneDestroys)
+{
+    SharedFakeEngine shared;
+    int created = 0;
+    int destroyed = 0;
+    auto create = [&]()
+    {
+        ++created;
+        return std::unique_ptr<FakeEngine>(new FakeEngine(&destroyed));
+    };
+
+    int first = 0;
+    int second = 0;
+    FakeEngine* engine = shared.Acquire(FLAGS, create);
+    REQUIRE(engine != nullptr);
+    CHECK(shared.Acquire(FLAGS, create) == engine);
+    CHECK(created == 1);
+    CHECK(shared.GetReferenceCount() == 2);
+
+    // Each instance takes its own windows with it
+    CHECK(!shared.Release(engine, &first));
+    REQUIRE(engine->removed.size() == 1);
+    CHECK(engine->removed[0] == &first);
+    CHECK(destroyed == 0);
+    CHECK(shared.Release(engine, &second));
+    CHECK(destroyed == 1);
+    CHECK(shared.GetReferenceCount() == 0);
+
+    // The next instance starts a new engine
+    engine = shared.Acquire(FLAGS, create);
+    CHECK(created == 2);
+    CHECK(shared.Release(engine, &first));
+    CHECK(destroyed == 2);
+}
+
+TEST(OtherFlagsAreRefused)
+{
+    SharedFakeEngine shared;
+    int destroyed = 0;
+    auto create = [&]()
+    {
+        return std::unique_ptr<FakeEngine>(new FakeEngine(&destroyed));
+    };
+
+    int owner = 0;
+    FakeEngine* engine = shared.Acquire(1, create);
+    REQUIRE(engine != nullptr);
+    CHECK(shared.Acquire(3, create) == nullptr);
+    CHECK(shared.Acquire(0, create) == nullptr);
+    CHECK(shared.GetReferenceCount() == 1);
+
+    // Once it is gone, other flags are fine
+    CHECK(shared.Release(engine, &owner));
+    engine = shared.Acquire(3, create);
+    CHECK(engine != nullptr);
+    CHECK(shared.Release(engine, &owner));
+}
+
+TEST(EngineThatFailsToStartIsNotKept)
+{
+    SharedFakeEngine shared;
+    int destroyed = 0;
+    CHECK(shared.Acquire(0, []() { return std::unique_ptr<FakeEngine>(); }) == nullptr);
+    CHECK(shared.GetReferenceCount() == 0);
+
+    // A later instance may ask for other flags, and foreign engines are not released
+    FakeEngine* engine = shared.Acquire(2, [&]() { return std::unique_ptr<FakeEngine>(new FakeEngine(&destroyed)); });
+    REQUIRE(engine != nullptr);
+    FakeEngine other(&destroyed);
+    int owner = 0;
+    CHECK(!shared.Release(&other, &owner));
+    CHECK(!shared.Release(nullptr, &owner));
+    CHECK(shared.GetReferenceCount() == 1);
+    CHECK(shared.Release(engine, &owner));
+}
+
+TEST(ConcurrentInstancesShareOneEngine)
+{
+    SharedFakeEngine shared;
+    std::atomic<int> created(0);
+    int destroyed = 0;
+    std::atomic<int> mismatched(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < 500; ++i)
+            {
+                int owner = 0;
+                FakeEngine* engine = shared.Acquire(FLAGS, [&]()
+                {
+                    ++created;
+                    return std::unique_ptr<FakeEngine>(new FakeEngine(&destroyed));
+                });
+                if (!engine)
+                {
+                    ++mismatched;
+                    continue;
+                }
+                std::this_thread::yield();
+                shared.Release(engine, &owner);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    CHECK(mismatched == 0);
+    CHECK(created == destroyed);
+    CHECK(shared.GetReferenceCount() == 0);
+}
+
+TEST(WindowsBelongToOneInstance)
+{
+    SimulatedWindowSystem windowSystem;
+    HWND widget = windowSystem.CreateWindow(L"Widget", L"", 1);
+    WindowRegistry registry;
+    int first = 0;
+    int second = 0;
+
+    const WindowInfo* info = WindowOwnership::Insert(windowSystem, registry, &first, widget, 2);
+    REQUIRE(info != nullptr);
+    CHECK(info->owner == &first);
+    CHECK(info->layer == 2);
+    CHECK(info->processId == 1);
+
+    // The other instance can neither take it over nor see it as its own
+    CHECK(WindowOwnership::Insert(windowSystem, registry, &second, widget, 5) == nullptr);
+    CHECK(registry.Find(widget)->layer == 2);
+    CHECK(WindowOwnership::Find(registry, &second, widget) == nullptr);
+    CHECK(WindowOwnership::Find(registry, &first, widget) != nullptr);
+
+    // The owner can move it to another layer
+    info = WindowOwnership::Insert(windowSystem, registry, &first, widget, 3);
+    REQUIRE(info != nullptr);
+    CHECK(info->layer == 3);
+    CHECK(registry.GetSize() == 1);
+
+    // Windows that do not exist are not registered
+    HWND gone = windowSystem.CreateWindow(L"Widget", L"", 1);
+    windowSystem.DestroyWindow(gone);
+    CHECK(WindowOwnership::Insert(windowSystem, registry, &first, gone, 0) == nullptr);
+}
+
+TEST(ReusedHandlesAreUpForGrabs)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.SetReuseHandles(true);
+    HWND widget = windowSystem.CreateWindow(L"Widget", L"", 1);
+    WindowRegistry registry;
+    int first = 0;
+    int second = 0;
+    REQUIRE(WindowOwnership::Insert(windowSystem, registry, &first, widget, 0) != nullptr);
+
+    // Destroyed without the library noticing, the handle now names a window of another process
+    windowSystem.DestroyWindow(widget);
+    HWND reused = windowSystem.CreateWindow(L"Widget", L"", 2);
+    REQUIRE(reused == widget);
+    const WindowInfo* info = WindowOwnership::Insert(windowSystem, registry, &second, reused, 1);
+    REQUIRE(info != nullptr);
+    CHECK(info->owner == &second);
+    CHECK(info->processId == 2);
+    CHECK(WindowOwnership::Find(registry, &first, reused) == nullptr);
+}
+
+TEST(InstancesFindOnlyTheirWindows)
+{
+    SimulatedWindowSystem windowSystem;
+    WindowRegistry registry;
+    int first = 0;
+    int second = 0;
+    std::vector<HWND> mine;
+    for (int i = 0; i < 10; ++i)
+    {
+        HWND hwnd = windowSystem.CreateWindow(L"Widget", L"", 1);
+        const void* owner = i % 3 == 0 ? static_cast<const void*>(&first) : &second;
+        WindowOwnership::Insert(windowSystem, registry, owner, hwnd, 0);
+        if (owner == &first)
+        {
+            mine.push_back(hwnd);
+        }
+    }
+
+    std::vector<HWND> found = WindowOwnership::FindAll(registry, &first);
+    std::sort(found.begin(), found.end());
+    std::sort(mine.begin(), mine.end());
+    CHECK(found == mine);
+    CHECK(WindowOwnership::FindAll(registry, nullptr).empty());
+}
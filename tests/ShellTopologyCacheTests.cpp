@@ -0,0 +1,108 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+static HWND Handle(uintptr_t value)
+{
+    return reinterpret_cast<HWND>(value * 4);
+}
+
+static ShellTopology Topology()
+{
+    ShellTopology topology = { Handle(1), Handle(2), Handle(3), 42 };
+    return topology;
+}
+
+TEST(LookupHitsUntilShellWindowChanges)
+{
+    ShellTopologyCache cache;
+    CHECK(cache.Lookup(Handle(1)) == nullptr);
+    CHECK(cache.GetMissCount() == 1);
+
+    cache.Store(Topology());
+    const ShellTopology* cached = cache.Lookup(Handle(1));
+    REQUIRE(cached != nullptr);
+    CHECK(cached->host == Handle(3));
+    CHECK(cache.GetHitCount() == 1);
+
+    // A new shell window means the shell restarted
+    CHECK(cache.Lookup(Handle(9)) == nullptr);
+    CHECK(!cache.IsValid());
+    CHECK(cache.GetInvalidationCount() == 1);
+}
+
+TEST(EventsInvalidateOnlyForCachedWindows)
+{
+    ShellTopologyCache cache;
+    cache.Store(Topology());
+
+    cache.OnWindowDestroyed(Handle(7));
+    cache.OnWindowReparented(Handle(3));
+    CHECK(cache.IsValid());
+
+    cache.OnWindowReparented(Handle(2));
+    CHECK(!cache.IsValid());
+
+    cache.Store(Topology());
+    cache.OnWindowDestroyed(Handle(3));
+    CHECK(!cache.IsValid());
+    CHECK(cache.GetInvalidationCount() == 2);
+}
+
+TEST(TransitionsReuseTheCachedTopology)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    const uint64_t misses = desktop.controller.GetTopology().GetMissCount();
+
+    for (int i = 0; i < 5; ++i)
+    {
+        desktop.windowSystem.ShowDesktop();
+        REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(500);
+        desktop.windowSystem.RestoreWindows(desktop.apps[0]);
+        REQUIRE(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(500);
+    }
+    CHECK(desktop.controller.GetTopology().GetMissCount() == misses);
+    CHECK(desktop.controller.GetTopology().GetHitCount() > 10);
+}
+
+TEST(DefViewMovingToAnotherHostIsFollowed)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    HWND oldHost = desktop.windowSystem.GetDesktopIconsHost();
+    REQUIRE(desktop.controller.GetTopology().IsValid());
+    CHECK(desktop.controller.GetTopology().GetTopology().host == oldHost);
+
+    HWND defView = desktop.windowSystem.FindWindowAfter(oldHost, nullptr, L"SHELLDLL_DefView", L"");
+    HWND newHost = desktop.windowSystem.CreateWindow(L"WorkerW", L"", SimulatedDesktop::SHELL_PROCESS_ID);
+    desktop.windowSystem.SetParent(defView, newHost);
+    CHECK(!desktop.controller.GetTopology().IsValid());
+    desktop.windowSystem.SetVisible(oldHost, false);
+
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    CHECK(desktop.controller.GetTopology().GetTopology().host == newHost);
+}
+
+TEST(ShellRestartIsRediscovered)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+
+    HWND oldHost = desktop.windowSystem.GetDesktopIconsHost();
+    desktop.windowSystem.DestroyWindow(oldHost);
+    desktop.windowSystem.DestroyWindow(desktop.windowSystem.GetShellWindow());
+    CHECK(!desktop.controller.GetTopology().IsValid());
+
+    desktop.windowSystem.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID + 1, false);
+    desktop.controller.OnShellRestarted();
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    CHECK(desktop.controller.GetTopology().GetTopology().host == desktop.windowSystem.GetDesktopIconsHost());
+    CHECK(desktop.controller.GetTopology().GetTopology().shellProcessId == SimulatedDesktop::SHELL_PROCESS_ID + 1);
+}
@@ -0,0 +1,238 @@
+#include "Test.h"
+#include "ShowDesktopDetector.h"
+
+typedef ShowDesktopDetector::Event Event;
+typedef ShowDesktopDetector::Mode Mode;
+
+// Runs the probes the detector asks for while the desktop stays in one state,
+// until it has nothing left to do or the time is up
+static uint64_t Probe(ShowDesktopDetector& detector, bool showDesktop, uint64_t nowMs, uint64_t untilMs)
+{
+    for (;;)
+    {
+        uint32_t delay = detector.NextProbeDelayMs();
+        if (delay == ShowDesktopDetector::NO_PROBE || nowMs + delay > untilMs)
+            return nowMs;
+
+        nowMs += delay;
+        detector.OnProbe(showDesktop, nowMs);
+    }
+}
+
+TEST(EventStartsBurst)
+{
+    ShowDesktopDetector detector;
+    const ShowDesktopDetector::Config& config = detector.GetConfig();
+    CHECK(detector.NextProbeDelayMs() == config.fallbackIntervalMs);
+
+    CHECK(detector.OnEvent(Event::Foreground, 1000));
+    CHECK(detector.IsInBurst());
+    CHECK(detector.NextProbeDelayMs() == config.burstIntervalMs);
+
+    for (uint32_t i = 0; i < config.burstProbes; ++i)
+    {
+        CHECK(!detector.OnProbe(false, 1000 + (i + 1) * config.burstIntervalMs));
+    }
+    CHECK(!detector.IsInBurst());
+    CHECK(detector.NextProbeDelayMs() == config.fallbackIntervalMs);
+}
+
+TEST(TransitionInBurstMeasuresLatency)
+{
+    ShowDesktopDetector detector;
+    detector.OnEvent(Event::HostReorder, 5000);
+    detector.OnEvent(Event::Foreground, 5004);
+
+    CHECK(!detector.OnProbe(false, 5016));
+    CHECK(detector.OnProbe(true, 5032));
+    CHECK(detector.IsShowingDesktop());
+    CHECK(detector.GetLastDetectionLatencyMs() == 32);
+    CHECK(detector.GetTransitionCount() == 1);
+    CHECK(detector.GetEventCount() == 2);
+    CHECK(detector.GetMode() == Mode::EventDriven);
+
+    // The shell often settles in more than one step, so probing goes on
+    CHECK(detector.IsInBurst());
+}
+
+TEST(SafetyPollBacksOff)
+{
+    ShowDesktopDetector detector;
+    const ShowDesktopDetector::Config& config = detector.GetConfig();
+
+    uint64_t now = 0;
+    uint32_t expected = config.fallbackIntervalMs;
+    for (int i = 0; i < 8; ++i)
+    {
+        CHECK(detector.NextProbeDelayMs() == expected);
+        now += detector.NextProbeDelayMs();
+        CHECK(!detector.OnProbe(false, now));
+        expected = expected * 2 < config.maxFallbackIntervalMs ? expected * 2 : config.maxFallbackIntervalMs;
+    }
+    CHECK(detector.NextProbeDelayMs() == config.maxFallbackIntervalMs);
+
+    // Any event starts the backoff over
+    detector.OnEvent(Event::HostShow, now);
+    now = Probe(detector, false, now, now + 100);
+    CHECK(detector.NextProbeDelayMs() == config.fallbackIntervalMs);
+}
+
+TEST(BurstProbesDoNotBackOff)
+{
+    ShowDesktopDetector detector;
+    detector.OnEvent(Event::Foreground, 0);
+    Probe(detector, false, 0, 100);
+    CHECK(detector.NextProbeDelayMs() == detector.GetConfig().fallbackIntervalMs);
+}
+
+TEST(MissedTransitionsFallBackToPolling)
+{
+    ShowDesktopDetector detector;
+    const ShowDesktopDetector::Config& config = detector.GetConfig();
+
+    // The first transition only the safety poll saw gives up on events
+    uint64_t now = detector.NextProbeDelayMs();
+    CHECK(detector.OnProbe(true, now));
+    CHECK(detector.GetLastDetectionLatencyMs() == 0);
+    CHECK(detector.GetMode() == Mode::Polling);
+    now = Probe(detector, true, now, now + 100);
+
+    // Polling uses the classic intervals of each state
+    CHECK(detector.NextProbeDelayMs() == config.restorePollIntervalMs);
+    now += detector.NextProbeDelayMs();
+    CHECK(detector.OnProbe(false, now));
+    Probe(detector, false, now, now + 100);
+    CHECK(detector.NextProbeDelayMs() == config.pollIntervalMs);
+}
+
+TEST(LostEventsDelayDetectionBoundedly)
+{
+    ShowDesktopDetector detector;
+    const ShowDesktopDetector::Config& config = detector.GetConfig();
+    CHECK(detector.GetMaxMissLatencyMs() <= 2500);
+
+    // The worst case: a long quiet time has backed the safety poll off fully,
+    // and the transition happens right after a poll that was run late
+    uint64_t now = Probe(detector, false, 0, 60 * 60 * 1000);
+    CHECK(detector.NextProbeDelayMs() == config.maxFallbackIntervalMs);
+    const uint64_t transition = now + 1;
+    now += detector.NextProbeDelayMs() + detector.NextProbeToleranceMs();
+    CHECK(detector.OnProbe(true, now));
+    CHECK(now - transition <= detector.GetMaxMissLatencyMs());
+
+    // Every later transition is polled for at the classic intervals
+    for (int i = 0; i < 10; ++i)
+    {
+        const bool showDesktop = i % 2 == 1;
+        now = Probe(detector, !showDesktop, now, now + 5000);
+        const uint64_t start = now;
+        now += detector.NextProbeDelayMs();
+        CHECK(detector.OnProbe(showDesktop, now));
+        CHECK(now - start <= config.pollIntervalMs);
+    }
+}
+
+TEST(EventsRecoverFromPolling)
+{
+    ShowDesktopDetector::Config config = ShowDesktopDetector::DefaultConfig();
+    config.missedTransitionLimit = 1;
+    ShowDesktopDetector detector(config);
+
+    CHECK(detector.OnProbe(true, 1000));
+    CHECK(detector.GetMode() == Mode::Polling);
+    uint64_t now = Probe(detector, true, 1000, 1100);
+
+    // A transition an event led to proves the hooks work again
+    detector.OnEvent(Event::HostReorder, now);
+    CHECK(detector.OnProbe(false, now + config.burstIntervalMs));
+    CHECK(detector.GetMode() == Mode::EventDriven);
+    CHECK(detector.GetLastDetectionLatencyMs() == config.burstIntervalMs);
+}
+
+TEST(ResetKeepsConfig)
+{
+    ShowDesktopDetector::Config config = ShowDesktopDetector::DefaultConfig();
+    config.fallbackIntervalMs = 500;
+    ShowDesktopDetector detector(config);
+    detector.OnEvent(Event::Foreground, 0);
+    detector.OnProbe(true, 16);
+
+    detector.Reset();
+    CHECK(!detector.IsShowingDesktop());
+    CHECK(!detector.IsInBurst());
+    CHECK(detector.GetTransitionCount() == 0);
+    CHECK(detector.NextProbeDelayMs() == 500);
+}
+
+TEST(IdleStopsPeriodicProbes)
+{
+    ShowDesktopDetector detector;
+    const ShowDesktopDetector::Config& config = detector.GetConfig();
+    detector.SetIdle(true);
+    CHECK(detector.NextProbeDelayMs() == ShowDesktopDetector::NO_PROBE);
+    CHECK(detector.NextProbeToleranceMs() == 0);
+    CHECK(!detector.OnTrigger(1000));
+    CHECK(detector.GetTriggerCount() == 0);
+
+    // Events still run their burst, and nothing after it
+    CHECK(detector.OnEvent(Event::Foreground, 1000));
+    CHECK(detector.NextProbeDelayMs() == config.burstIntervalMs);
+    CHECK(detector.OnProbe(true, 1000 + config.burstIntervalMs));
+    uint64_t now = Probe(detector, true, 1000 + config.burstIntervalMs, 100000);
+    CHECK(now == 1000 + config.burstIntervalMs * (config.burstProbes + 1));
+    CHECK(detector.NextProbeDelayMs() == ShowDesktopDetector::NO_PROBE);
+
+    detector.SetIdle(false);
+    CHECK(detector.NextProbeDelayMs() == config.fallbackIntervalMs);
+}
+
+TEST(SuspendedDetectorDoesNotProbe)
+{
+    ShowDesktopDetector detector;
+    const ShowDesktopDetector::Config& config = detector.GetConfig();
+    uint64_t now = Probe(detector, false, 0, 20000);
+    CHECK(detector.NextProbeDelayMs() == config.maxFallbackIntervalMs);
+
+    CHECK(!detector.SetSuspended(true, now));
+    CHECK(!detector.SetSuspended(true, now));
+    CHECK(detector.IsSuspended());
+    CHECK(detector.NextProbeDelayMs() == ShowDesktopDetector::NO_PROBE);
+    CHECK(!detector.OnTrigger(now));
+
+    // Not even for events
+    detector.OnEvent(Event::HostReorder, now);
+    CHECK(detector.NextProbeDelayMs() == ShowDesktopDetector::NO_PROBE);
+
+    // Resuming is an event: a burst, and the safety poll starts over
+    CHECK(detector.SetSuspended(false, now + 60000));
+    CHECK(detector.NextProbeDelayMs() == config.burstIntervalMs);
+    Probe(detector, false, now + 60000, now + 61000);
+    CHECK(detector.NextProbeDelayMs() == config.fallbackIntervalMs);
+}
+
+TEST(OnlyTheSafetyPollIsCoalescable)
+{
+    ShowDesktopDetector::Config config = ShowDesktopDetector::DefaultConfig();
+    config.missedTransitionLimit = 1;
+    ShowDesktopDetector detector(config);
+    CHECK(detector.NextProbeToleranceMs() == config.fallbackIntervalMs / 4);
+
+    // The tolerance grows with the interval as the poll backs off
+    detector.OnProbe(false, 1000);
+    CHECK(detector.NextProbeToleranceMs() == config.fallbackIntervalMs / 2);
+
+    detector.OnEvent(Event::Foreground, 2000);
+    CHECK(detector.NextProbeToleranceMs() == 0);
+    uint64_t now = Probe(detector, false, 2000, 3000);
+    CHECK(detector.NextProbeToleranceMs() == config.fallbackIntervalMs / 4);
+
+    CHECK(detector.OnTrigger(now));
+    CHECK(detector.NextProbeToleranceMs() == 0);
+    now = Probe(detector, false, now, now + 1000);
+
+    // Polling stands in for events, so it runs on time
+    CHECK(detector.OnProbe(true, now + 1000));
+    now = Probe(detector, true, now + 1000, now + 2000);
+    CHECK(detector.GetMode() == Mode::Polling);
+    CHECK(detector.NextProbeToleranceMs() == 0);
+}
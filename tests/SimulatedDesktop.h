@@ -0,0 +1,179 @@
+#pragma once
+
+#include "DesktopController.h"
+#include "SimulatedWindowSystem.h"
+#include <cwchar>
+#include <memory>
+#include <vector>
+
+// A simulated desktop with the shell, a few application windows and the
+// library's own windows, and a controller running over it
+struct SimulatedDesktop
+{
+    static const uint32_t OWN_PROCESS_ID = 1;
+    static const uint32_t SHELL_PROCESS_ID = 42;
+
+    explicit SimulatedDesktop(bool shellWindowHost = false, size_t appCount = 5) :
+        windowSystem(OWN_PROCESS_ID),
+        controller(windowSystem, windows)
+    {
+        windowSystem.CreateShell(SHELL_PROCESS_ID, shellWindowHost);
+        for (size_t i = 0; i < appCount; ++i)
+        {
+            apps.push_back(windowSystem.CreateWindow(L"Application", L"Window", 100 + static_cast<uint32_t>(i)));
+        }
+        systemWindow = windowSystem.CreateWindow(ZPOS_SYSTEM_WINDOW_CLASS, ZPOS_SYSTEM_WINDOW_TITLE, OWN_PROCESS_ID);
+        helperWindow = windowSystem.CreateWindow(ZPOS_SYSTEM_WINDOW_CLASS, ZPOS_HELPER_WINDOW_TITLE, OWN_PROCESS_ID);
+    }
+
+    ~SimulatedDesktop()
+    {
+        controller.Stop();
+    }
+
+    // Starts detection and places the windows registered so far, as the library does
+    void Start()
+    {
+        controller.Start(systemWindow, helperWindow);
+        controller.PositionWindows();
+    }
+
+    // Restacking asked for in a frame that was already restacked runs in the next one
+    void NextFrame()
+    {
+        windowSystem.Advance(FRAME_MS);
+    }
+
+    // Creates a window of this process and registers it, as the library does
+    HWND Register(int32_t layer = 0)
+    {
+        HWND hwnd = windowSystem.CreateWindow(L"Widget", L"", OWN_PROCESS_ID);
+        Register(hwnd, layer);
+        return hwnd;
+    }
+
+    void Register(HWND hwnd, int32_t layer)
+    {
+        Register(std::vector<HWND>(1, hwnd), layer);
+    }
+
+    // Registers all windows with one new registry, as bulk registration does
+    void Register(const std::vector<HWND>& hwnds, int32_t layer)
+    {
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(windows.GetForWriter()));
+        for (HWND hwnd : hwnds)
+        {
+            WindowInfo info = { hwnd, windowSystem.IsWindowVisible(hwnd), windowSystem.IsMinimized(hwnd),
+                nullptr, layer, windowSystem.GetWindowProcessId(hwnd), 0 };
+            registry->Insert(info);
+        }
+        windows.Publish(std::move(registry));
+    }
+
+    std::vector<HWND> CreateWidgets(size_t count)
+    {
+        std::vector<HWND> hwnds;
+        for (size_t i = 0; i < count; ++i)
+        {
+            hwnds.push_back(windowSystem.CreateWindow(L"Widget", L"", OWN_PROCESS_ID));
+        }
+        return hwnds;
+    }
+
+    void Unregister(HWND hwnd)
+    {
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(windows.GetForWriter()));
+        registry->Erase(hwnd);
+        windows.Publish(std::move(registry));
+    }
+
+    // Advances the clock a millisecond at a time until the controller reports
+    // the state, returning how long that took or NOT_DETECTED
+    uint64_t WaitForState(bool showDesktop, uint64_t timeoutMs = 20000)
+    {
+        for (uint64_t elapsed = 0; elapsed <= timeoutMs; ++elapsed)
+        {
+            if (controller.IsShowingDesktop() == showDesktop)
+                return elapsed;
+            windowSystem.Advance(1);
+        }
+        return NOT_DETECTED;
+    }
+
+    // True if the visible registered windows form one block, higher layers
+    // first, directly below the helper window while showing the desktop, or
+    // below every other window but the shell's and the library's otherwise.
+    // Widgets that are hidden or no longer registered may sit anywhere.
+    bool IsInPlace()
+    {
+        SnapshotCell<WindowRegistry>::ReadGuard registry = windows.Read();
+        const std::vector<HWND>& stack = windowSystem.GetStack();
+        size_t first = 0;
+        while (first < stack.size() && !IsPositioned(*registry, stack[first]))
+        {
+            ++first;
+        }
+
+        size_t end = first;
+        size_t found = 0;
+        HWND previous = nullptr;
+        for (; end < stack.size() && found < registry->GetPositionedCount(); ++end)
+        {
+            if (!IsPositioned(*registry, stack[end]))
+            {
+                if (!IsStrayWidget(*registry, stack[end]))
+                    return false;
+                continue;
+            }
+
+            if (previous && registry->Find(stack[end])->layer > registry->Find(previous)->layer)
+                return false;
+            previous = stack[end];
+            ++found;
+        }
+        if (found != registry->GetPositionedCount())
+            return false;
+
+        if (controller.IsShowingDesktop())
+        {
+            while (first > 0 && IsStrayWidget(*registry, stack[first - 1]))
+            {
+                --first;
+            }
+            return first > 0 && stack[first - 1] == helperWindow;
+        }
+
+        for (size_t i = end; i < stack.size(); ++i)
+        {
+            wchar_t className[64];
+            windowSystem.GetWindowClass(stack[i], className, 64);
+            if (std::wcscmp(className, L"Progman") != 0 && std::wcscmp(className, L"WorkerW") != 0 &&
+                std::wcscmp(className, ZPOS_SYSTEM_WINDOW_CLASS) != 0 && !IsStrayWidget(*registry, stack[i]))
+                return false;
+        }
+        return true;
+    }
+
+    bool IsStrayWidget(const WindowRegistry& registry, HWND hwnd)
+    {
+        wchar_t className[64];
+        windowSystem.GetWindowClass(hwnd, className, 64);
+        return std::wcscmp(className, L"Widget") == 0 && !IsPositioned(registry, hwnd);
+    }
+
+    static const uint64_t NOT_DETECTED = static_cast<uint64_t>(-1);
+    static const uint32_t FRAME_MS = 17;
+
+    static bool IsPositioned(const WindowRegistry& registry, HWND hwnd)
+    {
+        const WindowInfo* info = registry.Find(hwnd);
+        return info && ::IsPositioned(*info);
+    }
+
+    SimulatedWindowSystem windowSystem;
+    SnapshotCell<WindowRegistry> windows;
+    DesktopController controller;
+    std::vector<HWND> apps;
+    HWND systemWindow;
+    HWND helperWindow;
+};
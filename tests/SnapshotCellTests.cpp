@@ -0,0 +1,202 @@
+#include "Test.h"
+#include "SnapshotCell.h"
+#include <chrono>
+#include <vector>
+
+// A snapshot that can tell whether it was torn or freed while in use
+struct Versioned
+{
+    static std::atomic<int> live;
+
+    Versioned() : version(0), values(16, 0), alive(ALIVE) { ++live; }
+    Versioned(const Versioned& other) : version(other.version), values(other.values), alive(ALIVE) { ++live; }
+    ~Versioned() { alive = 0; --live; }
+
+    bool IsConsistent() const
+    {
+        if (alive != ALIVE)
+            return false;
+        for (uint64_t value : values)
+        {
+            if (value != version)
+                return false;
+        }
+        return true;
+    }
+
+    static const uint32_t ALIVE = 0x600DF00D;
+
+    uint64_t version;
+    std::vector<uint64_t> values;
+    volatile uint32_t alive;
+};
+
+std::atomic<int> Versioned::live(0);
+
+TEST(ReadersSeeWholeSnapshots)
+{
+    {
+        SnapshotCell<Versioned> cell;
+        std::atomic<bool> done(false);
+        std::atomic<int> torn(0);
+        std::atomic<uint64_t> reads(0);
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 2; ++i)
+        {
+            readers.emplace_back([&]()
+            {
+                uint64_t last = 0;
+                while (!done.load())
+                {
+                    SnapshotCell<Versioned>::ReadGuard snapshot = cell.Read();
+                    // Versions only go forward, and a snapshot never changes under a reader
+                    if (!snapshot->IsConsistent() || snapshot->version < last)
+                    {
+                        ++torn;
+                    }
+                    last = snapshot->version;
+                    ++reads;
+                    std::this_thread::yield();
+                }
+            });
+        }
+
+        while (reads.load() == 0)
+        {
+            std::this_thread::yield();
+        }
+
+        for (uint64_t version = 1; version <= 500; ++version)
+        {
+            std::unique_ptr<Versioned> next(new Versioned(cell.GetForWriter()));
+            next->version = version;
+            next->values.assign(next->values.size(), version);
+            cell.Publish(std::move(next));
+            std::this_thread::yield();
+        }
+
+        done = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+        CHECK(torn == 0);
+        CHECK(cell.GetForWriter().version == 500);
+
+        // Every replaced snapshot has been freed
+        CHECK(Versioned::live == 1);
+    }
+    CHECK(Versioned::live == 0);
+}
+
+TEST(PublishWaitsForReadersOfTheOldSnapshot)
+{
+    SnapshotCell<Versioned> cell;
+    std::atomic<bool> published(false);
+    std::thread writer;
+    {
+        SnapshotCell<Versioned>::ReadGuard snapshot = cell.Read();
+        writer = std::thread([&]()
+        {
+            std::unique_ptr<Versioned> next(new Versioned());
+            next->version = 1;
+            next->values.assign(next->values.size(), 1);
+            cell.Publish(std::move(next));
+            published = true;
+        });
+
+        // The old snapshot stays valid for as long as it is read
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(!published);
+        CHECK(snapshot->IsConsistent());
+        CHECK(snapshot->version == 0);
+    }
+
+    writer.join();
+    CHECK(published);
+    CHECK(cell.Read()->version == 1);
+    CHECK(Versioned::live == 1);
+}
+
+// A snapshot that marks in a table outside itself when it is freed, so a
+// reader can tell without touching freed memory
+struct Tracked
+{
+    static const size_t COUNT = 2048;
+    static std::atomic<bool> freed[COUNT];
+
+    Tracked() : id(0) {}
+    ~Tracked() { freed[id].store(true, std::memory_order_seq_cst); }
+
+    size_t id;
+};
+
+std::atomic<bool> Tracked::freed[Tracked::COUNT];
+
+TEST(ReadersNeverSeeFreedSnapshots)
+{
+    for (std::atomic<bool>& flag : Tracked::freed)
+    {
+        flag = false;
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<int> freedInUse(0);
+    std::atomic<uint64_t> reads(0);
+    {
+        SnapshotCell<Tracked> cell;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 3; ++i)
+        {
+            readers.emplace_back([&]()
+            {
+                while (!done.load())
+                {
+                    SnapshotCell<Tracked>::ReadGuard snapshot = cell.Read();
+                    const size_t id = snapshot->id;
+
+                    // Still not freed however long the guard is held
+                    for (int check = 0; check < 3; ++check)
+                    {
+                        if (Tracked::freed[id].load(std::memory_order_seq_cst))
+                        {
+                            ++freedInUse;
+                        }
+                        std::this_thread::yield();
+                    }
+                    ++reads;
+                }
+            });
+        }
+
+        while (reads.load() == 0)
+        {
+            std::this_thread::yield();
+        }
+
+        for (size_t id = 1; id < Tracked::COUNT; ++id)
+        {
+            std::unique_ptr<Tracked> next(new Tracked());
+            next->id = id;
+            cell.Publish(std::move(next));
+            if (id % 4 == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        done = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+        CHECK(freedInUse == 0);
+        CHECK(reads > 0);
+
+        // Everything but the current snapshot was freed on the way
+        CHECK(Tracked::freed[Tracked::COUNT - 2]);
+        CHECK(!Tracked::freed[Tracked::COUNT - 1]);
+    }
+    CHECK(Tracked::freed[Tracked::COUNT - 1]);
+}
@@ -0,0 +1,147 @@
+#include "Test.h"
+#include "StateSnapshot.h"
+#include <vector>
+
+typedef StateSnapshotCell::Snapshot Snapshot;
+
+// Waits until count threads are in WaitForChange, or a second passed
+static bool WaitForWaiters(const StateSnapshotCell& cell, uint32_t count)
+{
+    for (int i = 0; i < 1000 && cell.GetWaiterCount() < count; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return cell.GetWaiterCount() == count;
+}
+
+TEST(OnlyTransitionsArePublished)
+{
+    StateSnapshotCell cell;
+    Snapshot snapshot = cell.Read();
+    CHECK(!snapshot.showDesktop);
+    CHECK(snapshot.sequence == 0);
+    CHECK(snapshot.transitionMs == 0);
+
+    cell.Publish(false, 100);
+    CHECK(cell.Read().sequence == 0);
+
+    cell.Publish(true, 200);
+    cell.Publish(true, 300);
+    snapshot = cell.Read();
+    CHECK(snapshot.showDesktop);
+    CHECK(snapshot.sequence == 1);
+    CHECK(snapshot.transitionMs == 200);
+}
+
+TEST(WaitEndsAtOnceAfterAMissedChange)
+{
+    StateSnapshotCell cell;
+    cell.Publish(true, 10);
+
+    Snapshot snapshot;
+    CHECK(cell.WaitForChange(0, StateSnapshotCell::FOREVER, snapshot));
+    CHECK(snapshot.sequence == 1);
+    CHECK(snapshot.showDesktop);
+    CHECK(cell.GetWaiterCount() == 0);
+}
+
+TEST(WaitTimesOut)
+{
+    StateSnapshotCell cell;
+    cell.Publish(true, 10);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Snapshot snapshot;
+    CHECK(!cell.WaitForChange(1, 30, snapshot));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(30));
+    CHECK(snapshot.sequence == 1);
+    CHECK(cell.GetWaiterCount() == 0);
+
+    CHECK(!cell.WaitForChange(1, 0, snapshot));
+}
+
+TEST(PublishWakesEveryWaiter)
+{
+    StateSnapshotCell cell;
+    std::atomic<int> woken(0);
+    std::vector<std::thread> waiters;
+    for (int i = 0; i < 4; ++i)
+    {
+        waiters.emplace_back([&cell, &woken, i]()
+        {
+            // With and without a timeout
+            Snapshot snapshot;
+            if (cell.WaitForChange(0, i % 2 ? StateSnapshotCell::FOREVER : 10000, snapshot) &&
+                snapshot.sequence == 1 && snapshot.showDesktop && snapshot.transitionMs == 42)
+            {
+                ++woken;
+            }
+        });
+    }
+
+    REQUIRE(WaitForWaiters(cell, 4));
+    cell.Publish(true, 42);
+    for (std::thread& waiter : waiters)
+    {
+        waiter.join();
+    }
+    CHECK(woken == 4);
+    CHECK(cell.GetWaiterCount() == 0);
+}
+
+TEST(ReadersNeverSeeTornSnapshots)
+{
+    StateSnapshotCell cell;
+    const uint32_t transitions = 20000;
+    std::atomic<bool> torn(false);
+    std::atomic<bool> done(false);
+
+    // Each transition is odd or even together with its sequence and time
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 2; ++i)
+    {
+        readers.emplace_back([&]()
+        {
+            uint32_t last = 0;
+            while (!done)
+            {
+                Snapshot snapshot = cell.Read();
+                if (snapshot.showDesktop != (snapshot.sequence % 2 == 1) ||
+                    snapshot.transitionMs != snapshot.sequence * 10ull || snapshot.sequence < last)
+                {
+                    torn = true;
+                }
+                last = snapshot.sequence;
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    // A waiter keeps up with some of the changes, and sees the last one
+    std::thread waiter([&]()
+    {
+        Snapshot snapshot = cell.Read();
+        while (snapshot.sequence < transitions)
+        {
+            cell.WaitForChange(snapshot.sequence, StateSnapshotCell::FOREVER, snapshot);
+        }
+    });
+
+    for (uint32_t n = 1; n <= transitions; ++n)
+    {
+        cell.Publish(n % 2 == 1, n * 10ull);
+        if (n % 16 == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    waiter.join();
+    done = true;
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+    CHECK(!torn);
+    CHECK(cell.Read().sequence == transitions);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+// A minimal test registry. Each test file builds into its own executable, and
+// TestMain.cpp runs the tests it defines:
+//
+//     TEST(DetectsTransition)
+//     {
+//         CHECK(detector.OnProbe(true, 0));
+//     }
+//
+// CHECK reports a failure and carries on; REQUIRE also ends the test.
+
+struct TestCase
+{
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<TestCase>& GetTestCases()
+{
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+inline int& GetTestFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+struct TestRegistration
+{
+    TestRegistration(const char* name, void (*run)())
+    {
+        TestCase test = { name, run };
+        GetTestCases().push_back(test);
+    }
+};
+
+inline bool TestCheck(bool passed, const char* expression, const char* file, int line)
+{
+    if (!passed)
+    {
+        std::printf("  %s(%d): failed: %s\n", file, line, expression);
+        ++GetTestFailures();
+    }
+    return passed;
+}
+
+#define TEST(name) \
+    static void Test##name(); \
+    static TestRegistration s_test##name(#name, Test##name); \
+    static void Test##name()
+
+#define CHECK(expression) TestCheck(!!(expression), #expression, __FILE__, __LINE__)
+
+#define REQUIRE(expression) \
+    do \
+    { \
+        if (!CHECK(expression)) \
+            return; \
+    } while (false)
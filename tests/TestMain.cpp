@@ -0,0 +1,30 @@
+// Runs the tests of one test executable, or those named on the command line
+#include "Test.h"
+#include <cstring>
+
+int main(int argc, char** argv)
+{
+    int run = 0;
+    int failed = 0;
+    for (const TestCase& test : GetTestCases())
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc && !selected; ++i)
+        {
+            selected = std::strcmp(argv[i], test.name) == 0;
+        }
+        if (!selected)
+            continue;
+
+        const int failures = GetTestFailures();
+        test.run();
+        ++run;
+
+        const bool passed = GetTestFailures() == failures;
+        failed += passed ? 0 : 1;
+        std::printf("%-6s %s\n", passed ? "ok" : "FAILED", test.name);
+    }
+
+    std::printf("%d of %d tests passed\n", run - failed, run);
+    return failed || run == 0 ? 1 : 0;
+}
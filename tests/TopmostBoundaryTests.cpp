@@ -0,0 +1,136 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+// Creates count topmost windows of another process, the lowest one last
+static std::vector<HWND> CreateTopmostWindows(SimulatedWindowSystem& windowSystem, size_t count)
+{
+    std::vector<HWND> hwnds;
+    for (size_t i = 0; i < count; ++i)
+    {
+        hwnds.insert(hwnds.begin(), windowSystem.CreateWindow(L"Tool", L"", 200 + static_cast<uint32_t>(i)));
+        windowSystem.SetTopmost(hwnds.front(), true);
+    }
+    return hwnds;
+}
+
+TEST(BoundaryIsWalkedOnceThenChecked)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, false);
+    for (int i = 0; i < 20; ++i)
+    {
+        windowSystem.CreateWindow(L"Application", L"", 100);
+    }
+    std::vector<HWND> tools = CreateTopmostWindows(windowSystem, 4);
+    HWND helper = windowSystem.CreateWindow(L"Helper", L"", 1);
+    windowSystem.SetTopmost(helper, true);
+
+    TopmostBoundary boundary;
+    CHECK(boundary.Find(windowSystem, helper) == tools.back());
+    CHECK(boundary.GetWalkCount() == 1);
+    CHECK(boundary.GetWalkStepCount() == 4);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK(boundary.Find(windowSystem, helper) == tools.back());
+    }
+    CHECK(boundary.GetHitCount() == 10);
+    CHECK(boundary.GetWalkCount() == 1);
+
+    // A window joining the band at the top leaves its end where it was
+    HWND newer = windowSystem.CreateWindow(L"Tool", L"", 300);
+    windowSystem.SetTopmost(newer, true);
+    windowSystem.SetTopmost(helper, true);
+    CHECK(boundary.Find(windowSystem, helper) == tools.back());
+    CHECK(boundary.GetWalkCount() == 1);
+}
+
+TEST(BandChangesWithoutEventsAreNoticed)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.CreateWindow(L"Application", L"", 100);
+    std::vector<HWND> tools = CreateTopmostWindows(windowSystem, 3);
+    HWND helper = windowSystem.CreateWindow(L"Helper", L"", 1);
+    windowSystem.SetTopmost(helper, true);
+
+    TopmostBoundary boundary;
+    REQUIRE(boundary.Find(windowSystem, helper) == tools[2]);
+
+    // The lowest one leaves the band
+    windowSystem.SetTopmost(tools[2], false);
+    CHECK(boundary.Find(windowSystem, helper) == tools[1]);
+    CHECK(boundary.GetWalkCount() == 2);
+
+    // One joins it below the remembered end
+    HWND lower = windowSystem.CreateWindow(L"Tool", L"", 300);
+    const ZOrderMove move = { lower, tools[1], ZOrderMove::After };
+    REQUIRE(windowSystem.MoveWindow(move));
+    CHECK(boundary.Find(windowSystem, helper) == lower);
+    CHECK(boundary.GetWalkCount() == 3);
+
+    // The remembered end is destroyed, with or without the event
+    windowSystem.DestroyWindow(lower);
+    CHECK(boundary.Find(windowSystem, helper) == tools[1]);
+    CHECK(boundary.GetWalkCount() == 4);
+    windowSystem.DestroyWindow(tools[1]);
+    boundary.OnWindowEvent(WINDOW_EVENT_DESTROY, tools[1]);
+    CHECK(boundary.Find(windowSystem, helper) == tools[0]);
+    CHECK(boundary.GetWalkCount() == 5);
+}
+
+TEST(NoBoundaryWithoutOtherTopmostWindows)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.CreateWindow(L"Application", L"", 100);
+    HWND helper = windowSystem.CreateWindow(L"Helper", L"", 1);
+    windowSystem.SetTopmost(helper, true);
+
+    TopmostBoundary boundary;
+    CHECK(boundary.Find(windowSystem, helper) == nullptr);
+    CHECK(boundary.GetWalkStepCount() == 0);
+
+    HWND tool = windowSystem.CreateWindow(L"Tool", L"", 200);
+    windowSystem.SetTopmost(tool, true);
+    windowSystem.SetTopmost(helper, true);
+    CHECK(boundary.Find(windowSystem, helper) == tool);
+
+    // Invalidating forces a walk even when the end is unchanged
+    boundary.Invalidate();
+    CHECK(boundary.Find(windowSystem, helper) == tool);
+    CHECK(boundary.GetWalkCount() == 3);
+    CHECK(boundary.GetHitCount() == 0);
+}
+
+TEST(HelperStaysBelowTheTopmostBand)
+{
+    SimulatedDesktop desktop;
+    std::vector<HWND> tools = CreateTopmostWindows(desktop.windowSystem, 3);
+    desktop.Register(desktop.CreateWidgets(3), 0);
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+
+    for (size_t i = 0; i < 6; ++i)
+    {
+        // The band changes under the library halfway through
+        if (i == 3)
+        {
+            desktop.windowSystem.SetTopmost(tools.back(), false);
+        }
+        HWND lowest = i < 3 ? tools[2] : tools[1];
+
+        desktop.windowSystem.ShowDesktop();
+        REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+        desktop.NextFrame();
+        CHECK(desktop.windowSystem.GetWindowAbove(desktop.helperWindow) == lowest);
+        CHECK(desktop.IsInPlace());
+
+        desktop.windowSystem.RestoreWindows(desktop.apps[i % desktop.apps.size()]);
+        REQUIRE(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(1000);
+    }
+
+    // The band is walked when it changed, not on every transition
+    const TopmostBoundary& boundary = desktop.controller.GetTopmostBoundary();
+    CHECK(boundary.GetWalkCount() <= 2);
+    CHECK(boundary.GetHitCount() >= 4);
+}
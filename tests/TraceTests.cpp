@@ -0,0 +1,327 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+#include "TraceRecorder.h"
+#include "TraceReplay.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+static const char* TRACE_PATH = "TraceTests.zdt";
+
+// A simulated desktop whose controller runs through the recording backend,
+// with the inputs recorded as the library records them
+struct RecordedDesktop
+{
+    RecordedDesktop() :
+        recording(desktop.windowSystem),
+        controller(recording, desktop.windows),
+        recorder(nullptr)
+    {
+        controller.SetWindowLifecycleHandler([this](const WindowLifecycle& change)
+        {
+            std::unique_ptr<WindowRegistry> registry(new WindowRegistry(desktop.windows.GetForWriter()));
+            if (registry->Apply(change))
+            {
+                desktop.windows.Publish(std::move(registry));
+            }
+        });
+    }
+
+    ~RecordedDesktop()
+    {
+        controller.Stop();
+    }
+
+    // Starts detection with the trace attached, as StartTrace does
+    void Start(TraceRecorder& traceRecorder)
+    {
+        recorder = &traceRecorder;
+        TraceStart start = { TraceHandle(desktop.systemWindow), TraceHandle(desktop.helperWindow) };
+        recorder->Record(TRACE_START, start);
+        TraceRect area = { 0, 0, 0, 0 };
+        recorder->Record(TRACE_TRIGGER_AREA, area);
+        RecordRegistrations(desktop.windows.GetForWriter());
+
+        recording.SetRecorder(recorder);
+        controller.SetTraceRecorder(recorder);
+        controller.Start(desktop.systemWindow, desktop.helperWindow);
+    }
+
+    void Stop()
+    {
+        recorder->Record(TRACE_STOP, nullptr, 0);
+        recording.SetRecorder(nullptr);
+        controller.SetTraceRecorder(nullptr);
+        controller.Stop();
+    }
+
+    void Register(const std::vector<HWND>& hwnds, int32_t layer)
+    {
+        desktop.Register(hwnds, layer);
+        if (recorder)
+        {
+            WindowRegistry registered;
+            for (HWND hwnd : hwnds)
+            {
+                registered.Insert(*desktop.windows.GetForWriter().Find(hwnd));
+            }
+            RecordRegistrations(registered);
+        }
+    }
+
+    void Refresh(bool full)
+    {
+        uint32_t message = full ? TRACE_MESSAGE_REFRESH : TRACE_MESSAGE_LAYERS;
+        recorder->Record(TRACE_MESSAGE, message);
+        controller.RequestRefresh(full);
+    }
+
+    bool WaitForState(bool showDesktop)
+    {
+        for (int elapsed = 0; elapsed <= 20000; ++elapsed)
+        {
+            if (controller.IsShowingDesktop() == showDesktop)
+                return true;
+            desktop.windowSystem.Advance(1);
+        }
+        return false;
+    }
+
+    void RecordRegistrations(const WindowRegistry& registry)
+    {
+        std::vector<TraceRegistration> registrations;
+        for (const WindowInfo& info : registry)
+        {
+            uint32_t flags = (info.isVisible ? TRACE_WINDOW_VISIBLE : 0) | (info.isMinimized ? TRACE_WINDOW_MINIMIZED : 0);
+            TraceRegistration registration = { TraceHandle(info.hwnd), info.layer, info.processId, flags, 0 };
+            registrations.push_back(registration);
+        }
+        recorder->Record(TRACE_REGISTER, registrations.data(), registrations.size() * sizeof(TraceRegistration));
+    }
+
+    SimulatedDesktop desktop;
+    RecordingWindowSystem recording;
+    DesktopController controller;
+    TraceRecorder* recorder;
+};
+
+// Records Show Desktop and restores, refreshes and registrations in three layers
+static bool RecordSession(const char* path, uint32_t& stateChanges)
+{
+    RecordedDesktop session;
+    session.Register(session.desktop.CreateWidgets(3), 0);
+    session.Register(session.desktop.CreateWidgets(2), 1);
+
+    TraceRecorder recorder;
+    if (!recorder.Open(std::fopen(path, "wb")))
+        return false;
+
+    stateChanges = 0;
+    session.controller.SetStateChangedHandler([&](bool, uint64_t) { ++stateChanges; });
+    session.Start(recorder);
+    session.Refresh(true);
+    session.desktop.windowSystem.Advance(1000);
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        session.desktop.windowSystem.ShowDesktop();
+        if (!session.WaitForState(true))
+            return false;
+        session.desktop.windowSystem.Advance(500);
+
+        // A window registered while the desktop is shown joins the others
+        if (i == 1)
+        {
+            session.Register(session.desktop.CreateWidgets(1), 2);
+            session.Refresh(false);
+            session.desktop.windowSystem.Advance(100);
+        }
+
+        session.desktop.windowSystem.RestoreWindows(session.desktop.apps[i % session.desktop.apps.size()]);
+        if (!session.WaitForState(false))
+            return false;
+        session.desktop.windowSystem.Advance(1500);
+    }
+    if (!session.desktop.IsInPlace())
+        return false;
+
+    session.Stop();
+    recorder.Close();
+    return recorder.GetDroppedCount() == 0;
+}
+
+static std::vector<char> ReadFile(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(const char* path, const std::vector<char>& data)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+}
+
+TEST(RecordedSessionReplaysWithoutDivergence)
+{
+    uint32_t stateChanges = 0;
+    REQUIRE(RecordSession(TRACE_PATH, stateChanges));
+    REQUIRE(stateChanges == 8);
+
+    TraceReader trace;
+    REQUIRE(trace.Load(TRACE_PATH));
+    CHECK(!trace.IsTruncated());
+    CHECK(trace.GetLostCount() == 0);
+
+    TraceReplayer::Report report;
+    TraceReplayer::Run(trace, false, report);
+    CHECK(report.divergences == 0);
+    CHECK(report.notes.empty());
+    CHECK(report.inputs > 8);
+    CHECK(report.moves > 0);
+
+    // The replay takes the decisions the session took, at the same inputs
+    REQUIRE(report.recorded.size() == stateChanges);
+    REQUIRE(report.replayed.size() == report.recorded.size());
+    for (size_t i = 0; i < report.recorded.size(); ++i)
+    {
+        CHECK(report.replayed[i].showDesktop == report.recorded[i].showDesktop);
+        CHECK(report.replayed[i].showDesktop == (i % 2 == 0));
+        CHECK(report.replayed[i].timeUs == report.recorded[i].timeUs);
+        CHECK(report.replayed[i].detectionLatencyMs == report.recorded[i].detectionLatencyMs);
+    }
+    std::remove(TRACE_PATH);
+}
+
+TEST(TruncatedTracesAreRefused)
+{
+    uint32_t stateChanges = 0;
+    REQUIRE(RecordSession(TRACE_PATH, stateChanges));
+    std::vector<char> data = ReadFile(TRACE_PATH);
+    REQUIRE(data.size() > sizeof(TraceFileHeader) + sizeof(TraceRecordHeader));
+
+    // Cut in the middle of the last record
+    data.resize(data.size() - 3);
+    WriteFile(TRACE_PATH, data);
+    TraceReader trace;
+    CHECK(!trace.Load(TRACE_PATH));
+    CHECK(trace.GetRecords().empty());
+    CHECK(std::strcmp(trace.GetError(), "ends in the middle of a record") == 0);
+
+    // What a crash left behind can still be read up to the cut
+    CHECK(trace.Load(TRACE_PATH, true));
+    CHECK(trace.IsTruncated());
+    CHECK(!trace.GetRecords().empty());
+
+    // Shorter than the file header
+    data.resize(sizeof(TraceFileHeader) - 1);
+    WriteFile(TRACE_PATH, data);
+    CHECK(!trace.Load(TRACE_PATH, true));
+    std::remove(TRACE_PATH);
+    CHECK(!trace.Load(TRACE_PATH));
+}
+
+TEST(CorruptedTracesAreRefused)
+{
+    uint32_t stateChanges = 0;
+    REQUIRE(RecordSession(TRACE_PATH, stateChanges));
+    const std::vector<char> recorded = ReadFile(TRACE_PATH);
+    const size_t first = sizeof(TraceFileHeader);
+    REQUIRE(recorded.size() > first + sizeof(TraceRecordHeader));
+
+    TraceReader trace;
+    std::vector<char> data = recorded;
+    data[0] = 'X';
+    WriteFile(TRACE_PATH, data);
+    CHECK(!trace.Load(TRACE_PATH));
+
+    // Another version
+    data = recorded;
+    data[4] = static_cast<char>(TRACE_VERSION + 1);
+    WriteFile(TRACE_PATH, data);
+    CHECK(!trace.Load(TRACE_PATH));
+
+    // A record type that does not exist
+    data = recorded;
+    data[first + offsetof(TraceRecordHeader, type)] = static_cast<char>(TRACE_RECORD_TYPE_COUNT);
+    WriteFile(TRACE_PATH, data);
+    CHECK(!trace.Load(TRACE_PATH, true));
+    CHECK(std::strcmp(trace.GetError(), "holds a corrupted record") == 0);
+    CHECK(trace.GetRecords().empty());
+
+    // A payload size that does not fit the type, even with truncation allowed
+    data = recorded;
+    data[first + offsetof(TraceRecordHeader, size)] += 4;
+    WriteFile(TRACE_PATH, data);
+    CHECK(!trace.Load(TRACE_PATH, true));
+
+    // Garbage in the reserved bytes
+    data = recorded;
+    data[first + offsetof(TraceRecordHeader, reserved)] = 1;
+    WriteFile(TRACE_PATH, data);
+    CHECK(!trace.Load(TRACE_PATH, true));
+
+    // The untouched trace loads
+    WriteFile(TRACE_PATH, recorded);
+    CHECK(trace.Load(TRACE_PATH));
+    std::remove(TRACE_PATH);
+}
+
+TEST(RecordsDroppedWhileTheWriterIsBehindAreReported)
+{
+    // Two buffers of a few records each, filled faster than they are written
+    TraceRecorder recorder(256);
+    REQUIRE(recorder.Open(std::fopen(TRACE_PATH, "wb")));
+    uint64_t timer = 0;
+    for (int i = 0; i < 1000000 && recorder.GetDroppedCount() == 0; ++i)
+    {
+        recorder.Record(TRACE_TIMER, ++timer);
+    }
+    const uint64_t dropped = recorder.GetDroppedCount();
+    REQUIRE(dropped > 0);
+
+    // Once the writer caught up, the next record says how many went missing
+    while (recorder.GetWrittenBytes() == 0)
+    {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const uint64_t recorded = recorder.GetRecordCount();
+    recorder.Record(TRACE_TIMER, ++timer);
+    const bool droppedAgain = recorder.GetDroppedCount() != dropped;
+    recorder.Close();
+
+    TraceReader trace;
+    REQUIRE(trace.Load(TRACE_PATH));
+    CHECK(trace.GetLostCount() == recorder.GetDroppedCount());
+    CHECK(trace.GetRecords().size() == recorder.GetRecordCount());
+    CHECK(droppedAgain || recorder.GetRecordCount() == recorded + 1);
+
+    // The marker sits where the records went missing, before the next one kept
+    std::vector<char> data = ReadFile(TRACE_PATH);
+    size_t offset = sizeof(TraceFileHeader);
+    uint64_t previous = 0;
+    bool gapMarked = true;
+    bool marked = false;
+    while (offset + sizeof(TraceRecordHeader) <= data.size())
+    {
+        TraceRecordHeader header;
+        std::memcpy(&header, &data[offset], sizeof(header));
+        offset += sizeof(header);
+        uint64_t value = 0;
+        std::memcpy(&value, &data[offset], sizeof(value));
+        offset += header.size;
+
+        if (header.type == TRACE_LOST)
+        {
+            marked = true;
+            previous += value;
+            continue;
+        }
+        gapMarked = gapMarked && value == previous + 1;
+        previous = value;
+    }
+    CHECK(marked);
+    CHECK(gapMarked);
+    std::remove(TRACE_PATH);
+}
@@ -0,0 +1,232 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+typedef TriggerRecognizer::Trigger Trigger;
+
+static InputEvent Key(bool down, uint32_t key)
+{
+    InputEvent event = { down ? InputEvent::KEY_DOWN : InputEvent::KEY_UP, key, 0, 0 };
+    return event;
+}
+
+static InputEvent Pointer(InputEvent::Type type, int32_t x, int32_t y, uint32_t button = INPUT_BUTTON_LEFT)
+{
+    InputEvent event = { type, button, x, y };
+    return event;
+}
+
+// Presses and releases key, returning what the press completed
+static Trigger Press(TriggerRecognizer& recognizer, uint32_t key)
+{
+    Trigger trigger = recognizer.OnInput(Key(true, key));
+    recognizer.OnInput(Key(false, key));
+    return trigger;
+}
+
+static const InputRect BUTTON_AREA = { 1900, 1040, 1920, 1080 };
+
+TEST(WinKeyCombinationsAreTriggers)
+{
+    TriggerRecognizer recognizer;
+    recognizer.OnInput(Key(true, INPUT_KEY_LWIN));
+    CHECK(Press(recognizer, INPUT_KEY_D) == Trigger::ShowDesktopKey);
+    CHECK(Press(recognizer, INPUT_KEY_M) == Trigger::MinimizeKey);
+    CHECK(Press(recognizer, INPUT_KEY_COMMA) == Trigger::PeekKey);
+
+    // Either shift key, reported with or without the generic one
+    recognizer.OnInput(Key(true, INPUT_KEY_RSHIFT));
+    recognizer.OnInput(Key(true, INPUT_KEY_SHIFT));
+    recognizer.OnInput(Key(false, INPUT_KEY_SHIFT));
+    CHECK(Press(recognizer, INPUT_KEY_M) == Trigger::RestoreKey);
+    recognizer.OnInput(Key(false, INPUT_KEY_RSHIFT));
+    CHECK(Press(recognizer, INPUT_KEY_M) == Trigger::MinimizeKey);
+    recognizer.OnInput(Key(false, INPUT_KEY_LWIN));
+
+    recognizer.OnInput(Key(true, INPUT_KEY_RWIN));
+    CHECK(Press(recognizer, INPUT_KEY_D) == Trigger::ShowDesktopKey);
+    CHECK(recognizer.GetTriggerCount() == 6);
+}
+
+TEST(OtherKeysAreNotTriggers)
+{
+    TriggerRecognizer recognizer;
+
+    // Typing without the Windows key
+    CHECK(Press(recognizer, INPUT_KEY_D) == Trigger::None);
+    recognizer.OnInput(Key(true, INPUT_KEY_SHIFT));
+    CHECK(Press(recognizer, INPUT_KEY_M) == Trigger::None);
+    recognizer.OnInput(Key(false, INPUT_KEY_SHIFT));
+
+    // Other Windows key combinations, and the Windows key released first
+    recognizer.OnInput(Key(true, INPUT_KEY_LWIN));
+    CHECK(Press(recognizer, 'E') == Trigger::None);
+    CHECK(Press(recognizer, INPUT_KEY_LSHIFT) == Trigger::None);
+    recognizer.OnInput(Key(false, INPUT_KEY_LWIN));
+    CHECK(Press(recognizer, INPUT_KEY_D) == Trigger::None);
+
+    // D held down before the Windows key, then repeating
+    recognizer.OnInput(Key(true, INPUT_KEY_D));
+    recognizer.OnInput(Key(true, INPUT_KEY_RWIN));
+    CHECK(recognizer.OnInput(Key(true, INPUT_KEY_D)) == Trigger::ShowDesktopKey);
+    CHECK(recognizer.GetTriggerCount() == 1);
+}
+
+TEST(HeldKeysTriggerOnce)
+{
+    TriggerRecognizer recognizer;
+    recognizer.OnInput(Key(true, INPUT_KEY_LWIN));
+    CHECK(recognizer.OnInput(Key(true, INPUT_KEY_D)) == Trigger::ShowDesktopKey);
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK(recognizer.OnInput(Key(true, INPUT_KEY_D)) == Trigger::None);
+    }
+    CHECK(recognizer.OnInput(Key(false, INPUT_KEY_D)) == Trigger::None);
+    CHECK(recognizer.OnInput(Key(true, INPUT_KEY_D)) == Trigger::ShowDesktopKey);
+
+    // Pressing the other Windows key as well is not a new combination
+    CHECK(recognizer.OnInput(Key(true, INPUT_KEY_RWIN)) == Trigger::None);
+    CHECK(recognizer.OnInput(Key(true, INPUT_KEY_D)) == Trigger::None);
+
+    // Releases that were never seen are forgotten on reset
+    recognizer.Reset();
+    CHECK(!recognizer.IsWinDown());
+    CHECK(recognizer.OnInput(Key(true, INPUT_KEY_D)) == Trigger::None);
+}
+
+TEST(ButtonClicksAndHoverAreTriggers)
+{
+    TriggerRecognizer recognizer;
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_DOWN, 1910, 1050)) == Trigger::None);
+
+    recognizer.SetButtonArea(BUTTON_AREA);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_MOVE, 10, 10)) == Trigger::None);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_MOVE, 1910, 1050)) == Trigger::PeekHover);
+
+    // Moving around on the button is not entering it again
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_MOVE, 1911, 1051)) == Trigger::None);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_DOWN, 1911, 1051)) == Trigger::ShowDesktopButton);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_UP, 1911, 1051)) == Trigger::None);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_DOWN, 1911, 1051, 0x02)) == Trigger::None);
+
+    // The right edge is outside, leaving and coming back is a new hover
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_MOVE, 1920, 1050)) == Trigger::None);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_MOVE, 1919, 1079)) == Trigger::PeekHover);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_DOWN, 100, 1050)) == Trigger::None);
+
+    // An empty area is no area
+    InputRect empty = { 10, 10, 10, 20 };
+    recognizer.SetButtonArea(empty);
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_DOWN, 10, 15)) == Trigger::None);
+    recognizer.SetButtonArea(BUTTON_AREA);
+    recognizer.ClearButtonArea();
+    CHECK(recognizer.OnInput(Pointer(InputEvent::POINTER_MOVE, 1910, 1050)) == Trigger::None);
+}
+
+TEST(PredictionFollowsTheState)
+{
+    CHECK(TriggerRecognizer::PredictsDesktop(Trigger::ShowDesktopKey, false));
+    CHECK(!TriggerRecognizer::PredictsDesktop(Trigger::ShowDesktopKey, true));
+    CHECK(!TriggerRecognizer::PredictsDesktop(Trigger::ShowDesktopButton, true));
+    CHECK(TriggerRecognizer::PredictsDesktop(Trigger::MinimizeKey, true));
+    CHECK(TriggerRecognizer::PredictsDesktop(Trigger::PeekHover, false));
+    CHECK(!TriggerRecognizer::PredictsDesktop(Trigger::RestoreKey, true));
+    CHECK(!TriggerRecognizer::PredictsDesktop(Trigger::None, false));
+}
+
+static void PressWinD(SimulatedDesktop& desktop)
+{
+    desktop.controller.OnInput(Key(true, INPUT_KEY_LWIN));
+    desktop.controller.OnInput(Key(true, INPUT_KEY_D));
+    desktop.controller.OnInput(Key(false, INPUT_KEY_D));
+    desktop.controller.OnInput(Key(false, INPUT_KEY_LWIN));
+}
+
+TEST(TriggerCatchesTransitionWithoutEvents)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    desktop.windowSystem.Advance(20000);
+    const ShowDesktopDetector::Config& config = desktop.controller.GetDetector().GetConfig();
+
+    PressWinD(desktop);
+    CHECK(desktop.controller.GetDetector().IsTriggered());
+    CHECK(desktop.controller.GetProbeIntervalMs() == config.triggerIntervalMs);
+
+    // The shell acts a little later and its events are lost
+    desktop.windowSystem.Advance(30);
+    desktop.windowSystem.SetDropEvents(true);
+    desktop.windowSystem.ShowDesktop();
+    uint64_t latency = desktop.WaitForState(true);
+    CHECK(latency <= config.triggerIntervalMs);
+    CHECK(desktop.controller.GetDetector().GetTriggerHitCount() == 1);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(TriggerWithoutTransitionEndsItsRun)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    desktop.windowSystem.Advance(20000);
+    const ShowDesktopDetector::Config& config = desktop.controller.GetDetector().GetConfig();
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+
+    // Win+D in an application that swallows it
+    PressWinD(desktop);
+    desktop.windowSystem.Advance(config.triggerIntervalMs * (config.triggerProbes + 1));
+    CHECK(!desktop.controller.GetDetector().IsTriggered());
+    CHECK(desktop.controller.GetDetector().GetTriggerMissCount() == 1);
+    CHECK(desktop.controller.GetDetector().GetTriggerMissProbeCount() == config.triggerProbes);
+    CHECK(desktop.controller.GetProbeIntervalMs() >= config.fallbackIntervalMs);
+    CHECK(!desktop.controller.IsShowingDesktop());
+
+    // Whatever was raised ahead of time went back where it belongs
+    CHECK(desktop.windowSystem.GetMoveCount() - moves <= 2);
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(ClicksOutsideTheButtonAreIgnored)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    desktop.controller.SetTriggerArea(BUTTON_AREA);
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+
+    for (int i = 0; i < 100; ++i)
+    {
+        desktop.controller.OnInput(Pointer(InputEvent::POINTER_DOWN, i * 10, 500));
+        desktop.controller.OnInput(Pointer(InputEvent::POINTER_UP, i * 10, 500));
+    }
+    CHECK(!desktop.controller.GetDetector().IsTriggered());
+    CHECK(desktop.controller.GetDetector().GetTriggerCount() == 0);
+
+    // The helper was not placed for a Show Desktop that is not coming
+    CHECK(desktop.windowSystem.GetMoveCount() == moves);
+    CHECK(!desktop.controller.IsShowingDesktop());
+    CHECK(desktop.IsInPlace());
+
+    desktop.controller.OnInput(Pointer(InputEvent::POINTER_DOWN, 1910, 1050));
+    CHECK(desktop.controller.GetDetector().IsTriggered());
+}
+
+TEST(TriggersAreIgnoredWithoutRegisteredWindows)
+{
+    SimulatedDesktop desktop;
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+    const uint64_t wakeups = desktop.controller.GetWakeupCount();
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    const std::vector<HWND> stack = desktop.windowSystem.GetStack();
+
+    PressWinD(desktop);
+    desktop.windowSystem.Advance(1000);
+    CHECK(!desktop.controller.GetDetector().IsTriggered());
+    CHECK(desktop.controller.GetWakeupCount() == wakeups);
+
+    // Nothing is placed ahead of a transition there is nothing to place for
+    CHECK(desktop.windowSystem.GetMoveCount() == moves);
+    CHECK(desktop.windowSystem.GetStack() == stack);
+}
@@ -0,0 +1,194 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+// Counts what the cache asks the window system
+class CountingWindowSystem : public SimulatedWindowSystem
+{
+public:
+    CountingWindowSystem() : queries(0) {}
+
+    int GetWindowClass(HWND hwnd, wchar_t* className, int size) override
+    {
+        ++queries;
+        return SimulatedWindowSystem::GetWindowClass(hwnd, className, size);
+    }
+
+    uint32_t GetWindowProcessId(HWND hwnd) override
+    {
+        ++queries;
+        return SimulatedWindowSystem::GetWindowProcessId(hwnd);
+    }
+
+    bool IsWindowVisible(HWND hwnd) override
+    {
+        ++queries;
+        return SimulatedWindowSystem::IsWindowVisible(hwnd);
+    }
+
+    bool IsTopmost(HWND hwnd) override
+    {
+        ++queries;
+        return SimulatedWindowSystem::IsTopmost(hwnd);
+    }
+
+    uint64_t queries;
+};
+
+TEST(StableFactsAreAskedForOnce)
+{
+    CountingWindowSystem windowSystem;
+    windowSystem.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, false);
+    HWND app = windowSystem.CreateWindow(L"Application", L"", 100);
+    WindowMetadataCache metadata(16);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK(metadata.GetClassAtom(windowSystem, windowSystem.GetShellWindow()) == CLASS_ATOM_PROGMAN);
+        CHECK(metadata.GetClassAtom(windowSystem, windowSystem.GetDesktopIconsHost()) == CLASS_ATOM_WORKERW);
+        CHECK(metadata.GetProcessId(windowSystem, app) == 100);
+    }
+    CHECK(windowSystem.queries == 3);
+    CHECK(metadata.GetMissCount() == 3);
+    CHECK(metadata.GetHitCount() == 27);
+    CHECK(metadata.GetSize() == 3);
+
+    // Other classes get atoms of their own, the same for the same name
+    HWND other = windowSystem.CreateWindow(L"Application", L"", 101);
+    const ClassAtom atom = metadata.GetClassAtom(windowSystem, app);
+    CHECK(atom > CLASS_ATOM_DEFVIEW);
+    CHECK(metadata.GetClassAtom(windowSystem, other) == atom);
+}
+
+TEST(UnknownWindowsAreNotRemembered)
+{
+    CountingWindowSystem windowSystem;
+    WindowMetadataCache metadata(16);
+    HWND gone = reinterpret_cast<HWND>(static_cast<uintptr_t>(0x4000));
+    CHECK(metadata.GetClassAtom(windowSystem, gone) == CLASS_ATOM_NONE);
+    CHECK(metadata.GetProcessId(windowSystem, gone) == 0);
+    CHECK(metadata.GetClassAtom(windowSystem, gone) == CLASS_ATOM_NONE);
+    CHECK(windowSystem.queries == 3);
+    CHECK(metadata.GetSize() == 0);
+}
+
+TEST(ClassesBeyondTheLimitShareOneAtom)
+{
+    SimulatedWindowSystem windowSystem;
+    WindowMetadataCache metadata(1024);
+    std::vector<ClassAtom> atoms;
+    for (int i = 0; i < 100; ++i)
+    {
+        std::wstring name = L"Class" + std::to_wstring(i);
+        atoms.push_back(metadata.GetClassAtom(windowSystem, windowSystem.CreateWindow(name.c_str(), L"", 100)));
+    }
+    CHECK(atoms[0] != atoms[1]);
+    CHECK(atoms.back() == CLASS_ATOM_OTHER);
+
+    // The shell classes keep theirs
+    windowSystem.CreateShell(SimulatedDesktop::SHELL_PROCESS_ID, false);
+    CHECK(metadata.GetClassAtom(windowSystem, windowSystem.GetShellWindow()) == CLASS_ATOM_PROGMAN);
+}
+
+TEST(VisibilityIsForgottenOnEvents)
+{
+    CountingWindowSystem windowSystem;
+    HWND app = windowSystem.CreateWindow(L"Application", L"", 100);
+    WindowMetadataCache metadata(16);
+    CHECK(metadata.IsVisible(windowSystem, app));
+
+    // Without an event the cached answer stands
+    windowSystem.SetVisible(app, false);
+    CHECK(metadata.IsVisible(windowSystem, app));
+    metadata.OnWindowEvent(WINDOW_EVENT_HIDE, app);
+    CHECK(!metadata.IsVisible(windowSystem, app));
+
+    windowSystem.SetVisible(app, true);
+    metadata.ExpireVolatile();
+    CHECK(metadata.IsVisible(windowSystem, app));
+
+    windowSystem.SetMinimized(app, true);
+    windowSystem.SetVisible(app, false);
+    metadata.OnWindowEvent(WINDOW_EVENT_MINIMIZESTART, app);
+    CHECK(!metadata.IsVisible(windowSystem, app));
+    CHECK(windowSystem.queries == 4);
+}
+
+TEST(TopmostIsForgottenOnReorder)
+{
+    SimulatedWindowSystem windowSystem;
+    HWND app = windowSystem.CreateWindow(L"Application", L"", 100);
+    HWND other = windowSystem.CreateWindow(L"Application", L"", 101);
+    WindowMetadataCache metadata(16);
+    CHECK(!metadata.IsTopmost(windowSystem, app));
+    CHECK(metadata.GetProcessId(windowSystem, app) == 100);
+
+    windowSystem.SetTopmost(app, true);
+    CHECK(!metadata.IsTopmost(windowSystem, app));
+
+    // Any window changing places may have changed the band of others
+    metadata.OnWindowEvent(WINDOW_EVENT_REORDER, other);
+    CHECK(metadata.IsTopmost(windowSystem, app));
+    const uint64_t misses = metadata.GetMissCount();
+    CHECK(metadata.GetProcessId(windowSystem, app) == 100);
+    CHECK(metadata.GetMissCount() == misses);
+}
+
+TEST(DestroyedWindowsAreForgotten)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.SetReuseHandles(true);
+    HWND app = windowSystem.CreateWindow(L"Application", L"", 100);
+    WindowMetadataCache metadata(16);
+    CHECK(metadata.GetProcessId(windowSystem, app) == 100);
+
+    windowSystem.DestroyWindow(app);
+    metadata.OnWindowEvent(WINDOW_EVENT_DESTROY, app);
+    HWND reused = windowSystem.CreateWindow(L"Application", L"", 200);
+    REQUIRE(reused == app);
+    CHECK(metadata.GetProcessId(windowSystem, reused) == 200);
+    CHECK(metadata.GetSize() == 1);
+}
+
+TEST(FullCacheStartsOver)
+{
+    SimulatedWindowSystem windowSystem;
+    WindowMetadataCache metadata(4);
+    std::vector<HWND> windows;
+    for (int i = 0; i < 4; ++i)
+    {
+        windows.push_back(windowSystem.CreateWindow(L"Application", L"", 100 + i));
+        metadata.GetProcessId(windowSystem, windows.back());
+    }
+    CHECK(metadata.GetSize() == 4);
+
+    // Known windows do not count against the limit
+    metadata.IsVisible(windowSystem, windows[0]);
+    CHECK(metadata.GetSize() == 4);
+
+    metadata.GetProcessId(windowSystem, windowSystem.CreateWindow(L"Application", L"", 200));
+    CHECK(metadata.GetSize() == 1);
+    metadata.Clear();
+    CHECK(metadata.GetSize() == 0);
+}
+
+TEST(ProbesMostlyHitTheCache)
+{
+    SimulatedDesktop desktop;
+    desktop.Register();
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+
+    for (size_t i = 0; i < 20; ++i)
+    {
+        desktop.windowSystem.ShowDesktop();
+        REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(500);
+        desktop.windowSystem.RestoreWindows(desktop.apps[i % desktop.apps.size()]);
+        REQUIRE(desktop.WaitForState(false) != SimulatedDesktop::NOT_DETECTED);
+        desktop.windowSystem.Advance(2000);
+    }
+
+    const WindowMetadataCache& metadata = desktop.controller.GetMetadata();
+    CHECK(metadata.GetHitCount() > metadata.GetMissCount() * 2);
+    CHECK(metadata.GetSize() <= METADATA_CACHE_SIZE);
+}
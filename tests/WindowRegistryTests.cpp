@@ -0,0 +1,160 @@
+#include "Test.h"
+#include "WindowRegistry.h"
+#include <map>
+#include <random>
+
+static HWND Handle(uintptr_t value)
+{
+    return reinterpret_cast<HWND>(value * 4);
+}
+
+static WindowInfo Info(HWND hwnd, bool visible = true, int32_t layer = 0)
+{
+    WindowInfo info = { hwnd, visible, false, nullptr, layer, 1, 0 };
+    return info;
+}
+
+TEST(InsertFindErase)
+{
+    WindowRegistry registry;
+    CHECK(registry.IsEmpty());
+    CHECK(registry.Find(Handle(1)) == nullptr);
+
+    CHECK(registry.Insert(Info(Handle(1))));
+    CHECK(registry.Insert(Info(Handle(2), false)));
+    CHECK(registry.GetSize() == 2);
+    CHECK(registry.GetPositionedCount() == 1);
+    CHECK(registry.Contains(Handle(2)));
+    CHECK(!registry.Contains(Handle(3)));
+
+    CHECK(registry.Erase(Handle(1)));
+    CHECK(!registry.Erase(Handle(1)));
+    CHECK(!registry.Contains(Handle(1)));
+    CHECK(registry.Find(Handle(2)) != nullptr);
+    CHECK(registry.GetPositionedCount() == 0);
+}
+
+TEST(ReplaceKeepsGeneration)
+{
+    WindowRegistry registry;
+    registry.Insert(Info(Handle(1)));
+    uint32_t generation = registry.Find(Handle(1))->generation;
+
+    CHECK(!registry.Insert(Info(Handle(1), false, 3)));
+    CHECK(registry.GetSize() == 1);
+    CHECK(registry.Find(Handle(1))->generation == generation);
+    CHECK(registry.Find(Handle(1))->layer == 3);
+    CHECK(registry.GetPositionedCount() == 0);
+
+    // Registering again after removal is a new registration
+    registry.Erase(Handle(1));
+    registry.Insert(Info(Handle(1)));
+    CHECK(registry.Find(Handle(1))->generation != generation);
+}
+
+TEST(ChangesOfOldRegistrationsAreIgnored)
+{
+    WindowRegistry registry;
+    registry.Insert(Info(Handle(1)));
+    WindowLifecycle change = { Handle(1), registry.Find(Handle(1))->generation, false, false, false };
+
+    registry.Erase(Handle(1));
+    registry.Insert(Info(Handle(1)));
+    CHECK(!registry.Apply(change));
+    CHECK(registry.Find(Handle(1))->isVisible);
+
+    change.generation = registry.Find(Handle(1))->generation;
+    CHECK(registry.Apply(change));
+    CHECK(!registry.Find(Handle(1))->isVisible);
+    CHECK(registry.GetPositionedCount() == 0);
+
+    change.destroyed = true;
+    CHECK(registry.Apply(change));
+    CHECK(registry.IsEmpty());
+}
+
+TEST(EraseKeepsClustersReachable)
+{
+    // At a load factor of one half, runs of occupied slots are common. Erasing
+    // from them shifts the rest back, which must leave every window findable.
+    WindowRegistry registry;
+    std::vector<HWND> handles;
+    for (uintptr_t i = 1; i <= 1000; ++i)
+    {
+        handles.push_back(Handle(i));
+        registry.Insert(Info(handles.back()));
+    }
+
+    for (size_t i = 0; i < handles.size(); i += 2)
+    {
+        CHECK(registry.Erase(handles[i]));
+    }
+    for (size_t i = 0; i < handles.size(); ++i)
+    {
+        CHECK(registry.Contains(handles[i]) == (i % 2 == 1));
+        CHECK(!registry.Contains(handles[i]) || registry.Find(handles[i])->hwnd == handles[i]);
+    }
+    CHECK(registry.GetSize() == 500);
+}
+
+TEST(MatchesMapUnderRandomOperations)
+{
+    std::mt19937 random(99);
+    WindowRegistry registry;
+    std::map<HWND, WindowInfo> expected;
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        HWND hwnd = Handle(1 + random() % 500);
+        switch (random() % 3)
+        {
+        case 0:
+        case 1:
+            {
+                WindowInfo info = Info(hwnd, random() % 4 != 0, static_cast<int32_t>(random() % 5));
+                CHECK(registry.Insert(info) == (expected.count(hwnd) == 0));
+                expected[hwnd] = info;
+                break;
+            }
+        default:
+            CHECK(registry.Erase(hwnd) == (expected.erase(hwnd) == 1));
+            break;
+        }
+    }
+
+    REQUIRE(registry.GetSize() == expected.size());
+    size_t positioned = 0;
+    for (const std::pair<const HWND, WindowInfo>& entry : expected)
+    {
+        const WindowInfo* info = registry.Find(entry.first);
+        REQUIRE(info != nullptr);
+        CHECK(info->layer == entry.second.layer);
+        CHECK(info->isVisible == entry.second.isVisible);
+        positioned += IsPositioned(entry.second) ? 1 : 0;
+    }
+    CHECK(registry.GetPositionedCount() == positioned);
+
+    // Iteration visits every window once
+    size_t visited = 0;
+    for (const WindowInfo& info : registry)
+    {
+        visited += expected.count(info.hwnd);
+    }
+    CHECK(visited == expected.size());
+}
+
+TEST(ClearEmptiesTheTable)
+{
+    WindowRegistry registry;
+    for (uintptr_t i = 1; i <= 100; ++i)
+    {
+        registry.Insert(Info(Handle(i)));
+    }
+    registry.Clear();
+    CHECK(registry.IsEmpty());
+    CHECK(registry.GetPositionedCount() == 0);
+    CHECK(!registry.Contains(Handle(5)));
+
+    CHECK(registry.Insert(Info(Handle(5))));
+    CHECK(registry.Contains(Handle(5)));
+}
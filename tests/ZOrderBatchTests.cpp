@@ -0,0 +1,84 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+
+TEST(CommitsMovesInOrder)
+{
+    SimulatedWindowSystem windowSystem;
+    HWND a = windowSystem.CreateWindow(L"A", L"", 2);
+    HWND b = windowSystem.CreateWindow(L"B", L"", 2);
+    HWND c = windowSystem.CreateWindow(L"C", L"", 2);
+
+    // A move may refer to a window placed by an earlier move of the batch
+    ZOrderBatch batch;
+    batch.PlaceAtBottom(c);
+    batch.PlaceAfter(a, c);
+    batch.PlaceAfter(b, c);
+    CHECK(batch.GetSize() == 3);
+    batch.Commit(windowSystem);
+
+    CHECK(batch.IsEmpty());
+    CHECK(batch.GetCommitCount() == 1);
+    CHECK(batch.GetFallbackCount() == 0);
+    CHECK(windowSystem.GetCommitCount() == 1);
+    CHECK(windowSystem.GetStack() == std::vector<HWND>({ c, b, a }));
+}
+
+TEST(FallsBackToSingleMoves)
+{
+    SimulatedWindowSystem windowSystem;
+    HWND a = windowSystem.CreateWindow(L"A", L"", 2);
+    HWND b = windowSystem.CreateWindow(L"B", L"", 2);
+    windowSystem.SetRejectBatches(true);
+
+    ZOrderBatch batch;
+    batch.PlaceAtBottom(b);
+    batch.PlaceAfter(a, b);
+    batch.Commit(windowSystem);
+
+    CHECK(batch.GetFallbackCount() == 1);
+    CHECK(windowSystem.GetMoveCount() == 2);
+    CHECK(windowSystem.GetStack() == std::vector<HWND>({ b, a }));
+}
+
+TEST(EmptyBatchCommitsNothing)
+{
+    SimulatedWindowSystem windowSystem;
+    ZOrderBatch batch;
+    batch.Commit(windowSystem);
+    CHECK(batch.GetCommitCount() == 0);
+    CHECK(windowSystem.GetCommitCount() == 0);
+}
+
+TEST(PassCommitsOneBatch)
+{
+    SimulatedDesktop desktop;
+    for (int i = 0; i < 8; ++i)
+    {
+        desktop.Register();
+    }
+    desktop.controller.Start(desktop.systemWindow, desktop.helperWindow);
+
+    const uint64_t commits = desktop.windowSystem.GetCommitCount();
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    desktop.controller.PositionWindows();
+    CHECK(desktop.windowSystem.GetCommitCount() == commits + 1);
+    CHECK(desktop.windowSystem.GetMoveCount() - moves == 8);
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(PassFallsBackWhenBatchIsRejected)
+{
+    SimulatedDesktop desktop;
+    for (int i = 0; i < 4; ++i)
+    {
+        desktop.Register();
+    }
+    desktop.windowSystem.SetRejectBatches(true);
+    desktop.Start();
+    CHECK(desktop.IsInPlace());
+
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    desktop.NextFrame();
+    CHECK(desktop.IsInPlace());
+}
@@ -0,0 +1,257 @@
+#include "Test.h"
+#include "SimulatedDesktop.h"
+#include <random>
+
+static HWND Handle(uintptr_t value)
+{
+    return reinterpret_cast<HWND>(value * 4);
+}
+
+static void Insert(WindowRegistry& registry, HWND hwnd, int32_t layer, bool visible = true)
+{
+    WindowInfo info = { hwnd, visible, false, nullptr, layer, 1, 0 };
+    registry.Insert(info);
+}
+
+static ZOrderPlanner::PlacedWindow Placed(HWND hwnd, int32_t layer)
+{
+    ZOrderPlanner::PlacedWindow window;
+    window.hwnd = hwnd;
+    window.layer = layer;
+    return window;
+}
+
+TEST(OnlyChangedLayersAreDirty)
+{
+    ZOrderLayers layers;
+    CHECK(!layers.IsValid(nullptr));
+
+    std::vector<ZOrderPlanner::PlacedWindow> block;
+    block.push_back(Placed(Handle(1), 2));
+    block.push_back(Placed(Handle(2), 1));
+    block.push_back(Placed(Handle(3), 1));
+    block.push_back(Placed(Handle(4), 0));
+    layers.Store(Handle(9), block);
+    CHECK(layers.IsValid(Handle(9)));
+    CHECK(!layers.IsValid(nullptr));
+
+    // Registration order within a layer does not matter
+    WindowRegistry registry;
+    Insert(registry, Handle(4), 0);
+    Insert(registry, Handle(3), 1);
+    Insert(registry, Handle(2), 1);
+    Insert(registry, Handle(1), 2);
+    ZOrderLayers::Registered registered;
+    registered.Read(registry);
+    std::vector<int32_t> dirty;
+    layers.GetDirtyLayers(registered, dirty);
+    CHECK(dirty.empty());
+
+    // A window moving between layers dirties both, a new layer and a hidden window too
+    registry.Erase(Handle(2));
+    Insert(registry, Handle(2), 0);
+    Insert(registry, Handle(5), -1);
+    registry.Erase(Handle(1));
+    Insert(registry, Handle(1), 2, false);
+    registered.Read(registry);
+    layers.GetDirtyLayers(registered, dirty);
+    REQUIRE(dirty.size() == 4);
+    CHECK(dirty[0] == 2);
+    CHECK(dirty[1] == 1);
+    CHECK(dirty[2] == 0);
+    CHECK(dirty[3] == -1);
+    CHECK(registered.Contains(Handle(1)));
+    CHECK(!registered.IsPlaced(Handle(1)));
+    CHECK(registered.IsInLayer(Handle(2), 0));
+}
+
+TEST(ForgottenWindowsDirtyTheirLayer)
+{
+    ZOrderLayers layers;
+    std::vector<ZOrderPlanner::PlacedWindow> block;
+    block.push_back(Placed(Handle(1), 0));
+    block.push_back(Placed(Handle(2), 0));
+    layers.Store(nullptr, block);
+
+    // A new window under a destroyed window's handle
+    layers.Forget(Handle(2));
+    WindowRegistry registry;
+    Insert(registry, Handle(1), 0);
+    Insert(registry, Handle(2), 0);
+    ZOrderLayers::Registered registered;
+    registered.Read(registry);
+    std::vector<int32_t> dirty;
+    layers.GetDirtyLayers(registered, dirty);
+    CHECK(dirty.size() == 1);
+
+    layers.Invalidate();
+    CHECK(!layers.IsValid(nullptr));
+    CHECK(layers.GetLayers().empty());
+}
+
+TEST(NewWindowIsPlacedWithoutEnumerating)
+{
+    SimulatedDesktop desktop;
+    desktop.Register(desktop.CreateWidgets(10), 1);
+    desktop.Register(desktop.CreateWidgets(10), 0);
+    std::vector<HWND> added = desktop.CreateWidgets(3);
+    desktop.Start();
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    desktop.NextFrame();
+    REQUIRE(desktop.IsInPlace());
+
+    for (int32_t layer = 2; layer >= 0; --layer)
+    {
+        desktop.Register(added[layer], layer);
+        const uint64_t moves = desktop.windowSystem.GetMoveCount();
+        const uint64_t enumerations = desktop.windowSystem.GetEnumerationCount();
+        desktop.controller.PositionDirtyLayers();
+        CHECK(desktop.windowSystem.GetMoveCount() - moves == 1);
+        CHECK(desktop.windowSystem.GetEnumerationCount() == enumerations);
+        CHECK(desktop.IsInPlace());
+    }
+
+    // Unregistering leaves the rest where it is
+    HWND last = desktop.windowSystem.GetStack()[desktop.windowSystem.GetStackIndex(desktop.helperWindow) + 5];
+    desktop.Unregister(last);
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    desktop.controller.PositionDirtyLayers();
+    CHECK(desktop.windowSystem.GetMoveCount() == moves);
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(SingleLayerAtTheBottomIsPlacedFromItsLowestWindow)
+{
+    SimulatedDesktop desktop;
+    desktop.Register(desktop.CreateWidgets(10), 0);
+    desktop.Start();
+    desktop.windowSystem.Advance(1000);
+    REQUIRE(!desktop.controller.IsShowingDesktop());
+    REQUIRE(desktop.IsInPlace());
+
+    // Nothing is below the layer, so the walk starts at its own lowest window
+    HWND added = desktop.CreateWidgets(1)[0];
+    desktop.Register(added, 0);
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    const uint64_t enumerations = desktop.windowSystem.GetEnumerationCount();
+    desktop.controller.PositionDirtyLayers();
+    CHECK(desktop.windowSystem.GetMoveCount() - moves == 1);
+    CHECK(desktop.windowSystem.GetEnumerationCount() == enumerations);
+    CHECK(desktop.IsInPlace());
+
+    // It joins the top of the block, right above the windows already there
+    const ZOrderLayers::LayerMap& layers = desktop.controller.GetZOrderLayers().GetLayers();
+    REQUIRE(layers.size() == 1);
+    REQUIRE(layers.begin()->second.size() == 11);
+    CHECK(layers.begin()->second.front() == added);
+    CHECK(desktop.windowSystem.GetWindowBelow(added) == layers.begin()->second[1]);
+
+    // Once the lowest window is unregistered, the walk starts at the one above it
+    desktop.Unregister(layers.begin()->second.back());
+    desktop.controller.PositionDirtyLayers();
+    desktop.Register(desktop.CreateWidgets(1)[0], 0);
+    const uint64_t before = desktop.windowSystem.GetEnumerationCount();
+    desktop.controller.PositionDirtyLayers();
+    CHECK(desktop.windowSystem.GetEnumerationCount() == before);
+    CHECK(desktop.IsInPlace());
+}
+
+TEST(RandomChangesKeepTheBlockInPlace)
+{
+    SimulatedDesktop desktop;
+    desktop.Register(desktop.CreateWidgets(20), 0);
+    desktop.Start();
+
+    std::mt19937 random(1);
+    for (int i = 0; i < 500; ++i)
+    {
+        std::vector<HWND> registered;
+        for (const WindowInfo& info : desktop.windows.GetForWriter())
+        {
+            registered.push_back(info.hwnd);
+        }
+
+        const int32_t layer = static_cast<int32_t>(random() % 5) - 1;
+        switch (random() % 5)
+        {
+        case 0:
+            desktop.Register(layer);
+            break;
+        case 1:
+            if (registered.size() > 5)
+            {
+                desktop.Unregister(registered[random() % registered.size()]);
+            }
+            break;
+        case 2:
+            desktop.Register(registered[random() % registered.size()], layer);
+            break;
+        case 3:
+            desktop.windowSystem.SetVisible(registered[random() % registered.size()], random() % 2 == 0);
+            desktop.controller.PositionWindows();
+            break;
+        default:
+            if (desktop.controller.IsShowingDesktop())
+            {
+                desktop.windowSystem.RestoreWindows(desktop.apps[random() % desktop.apps.size()]);
+            }
+            else
+            {
+                desktop.windowSystem.ShowDesktop();
+            }
+            desktop.windowSystem.Advance(200);
+            break;
+        }
+
+        // Changes pile up between some passes
+        if (random() % 3 == 0)
+            continue;
+
+        desktop.controller.PositionDirtyLayers();
+        if (!CHECK(desktop.IsInPlace()))
+            break;
+    }
+}
+
+TEST(RegistryPublishedWhileMovingIsPickedUp)
+{
+    SimulatedDesktop desktop;
+    std::vector<HWND> widgets = desktop.CreateWidgets(6);
+    desktop.Register(std::vector<HWND>(widgets.begin(), widgets.begin() + 3), 1);
+    desktop.Register(std::vector<HWND>(widgets.begin() + 3, widgets.end()), 0);
+    desktop.Start();
+    desktop.windowSystem.ShowDesktop();
+    REQUIRE(desktop.WaitForState(true) != SimulatedDesktop::NOT_DETECTED);
+    desktop.NextFrame();
+
+    // The window procedure of a moved window unregisters another window
+    HWND victim = widgets[0];
+    int published = 0;
+    desktop.windowSystem.SetMoveHandler([&](HWND)
+    {
+        if (victim)
+        {
+            desktop.Unregister(victim);
+            victim = nullptr;
+            ++published;
+        }
+    });
+
+    desktop.Register(1);
+    desktop.controller.PositionDirtyLayers();
+    CHECK(published == 1);
+    CHECK(desktop.windows.Read()->Find(widgets[0]) == nullptr);
+
+    // The next pass places what the pass in between could not see
+    desktop.controller.PositionDirtyLayers();
+    CHECK(desktop.IsInPlace());
+
+    // The same from inside a full pass
+    victim = widgets[3];
+    desktop.Register(0);
+    desktop.controller.PositionWindows();
+    CHECK(published == 2);
+    desktop.controller.PositionDirtyLayers();
+    CHECK(desktop.IsInPlace());
+}
@@ -0,0 +1,293 @@
+#include "Test.h"
+#include "ZOrderPlanner.h"
+#include "SimulatedWindowSystem.h"
+#include <algorithm>
+#include <map>
+#include <random>
+
+// Layers of the registered windows, keyed by handle
+typedef std::map<HWND, int32_t> Registered;
+
+static size_t Plan(ZOrderPlanner& planner, SimulatedWindowSystem& windowSystem, const Registered& registered,
+    HWND anchor, ZOrderBatch& batch)
+{
+    planner.Begin(anchor, registered.size());
+    size_t observed = 0;
+    for (HWND hwnd : windowSystem.GetStack())
+    {
+        ++observed;
+        Registered::const_iterator it = registered.find(hwnd);
+        if (!planner.Observe(hwnd, it != registered.end(), it != registered.end() ? it->second : 0))
+            break;
+    }
+    planner.Plan(batch);
+    return observed;
+}
+
+// True if the registered windows sit right below anchor, or at the bottom, with
+// higher layers first
+static bool IsBlockInPlace(const SimulatedWindowSystem& windowSystem, const Registered& registered, HWND anchor)
+{
+    const std::vector<HWND>& stack = windowSystem.GetStack();
+    size_t first = anchor ? windowSystem.GetStackIndex(anchor) + 1 : stack.size() - registered.size();
+    if (first + registered.size() > stack.size())
+        return false;
+
+    for (size_t i = first; i < first + registered.size(); ++i)
+    {
+        Registered::const_iterator it = registered.find(stack[i]);
+        if (it == registered.end())
+            return false;
+        if (i > first && it->second > registered.find(stack[i - 1])->second)
+            return false;
+    }
+    return true;
+}
+
+// The fewest moves that form the block below anchor: every registered window
+// but the longest run right below it that is already in block order
+static size_t MinimalMoves(const SimulatedWindowSystem& windowSystem, const Registered& registered, HWND anchor)
+{
+    const std::vector<HWND>& stack = windowSystem.GetStack();
+    std::vector<HWND> order;
+    for (HWND hwnd : stack)
+    {
+        if (registered.count(hwnd))
+        {
+            order.push_back(hwnd);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&registered](HWND a, HWND b)
+    {
+        return registered.find(a)->second > registered.find(b)->second;
+    });
+
+    std::vector<size_t> run;
+    for (size_t i = windowSystem.GetStackIndex(anchor) + 1; i < stack.size() && registered.count(stack[i]); ++i)
+    {
+        run.push_back(static_cast<size_t>(std::find(order.begin(), order.end(), stack[i]) - order.begin()));
+    }
+
+    size_t longest = 0;
+    std::vector<size_t> lengths(run.size(), 1);
+    for (size_t i = 0; i < run.size(); ++i)
+    {
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (run[j] < run[i])
+            {
+                lengths[i] = std::max(lengths[i], lengths[j] + 1);
+            }
+        }
+        longest = std::max(longest, lengths[i]);
+    }
+    return registered.size() - longest;
+}
+
+static HWND Create(SimulatedWindowSystem& windowSystem, Registered* registered = nullptr, int32_t layer = 0)
+{
+    HWND hwnd = windowSystem.CreateWindow(L"Window", L"", 2);
+    if (registered)
+    {
+        (*registered)[hwnd] = layer;
+    }
+    return hwnd;
+}
+
+TEST(BlockInPlaceCostsNoMoves)
+{
+    SimulatedWindowSystem windowSystem;
+    Registered registered;
+    Create(windowSystem, &registered);
+    Create(windowSystem, &registered);
+    Create(windowSystem, &registered);
+    HWND anchor = Create(windowSystem);
+    Create(windowSystem);
+
+    ZOrderPlanner planner;
+    ZOrderBatch batch;
+    size_t observed = Plan(planner, windowSystem, registered, anchor, batch);
+    CHECK(batch.IsEmpty());
+    CHECK(planner.GetKeptCount() == 3);
+    CHECK(planner.GetBlock().size() == 3);
+
+    // The enumeration stops at the last registered window
+    CHECK(observed == 5);
+}
+
+TEST(MovesOnlyWhatIsOutOfPlace)
+{
+    SimulatedWindowSystem windowSystem;
+    Registered registered;
+    HWND other = Create(windowSystem);
+    Create(windowSystem, &registered, 1);
+    HWND b = Create(windowSystem, &registered, 1);
+    HWND c = Create(windowSystem, &registered, 1);
+    Create(windowSystem, &registered, 1);
+    HWND anchor = Create(windowSystem);
+
+    // A window of a lower layer in the middle of the block goes to its end
+    HWND low = Create(windowSystem, &registered, 0);
+    windowSystem.MoveWindow(ZOrderMove{ low, c, ZOrderMove::After });
+    ZOrderPlanner planner;
+    ZOrderBatch batch;
+    Plan(planner, windowSystem, registered, anchor, batch);
+    CHECK(batch.GetSize() == 1);
+    CHECK(planner.GetKeptCount() == 4);
+    batch.Commit(windowSystem);
+    CHECK(IsBlockInPlace(windowSystem, registered, anchor));
+
+    // A window that strayed from the block is brought back alone
+    windowSystem.MoveWindow(ZOrderMove{ b, other, ZOrderMove::After });
+    Plan(planner, windowSystem, registered, anchor, batch);
+    CHECK(batch.GetSize() == 1);
+    batch.Commit(windowSystem);
+    CHECK(IsBlockInPlace(windowSystem, registered, anchor));
+}
+
+TEST(KeepsRelativeOrderWithinLayers)
+{
+    SimulatedWindowSystem windowSystem;
+    Registered registered;
+    HWND anchor = Create(windowSystem);
+    HWND low1 = Create(windowSystem, &registered, 0);
+    HWND high1 = Create(windowSystem, &registered, 5);
+    HWND low2 = Create(windowSystem, &registered, 0);
+    HWND high2 = Create(windowSystem, &registered, 5);
+    windowSystem.MoveWindow(ZOrderMove{ anchor, nullptr, ZOrderMove::Topmost });
+
+    ZOrderPlanner planner;
+    ZOrderBatch batch;
+    Plan(planner, windowSystem, registered, anchor, batch);
+    batch.Commit(windowSystem);
+
+    const std::vector<ZOrderPlanner::PlacedWindow>& block = planner.GetBlock();
+    REQUIRE(block.size() == 4);
+    CHECK(block[0].hwnd == high2);
+    CHECK(block[1].hwnd == high1);
+    CHECK(block[2].hwnd == low2);
+    CHECK(block[3].hwnd == low1);
+    CHECK(IsBlockInPlace(windowSystem, registered, anchor));
+}
+
+TEST(PlacesBlockAtBottom)
+{
+    SimulatedWindowSystem windowSystem;
+    Registered registered;
+    HWND a = Create(windowSystem, &registered);
+    Create(windowSystem);
+    HWND b = Create(windowSystem, &registered);
+    Create(windowSystem);
+
+    ZOrderPlanner planner;
+    ZOrderBatch batch;
+    Plan(planner, windowSystem, registered, nullptr, batch);
+    batch.Commit(windowSystem);
+    CHECK(IsBlockInPlace(windowSystem, registered, nullptr));
+
+    // Once there, nothing moves and the windows keep their order
+    Plan(planner, windowSystem, registered, nullptr, batch);
+    CHECK(batch.IsEmpty());
+    CHECK(windowSystem.GetStackIndex(b) < windowSystem.GetStackIndex(a));
+}
+
+TEST(FloorWindowsStayBelowTheBlock)
+{
+    SimulatedWindowSystem windowSystem;
+    windowSystem.CreateShell(42, false);
+    Registered registered;
+    HWND low = Create(windowSystem, &registered);
+    HWND helper = Create(windowSystem);
+    HWND a = Create(windowSystem, &registered);
+    HWND b = Create(windowSystem, &registered);
+    Create(windowSystem);
+    const HWND floor[] = { windowSystem.GetShellWindow(), windowSystem.GetDesktopIconsHost(), helper };
+
+    ZOrderPlanner planner;
+    ZOrderBatch batch;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        planner.Begin(nullptr, registered.size());
+        for (HWND hwnd : windowSystem.GetStack())
+        {
+            bool more = std::find(std::begin(floor), std::end(floor), hwnd) != std::end(floor) ?
+                planner.ObserveFloor(hwnd) : planner.Observe(hwnd, registered.count(hwnd) != 0);
+            if (!more)
+                break;
+        }
+        planner.Plan(batch);
+
+        if (pass == 0)
+        {
+            // Only the windows above the helper move, the one below it stays
+            CHECK(!batch.IsEmpty());
+            CHECK(planner.GetKeptCount() == 1);
+            batch.Commit(windowSystem);
+        }
+        else
+        {
+            // Windows that stay below the block leave it in place
+            CHECK(batch.IsEmpty());
+            CHECK(planner.GetKeptCount() == 3);
+        }
+    }
+
+    const size_t bottom = windowSystem.GetStackIndex(low);
+    CHECK(windowSystem.GetStackIndex(helper) + 3 == bottom);
+    CHECK(windowSystem.GetStackIndex(b) + 2 == bottom);
+    CHECK(windowSystem.GetStackIndex(a) + 1 == bottom);
+    CHECK(windowSystem.GetWindowBelow(low) == windowSystem.GetDesktopIconsHost());
+}
+
+TEST(RandomStacksTakeMinimalMoves)
+{
+    std::mt19937 random(1234);
+    for (int round = 0; round < 200; ++round)
+    {
+        SimulatedWindowSystem windowSystem;
+        Registered registered;
+        std::vector<HWND> all;
+        const int count = 2 + static_cast<int>(random() % 20);
+        for (int i = 0; i < count; ++i)
+        {
+            bool isRegistered = random() % 2 == 0;
+            all.push_back(Create(windowSystem, isRegistered ? &registered : nullptr, static_cast<int32_t>(random() % 3)));
+        }
+        if (registered.empty())
+            continue;
+
+        for (int i = 0; i < count; ++i)
+        {
+            HWND hwnd = all[random() % all.size()];
+            HWND after = all[random() % all.size()];
+            if (hwnd != after)
+            {
+                windowSystem.MoveWindow(ZOrderMove{ hwnd, after, ZOrderMove::After });
+            }
+        }
+
+        HWND anchor = nullptr;
+        if (registered.size() < all.size() && random() % 2 == 0)
+        {
+            do
+            {
+                anchor = all[random() % all.size()];
+            } while (registered.count(anchor));
+        }
+
+        ZOrderPlanner planner;
+        ZOrderBatch batch;
+        Plan(planner, windowSystem, registered, anchor, batch);
+        CHECK(batch.GetSize() + planner.GetKeptCount() == registered.size());
+        if (anchor)
+        {
+            CHECK(batch.GetSize() == MinimalMoves(windowSystem, registered, anchor));
+        }
+        batch.Commit(windowSystem);
+        CHECK(IsBlockInPlace(windowSystem, registered, anchor));
+
+        // A second pass finds everything in place
+        Plan(planner, windowSystem, registered, anchor, batch);
+        CHECK(batch.IsEmpty());
+    }
+}
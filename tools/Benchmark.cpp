@@ -0,0 +1,1002 @@
+// Runs the desktop logic over the simulated window stack and reports what it
+// costs at different numbers of open windows. The default scenario, detection,
+// reports the time spent per timer tick while the desktop is idle, the time
+// and z-order moves of a repositioning pass, and how long Show Desktop and
+// restores take to be detected on the simulated clock. --scenario picks
+// another one, see SCENARIOS. Needs nothing from Windows:
+//
+//     g++ -std=c++14 -O2 -I.. Benchmark.cpp -o Benchmark -lpthread
+//
+// The simulated clock makes the detection latencies and counts the same on
+// every run; only the times in microseconds depend on the machine.
+
+#include "DesktopController.h"
+#include "SimulatedWindowSystem.h"
+#include "StateSnapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+struct BenchmarkOptions
+{
+    const char* scenario;
+    std::vector<size_t> windowCounts;
+    size_t registeredWindows;
+    size_t topmostWindows;
+    uint32_t idleSeconds;
+    uint32_t passes;
+    uint32_t transitions;
+};
+
+struct Detection
+{
+    uint32_t detected;
+    double latencyMs;
+    uint64_t latencyMaxMs;
+};
+
+struct BenchmarkResult
+{
+    size_t windows;
+    uint64_t ticks;
+    double tickUs;
+    double checkUs;
+    double enumeratedPerTick;
+    double passUs;
+    double movesPerPass;
+    uint64_t transitionPasses;
+    double transitionPassUs;
+    double movesPerTransition;
+    Detection events;
+    Detection poll;
+};
+
+static const uint32_t SHELL_PROCESS_ID = 42;
+static const uint32_t OWN_PROCESS_ID = 1;
+static const uint32_t APP_PROCESS_COUNT = 50;
+static const int32_t LAYER_COUNT = 3;
+
+// Simulated time a transition is given to be detected, above the longest poll interval
+static const uint32_t DETECTION_TIMEOUT_MS = 20000;
+
+static double ElapsedUs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double Average(double total, uint64_t count)
+{
+    return count ? total / count : 0.0;
+}
+
+// The shell, windows of other applications, topmost tools and the library's
+// own windows, with a controller over them
+struct BenchmarkDesktop
+{
+    BenchmarkDesktop(size_t windowCount, size_t topmostCount, bool shellWindowHost = false) :
+        windowSystem(OWN_PROCESS_ID),
+        controller(windowSystem, windows)
+    {
+        windowSystem.CreateShell(SHELL_PROCESS_ID, shellWindowHost);
+        for (size_t i = 0; i < windowCount; ++i)
+        {
+            apps.push_back(windowSystem.CreateWindow(L"Application", L"Window", 100 + i % APP_PROCESS_COUNT));
+        }
+        for (size_t i = 0; i < topmostCount; ++i)
+        {
+            tools.push_back(windowSystem.CreateWindow(L"Tool", L"", 200 + static_cast<uint32_t>(i)));
+            windowSystem.SetTopmost(tools.back(), true);
+        }
+
+        systemWindow = windowSystem.CreateWindow(ZPOS_SYSTEM_WINDOW_CLASS, ZPOS_SYSTEM_WINDOW_TITLE, OWN_PROCESS_ID);
+        helperWindow = windowSystem.CreateWindow(ZPOS_SYSTEM_WINDOW_CLASS, ZPOS_HELPER_WINDOW_TITLE, OWN_PROCESS_ID);
+    }
+
+    ~BenchmarkDesktop()
+    {
+        controller.Stop();
+    }
+
+    std::vector<HWND> CreateWidgets(size_t count)
+    {
+        std::vector<HWND> hwnds;
+        for (size_t i = 0; i < count; ++i)
+        {
+            hwnds.push_back(windowSystem.CreateWindow(L"Widget", L"", OWN_PROCESS_ID));
+        }
+        return hwnds;
+    }
+
+    // Registers the windows with one new registry, as bulk registration does
+    void Register(const std::vector<HWND>& hwnds, int32_t layer)
+    {
+        std::unique_ptr<WindowRegistry> registry(new WindowRegistry(windows.GetForWriter()));
+        for (HWND hwnd : hwnds)
+        {
+            registry->Insert(WindowInfo{ hwnd, true, false, nullptr, layer, OWN_PROCESS_ID, 0 });
+        }
+        windows.Publish(std::move(registry));
+    }
+
+    void Start()
+    {
+        controller.Start(systemWindow, helperWindow);
+        controller.PositionWindows();
+        windowSystem.Advance(1000);
+    }
+
+    SimulatedWindowSystem windowSystem;
+    SnapshotCell<WindowRegistry> windows;
+    DesktopController controller;
+    std::vector<HWND> apps;
+    std::vector<HWND> tools;
+    HWND systemWindow;
+    HWND helperWindow;
+};
+
+// Alternates Show Desktop and restores a second apart and measures on the
+// simulated clock how long each takes to be detected
+static void MeasureTransitions(SimulatedWindowSystem& windowSystem, DesktopController& controller,
+    const std::vector<HWND>& apps, uint32_t transitions, Detection& detection)
+{
+    uint64_t latencyTotal = 0;
+    for (uint32_t i = 0; i < transitions; ++i)
+    {
+        bool showDesktop = !controller.IsShowingDesktop();
+        if (showDesktop)
+        {
+            windowSystem.ShowDesktop();
+        }
+        else
+        {
+            windowSystem.RestoreWindows(apps.empty() ? nullptr : apps[i % apps.size()]);
+        }
+
+        uint32_t elapsed = 0;
+        while (controller.IsShowingDesktop() != showDesktop && elapsed < DETECTION_TIMEOUT_MS)
+        {
+            windowSystem.Advance(1);
+            ++elapsed;
+        }
+
+        if (controller.IsShowingDesktop() == showDesktop)
+        {
+            ++detection.detected;
+            latencyTotal += elapsed;
+            detection.latencyMaxMs = std::max<uint64_t>(detection.latencyMaxMs, elapsed);
+        }
+        windowSystem.Advance(1000);
+    }
+    detection.latencyMs = Average(static_cast<double>(latencyTotal), detection.detected);
+}
+
+static BenchmarkResult Run(size_t windowCount, const BenchmarkOptions& options)
+{
+    BenchmarkResult result = BenchmarkResult();
+    result.windows = windowCount;
+
+    BenchmarkDesktop desktop(windowCount, options.topmostWindows);
+    SimulatedWindowSystem& windowSystem = desktop.windowSystem;
+    DesktopController& controller = desktop.controller;
+    const std::vector<HWND>& apps = desktop.apps;
+
+    std::unique_ptr<WindowRegistry> registry(new WindowRegistry());
+    for (size_t i = 0; i < options.registeredWindows; ++i)
+    {
+        HWND hwnd = windowSystem.CreateWindow(L"Widget", L"", OWN_PROCESS_ID);
+        registry->Insert(WindowInfo{ hwnd, true, false, nullptr, static_cast<int32_t>(i % LAYER_COUNT), OWN_PROCESS_ID, 0 });
+    }
+    desktop.windows.Publish(std::move(registry));
+
+    controller.Start(desktop.systemWindow, desktop.helperWindow);
+    windowSystem.Advance(1000);
+
+    // Idle: only the safety poll runs
+    PerfSnapshot before;
+    PerfSnapshot after;
+    PerfCounters::Read(before);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    windowSystem.Advance(static_cast<uint64_t>(options.idleSeconds) * 1000);
+    double idleUs = ElapsedUs(start);
+    PerfCounters::Read(after);
+
+    const PerfHistogramData& checks = after.histograms[PERF_CHECK_DESKTOP_STATE];
+    const PerfHistogramData& checksBefore = before.histograms[PERF_CHECK_DESKTOP_STATE];
+    result.ticks = after.counters[PERF_WAKEUPS] - before.counters[PERF_WAKEUPS];
+    result.tickUs = Average(idleUs, result.ticks);
+    result.checkUs = Average(static_cast<double>(checks.totalUs - checksBefore.totalUs), checks.count - checksBefore.count);
+    result.enumeratedPerTick = Average(static_cast<double>(
+        after.counters[PERF_ENUMERATED_WINDOWS] - before.counters[PERF_ENUMERATED_WINDOWS]), result.ticks);
+
+    // Full repositioning passes over a stack that is already in order
+    uint64_t moves = windowSystem.GetMoveCount();
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.passes; ++i)
+    {
+        controller.PositionWindows();
+    }
+    result.passUs = Average(ElapsedUs(start), options.passes);
+    result.movesPerPass = Average(static_cast<double>(windowSystem.GetMoveCount() - moves), options.passes);
+
+    // Show Desktop and restores, detected from the shell's events
+    PerfCounters::Read(before);
+    moves = windowSystem.GetMoveCount();
+    MeasureTransitions(windowSystem, controller, apps, options.transitions, result.events);
+    PerfCounters::Read(after);
+
+    const PerfHistogramData& passes = after.histograms[PERF_POSITION_WINDOWS];
+    const PerfHistogramData& passesBefore = before.histograms[PERF_POSITION_WINDOWS];
+    result.transitionPasses = passes.count - passesBefore.count;
+    result.transitionPassUs = Average(static_cast<double>(passes.totalUs - passesBefore.totalUs), result.transitionPasses);
+    result.movesPerTransition = Average(static_cast<double>(windowSystem.GetMoveCount() - moves), options.transitions);
+
+    // The same with every event lost, left to the safety poll
+    windowSystem.SetDropEvents(true);
+    MeasureTransitions(windowSystem, controller, apps, options.transitions, result.poll);
+    return result;
+}
+
+static bool RunDetection(const BenchmarkOptions& options)
+{
+    std::printf("Registered windows: %zu in %d layers, topmost windows: %zu\n",
+        options.registeredWindows, LAYER_COUNT, options.topmostWindows);
+    std::printf("%8s | %-38s | %-17s | %-24s | %-26s | %s\n",
+        "", "Idle", "Full pass", "Transition passes", "Detection from events", "Detection by polling");
+    std::printf("%8s | %8s %9s %9s %9s | %9s %7s | %6s %9s %7s | %8s %9s %7s | %8s %9s %7s\n",
+        "Windows", "Ticks", "Tick us", "Probe us", "Enum/tick",
+        "us", "Moves", "Count", "us", "Moves",
+        "Detected", "Mean ms", "Max ms", "Detected", "Mean ms", "Max ms");
+
+    bool missed = false;
+    for (size_t windowCount : options.windowCounts)
+    {
+        BenchmarkResult result = Run(windowCount, options);
+        std::printf("%8zu | %8llu %9.2f %9.2f %9.1f | %9.2f %7.1f | %6llu %9.2f %7.1f | %3u/%-4u %9.1f %7llu | %3u/%-4u %9.1f %7llu\n",
+            result.windows,
+            static_cast<unsigned long long>(result.ticks),
+            result.tickUs,
+            result.checkUs,
+            result.enumeratedPerTick,
+            result.passUs,
+            result.movesPerPass,
+            static_cast<unsigned long long>(result.transitionPasses),
+            result.transitionPassUs,
+            result.movesPerTransition,
+            result.events.detected,
+            options.transitions,
+            result.events.latencyMs,
+            static_cast<unsigned long long>(result.events.latencyMaxMs),
+            result.poll.detected,
+            options.transitions,
+            result.poll.latencyMs,
+            static_cast<unsigned long long>(result.poll.latencyMaxMs));
+        missed = missed || result.events.detected != options.transitions || result.poll.detected != options.transitions;
+    }
+
+    return !missed;
+}
+
+// True if the windows follow each other in the stack
+static bool IsContiguous(SimulatedWindowSystem& windowSystem, const std::vector<HWND>& hwnds)
+{
+    size_t first = windowSystem.GetStack().size();
+    size_t last = 0;
+    for (HWND hwnd : hwnds)
+    {
+        const size_t index = windowSystem.GetStackIndex(hwnd);
+        first = std::min(first, index);
+        last = std::max(last, index);
+    }
+    return last - first + 1 == hwnds.size();
+}
+
+struct RegistrationCost
+{
+    uint64_t passes;
+    uint64_t enumerated;
+    uint64_t moves;
+    double us;
+};
+
+// Registers count widgets on a desktop of 100 other windows, each followed by
+// a pass of its own or all at once followed by one pass. Clears inPlace if the
+// widgets do not end up in one block.
+static RegistrationCost MeasureRegistration(size_t count, bool bulk, bool& inPlace)
+{
+    BenchmarkDesktop desktop(100, 0);
+    desktop.Start();
+    std::vector<HWND> widgets = desktop.CreateWidgets(count);
+
+    RegistrationCost cost = RegistrationCost();
+    const uint64_t enumerated = desktop.windowSystem.GetEnumeratedWindowCount();
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    PerfSnapshot before;
+    PerfSnapshot after;
+    PerfCounters::Read(before);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (bulk)
+    {
+        desktop.Register(widgets, 0);
+        desktop.controller.PositionWindows();
+    }
+    else
+    {
+        for (HWND hwnd : widgets)
+        {
+            desktop.Register(std::vector<HWND>(1, hwnd), 0);
+            desktop.controller.PositionWindows();
+        }
+    }
+    cost.us = ElapsedUs(start);
+    PerfCounters::Read(after);
+
+    cost.passes = after.counters[PERF_REPOSITION_PASSES] - before.counters[PERF_REPOSITION_PASSES];
+    cost.enumerated = desktop.windowSystem.GetEnumeratedWindowCount() - enumerated;
+    cost.moves = desktop.windowSystem.GetMoveCount() - moves;
+    inPlace = inPlace && IsContiguous(desktop.windowSystem, widgets);
+    return cost;
+}
+
+// Registering N windows one at a time, each followed by a full pass as before
+// bulk registration, against registering them all at once with one pass
+static bool RunRegistration(const BenchmarkOptions& options)
+{
+    std::printf("Widgets registered on a desktop of 100 windows\n");
+    std::printf("%8s | %-37s | %-37s\n", "", "One by one, a pass each", "Bulk, one pass");
+    std::printf("%8s | %6s %10s %7s %11s | %6s %10s %7s %11s\n",
+        "Windows", "Passes", "Enumerated", "Moves", "us",
+        "Passes", "Enumerated", "Moves", "us");
+
+    bool inPlace = true;
+    for (size_t count : options.windowCounts)
+    {
+        if (count == 0)
+            continue;
+
+        std::printf("%8zu", count);
+        for (int bulk = 0; bulk < 2; ++bulk)
+        {
+            RegistrationCost cost = MeasureRegistration(count, bulk != 0, inPlace);
+            std::printf(" | %6llu %10llu %7llu %11.1f",
+                static_cast<unsigned long long>(cost.passes),
+                static_cast<unsigned long long>(cost.enumerated),
+                static_cast<unsigned long long>(cost.moves),
+                cost.us);
+        }
+        std::printf("\n");
+    }
+    return inPlace;
+}
+
+struct LayerCost
+{
+    uint64_t moves;
+    uint64_t neighbours;
+    uint64_t enumerated;
+    double us;
+};
+
+// Adds a widget to a layer of count widgets on a desktop of 100 windows, then
+// restacks the dirty layers or runs a full pass. With upperLayer a layer of 5
+// widgets sits above, otherwise the layer is alone at the bottom of the stack.
+// Clears inPlace if the block ends up split or out of order.
+static LayerCost MeasureLayerChange(size_t count, bool upperLayer, bool full, bool& inPlace)
+{
+    BenchmarkDesktop desktop(100, 0);
+    std::vector<HWND> lower = desktop.CreateWidgets(count);
+    std::vector<HWND> upper = desktop.CreateWidgets(upperLayer ? 5 : 0);
+    desktop.Register(lower, 0);
+    desktop.Register(upper, 1);
+    desktop.Start();
+    lower.push_back(desktop.CreateWidgets(1)[0]);
+    desktop.Register(std::vector<HWND>(1, lower.back()), 0);
+
+    LayerCost cost = LayerCost();
+    const uint64_t moves = desktop.windowSystem.GetMoveCount();
+    const uint64_t neighbours = desktop.windowSystem.GetNeighbourQueryCount();
+    const uint64_t enumerated = desktop.windowSystem.GetEnumeratedWindowCount();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (full)
+    {
+        desktop.controller.PositionWindows();
+    }
+    else
+    {
+        desktop.controller.PositionDirtyLayers();
+    }
+    cost.us = ElapsedUs(start);
+    cost.moves = desktop.windowSystem.GetMoveCount() - moves;
+    cost.neighbours = desktop.windowSystem.GetNeighbourQueryCount() - neighbours;
+    cost.enumerated = desktop.windowSystem.GetEnumeratedWindowCount() - enumerated;
+
+    std::vector<HWND> block(upper);
+    block.insert(block.end(), lower.begin(), lower.end());
+    inPlace = inPlace && IsContiguous(desktop.windowSystem, block) &&
+        (upper.empty() || desktop.windowSystem.GetStackIndex(upper.back()) < desktop.windowSystem.GetStackIndex(lower.front()));
+    return cost;
+}
+
+// Adding a window to a layer of N, restacking only that layer against a full
+// pass, for a layer below another and for a single layer at the bottom. The
+// simulator searches its stack for every neighbour query, so compare the
+// counts: the times overstate what a layer pass costs on Windows.
+static bool RunLayers(const BenchmarkOptions& options)
+{
+    std::printf("One widget added to a layer of N on a desktop of 100 windows\n");
+    std::printf("%8s | %-35s | %-35s | %-35s | %-35s\n", "",
+        "Below a layer: dirty layers", "Below a layer: full pass",
+        "Alone at the bottom: dirty layers", "Alone at the bottom: full pass");
+    std::printf("%8s", "Windows");
+    for (int column = 0; column < 4; ++column)
+    {
+        std::printf(" | %5s %9s %10s %7s", "Moves", "Neighbour", "Enumerated", "us");
+    }
+    std::printf("\n");
+
+    bool inPlace = true;
+    for (size_t count : options.windowCounts)
+    {
+        if (count == 0)
+            continue;
+
+        std::printf("%8zu", count);
+        for (int column = 0; column < 4; ++column)
+        {
+            LayerCost cost = MeasureLayerChange(count, column < 2, column % 2 != 0, inPlace);
+            std::printf(" | %5llu %9llu %10llu %7.1f",
+                static_cast<unsigned long long>(cost.moves),
+                static_cast<unsigned long long>(cost.neighbours),
+                static_cast<unsigned long long>(cost.enumerated),
+                cost.us);
+        }
+        std::printf("\n");
+    }
+    return inPlace;
+}
+
+// Nanoseconds per call of count calls of record
+template <typename Record>
+static double MeasureNs(uint64_t count, Record record)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        record(i);
+    }
+    return ElapsedUs(start) * 1000.0 / count;
+}
+
+// What the instrumentation costs the thread that records, against one locked
+// increment of a shared counter
+static bool RunCounters(const BenchmarkOptions& options)
+{
+    const uint64_t count = static_cast<uint64_t>(options.passes) * 50000;
+    PerfSnapshot before;
+    PerfCounters::Read(before);
+
+    std::atomic<uint64_t> shared(0);
+    const double lockedNs = MeasureNs(count, [&](uint64_t) { shared.fetch_add(1); });
+    const double addNs = MeasureNs(count, [](uint64_t) { PerfCounters::Add(PERF_MESSAGES); });
+    const double recordNs = MeasureNs(count, [](uint64_t i) { PerfCounters::Record(PERF_CHECK_DESKTOP_STATE, i & 1023); });
+    const double scopeNs = MeasureNs(count, [](uint64_t) { PerfScope scope(PERF_POSITION_WINDOWS); });
+
+    PerfSnapshot after;
+    PerfCounters::Read(after);
+    std::printf("%llu calls each, stats %s\n", static_cast<unsigned long long>(count), PerfCounters::IsEnabled() ? "on" : "compiled out");
+    std::printf("%-28s %8s\n", "", "ns/call");
+    std::printf("%-28s %8.2f\n", "Shared atomic fetch_add", lockedNs);
+    std::printf("%-28s %8.2f\n", "PerfCounters::Add", addNs);
+    std::printf("%-28s %8.2f\n", "PerfCounters::Record", recordNs);
+    std::printf("%-28s %8.2f\n", "PerfScope", scopeNs);
+
+    // Every call was counted
+    const uint64_t expected = PerfCounters::IsEnabled() ? count : 0;
+    return shared == count &&
+        after.counters[PERF_MESSAGES] - before.counters[PERF_MESSAGES] == expected &&
+        after.histograms[PERF_CHECK_DESKTOP_STATE].count - before.histograms[PERF_CHECK_DESKTOP_STATE].count == expected &&
+        after.histograms[PERF_POSITION_WINDOWS].count - before.histograms[PERF_POSITION_WINDOWS].count == expected;
+}
+
+// The value below which fraction of the sorted samples fall
+static double Percentile(const std::vector<double>& sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0.0;
+
+    return sorted[static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1))];
+}
+
+// How long a waiter on the state snapshot takes to wake up after a publish,
+// the CPU it uses while blocked, and what reads and publishes cost with
+// nobody waiting
+static bool RunState(const BenchmarkOptions& options)
+{
+    const uint64_t count = static_cast<uint64_t>(options.passes) * 50000;
+    StateSnapshotCell cell;
+    const double publishNs = MeasureNs(count, [&](uint64_t i) { cell.Publish(i % 2 == 0, i); });
+    uint64_t sequences = 0;
+    const double readNs = MeasureNs(count, [&](uint64_t) { sequences += cell.Read().sequence; });
+    bool valid = sequences == count * cell.Read().sequence;
+
+    // One waiter, woken by transitions published once it is asleep
+    const uint32_t wakeups = options.transitions * 25;
+    std::vector<double> latencies;
+    std::atomic<int64_t> publishedNs(0);
+    std::thread waiter([&]()
+    {
+        StateSnapshotCell::Snapshot snapshot = cell.Read();
+        for (uint32_t i = 0; i < wakeups; ++i)
+        {
+            const uint32_t last = snapshot.sequence;
+            cell.WaitForChange(last, StateSnapshotCell::FOREVER, snapshot);
+            const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            latencies.push_back((now - publishedNs.load()) / 1000.0);
+            valid = valid && snapshot.sequence == last + 1;
+        }
+    });
+    for (uint32_t i = 0; i < wakeups; ++i)
+    {
+        while (cell.GetWaiterCount() == 0)
+        {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        publishedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        cell.Publish(!cell.Read().showDesktop, i);
+    }
+    waiter.join();
+    std::sort(latencies.begin(), latencies.end());
+
+    // A waiter that times out, with this thread asleep, so the process CPU is its own
+    const uint32_t blockedMs = 500;
+    bool changed = true;
+    std::clock_t cpuStart = std::clock();
+    std::chrono::steady_clock::time_point blockedStart = std::chrono::steady_clock::now();
+    std::thread sleeper([&]()
+    {
+        StateSnapshotCell::Snapshot snapshot;
+        changed = cell.WaitForChange(cell.Read().sequence, blockedMs, snapshot);
+    });
+    sleeper.join();
+    const double blockedUs = ElapsedUs(blockedStart);
+    const double cpuMs = 1000.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    valid = valid && !changed && blockedUs >= blockedMs * 1000.0;
+
+    std::printf("%-32s %10.2f\n", "Publish, no waiters (ns)", publishNs);
+    std::printf("%-32s %10.2f\n", "Read (ns)", readNs);
+    std::printf("%-32s %10.1f\n", "Wake-up p50 (us)", Percentile(latencies, 0.5));
+    std::printf("%-32s %10.1f\n", "Wake-up p99 (us)", Percentile(latencies, 0.99));
+    std::printf("%-32s %10.1f\n", "Wake-up max (us)", Percentile(latencies, 1.0));
+    std::printf("%-32s %10.2f\n", "CPU while blocked (ms per s)", cpuMs * 1e6 / blockedUs);
+    return valid;
+}
+
+// Selecting the strategy for a shell layout, which is now done once when
+// detection starts, and resolving the host from scratch with it, as after the
+// topology was invalidated, among N other windows. The simulator searches its
+// window list for each window it visits, so the WorkerW search, which visits
+// the top-level windows, grows faster with N here than on Windows.
+static bool RunHosts(const BenchmarkOptions& options)
+{
+    const uint64_t count = static_cast<uint64_t>(options.passes) * 500;
+    std::printf("%8s | %-24s | %-24s\n", "", "WorkerW", "Shell window (24H2)");
+    std::printf("%8s | %11s %12s | %11s %12s\n", "Windows", "Select ns", "Resolve ns", "Select ns", "Resolve ns");
+
+    bool resolved = true;
+    for (size_t windowCount : options.windowCounts)
+    {
+        std::printf("%8zu", windowCount);
+        for (int shellWindowHost = 0; shellWindowHost < 2; ++shellWindowHost)
+        {
+            SimulatedWindowSystem windowSystem(OWN_PROCESS_ID);
+            windowSystem.CreateShell(SHELL_PROCESS_ID, shellWindowHost != 0);
+            for (size_t i = 0; i < windowCount; ++i)
+            {
+                windowSystem.CreateWindow(L"Application", L"Window", 100 + i % APP_PROCESS_COUNT);
+            }
+
+            DesktopHostStrategies strategies;
+            DesktopHostStrategy* strategy = nullptr;
+            const double selectNs = MeasureNs(count, [&](uint64_t) { strategy = strategies.Select(windowSystem); });
+
+            WindowMetadataCache metadata(256);
+            ShellTopology topology = ShellTopology();
+            const double resolveNs = MeasureNs(count, [&](uint64_t)
+            {
+                topology = ShellTopology{ windowSystem.GetShellWindow(), nullptr, nullptr, SHELL_PROCESS_ID };
+                strategy->Resolve(windowSystem, metadata, topology);
+            });
+
+            HWND expected = shellWindowHost ? windowSystem.GetShellWindow() : windowSystem.GetDesktopIconsHost();
+            resolved = resolved && topology.host == expected && topology.defView != nullptr;
+            std::printf(" | %11.1f %12.1f", selectNs, resolveNs);
+        }
+        std::printf("\n");
+    }
+    return resolved;
+}
+
+// Window queries per desktop probe and how many of the lookups the metadata
+// cache answers, over Show Desktop and restores, for both shell layouts
+static bool RunMetadata(const BenchmarkOptions& options)
+{
+    std::printf("Registered windows: %zu, topmost windows: %zu, %u transitions\n",
+        options.registeredWindows, options.topmostWindows, options.transitions);
+    std::printf("%8s %-20s | %7s %9s %13s %9s | %9s\n",
+        "Windows", "Layout", "Probes", "Queries", "Queries/probe", "Hit rate", "Detected");
+
+    bool detected = true;
+    for (size_t windowCount : options.windowCounts)
+    {
+        for (int shellWindowHost = 0; shellWindowHost < 2; ++shellWindowHost)
+        {
+            BenchmarkDesktop desktop(windowCount, options.topmostWindows, shellWindowHost != 0);
+            desktop.Register(desktop.CreateWidgets(options.registeredWindows), 0);
+            desktop.Start();
+
+            const WindowMetadataCache& metadata = desktop.controller.GetMetadata();
+            const uint64_t queries = desktop.windowSystem.GetWindowQueryCount();
+            const uint64_t hits = metadata.GetHitCount();
+            const uint64_t misses = metadata.GetMissCount();
+            PerfSnapshot before;
+            PerfSnapshot after;
+            PerfCounters::Read(before);
+            Detection detection = Detection();
+            MeasureTransitions(desktop.windowSystem, desktop.controller, desktop.apps, options.transitions, detection);
+            PerfCounters::Read(after);
+
+            const uint64_t probes = after.counters[PERF_DESKTOP_CHECKS] - before.counters[PERF_DESKTOP_CHECKS];
+            const uint64_t queried = desktop.windowSystem.GetWindowQueryCount() - queries;
+            const uint64_t lookups = metadata.GetHitCount() - hits + metadata.GetMissCount() - misses;
+            std::printf("%8zu %-20s | %7llu %9llu %13.2f %8.1f%% | %4llu/%-4u\n",
+                windowCount,
+                shellWindowHost ? "Shell window (24H2)" : "WorkerW",
+                static_cast<unsigned long long>(probes),
+                static_cast<unsigned long long>(queried),
+                Average(static_cast<double>(queried), probes),
+                100.0 * Average(static_cast<double>(metadata.GetHitCount() - hits), lookups),
+                static_cast<unsigned long long>(detection.detected),
+                options.transitions);
+            detected = detected && detection.detected == options.transitions;
+        }
+    }
+    return detected;
+}
+
+// True if the helper sits right below the lowest topmost tool, with the rest
+// of the band above it
+static bool IsBelowTheBand(BenchmarkDesktop& desktop)
+{
+    const size_t helper = desktop.windowSystem.GetStackIndex(desktop.helperWindow);
+    size_t lowest = 0;
+    bool band = false;
+    for (HWND tool : desktop.tools)
+    {
+        if (!desktop.windowSystem.IsTopmost(tool))
+            continue;
+
+        const size_t index = desktop.windowSystem.GetStackIndex(tool);
+        if (index > helper)
+            return false;
+        lowest = std::max(lowest, index);
+        band = true;
+    }
+    return !band || lowest + 1 == helper;
+}
+
+// Window queries made to place the helper below the topmost band when Win+D
+// announces Show Desktop, before the shell has raised the desktop host. The
+// lowest topmost window leaves the band halfway, without an event.
+static bool RunTopmost(const BenchmarkOptions& options)
+{
+    const size_t topmostCount = std::max<size_t>(options.topmostWindows, 2);
+    std::printf("Topmost windows: %zu, %u transitions\n", topmostCount, options.transitions);
+    std::printf("%8s | %9s %13s %6s %6s | %9s\n", "Windows", "Pre-arms", "Queries/arm", "Hits", "Walks", "In place");
+
+    bool inPlace = true;
+    for (size_t windowCount : options.windowCounts)
+    {
+        BenchmarkDesktop desktop(windowCount, topmostCount);
+        desktop.Register(desktop.CreateWidgets(options.registeredWindows), 0);
+        desktop.Start();
+        SimulatedWindowSystem& windowSystem = desktop.windowSystem;
+
+        uint32_t arms = 0;
+        uint32_t placed = 0;
+        uint64_t queries = 0;
+        for (uint32_t i = 0; i < options.transitions; ++i)
+        {
+            if (i == options.transitions / 2)
+            {
+                windowSystem.SetTopmost(desktop.tools.front(), false);
+            }
+
+            const uint64_t before = windowSystem.GetWindowQueryCount() + windowSystem.GetNeighbourQueryCount();
+            desktop.controller.OnInput(InputEvent{ InputEvent::KEY_DOWN, INPUT_KEY_LWIN, 0, 0 });
+            desktop.controller.OnInput(InputEvent{ InputEvent::KEY_DOWN, INPUT_KEY_D, 0, 0 });
+            queries += windowSystem.GetWindowQueryCount() + windowSystem.GetNeighbourQueryCount() - before;
+            ++arms;
+
+            desktop.controller.OnInput(InputEvent{ InputEvent::KEY_UP, INPUT_KEY_D, 0, 0 });
+            desktop.controller.OnInput(InputEvent{ InputEvent::KEY_UP, INPUT_KEY_LWIN, 0, 0 });
+            windowSystem.ShowDesktop();
+            for (uint32_t elapsed = 0; !desktop.controller.IsShowingDesktop() && elapsed < DETECTION_TIMEOUT_MS; ++elapsed)
+            {
+                windowSystem.Advance(1);
+            }
+            windowSystem.Advance(100);
+            if (desktop.controller.IsShowingDesktop() && IsBelowTheBand(desktop))
+            {
+                ++placed;
+            }
+
+            windowSystem.RestoreWindows(desktop.apps.empty() ? nullptr : desktop.apps[i % desktop.apps.size()]);
+            for (uint32_t elapsed = 0; desktop.controller.IsShowingDesktop() && elapsed < DETECTION_TIMEOUT_MS; ++elapsed)
+            {
+                windowSystem.Advance(1);
+            }
+            windowSystem.Advance(1000);
+        }
+
+        const TopmostBoundary& boundary = desktop.controller.GetTopmostBoundary();
+        std::printf("%8zu | %9u %13.1f %6llu %6llu | %4u/%-4u\n",
+            windowCount,
+            arms,
+            Average(static_cast<double>(queries), arms),
+            static_cast<unsigned long long>(boundary.GetHitCount()),
+            static_cast<unsigned long long>(boundary.GetWalkCount()),
+            placed,
+            options.transitions);
+        inPlace = inPlace && placed == options.transitions;
+    }
+    return inPlace;
+}
+
+// Bursts of Show Desktop flips 3 ms apart, against isolated transitions: the
+// most stacking passes that moved windows in one display frame, how long after
+// the last flip of a burst the windows settle, and how many passes waited for
+// the next frame
+static bool RunPacing(const BenchmarkOptions& options)
+{
+    std::printf("Registered windows: %zu, %u bursts a second apart, flips 3 ms apart\n",
+        options.registeredWindows, options.transitions);
+    std::printf("%8s %6s | %11s %13s %12s %11s | %9s\n",
+        "Windows", "Flips", "Passes/frame", "Settle ms", "Settle max", "Deferred", "Settled");
+
+    bool settled = true;
+    for (size_t windowCount : options.windowCounts)
+    {
+        for (uint32_t flips : { 1u, 4u })
+        {
+            BenchmarkDesktop desktop(windowCount, options.topmostWindows);
+            std::vector<HWND> widgets = desktop.CreateWidgets(options.registeredWindows);
+            desktop.Register(widgets, 0);
+            desktop.Start();
+            SimulatedWindowSystem& windowSystem = desktop.windowSystem;
+            const FramePacer& pacer = desktop.controller.GetFramePacer();
+            const uint64_t deferred = pacer.GetDeferredCount();
+
+            // Which passes moved windows of this process in each frame
+            std::map<uint64_t, std::set<uint64_t>> passes;
+            windowSystem.SetMoveHandler([&](HWND)
+            {
+                passes[windowSystem.GetFrameTime().frame].insert(pacer.GetPassCount());
+            });
+
+            uint64_t settleTotal = 0;
+            uint64_t settleMax = 0;
+            uint32_t inPlace = 0;
+            for (uint32_t burst = 0; burst < options.transitions; ++burst)
+            {
+                for (uint32_t flip = 0; flip < flips; ++flip)
+                {
+                    if (flip > 0)
+                    {
+                        windowSystem.Advance(3);
+                    }
+                    if (desktop.controller.IsShowingDesktop() == (flip % 2 == 1))
+                    {
+                        windowSystem.ShowDesktop();
+                    }
+                    else
+                    {
+                        windowSystem.RestoreWindows(desktop.apps.empty() ? nullptr : desktop.apps[burst % desktop.apps.size()]);
+                    }
+                }
+
+                // Settled once the state of the last flip is detected and no pass is waiting
+                const bool showDesktop = flips % 2 == 1 ? burst % 2 == 0 : false;
+                uint32_t elapsed = 0;
+                while ((desktop.controller.IsShowingDesktop() != showDesktop || pacer.IsPending()) &&
+                    elapsed < DETECTION_TIMEOUT_MS)
+                {
+                    windowSystem.Advance(1);
+                    ++elapsed;
+                }
+                settleTotal += elapsed;
+                settleMax = std::max<uint64_t>(settleMax, elapsed);
+
+                // Shown, the block sits right below the helper
+                size_t top = windowSystem.GetStack().size();
+                for (HWND hwnd : widgets)
+                {
+                    top = std::min(top, windowSystem.GetStackIndex(hwnd));
+                }
+                if (desktop.controller.IsShowingDesktop() == showDesktop && IsContiguous(windowSystem, widgets) &&
+                    (!showDesktop || top == windowSystem.GetStackIndex(desktop.helperWindow) + 1))
+                {
+                    ++inPlace;
+                }
+                windowSystem.Advance(1000);
+            }
+            windowSystem.SetMoveHandler(nullptr);
+
+            size_t maxPasses = 0;
+            for (const auto& frame : passes)
+            {
+                maxPasses = std::max(maxPasses, frame.second.size());
+            }
+            std::printf("%8zu %6u | %12zu %13.1f %12llu %11llu | %4u/%-4u\n",
+                windowCount,
+                flips,
+                maxPasses,
+                Average(static_cast<double>(settleTotal), options.transitions),
+                static_cast<unsigned long long>(settleMax),
+                static_cast<unsigned long long>(pacer.GetDeferredCount() - deferred),
+                inPlace,
+                options.transitions);
+            settled = settled && inPlace == options.transitions && maxPasses <= 1;
+        }
+    }
+    return settled;
+}
+
+struct Scenario
+{
+    const char* name;
+    bool (*run)(const BenchmarkOptions& options);
+};
+
+static const Scenario SCENARIOS[] =
+{
+    { "detection", RunDetection },
+    { "registration", RunRegistration },
+    { "counters", RunCounters },
+    { "layers", RunLayers },
+    { "state", RunState },
+    { "hosts", RunHosts },
+    { "metadata", RunMetadata },
+    { "topmost", RunTopmost },
+    { "pacing", RunPacing },
+};
+
+static bool ParseWindowCounts(const char* text, std::vector<size_t>& counts)
+{
+    counts.clear();
+    while (*text)
+    {
+        char* end = nullptr;
+        unsigned long count = std::strtoul(text, &end, 10);
+        if (end == text || (*end && *end != ','))
+            return false;
+
+        counts.push_back(count);
+        text = *end ? end + 1 : end;
+    }
+    return !counts.empty();
+}
+
+static bool ParseNumber(const char* text, uint32_t& value)
+{
+    char* end = nullptr;
+    unsigned long number = std::strtoul(text, &end, 10);
+    if (end == text || *end)
+        return false;
+
+    value = static_cast<uint32_t>(number);
+    return true;
+}
+
+static void PrintUsage()
+{
+    std::fprintf(stderr,
+        "Usage: Benchmark [--scenario detection] [--windows 10,100,1000] [--registered 16] [--topmost 4]\n"
+        "                 [--idle-seconds 600] [--passes 200] [--transitions 40]\n"
+        "Scenarios: all");
+    for (const Scenario& scenario : SCENARIOS)
+    {
+        std::fprintf(stderr, ", %s", scenario.name);
+    }
+    std::fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    options.scenario = "detection";
+    options.windowCounts = { 10, 100, 1000 };
+    options.registeredWindows = 16;
+    options.topmostWindows = 4;
+    options.idleSeconds = 600;
+    options.passes = 200;
+    options.transitions = 40;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        uint32_t number = 0;
+        bool valid = value != nullptr;
+        if (std::strcmp(argv[i], "--scenario") == 0 && valid)
+        {
+            options.scenario = value;
+        }
+        else if (std::strcmp(argv[i], "--windows") == 0 && valid)
+        {
+            valid = ParseWindowCounts(value, options.windowCounts);
+        }
+        else if (std::strcmp(argv[i], "--registered") == 0 && valid && (valid = ParseNumber(value, number)))
+        {
+            options.registeredWindows = number;
+        }
+        else if (std::strcmp(argv[i], "--topmost") == 0 && valid && (valid = ParseNumber(value, number)))
+        {
+            options.topmostWindows = number;
+        }
+        else if (std::strcmp(argv[i], "--idle-seconds") == 0 && valid)
+        {
+            valid = ParseNumber(value, options.idleSeconds);
+        }
+        else if (std::strcmp(argv[i], "--passes") == 0 && valid)
+        {
+            valid = ParseNumber(value, options.passes) && options.passes > 0;
+        }
+        else if (std::strcmp(argv[i], "--transitions") == 0 && valid)
+        {
+            valid = ParseNumber(value, options.transitions);
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            PrintUsage();
+            return 2;
+        }
+        ++i;
+    }
+
+    bool all = std::strcmp(options.scenario, "all") == 0;
+    bool found = false;
+    bool passed = true;
+    for (const Scenario& scenario : SCENARIOS)
+    {
+        if (!all && std::strcmp(options.scenario, scenario.name) != 0)
+            continue;
+
+        if (all)
+        {
+            std::printf("%s== %s\n", found ? "\n" : "", scenario.name);
+        }
+        found = true;
+        passed = scenario.run(options) && passed;
+    }
+
+    if (!found)
+    {
+        PrintUsage();
+        return 2;
+    }
+    return passed ? 0 : 1;
+}
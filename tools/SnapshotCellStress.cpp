@@ -0,0 +1,287 @@
+// Runs readers against a SnapshotCell while one writer publishes new snapshots
+// without pause, and reports how many reads the readers get through and how
+// long reads and Publish take. Needs nothing from Windows:
+//
+//     g++ -std=c++14 -O2 -I.. SnapshotCellStress.cpp -o SnapshotCellStress -lpthread
+//
+// A read is timed from Read() to the guard being released, having looked at
+// the whole snapshot. Publish is timed from the call until the previous
+// snapshot is freed, so it includes waiting for readers to drain.
+
+#include "SnapshotCell.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+struct StressOptions
+{
+    std::vector<size_t> readerCounts;
+    uint32_t milliseconds;
+    uint32_t snapshotSize;
+    uint32_t sampleEvery;
+};
+
+// What a snapshot holds: values that all equal the version, like a registry
+// whose entries were all replaced together
+struct Snapshot
+{
+    uint64_t version;
+    std::vector<uint64_t> values;
+};
+
+struct Latencies
+{
+    uint64_t count;
+    double p50Us;
+    double p99Us;
+    double p999Us;
+    double maxUs;
+};
+
+struct StressResult
+{
+    size_t readers;
+    double seconds;
+    uint64_t reads;
+    uint64_t publishes;
+    uint64_t torn;
+    Latencies read;
+    Latencies publish;
+};
+
+static double ElapsedUs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+static Latencies Summarize(std::vector<double>& samples)
+{
+    Latencies latencies = Latencies();
+    latencies.count = samples.size();
+    if (samples.empty())
+        return latencies;
+
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double fraction)
+    {
+        size_t index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1));
+        return samples[index];
+    };
+    latencies.p50Us = at(0.5);
+    latencies.p99Us = at(0.99);
+    latencies.p999Us = at(0.999);
+    latencies.maxUs = samples.back();
+    return latencies;
+}
+
+static StressResult Run(size_t readerCount, const StressOptions& options)
+{
+    StressResult result = StressResult();
+    result.readers = readerCount;
+
+    SnapshotCell<Snapshot> cell;
+    {
+        std::unique_ptr<Snapshot> first(new Snapshot());
+        first->version = 0;
+        first->values.assign(options.snapshotSize, 0);
+        cell.Publish(std::move(first));
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<size_t> started(0);
+    std::vector<uint64_t> reads(readerCount, 0);
+    std::vector<uint64_t> torn(readerCount, 0);
+    std::vector<std::vector<double>> readSamples(readerCount);
+
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < readerCount; ++r)
+    {
+        readers.emplace_back([&, r]()
+        {
+            uint64_t count = 0;
+            uint64_t tornCount = 0;
+            std::vector<double>& samples = readSamples[r];
+            ++started;
+            while (!done.load(std::memory_order_relaxed))
+            {
+                // Only every few reads are timed, the clock costs about as much as a read
+                const bool timed = count % options.sampleEvery == 0;
+                std::chrono::steady_clock::time_point start;
+                if (timed)
+                {
+                    start = std::chrono::steady_clock::now();
+                }
+                {
+                    SnapshotCell<Snapshot>::ReadGuard snapshot = cell.Read();
+                    for (uint64_t value : snapshot->values)
+                    {
+                        tornCount += value != snapshot->version;
+                    }
+                }
+                if (timed)
+                {
+                    samples.push_back(ElapsedUs(start, std::chrono::steady_clock::now()));
+                }
+                ++count;
+            }
+            reads[r] = count;
+            torn[r] = tornCount;
+        });
+    }
+
+    while (started.load() != readerCount)
+    {
+        std::this_thread::yield();
+    }
+
+    // The writer publishes back to back for the whole run
+    std::vector<double> publishSamples;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    const std::chrono::steady_clock::time_point end = begin + std::chrono::milliseconds(options.milliseconds);
+    uint64_t version = 0;
+    for (;;)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (start >= end)
+            break;
+
+        std::unique_ptr<Snapshot> next(new Snapshot(cell.GetForWriter()));
+        next->version = ++version;
+        next->values.assign(next->values.size(), version);
+        const std::chrono::steady_clock::time_point publishStart = std::chrono::steady_clock::now();
+        cell.Publish(std::move(next));
+        publishSamples.push_back(ElapsedUs(publishStart, std::chrono::steady_clock::now()));
+    }
+    const std::chrono::steady_clock::time_point finish = std::chrono::steady_clock::now();
+
+    done = true;
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+
+    std::vector<double> allReads;
+    for (size_t r = 0; r < readerCount; ++r)
+    {
+        result.reads += reads[r];
+        result.torn += torn[r];
+        allReads.insert(allReads.end(), readSamples[r].begin(), readSamples[r].end());
+    }
+    result.seconds = ElapsedUs(begin, finish) / 1e6;
+    result.publishes = version;
+    result.read = Summarize(allReads);
+    result.publish = Summarize(publishSamples);
+    return result;
+}
+
+static bool ParseCounts(const char* text, std::vector<size_t>& counts)
+{
+    counts.clear();
+    while (*text)
+    {
+        char* end = nullptr;
+        unsigned long count = std::strtoul(text, &end, 10);
+        if (end == text || (*end && *end != ','))
+            return false;
+
+        counts.push_back(count);
+        text = *end ? end + 1 : end;
+    }
+    return !counts.empty();
+}
+
+static bool ParseNumber(const char* text, uint32_t& value)
+{
+    char* end = nullptr;
+    unsigned long number = std::strtoul(text, &end, 10);
+    if (end == text || *end)
+        return false;
+
+    value = static_cast<uint32_t>(number);
+    return true;
+}
+
+static void PrintUsage()
+{
+    std::fprintf(stderr,
+        "Usage: SnapshotCellStress [--readers 1,2,4,8] [--milliseconds 2000]\n"
+        "                          [--snapshot-size 64] [--sample-every 16]\n");
+}
+
+int main(int argc, char** argv)
+{
+    StressOptions options;
+    options.readerCounts = { 1, 2, 4, 8 };
+    options.milliseconds = 2000;
+    options.snapshotSize = 64;
+    options.sampleEvery = 16;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool valid = value != nullptr;
+        if (std::strcmp(argv[i], "--readers") == 0 && valid)
+        {
+            valid = ParseCounts(value, options.readerCounts);
+        }
+        else if (std::strcmp(argv[i], "--milliseconds") == 0 && valid)
+        {
+            valid = ParseNumber(value, options.milliseconds);
+        }
+        else if (std::strcmp(argv[i], "--snapshot-size") == 0 && valid)
+        {
+            valid = ParseNumber(value, options.snapshotSize);
+        }
+        else if (std::strcmp(argv[i], "--sample-every") == 0 && valid)
+        {
+            valid = ParseNumber(value, options.sampleEvery) && options.sampleEvery > 0;
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            PrintUsage();
+            return 2;
+        }
+        ++i;
+    }
+
+    std::printf("Snapshot: %u values, one read in %u timed, %u hardware threads\n",
+        options.snapshotSize, options.sampleEvery, std::thread::hardware_concurrency());
+    std::printf("%7s | %-44s | %-41s\n", "", "Reads", "Publish");
+    std::printf("%7s | %10s %8s %8s %8s %8s | %9s %9s %9s %9s\n",
+        "Readers", "Reads/s", "p50 us", "p99 us", "p999 us", "Max us",
+        "Per sec", "p50 us", "p99 us", "p999 us");
+
+    bool torn = false;
+    for (size_t readerCount : options.readerCounts)
+    {
+        StressResult result = Run(readerCount, options);
+        std::printf("%7zu | %10.0f %8.2f %8.2f %8.2f %8.1f | %9.0f %9.2f %9.2f %9.2f\n",
+            result.readers,
+            result.seconds > 0 ? result.reads / result.seconds : 0.0,
+            result.read.p50Us,
+            result.read.p99Us,
+            result.read.p999Us,
+            result.read.maxUs,
+            result.seconds > 0 ? result.publishes / result.seconds : 0.0,
+            result.publish.p50Us,
+            result.publish.p99Us,
+            result.publish.p999Us);
+        torn = torn || result.torn != 0;
+    }
+
+    if (torn)
+    {
+        std::fprintf(stderr, "Readers saw snapshots change under them\n");
+    }
+    return torn ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Replays a trace recorded with CZposDesktop::StartTrace through the desktop
+// logic and reports the decisions it takes and the time spent per input.
+// Needs nothing from Windows, so it builds wherever a C++14 compiler does:
+//
+//     g++ -std=c++14 -O2 -I.. TraceReplay.cpp -o TraceReplay -lpthread
+//
+// Decisions and divergences are printed before timings, so the reports of two
+// versions replaying the same trace can be diffed directly.
+
+#include "TraceReplay.h"
+#include <cstdio>
+#include <cstring>
+
+static void PrintDecisions(const char* title, const std::vector<TraceReplayer::Decision>& decisions)
+{
+    std::printf("%s: %zu\n", title, decisions.size());
+    for (const TraceReplayer::Decision& decision : decisions)
+    {
+        std::printf("  %10.3f ms  %-16s latency %llu ms\n",
+            decision.timeUs / 1000.0,
+            decision.showDesktop ? "ShowingDesktop" : "ShowingWindows",
+            static_cast<unsigned long long>(decision.detectionLatencyMs));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = nullptr;
+    bool verbose = false;
+    bool truncated = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--verbose") == 0)
+        {
+            verbose = true;
+        }
+        else if (std::strcmp(argv[i], "--truncated") == 0)
+        {
+            truncated = true;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+
+    if (!path)
+    {
+        std::fprintf(stderr, "Usage: TraceReplay [--verbose] [--truncated] trace.zdt\n");
+        return 2;
+    }
+
+    TraceReader trace;
+    if (!trace.Load(path, truncated))
+    {
+        std::fprintf(stderr, "%s %s\n", path, trace.GetError());
+        return 1;
+    }
+
+    TraceReplayer::Report report;
+    TraceReplayer::Run(trace, verbose, report);
+
+    std::printf("Records: %llu, inputs: %llu, lost: %llu%s\n",
+        static_cast<unsigned long long>(report.records),
+        static_cast<unsigned long long>(report.inputs),
+        static_cast<unsigned long long>(trace.GetLostCount()),
+        trace.IsTruncated() ? " (truncated)" : "");
+
+    PrintDecisions("Recorded decisions", report.recorded);
+    PrintDecisions("Replayed decisions", report.replayed);
+
+    std::printf("Z-order: %llu moves in %llu commits\n",
+        static_cast<unsigned long long>(report.moves),
+        static_cast<unsigned long long>(report.commits));
+
+    std::printf("Divergences: %llu\n", static_cast<unsigned long long>(report.divergences));
+    for (const std::string& note : report.notes)
+    {
+        std::printf("  %s\n", note.c_str());
+    }
+
+    std::printf("%-14s %8s %14s %14s %14s\n", "Input", "Count", "Recorded us", "Replayed us", "Max replay us");
+    for (int type = TRACE_START; type <= TRACE_UNREGISTER; ++type)
+    {
+        const TraceReplayer::Timing& timing = report.timings[type];
+        if (!timing.count)
+            continue;
+
+        std::printf("%-14s %8llu %14llu %14llu %14llu\n",
+            TraceReplayer::GetInputName(static_cast<TraceRecordType>(type)),
+            static_cast<unsigned long long>(timing.count),
+            static_cast<unsigned long long>(timing.recordedUs),
+            static_cast<unsigned long long>(timing.replayedUs),
+            static_cast<unsigned long long>(timing.maxReplayedUs));
+    }
+
+    for (const std::string& line : report.log)
+    {
+        std::printf("%s\n", line.c_str());
+    }
+
+    return report.divergences ? 3 : 0;
+}